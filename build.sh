@@ -1 +1 @@
-gcc main.c -Iquickjs -Lquickjs -lquickjs -lm -ldl -o verde
\ No newline at end of file
+gcc main.c -Iquickjs -Lquickjs -lquickjs -lm -ldl -lpthread -o verde
\ No newline at end of file
@@ -1,20 +1,38 @@
 // main.c
 #include <quickjs.h>
+#include <quickjs-libc.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
 
 // JS console.log
 static JSValue js_console_log(JSContext *ctx, JSValueConst this_val,
                                int argc, JSValueConst *argv) {
+    // uma linha inteira de cada vez, mesmo com várias threads (-j)
+    flockfile(stdout);
     for (int i = 0; i < argc; i++) {
         const char *str = JS_ToCString(ctx, argv[i]);
-        if (!str)
+        if (!str) {
+            funlockfile(stdout);
             return JS_EXCEPTION;
+        }
         printf("%s%s", str, i == argc - 1 ? "\n" : " ");
         JS_FreeCString(ctx, str);
     }
+    funlockfile(stdout);
     return JS_UNDEFINED;
 }
 
@@ -31,6 +49,158 @@ static void adicionar_console(JSContext *ctx) {
     JS_FreeValue(ctx, global_obj);
 }
 
+// Bytecode dos módulos do verdemod, compilado uma vez por processo e lido
+// por todos os runtimes (threads do modo batch). As entradas só são
+// liberadas no fim: o bytecode lido com JS_READ_OBJ_ROM_DATA aponta para elas.
+typedef struct ModuloCompilado {
+    struct ModuloCompilado *prox;
+    char *arquivo;
+    off_t tamanho;
+    struct timespec mtime;
+    uint8_t *bytecode;
+    size_t len;
+} ModuloCompilado;
+
+static ModuloCompilado *modulos_compilados = NULL;
+static pthread_mutex_t modulos_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static ModuloCompilado *procurar_modulo(const char *arquivo, const struct stat *st) {
+    ModuloCompilado *m;
+    pthread_mutex_lock(&modulos_lock);
+    // a entrada mais nova vem primeiro
+    for (m = modulos_compilados; m; m = m->prox) {
+        if (!strcmp(m->arquivo, arquivo))
+            break;
+    }
+    pthread_mutex_unlock(&modulos_lock);
+    if (m && (m->tamanho != st->st_size ||
+              m->mtime.tv_sec != st->st_mtim.tv_sec ||
+              m->mtime.tv_nsec != st->st_mtim.tv_nsec))
+        m = NULL;
+    return m;
+}
+
+static void guardar_modulo(JSContext *ctx, const char *arquivo, const struct stat *st,
+                           JSValueConst fn) {
+    size_t len;
+    uint8_t *buf = JS_WriteObject(ctx, &len, fn, JS_WRITE_OBJ_BYTECODE);
+    if (!buf) {
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        return;
+    }
+    ModuloCompilado *m = malloc(sizeof(*m));
+    m->arquivo = strdup(arquivo);
+    m->tamanho = st->st_size;
+    m->mtime = st->st_mtim;
+    m->bytecode = malloc(len);
+    memcpy(m->bytecode, buf, len);
+    m->len = len;
+    js_free(ctx, buf);
+    pthread_mutex_lock(&modulos_lock);
+    m->prox = modulos_compilados;
+    modulos_compilados = m;
+    pthread_mutex_unlock(&modulos_lock);
+}
+
+static void liberar_modulos(void) {
+    ModuloCompilado *m, *prox;
+    for (m = modulos_compilados; m; m = prox) {
+        prox = m->prox;
+        free(m->arquivo);
+        free(m->bytecode);
+        free(m);
+    }
+    modulos_compilados = NULL;
+}
+
+// Executável compilado (verde --compile): uma cópia do verde seguida do
+// bytecode do script, dos módulos do verdemod e, se usada, da imagem do
+// sucrase. O rodapé no fim do arquivo diz onde começam as entradas; cada
+// entrada é um CabecalhoEntrada, o nome e os dados, alinhados em 8 bytes.
+#define EXECUTAVEL_MAGICA "VERDEEXE"
+#define EXECUTAVEL_VERSAO 1
+#define ALINHAR8(n) (((n) + 7) & ~(uint64_t)7)
+
+enum {
+    ENTRADA_PRINCIPAL,
+    ENTRADA_MODULO,     // nome: o arquivo pedido ao verdemod ("foo.js")
+    ENTRADA_SUCRASE,    // CabecalhoImagem seguido do bytecode do bundle
+};
+
+typedef struct {
+    uint32_t tipo;
+    uint32_t tamanho_nome;      // com o '\0'
+    uint64_t tamanho;
+} CabecalhoEntrada;
+
+typedef struct {
+    uint64_t inicio;            // deslocamento da primeira entrada no arquivo
+    uint64_t tamanho;           // das entradas, sem o rodapé
+    uint32_t versao;
+    uint32_t n_entradas;
+    char magica[8];
+} RodapeExecutavel;
+
+// entradas do executável em execução, mapeadas até o fim
+static const uint8_t *embutido = NULL;
+static RodapeExecutavel rodape_embutido;
+static void *executavel_mapeado = NULL;
+static size_t executavel_mapa_tamanho = 0;
+
+// Lê o rodapé de um executável. Retorna 0 se ele traz entradas.
+static int ler_rodape(int fd, RodapeExecutavel *r) {
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*r))
+        return -1;
+    if (pread(fd, r, sizeof(*r), st.st_size - sizeof(*r)) != sizeof(*r))
+        return -1;
+    if (memcmp(r->magica, EXECUTAVEL_MAGICA, sizeof(r->magica)) != 0 ||
+        r->versao != EXECUTAVEL_VERSAO ||
+        r->inicio + r->tamanho + sizeof(*r) != (uint64_t)st.st_size)
+        return -1;
+    return 0;
+}
+
+// Mapeia as entradas se o próprio executável as tem
+static int abrir_embutido(void) {
+    int fd = open("/proc/self/exe", O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (ler_rodape(fd, &rodape_embutido) < 0) {
+        close(fd);
+        return -1;
+    }
+    off_t pagina = rodape_embutido.inicio & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+    executavel_mapa_tamanho = rodape_embutido.inicio + rodape_embutido.tamanho - pagina;
+    executavel_mapeado = mmap(NULL, executavel_mapa_tamanho, PROT_READ, MAP_PRIVATE,
+                              fd, pagina);
+    close(fd);
+    if (executavel_mapeado == MAP_FAILED) {
+        executavel_mapeado = NULL;
+        return -1;
+    }
+    embutido = (const uint8_t *)executavel_mapeado + (rodape_embutido.inicio - pagina);
+    return 0;
+}
+
+// Dados da entrada 'tipo' (e 'nome', se não for NULL), ou NULL
+static const uint8_t *procurar_embutido(int tipo, const char *nome, size_t *plen) {
+    const uint8_t *p = embutido;
+    if (!p)
+        return NULL;
+    for (uint32_t i = 0; i < rodape_embutido.n_entradas; i++) {
+        const CabecalhoEntrada *e = (const CabecalhoEntrada *)p;
+        const char *nome_e = (const char *)(e + 1);
+        const uint8_t *dados = (const uint8_t *)nome_e + ALINHAR8(e->tamanho_nome);
+        if (e->tipo == tipo && (!nome || !strcmp(nome_e, nome))) {
+            *plen = e->tamanho;
+            return dados;
+        }
+        p = dados + ALINHAR8(e->tamanho);
+    }
+    return NULL;
+}
+
 // verdemod("foo") CommonJS loader
 static JSValue js_verdemod(JSContext *ctx, JSValueConst this_val,
                            int argc, JSValueConst *argv) {
@@ -43,77 +213,514 @@ static JSValue js_verdemod(JSContext *ctx, JSValueConst this_val,
     char filename[256];
     snprintf(filename, sizeof(filename), "%s.js", modname);
 
-    FILE *f = fopen(filename, "rb");
-    if (!f) {
+    // no executável compilado os módulos já vêm em bytecode
+    size_t len_embutido;
+    const uint8_t *bc = procurar_embutido(ENTRADA_MODULO, filename, &len_embutido);
+    if (bc) {
         JS_FreeCString(ctx, modname);
-        return JS_ThrowReferenceError(ctx, "Módulo '%s' não encontrado", modname);
+        JSValue fn = JS_ReadObject(ctx, bc, len_embutido,
+                                   JS_READ_OBJ_BYTECODE | JS_READ_OBJ_ROM_DATA);
+        if (JS_IsException(fn))
+            return fn;
+        return JS_EvalFunction(ctx, fn);
     }
-    fseek(f, 0, SEEK_END);
-    size_t size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    char *buf = malloc(size + 1);
-    fread(buf, 1, size, f);
-    buf[size] = '\0';
-    fclose(f);
 
-    JSValue ret = JS_Eval(ctx, buf, size, filename, JS_EVAL_TYPE_GLOBAL);
-    free(buf);
+    struct stat st;
+    FILE *f;
+    if (stat(filename, &st) < 0 || !(f = fopen(filename, "rb"))) {
+        JSValue exc = JS_ThrowReferenceError(ctx, "Módulo '%s' não encontrado", modname);
+        JS_FreeCString(ctx, modname);
+        return exc;
+    }
     JS_FreeCString(ctx, modname);
-    return ret;
+
+    JSValue fn;
+    ModuloCompilado *m = procurar_modulo(filename, &st);
+    if (m) {
+        fclose(f);
+        fn = JS_ReadObject(ctx, m->bytecode, m->len,
+                           JS_READ_OBJ_BYTECODE | JS_READ_OBJ_ROM_DATA);
+    } else {
+        fseek(f, 0, SEEK_END);
+        size_t size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        char *buf = malloc(size + 1);
+        size = fread(buf, 1, size, f);
+        buf[size] = '\0';
+        fclose(f);
+        fn = JS_Eval(ctx, buf, size, filename,
+                     JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY);
+        free(buf);
+        if (!JS_IsException(fn))
+            guardar_modulo(ctx, filename, &st, fn);
+    }
+    if (JS_IsException(fn))
+        return fn;
+    return JS_EvalFunction(ctx, fn);
 }
 
-// JSX transpile helper (sucraseTransform deve estar definido no bundle sucrase.bundle.js)
-static JSValue transpile_jsx(JSContext *ctx, const char *code, const char *filename) {
-    const char *js_transpile =
-        "(function(code) { return sucraseTransform(code); })";
+// Bundle do sucrase: só é carregado no primeiro acesso a sucraseTransform.
+// O bytecode compilado é guardado numa imagem ao lado do bundle e lido com
+// mmap nas execuções seguintes, sem compilar o fonte de novo.
+#define BUNDLE_SUCRASE "sucrase.bundle.js"
+#define IMAGEM_SUCRASE "sucrase.bundle.jsbc"
+#define IMAGEM_MAGICA "VERDEIMG"
+#define IMAGEM_VERSAO 1
 
-    JSValue transpiler_fn = JS_Eval(ctx, js_transpile, strlen(js_transpile), "[jsx-wrapper]", 0);
-    if (JS_IsException(transpiler_fn)) return transpiler_fn;
+typedef struct {
+    char magica[8];
+    uint32_t versao;
+    uint32_t reservado;
+    uint64_t tamanho_fonte;
+    int64_t mtime_fonte_sec;
+    int64_t mtime_fonte_nsec;
+} CabecalhoImagem;
 
-    JSValue code_val = JS_NewString(ctx, code);
-    JSValue result = JS_Call(ctx, transpiler_fn, JS_UNDEFINED, 1, &code_val);
+// a imagem fica mapeada até o fim: o bytecode lido referencia a memória dela.
+// Ela é mapeada uma vez e lida por todos os runtimes do processo.
+static void *imagem_mapeada = NULL;
+static size_t imagem_tamanho = 0;
+static pthread_mutex_t imagem_lock = PTHREAD_MUTEX_INITIALIZER;
+// a imagem é uma entrada do executável compilado: não é desmapeada à parte
+static int imagem_embutida = 0;
 
-    JS_FreeValue(ctx, transpiler_fn);
-    JS_FreeValue(ctx, code_val);
-    return result;
+static void liberar_imagem(void) {
+    if (imagem_mapeada && !imagem_embutida)
+        munmap(imagem_mapeada, imagem_tamanho);
+    imagem_mapeada = NULL;
 }
 
-// Load arquivo.js ou arquivo.jsx
-static JSValue carregar_arquivo(JSContext *ctx, const char *filename) {
-    FILE *f = fopen(filename, "rb");
-    if (!f) {
-        perror("Erro abrindo arquivo");
-        return JS_EXCEPTION;
+static void preencher_cabecalho(CabecalhoImagem *h, const struct stat *st) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magica, IMAGEM_MAGICA, sizeof(h->magica));
+    h->versao = IMAGEM_VERSAO;
+    h->tamanho_fonte = st->st_size;
+    h->mtime_fonte_sec = st->st_mtim.tv_sec;
+    h->mtime_fonte_nsec = st->st_mtim.tv_nsec;
+}
+
+// Mapeia a imagem se ela existe e corresponde ao fonte. Chamada com imagem_lock.
+static int mapear_imagem(void) {
+    CabecalhoImagem esperado;
+    struct stat st, st_fonte;
+    if (stat(BUNDLE_SUCRASE, &st_fonte) < 0)
+        return -1;
+    int fd = open(IMAGEM_SUCRASE, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || st.st_size <= (off_t)sizeof(CabecalhoImagem)) {
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+    preencher_cabecalho(&esperado, &st_fonte);
+    if (memcmp(data, &esperado, sizeof(esperado)) != 0) {
+        munmap(data, st.st_size);
+        return -1;
+    }
+    imagem_mapeada = data;
+    imagem_tamanho = st.st_size;
+    return 0;
+}
+
+static void gravar_imagem(JSContext *ctx, JSValueConst fn, const struct stat *st_fonte) {
+    CabecalhoImagem h;
+    size_t len;
+    char tmp[256];
+    uint8_t *buf = JS_WriteObject(ctx, &len, fn, JS_WRITE_OBJ_BYTECODE);
+    if (!buf) {
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        return;
+    }
+    preencher_cabecalho(&h, st_fonte);
+    // grava num arquivo temporário e renomeia, para nunca deixar uma imagem pela metade
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", IMAGEM_SUCRASE, (int)getpid());
+    FILE *f = fopen(tmp, "wb");
+    if (f) {
+        int ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(buf, 1, len, f) == len;
+        if (fclose(f) == 0 && ok)
+            rename(tmp, IMAGEM_SUCRASE);
+        else
+            unlink(tmp);
+    }
+    js_free(ctx, buf);
+}
+
+static JSValue carregar_bundle(JSContext *ctx) {
+    struct stat st;
+    JSValue fn;
+
+    pthread_mutex_lock(&imagem_lock);
+    if (imagem_mapeada) {
+        // validada em criar_runtime()
+        pthread_mutex_unlock(&imagem_lock);
+        fn = JS_ReadObject(ctx, (const uint8_t *)imagem_mapeada + sizeof(CabecalhoImagem),
+                           imagem_tamanho - sizeof(CabecalhoImagem),
+                           JS_READ_OBJ_BYTECODE | JS_READ_OBJ_ROM_DATA);
+        if (JS_IsException(fn))
+            return fn;
+        return JS_EvalFunction(ctx, fn);
     }
+    // sem imagem válida: compila o fonte e grava a imagem, que será usada
+    // pelos próximos runtimes. A gravação fica sob o lock para que duas
+    // threads não gravem a imagem ao mesmo tempo.
+    if (stat(BUNDLE_SUCRASE, &st) < 0) {
+        pthread_mutex_unlock(&imagem_lock);
+        return JS_ThrowReferenceError(ctx, "%s não encontrado", BUNDLE_SUCRASE);
+    }
+    {
+        FILE *f = fopen(BUNDLE_SUCRASE, "rb");
+        if (!f) {
+            pthread_mutex_unlock(&imagem_lock);
+            return JS_ThrowReferenceError(ctx, "%s não encontrado", BUNDLE_SUCRASE);
+        }
+        char *buf = malloc(st.st_size + 1);
+        size_t len = fread(buf, 1, st.st_size, f);
+        buf[len] = '\0';
+        fclose(f);
+        fn = JS_Eval(ctx, buf, len, BUNDLE_SUCRASE,
+                     JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY);
+        free(buf);
+        if (!JS_IsException(fn))
+            gravar_imagem(ctx, fn, &st);
+    }
+    pthread_mutex_unlock(&imagem_lock);
+    if (JS_IsException(fn))
+        return fn;
+    return JS_EvalFunction(ctx, fn);
+}
+
+// Estado do runtime da thread. Cada thread tem no máximo um runtime; o
+// opaque do runtime é do quickjs-libc (timers e handlers do laço de eventos).
+typedef struct {
+    // contexto onde o bundle do sucrase é carregado, compartilhado por
+    // todos os contextos do runtime: sucraseTransform não guarda estado
+    JSContext *ctx_sucrase;
+    // promises rejeitadas sem handler desde o último executar_laco()
+    int rejeicoes;
+} EstadoRuntime;
+
+static __thread EstadoRuntime estado_runtime;
+
+static JSValue obter_sucrase(JSContext *ctx) {
+    EstadoRuntime *er = &estado_runtime;
+    if (!er->ctx_sucrase) {
+        JSContext *ctx_s = JS_NewContext(JS_GetRuntime(ctx));
+        if (!ctx_s)
+            return JS_ThrowOutOfMemory(ctx);
+        JSValue ret = carregar_bundle(ctx_s);
+        if (JS_IsException(ret)) {
+            // a exceção é do runtime: continua pendente para 'ctx'
+            JS_FreeContext(ctx_s);
+            return ret;
+        }
+        JS_FreeValue(ctx_s, ret);
+        er->ctx_sucrase = ctx_s;
+    }
+    JSValue global = JS_GetGlobalObject(er->ctx_sucrase);
+    JSValue fn = JS_GetPropertyStr(er->ctx_sucrase, global, "sucraseTransform");
+    JS_FreeValue(er->ctx_sucrase, global);
+    return fn;
+}
+
+// Getter de globalThis.sucraseTransform: troca o acessor pela função
+// do contexto do sucrase
+static JSValue js_sucrase_get(JSContext *ctx, JSValueConst this_val,
+                              int argc, JSValueConst *argv) {
+    JSValue fn = obter_sucrase(ctx);
+    if (JS_IsException(fn))
+        return fn;
+    JSValue global = JS_GetGlobalObject(ctx);
+    JSAtom atom = JS_NewAtom(ctx, "sucraseTransform");
+    JS_DeleteProperty(ctx, global, atom, 0);
+    JS_DefinePropertyValue(ctx, global, atom, JS_DupValue(ctx, fn),
+                           JS_PROP_C_W_E);
+    JS_FreeAtom(ctx, atom);
+    JS_FreeValue(ctx, global);
+    return fn;
+}
+
+static JSValue js_sucrase_set(JSContext *ctx, JSValueConst this_val,
+                              int argc, JSValueConst *argv) {
+    JSValue global = JS_GetGlobalObject(ctx);
+    JSAtom atom = JS_NewAtom(ctx, "sucraseTransform");
+    JS_DeleteProperty(ctx, global, atom, 0);
+    int ret = JS_DefinePropertyValue(ctx, global, atom, JS_DupValue(ctx, argv[0]),
+                                     JS_PROP_C_W_E);
+    JS_FreeAtom(ctx, atom);
+    JS_FreeValue(ctx, global);
+    return ret < 0 ? JS_EXCEPTION : JS_UNDEFINED;
+}
+
+static void adicionar_sucrase(JSContext *ctx) {
+    JSValue global = JS_GetGlobalObject(ctx);
+    JSAtom atom = JS_NewAtom(ctx, "sucraseTransform");
+    JS_DefinePropertyGetSet(ctx, global, atom,
+                            JS_NewCFunction(ctx, js_sucrase_get, "get sucraseTransform", 0),
+                            JS_NewCFunction(ctx, js_sucrase_set, "set sucraseTransform", 1),
+                            JS_PROP_CONFIGURABLE);
+    JS_FreeAtom(ctx, atom);
+    JS_FreeValue(ctx, global);
+}
+
+// Lê o arquivo inteiro, terminado por '\0'. Retorna NULL se não o abrir.
+static char *ler_fonte(const char *filename, size_t *plen) {
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+        return NULL;
     fseek(f, 0, SEEK_END);
     size_t len = ftell(f);
     fseek(f, 0, SEEK_SET);
     char *buf = malloc(len + 1);
-    fread(buf, 1, len, f);
+    len = fread(buf, 1, len, f);
     buf[len] = '\0';
     fclose(f);
+    *plen = len;
+    return buf;
+}
 
-    JSValue result;
-    if (strstr(filename, ".jsx")) {
-        JSValue transpiled = transpile_jsx(ctx, buf, filename);
-        if (JS_IsException(transpiled)) {
-            free(buf);
-            return transpiled;
-        }
-        const char *js_code = JS_ToCString(ctx, transpiled);
-        result = JS_Eval(ctx, js_code, strlen(js_code), filename, JS_EVAL_TYPE_GLOBAL);
-        JS_FreeCString(ctx, js_code);
-        JS_FreeValue(ctx, transpiled);
-    } else {
-        result = JS_Eval(ctx, buf, len, filename, JS_EVAL_TYPE_GLOBAL);
+static int termina_com(const char *s, const char *sufixo) {
+    size_t n = strlen(s), m = strlen(sufixo);
+    return n >= m && !strcmp(s + n - m, sufixo);
+}
+
+static int flags_do_arquivo(const char *filename) {
+    // o JSX é convertido pelo próprio parser do QuickJS em chamadas a
+    // React.createElement (ou à função do pragma @jsx), sem passar pelo sucrase
+    int flags = JS_EVAL_TYPE_GLOBAL;
+    if (termina_com(filename, ".jsx") || termina_com(filename, ".tsx"))
+        flags |= JS_EVAL_FLAG_JSX;
+    // TypeScript: o parser descarta as anotações de tipo, interfaces,
+    // aliases, genéricos e declarações 'declare', sem transpilação
+    if (termina_com(filename, ".ts") || termina_com(filename, ".tsx") ||
+        termina_com(filename, ".mts") || termina_com(filename, ".cts"))
+        flags |= JS_EVAL_FLAG_TYPESCRIPT;
+    return flags;
+}
+
+// Load arquivo.js, .jsx, .ts, .tsx, .mts ou .cts
+static JSValue carregar_arquivo(JSContext *ctx, const char *filename) {
+    size_t len;
+    char *buf = ler_fonte(filename, &len);
+    if (!buf) {
+        perror("Erro abrindo arquivo");
+        return JS_EXCEPTION;
     }
+    JSValue result = JS_Eval(ctx, buf, len, filename, flags_do_arquivo(filename));
     free(buf);
     return result;
 }
 
-int main(int argc, char **argv) {
+// Heap snapshot no formato .heapsnapshot do Chrome DevTools
+static volatile sig_atomic_t snapshot_pedido = 0;
+static int snapshot_contador = 0;
+
+static void pedir_snapshot(int sig) {
+    snapshot_pedido = 1;
+}
+
+static void gravar_snapshot(JSRuntime *rt, const char *filename) {
+    char nome[256];
+    if (!filename) {
+        snprintf(nome, sizeof(nome), "verde-%d-%d.heapsnapshot", (int)getpid(),
+                 __atomic_add_fetch(&snapshot_contador, 1, __ATOMIC_RELAXED));
+        filename = nome;
+    }
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        perror(filename);
+        return;
+    }
+    int ret = JS_WriteHeapSnapshot(rt, f);
+    if (fclose(f) != 0 || ret < 0)
+        fprintf(stderr, "Erro gravando o heap snapshot %s\n", filename);
+    else
+        fprintf(stderr, "Heap snapshot gravado em %s\n", filename);
+}
+
+// O snapshot pedido com SIGUSR2 é gravado aqui, fora do handler de sinal
+// (com várias threads, pelo primeiro runtime que o vir)
+static void atender_snapshot(JSRuntime *rt) {
+    if (snapshot_pedido &&
+        __atomic_exchange_n(&snapshot_pedido, 0, __ATOMIC_RELAXED)) {
+        gravar_snapshot(rt, NULL);
+    }
+}
+
+// Chamado periodicamente pelo interpretador enquanto o script executa.
+// Parado no laço de eventos, o script é atendido pelo gancho do
+// quickjs-libc: o sinal interrompe a espera por eventos.
+static int verificar_interrupcao(JSRuntime *rt, void *opaque) {
+    atender_snapshot(rt);
+    return 0;
+}
+
+static void mostrar_excecao(JSContext *ctx) {
+    JSValue exc = JS_GetException(ctx);
+    const char *err = JS_ToCString(ctx, exc);
+    fprintf(stderr, "Erro: %s\n", err);
+    JS_FreeCString(ctx, err);
+    JS_FreeValue(ctx, exc);
+}
+
+// Como js_std_promise_rejection_tracker, mas sem exit(): no modo batch o
+// processo é comum a vários scripts e no modo servidor o filho ainda
+// precisa responder ao cliente. A falha é dada por executar_laco(). Uma
+// promise que recebe um handler depois de rejeitada não conta mais.
+static void rastrear_rejeicao(JSContext *ctx, JSValueConst promise,
+                              JSValueConst reason, JS_BOOL is_handled,
+                              void *opaque) {
+    if (!is_handled) {
+        fprintf(stderr, "Possibly unhandled promise rejection: ");
+        JS_Throw(ctx, JS_DupValue(ctx, reason));
+        js_std_dump_error(ctx);
+        estado_runtime.rejeicoes++;
+    } else {
+        estado_runtime.rejeicoes--;
+    }
+}
+
+// --lazy: compila as funções internas só na primeira chamada (acelera o
+// carregamento do bundle). Fica opcional até passar no test262.
+static int compilacao_preguicosa = 0;
+
+// 'reservar_atomos': o runtime deve usar o sucrase (custa ~0.5 ms)
+static JSRuntime *criar_runtime(int reservar_atomos) {
     JSRuntime *rt = JS_NewRuntime();
+    if (!rt)
+        return NULL;
+    // Os átomos da imagem do sucrase são criados antes de qualquer outro,
+    // com os mesmos índices que têm na imagem: o bytecode dela é então
+    // executado direto da memória mapeada, comum a todos os runtimes,
+    // sem ser copiado e relocado
+    pthread_mutex_lock(&imagem_lock);
+    int primeira = !imagem_mapeada;
+    if (reservar_atomos && (imagem_mapeada || mapear_imagem() == 0)) {
+        if (JS_ReserveImageAtoms(rt, (const uint8_t *)imagem_mapeada + sizeof(CabecalhoImagem),
+                                 imagem_tamanho - sizeof(CabecalhoImagem)) < 0 && primeira) {
+            // bytecode de outra versão do QuickJS: a imagem será refeita
+            munmap(imagem_mapeada, imagem_tamanho);
+            imagem_mapeada = NULL;
+        }
+    }
+    pthread_mutex_unlock(&imagem_lock);
+    JS_SetLazyCompile(rt, compilacao_preguicosa);
+    JS_SetInterruptHandler(rt, verificar_interrupcao, NULL);
+    JS_SetHostPromiseRejectionTracker(rt, rastrear_rejeicao, NULL);
+    // timers, handlers de E/S e workers do módulo os
+    js_std_init_handlers(rt);
+    JS_SetModuleLoaderFunc(rt, NULL, js_module_loader, NULL);
+    return rt;
+}
+
+static void liberar_runtime(JSRuntime *rt) {
+    EstadoRuntime *er = &estado_runtime;
+    if (er->ctx_sucrase)
+        JS_FreeContext(er->ctx_sucrase);
+    er->ctx_sucrase = NULL;
+    js_std_free_handlers(rt);
+    JS_FreeRuntime(rt);
+}
+
+// Globais do quickjs-libc: os módulos os e std só são importados no
+// primeiro acesso a um deles, como o sucrase
+static const char *const globais_libc[] = {
+    "os", "std", "setTimeout", "clearTimeout",
+};
+
+static int carregar_libc(JSContext *ctx) {
+    static const char fonte[] =
+        "import * as os from 'os';\n"
+        "import * as std from 'std';\n"
+        "globalThis.os = os;\n"
+        "globalThis.std = std;\n"
+        "globalThis.setTimeout = os.setTimeout;\n"
+        "globalThis.clearTimeout = os.clearTimeout;\n";
+    if (!js_init_module_std(ctx, "std") || !js_init_module_os(ctx, "os"))
+        return -1;
+    // sem await no módulo: ele já foi executado quando JS_Eval retorna
+    JSValue ret = JS_Eval(ctx, fonte, sizeof(fonte) - 1, "<verde>", JS_EVAL_TYPE_MODULE);
+    if (JS_IsException(ret))
+        return -1;
+    JS_FreeValue(ctx, ret);
+    return 0;
+}
+
+// Troca o acessor do global pelo valor (chamado pelo módulo acima)
+static JSValue js_libc_set(JSContext *ctx, JSValueConst this_val,
+                           int argc, JSValueConst *argv, int magic) {
+    JSValue global = JS_GetGlobalObject(ctx);
+    JSAtom atom = JS_NewAtom(ctx, globais_libc[magic]);
+    JS_DeleteProperty(ctx, global, atom, 0);
+    int ret = JS_DefinePropertyValue(ctx, global, atom, JS_DupValue(ctx, argv[0]),
+                                     JS_PROP_CONFIGURABLE | JS_PROP_WRITABLE);
+    JS_FreeAtom(ctx, atom);
+    JS_FreeValue(ctx, global);
+    return ret < 0 ? JS_EXCEPTION : JS_UNDEFINED;
+}
+
+static JSValue js_libc_get(JSContext *ctx, JSValueConst this_val,
+                           int argc, JSValueConst *argv, int magic) {
+    if (carregar_libc(ctx) < 0)
+        return JS_EXCEPTION;
+    JSValue global = JS_GetGlobalObject(ctx);
+    JSValue val = JS_GetPropertyStr(ctx, global, globais_libc[magic]);
+    JS_FreeValue(ctx, global);
+    return val;
+}
+
+// queueMicrotask(fn): fn é executada como um job, junto com as reações
+// das promises
+static JSValue job_microtarefa(JSContext *ctx, int argc, JSValueConst *argv) {
+    return JS_Call(ctx, argv[0], JS_UNDEFINED, 0, NULL);
+}
+
+static JSValue js_queue_microtask(JSContext *ctx, JSValueConst this_val,
+                                  int argc, JSValueConst *argv) {
+    if (!JS_IsFunction(ctx, argv[0]))
+        return JS_ThrowTypeError(ctx, "not a function");
+    if (JS_EnqueueJob(ctx, job_microtarefa, 1, argv) < 0)
+        return JS_EXCEPTION;
+    return JS_UNDEFINED;
+}
+
+static void adicionar_libc(JSContext *ctx) {
+    JSValue global = JS_GetGlobalObject(ctx);
+    for (int i = 0; i < (int)(sizeof(globais_libc) / sizeof(globais_libc[0])); i++) {
+        JSAtom atom = JS_NewAtom(ctx, globais_libc[i]);
+        JS_DefinePropertyGetSet(ctx, global, atom,
+                                JS_NewCFunctionMagic(ctx, js_libc_get, globais_libc[i], 0,
+                                                     JS_CFUNC_generic_magic, i),
+                                JS_NewCFunctionMagic(ctx, js_libc_set, globais_libc[i], 1,
+                                                     JS_CFUNC_generic_magic, i),
+                                JS_PROP_CONFIGURABLE);
+        JS_FreeAtom(ctx, atom);
+    }
+    JS_SetPropertyStr(ctx, global, "queueMicrotask",
+                      JS_NewCFunction(ctx, js_queue_microtask, "queueMicrotask", 1));
+    JS_FreeValue(ctx, global);
+}
+
+// Contexto de um os.Worker: o script do worker é um módulo que importa
+// "os" e "std"
+static JSContext *criar_contexto_worker(JSRuntime *rt) {
     JSContext *ctx = JS_NewContext(rt);
+    if (!ctx)
+        return NULL;
+    adicionar_console(ctx);
+    js_init_module_std(ctx, "std");
+    js_init_module_os(ctx, "os");
+    return ctx;
+}
+
+// Contexto com console, verdemod e sucraseTransform
+static JSContext *criar_contexto(JSRuntime *rt) {
+    JSContext *ctx = JS_NewContext(rt);
+    if (!ctx)
+        return NULL;
 
     adicionar_console(ctx);
 
@@ -123,38 +730,971 @@ int main(int argc, char **argv) {
     JS_SetPropertyStr(ctx, global, "verdemod", verdemod_fn);
     JS_FreeValue(ctx, global);
 
-    // Carrega o sucrase.bundle.js
-    carregar_arquivo(ctx, "sucrase.bundle.js");
+    // sucrase.bundle.js é carregado no primeiro uso de sucraseTransform
+    adicionar_sucrase(ctx);
+    adicionar_libc(ctx);
+    return ctx;
+}
+
+// Laço de eventos do quickjs-libc: entre duas macrotarefas (timers, E/S,
+// mensagens de workers) todos os jobs pendentes (promises, async,
+// queueMicrotask) são executados. Termina quando não há mais nada pendente.
+// Retorna -1 se uma exceção não foi tratada por um callback ou um job, ou
+// se uma promise foi rejeitada sem handler, 0 caso contrário.
+static int executar_laco(JSContext *ctx) {
+    EstadoRuntime *er = &estado_runtime;
+    int ret = js_std_loop(ctx);
+    if (er->rejeicoes) {
+        er->rejeicoes = 0;
+        ret = -1;
+    }
+    return ret;
+}
+
+// Retorna 0 se o script e o laço de eventos terminaram sem exceção, 1
+// caso contrário. O laço de eventos roda até o fim antes de retornar.
+static int executar_arquivo(JSContext *ctx, const char *filename) {
+    int ret = 0;
+    JSValue val = carregar_arquivo(ctx, filename);
+    if (JS_IsException(val)) {
+        mostrar_excecao(ctx);
+        ret = 1;
+    }
+    JS_FreeValue(ctx, val);
+    if (executar_laco(ctx) < 0)
+        ret = 1;
+    return ret;
+}
+
+// Modo servidor: um runtime aquecido (sucrase já carregado) e um processo
+// filho por job. Os filhos compartilham o heap inicializado em copy-on-write.
+//
+// Protocolo: o cliente conecta no socket Unix e envia "cwd\0arquivo\0"
+// com seus descritores stdin, stdout e stderr (SCM_RIGHTS). O filho
+// executa o arquivo com esses descritores e responde com o código de
+// saída (int32).
+#define JOB_MAX_MENSAGEM 8192
+
+static int enviar_job(int fd, const char *cwd, const char *arquivo, const int fds[3]) {
+    char buf[JOB_MAX_MENSAGEM];
+    size_t l1 = strlen(cwd) + 1, l2 = strlen(arquivo) + 1;
+    if (l1 + l2 > sizeof(buf)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(buf, cwd, l1);
+    memcpy(buf + l1, arquivo, l2);
+
+    struct iovec iov = { .iov_base = buf, .iov_len = l1 + l2 };
+    union {
+        struct cmsghdr h;
+        char buf[CMSG_SPACE(sizeof(int) * 3)];
+    } ctrl;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctrl, 0, sizeof(ctrl));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+    memcpy(CMSG_DATA(cm), fds, sizeof(int) * 3);
+    return sendmsg(fd, &msg, 0) < 0 ? -1 : 0;
+}
+
+// Executado no processo filho: nunca retorna
+static void atender_job(JSContext *ctx, int fd) {
+    char buf[JOB_MAX_MENSAGEM + 1];
+    union {
+        struct cmsghdr h;
+        char buf[CMSG_SPACE(sizeof(int) * 3)];
+    } ctrl;
+    struct iovec iov = { .iov_base = buf, .iov_len = JOB_MAX_MENSAGEM };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    ssize_t n = recvmsg(fd, &msg, 0);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if (n <= 0 || !cm || cm->cmsg_type != SCM_RIGHTS ||
+        cm->cmsg_len != CMSG_LEN(sizeof(int) * 3))
+        _exit(2);
+    buf[n] = '\0';
+    const char *cwd = buf;
+    const char *arquivo = buf + strlen(buf) + 1;
+    if (arquivo >= buf + n)
+        _exit(2);
+
+    int fds[3];
+    memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+    for (int i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+
+    int32_t status;
+    if (chdir(cwd) < 0) {
+        perror(cwd);
+        status = 1;
+    } else {
+        status = executar_arquivo(ctx, arquivo);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    if (write(fd, &status, sizeof(status)) < 0) {
+        // o cliente desistiu: nada a fazer
+    }
+    // o runtime não é liberado: as páginas compartilhadas ficam intactas
+    _exit(status);
+}
+
+static int abrir_socket(const char *caminho, struct sockaddr_un *addr) {
+    if (strlen(caminho) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Caminho do socket muito longo: %s\n", caminho);
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, caminho);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        perror("socket");
+    return fd;
+}
+
+static int modo_servidor(JSRuntime *rt, JSContext *ctx, const char *caminho,
+                         int processos) {
+    struct sockaddr_un addr;
+
+    // aquece o contexto: carrega o bundle para que sucraseTransform já
+    // esteja pronto nos filhos
+    const char *aquecimento = "sucraseTransform('<a/>')";
+    JSValue ret = JS_Eval(ctx, aquecimento, strlen(aquecimento), "[aquecimento]",
+                          JS_EVAL_TYPE_GLOBAL);
+    if (JS_IsException(ret))
+        mostrar_excecao(ctx);
+    JS_FreeValue(ctx, ret);
+    JS_RunGC(rt);
+
+    int sock = abrir_socket(caminho, &addr);
+    if (sock < 0)
+        return 1;
+    if (processos < 1)
+        processos = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    unlink(caminho);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(sock, SOMAXCONN) < 0) {
+        perror(caminho);
+        close(sock);
+        return 1;
+    }
+    fprintf(stderr, "verde: servidor pronto em %s (pid %d, %d processos)\n",
+            caminho, (int)getpid(), processos);
+    fflush(stdout);
+    fflush(stderr);
+
+    // pré-fork: cada filho espera um job em accept(), executa-o e termina.
+    // O fork acontece enquanto não há job, fora do caminho crítico.
+    int ativos = 0;
+    for (;;) {
+        while (ativos < processos) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                int fd;
+                do {
+                    fd = accept(sock, NULL, NULL);
+                } while (fd < 0 && (errno == EINTR || errno == ECONNABORTED));
+                if (fd < 0)
+                    _exit(2);
+                close(sock);
+                atender_job(ctx, fd);
+            }
+            if (pid < 0) {
+                perror("fork");
+                break;
+            }
+            ativos++;
+        }
+        if (ativos == 0)
+            break;
+        if (wait(NULL) > 0) {
+            ativos--;
+        } else if (errno != EINTR) {
+            perror("wait");
+            break;
+        }
+        verificar_interrupcao(rt, NULL);
+    }
+    close(sock);
+    return 1;
+}
+
+// Retorna o código de saída do job, ou -1 em caso de erro de comunicação
+static int executar_remoto(const char *caminho, const char *arquivo, const int fds[3]) {
+    struct sockaddr_un addr;
+    char cwd[4096];
+    int32_t status;
+
+    if (!getcwd(cwd, sizeof(cwd))) {
+        perror("getcwd");
+        return -1;
+    }
+    int fd = abrir_socket(caminho, &addr);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        enviar_job(fd, cwd, arquivo, fds) < 0) {
+        perror(caminho);
+        close(fd);
+        return -1;
+    }
+    ssize_t n;
+    do {
+        n = read(fd, &status, sizeof(status));
+    } while (n < 0 && errno == EINTR);
+    close(fd);
+    if (n != sizeof(status)) {
+        fprintf(stderr, "verde: job interrompido no servidor\n");
+        return -1;
+    }
+    return status;
+}
+
+static double agora_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Benchmark de vazão: 'clientes' processos enviam 'total' jobs ao servidor.
+// A saída dos scripts é descartada.
+static int benchmark_cliente(const char *caminho, const char *arquivo,
+                             int total, int clientes) {
+    int fds[3];
+    fds[0] = open("/dev/null", O_RDONLY);
+    fds[1] = open("/dev/null", O_WRONLY);
+    fds[2] = STDERR_FILENO;
+    if (fds[0] < 0 || fds[1] < 0) {
+        perror("/dev/null");
+        return 1;
+    }
+    if (clientes < 1)
+        clientes = 1;
+    if (clientes > total)
+        clientes = total;
+
+    double t0 = agora_us();
+    for (int c = 0; c < clientes; c++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            int n = total / clientes + (c < total % clientes);
+            for (int i = 0; i < n; i++) {
+                if (executar_remoto(caminho, arquivo, fds) != 0)
+                    _exit(1);
+            }
+            _exit(0);
+        }
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+    }
+    int falhas = 0, wstatus;
+    while (wait(&wstatus) > 0) {
+        if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0)
+            falhas++;
+    }
+    double dt = agora_us() - t0;
+    printf("%d jobs, %d clientes: %.3f s, %.0f jobs/s, latência média %.0f us\n",
+           total, clientes, dt / 1e6, total / (dt / 1e6), dt * clientes / total);
+    if (falhas)
+        fprintf(stderr, "verde: %d clientes falharam\n", falhas);
+    return falhas != 0;
+}
+
+// Lista de scripts do modo batch: um arquivo com um caminho por linha
+// (linhas vazias e começando com '#' são ignoradas) ou um diretório, do
+// qual são tomados os arquivos .js, .jsx, .ts e .tsx em ordem alfabética
+typedef struct {
+    char **itens;
+    int n, cap;
+} ListaArquivos;
+
+static void lista_adicionar(ListaArquivos *l, char *item) {
+    if (l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 16;
+        l->itens = realloc(l->itens, sizeof(l->itens[0]) * l->cap);
+    }
+    l->itens[l->n++] = item;
+}
+
+static void lista_liberar(ListaArquivos *l) {
+    for (int i = 0; i < l->n; i++)
+        free(l->itens[i]);
+    free(l->itens);
+}
+
+static int comparar_nomes(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
 
-    if (argc > 1) {
-        JSValue val = carregar_arquivo(ctx, argv[1]);
-        if (JS_IsException(val)) {
-            JSValue exc = JS_GetException(ctx);
-            const char *err = JS_ToCString(ctx, exc);
-            fprintf(stderr, "Erro: %s\n", err);
-            JS_FreeCString(ctx, err);
-            JS_FreeValue(ctx, exc);
+static int ler_lista(const char *caminho, ListaArquivos *l) {
+    struct stat st;
+    if (stat(caminho, &st) < 0) {
+        perror(caminho);
+        return -1;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        DIR *d = opendir(caminho);
+        if (!d) {
+            perror(caminho);
+            return -1;
+        }
+        struct dirent *e;
+        while ((e = readdir(d)) != NULL) {
+            if (!termina_com(e->d_name, ".js") && !termina_com(e->d_name, ".jsx") &&
+                !termina_com(e->d_name, ".ts") && !termina_com(e->d_name, ".tsx") &&
+                !termina_com(e->d_name, ".mts") && !termina_com(e->d_name, ".cts"))
+                continue;
+            char *item = malloc(strlen(caminho) + strlen(e->d_name) + 2);
+            sprintf(item, "%s/%s", caminho, e->d_name);
+            lista_adicionar(l, item);
         }
-        JS_FreeValue(ctx, val);
+        closedir(d);
+        qsort(l->itens, l->n, sizeof(l->itens[0]), comparar_nomes);
+    } else {
+        FILE *f = fopen(caminho, "r");
+        if (!f) {
+            perror(caminho);
+            return -1;
+        }
+        char *linha = NULL;
+        size_t cap = 0;
+        ssize_t n;
+        while ((n = getline(&linha, &cap, f)) >= 0) {
+            while (n > 0 && (linha[n - 1] == '\n' || linha[n - 1] == '\r'))
+                linha[--n] = '\0';
+            if (n == 0 || linha[0] == '#')
+                continue;
+            lista_adicionar(l, strdup(linha));
+        }
+        free(linha);
+        fclose(f);
+    }
+    return 0;
+}
+
+// Referência para a comparação: cada script num processo verde novo
+static double medir_um_processo_por_script(const ListaArquivos *l) {
+    double t0 = agora_us();
+    for (int i = 0; i < l->n; i++) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            int fd = open("/dev/null", O_WRONLY);
+            if (fd >= 0)
+                dup2(fd, STDOUT_FILENO);
+            execl("/proc/self/exe", "verde", l->itens[i], (char *)NULL);
+            _exit(127);
+        }
+        if (pid > 0)
+            waitpid(pid, NULL, 0);
+    }
+    return agora_us() - t0;
+}
+
+// Modo batch: um contexto novo por script. Cada thread tem o seu runtime,
+// em que os átomos, shapes e o contexto do sucrase são reaproveitados de um
+// script para o outro; entre as threads só se compartilham a imagem do
+// sucrase e o bytecode dos módulos do verdemod, ambos somente leitura.
+typedef struct {
+    pthread_t thread;
+    int id, n_threads;
+    const ListaArquivos *lista;
+    int *proximo;           // próximo script da lista, comum às threads
+    const char *snapshot;   // --heap-snapshot
+    int scripts, falhas;
+    double ocupado_us;
+    size_t memoria;         // memória do runtime ao terminar
+} TrabalhadorBatch;
+
+static void *executar_trabalhador(void *arg) {
+    TrabalhadorBatch *t = arg;
+    JSRuntime *rt = criar_runtime(1);
+    char prefixo[32];
+    int i;
+
+    if (t->n_threads > 1)
+        snprintf(prefixo, sizeof(prefixo), "[batch %d]", t->id);
+    else
+        snprintf(prefixo, sizeof(prefixo), "[batch]");
+    while ((i = __atomic_fetch_add(t->proximo, 1, __ATOMIC_RELAXED)) < t->lista->n) {
+        double t0 = agora_us();
+        JSContext *ctx = criar_contexto(rt);
+        int status = executar_arquivo(ctx, t->lista->itens[i]);
+        JS_FreeContext(ctx);
+        fflush(stdout);
+        double dt = agora_us() - t0;
+        t->scripts++;
+        t->falhas += status != 0;
+        t->ocupado_us += dt;
+        fprintf(stderr, "%s %-40s %9.2f ms%s\n", prefixo, t->lista->itens[i],
+                dt / 1e3, status ? "  (erro)" : "");
+    }
+
+    JSMemoryUsage uso_mem;
+    JS_ComputeMemoryUsage(rt, &uso_mem);
+    t->memoria = uso_mem.memory_used_size;
+    if (t->snapshot) {
+        char nome[256];
+        if (t->n_threads > 1)
+            snprintf(nome, sizeof(nome), "%s.%d", t->snapshot, t->id);
+        else
+            snprintf(nome, sizeof(nome), "%s", t->snapshot);
+        gravar_snapshot(rt, nome);
+    }
+    liberar_runtime(rt);
+    return NULL;
+}
+
+static int modo_batch(const ListaArquivos *l, int n_threads, int comparar,
+                      const char *snapshot) {
+    TrabalhadorBatch *trabalhadores = calloc(n_threads, sizeof(TrabalhadorBatch));
+    int proximo = 0, falhas = 0;
+
+    double t0 = agora_us();
+    for (int i = 0; i < n_threads; i++) {
+        TrabalhadorBatch *t = &trabalhadores[i];
+        t->id = i;
+        t->n_threads = n_threads;
+        t->lista = l;
+        t->proximo = &proximo;
+        t->snapshot = snapshot;
+        // com uma thread só, roda na principal
+        if (n_threads == 1) {
+            executar_trabalhador(t);
+        } else if (pthread_create(&t->thread, NULL, executar_trabalhador, t) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    for (int i = 0; n_threads > 1 && i < n_threads; i++)
+        pthread_join(trabalhadores[i].thread, NULL);
+    double dt = agora_us() - t0;
+
+    for (int i = 0; i < n_threads; i++) {
+        TrabalhadorBatch *t = &trabalhadores[i];
+        falhas += t->falhas;
+        if (n_threads > 1)
+            fprintf(stderr, "[batch %d] %d scripts, %d com erro, %.3f s ocupada, %zu KiB de heap\n",
+                    i, t->scripts, t->falhas, t->ocupado_us / 1e6, t->memoria / 1024);
+    }
+    fprintf(stderr, "[batch] %d scripts em %.3f s com %d thread%s: %.1f scripts/s, %d com erro\n",
+            l->n, dt / 1e6, n_threads, n_threads > 1 ? "s" : "", l->n / (dt / 1e6), falhas);
+    if (comparar && l->n > 0) {
+        double dt1 = medir_um_processo_por_script(l);
+        fprintf(stderr, "[batch] um processo por script: %.3f s: %.1f scripts/s (batch %.1fx mais rápido)\n",
+                dt1 / 1e6, l->n / (dt1 / 1e6), dt1 / dt);
+    }
+    free(trabalhadores);
+    return falhas != 0;
+}
+
+// verde --compile: gera o executável com o bytecode do script. As
+// dependências do verdemod são as chamadas com um literal, verdemod("nome"),
+// procuradas no fonte do script e, recursivamente, no dos módulos; um nome
+// calculado em tempo de execução continua sendo lido do disco.
+static int eh_identificador(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9') || c == '_' || c == '$' || (unsigned char)c >= 0x80;
+}
+
+// Pula uma string, um template ou uma expressão regular que começa antes
+// de 'p'. O template é pulado por inteiro, inclusive as expressões ${...}:
+// uma chamada dentro delas fica para o tempo de execução.
+static const char *pular_literal(const char *p, char delim) {
+    int classe = 0; // dentro de [...] na expressão regular
+    while (*p) {
+        char c = *p++;
+        if (c == '\\') {
+            if (*p)
+                p++;
+        } else if (delim == '/' && c == '[') {
+            classe = 1;
+        } else if (delim == '/' && c == ']') {
+            classe = 0;
+        } else if (c == delim && !classe) {
+            break;
+        } else if (c == '\n' && delim != '`') {
+            break;
+        }
+    }
+    return p;
+}
+
+// Depois do identificador verdemod: '(', o literal e ')'. Retorna o fim
+// da chamada ou 'p' se o nome não é um literal.
+static const char *ler_chamada(const char *p, ListaArquivos *deps) {
+    const char *q = p;
+    while (*q == ' ' || *q == '\t')
+        q++;
+    if (*q++ != '(')
+        return p;
+    while (*q == ' ' || *q == '\t')
+        q++;
+    char aspas = *q;
+    if (aspas != '"' && aspas != '\'' && aspas != '`')
+        return p;
+    const char *nome = ++q;
+    while (*q && *q != aspas && *q != '\\' && *q != '\n' && *q != '$')
+        q++;
+    if (*q != aspas)
+        return p;
+    const char *fim_nome = q++;
+    while (*q == ' ' || *q == '\t')
+        q++;
+    if (*q != ')')
+        return p;
+    char arquivo[256];
+    snprintf(arquivo, sizeof(arquivo), "%.*s.js", (int)(fim_nome - nome), nome);
+    int i;
+    for (i = 0; i < deps->n && strcmp(deps->itens[i], arquivo); i++)
+        continue;
+    if (i == deps->n)
+        lista_adicionar(deps, strdup(arquivo));
+    return q + 1;
+}
+
+// Só as chamadas no código contam: comentários, strings, templates e
+// expressões regulares são pulados
+static void coletar_dependencias(const char *fonte, ListaArquivos *deps) {
+    // palavras depois das quais '/' começa uma expressão regular
+    static const char *const antes_de_regexp[] = {
+        "return", "typeof", "case", "do", "else", "in", "of", "new",
+        "delete", "void", "throw", "yield", "await", "instanceof",
+    };
+    const char *p = fonte;
+    char ant = '\0'; // último caractere significativo ('a': identificador)
+    while (*p) {
+        char c = *p;
+        if (c == '/' && p[1] == '/') {
+            while (*p && *p != '\n')
+                p++;
+        } else if (c == '/' && p[1] == '*') {
+            const char *fim = strstr(p + 2, "*/");
+            if (!fim)
+                break;
+            p = fim + 2;
+        } else if (c == '"' || c == '\'' || c == '`' ||
+                   (c == '/' && (ant == '\0' || strchr("(,=:[!&|?{};+-*%<>~^", ant)))) {
+            p = pular_literal(p + 1, c);
+            ant = '"';
+        } else if (eh_identificador(c)) {
+            const char *ini = p;
+            while (eh_identificador(*p))
+                p++;
+            // obj.verdemod(...) não é o global
+            if (p - ini == 8 && !memcmp(ini, "verdemod", 8) && ant != '.')
+                p = ler_chamada(p, deps);
+            ant = 'a';
+            for (size_t i = 0; i < sizeof(antes_de_regexp) / sizeof(antes_de_regexp[0]); i++) {
+                if (strlen(antes_de_regexp[i]) == (size_t)(p - ini) &&
+                    !memcmp(ini, antes_de_regexp[i], p - ini)) {
+                    ant = '(';
+                    break;
+                }
+            }
+        } else {
+            if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+                ant = c;
+            p++;
+        }
+    }
+}
+
+static int escrever_entrada(FILE *f, int tipo, const char *nome,
+                            const void *dados, size_t len) {
+    static const uint8_t zeros[8];
+    CabecalhoEntrada e = { tipo, strlen(nome) + 1, len };
+    return fwrite(&e, sizeof(e), 1, f) == 1 &&
+        fwrite(nome, 1, e.tamanho_nome, f) == e.tamanho_nome &&
+        fwrite(zeros, 1, ALINHAR8(e.tamanho_nome) - e.tamanho_nome, f) ==
+            ALINHAR8(e.tamanho_nome) - e.tamanho_nome &&
+        fwrite(dados, 1, len, f) == len &&
+        fwrite(zeros, 1, ALINHAR8(len) - len, f) == ALINHAR8(len) - len ? 0 : -1;
+}
+
+// Compila 'arquivo' e grava o bytecode como uma entrada. O fonte é
+// devolvido em '*pfonte' para a busca das dependências.
+static int compilar_entrada(JSContext *ctx, FILE *f, int tipo, const char *arquivo,
+                            int flags, char **pfonte, size_t *ptotal) {
+    size_t len;
+    char *fonte = ler_fonte(arquivo, &len);
+    if (!fonte) {
+        perror(arquivo);
+        return -1;
+    }
+    JSValue fn = JS_Eval(ctx, fonte, len, arquivo, flags | JS_EVAL_FLAG_COMPILE_ONLY);
+    if (JS_IsException(fn)) {
+        mostrar_excecao(ctx);
+        free(fonte);
+        return -1;
+    }
+    uint8_t *buf = JS_WriteObject(ctx, &len, fn, JS_WRITE_OBJ_BYTECODE);
+    JS_FreeValue(ctx, fn);
+    if (!buf) {
+        mostrar_excecao(ctx);
+        free(fonte);
+        return -1;
+    }
+    int ret = escrever_entrada(f, tipo, arquivo, buf, len);
+    js_free(ctx, buf);
+    *ptotal += len;
+    *pfonte = fonte;
+    return ret;
+}
+
+// Imagem do sucrase (cabeçalho e bytecode), refeita se estiver desatualizada
+// ou se for de outra versão do QuickJS
+static int obter_imagem_sucrase(JSContext *ctx) {
+    struct stat st;
+    if (mapear_imagem() == 0) {
+        JSRuntime *rt = JS_NewRuntime();
+        int ok = JS_ReserveImageAtoms(rt, (const uint8_t *)imagem_mapeada + sizeof(CabecalhoImagem),
+                                      imagem_tamanho - sizeof(CabecalhoImagem)) == 0;
+        JS_FreeRuntime(rt);
+        if (ok)
+            return 0;
+        liberar_imagem();
+    }
+    size_t len;
+    char *fonte = ler_fonte(BUNDLE_SUCRASE, &len);
+    if (!fonte || stat(BUNDLE_SUCRASE, &st) < 0) {
+        free(fonte);
+        fprintf(stderr, "%s não encontrado\n", BUNDLE_SUCRASE);
+        return -1;
+    }
+    JSValue fn = JS_Eval(ctx, fonte, len, BUNDLE_SUCRASE,
+                         JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY);
+    free(fonte);
+    if (JS_IsException(fn)) {
+        mostrar_excecao(ctx);
+        return -1;
+    }
+    gravar_imagem(ctx, fn, &st);
+    JS_FreeValue(ctx, fn);
+    return mapear_imagem();
+}
+
+// Copia o próprio verde (sem as entradas, se ele já for um executável
+// compilado), alinhado em 8 bytes
+static int copiar_interpretador(FILE *saida) {
+    RodapeExecutavel r;
+    struct stat st;
+    char buf[65536];
+    int fd = open("/proc/self/exe", O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror("/proc/self/exe");
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    uint64_t resta = ler_rodape(fd, &r) == 0 ? r.inicio : (uint64_t)st.st_size;
+    uint64_t total = resta;
+    while (resta > 0) {
+        ssize_t n = read(fd, buf, resta < sizeof(buf) ? resta : sizeof(buf));
+        if (n <= 0 || fwrite(buf, 1, n, saida) != (size_t)n) {
+            close(fd);
+            return -1;
+        }
+        resta -= n;
+    }
+    close(fd);
+    memset(buf, 0, 8);
+    return fwrite(buf, 1, ALINHAR8(total) - total, saida) == ALINHAR8(total) - total ? 0 : -1;
+}
+
+static int compilar_executavel(const char *arquivo, const char *saida) {
+    ListaArquivos deps = { 0 };
+    RodapeExecutavel r = { 0 };
+    size_t bytecode = 0;
+    char tmp[512], *fonte;
+    int ret = -1, usa_sucrase;
+
+    JSRuntime *rt = criar_runtime(0);
+    JSContext *ctx = JS_NewContext(rt);
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", saida, (int)getpid());
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        perror(tmp);
+        goto fim;
+    }
+    if (copiar_interpretador(f) < 0)
+        goto fim;
+    r.inicio = ftell(f);
+
+    if (compilar_entrada(ctx, f, ENTRADA_PRINCIPAL, arquivo, flags_do_arquivo(arquivo),
+                         &fonte, &bytecode) < 0)
+        goto fim;
+    r.n_entradas++;
+    coletar_dependencias(fonte, &deps);
+    usa_sucrase = strstr(fonte, "sucraseTransform") != NULL;
+    free(fonte);
+    // a lista cresce enquanto é percorrida: os módulos de cada módulo
+    for (int i = 0; i < deps.n; i++) {
+        // o nome pode não ser um módulo (código morto, outro diretório):
+        // verdemod() o procura no disco ao executar, como sem --compile
+        if (access(deps.itens[i], R_OK) < 0) {
+            fprintf(stderr, "Aviso: %s: %s; o módulo será lido do disco ao executar\n",
+                    deps.itens[i], strerror(errno));
+            continue;
+        }
+        if (compilar_entrada(ctx, f, ENTRADA_MODULO, deps.itens[i], JS_EVAL_TYPE_GLOBAL,
+                             &fonte, &bytecode) < 0)
+            goto fim;
+        r.n_entradas++;
+        coletar_dependencias(fonte, &deps);
+        usa_sucrase |= strstr(fonte, "sucraseTransform") != NULL;
+        free(fonte);
+    }
+    if (usa_sucrase) {
+        if (obter_imagem_sucrase(ctx) < 0 ||
+            escrever_entrada(f, ENTRADA_SUCRASE, BUNDLE_SUCRASE,
+                             imagem_mapeada, imagem_tamanho) < 0)
+            goto fim;
+        r.n_entradas++;
+        bytecode += imagem_tamanho;
+    }
+
+    r.tamanho = ftell(f) - r.inicio;
+    r.versao = EXECUTAVEL_VERSAO;
+    memcpy(r.magica, EXECUTAVEL_MAGICA, sizeof(r.magica));
+    if (fwrite(&r, sizeof(r), 1, f) != 1)
+        goto fim;
+    ret = 0;
+ fim:
+    if (f) {
+        if (fclose(f) != 0)
+            ret = -1;
+        if (ret == 0 && (chmod(tmp, 0755) < 0 || rename(tmp, saida) < 0)) {
+            perror(saida);
+            ret = -1;
+        }
+        if (ret < 0)
+            unlink(tmp);
+    }
+    if (ret == 0)
+        fprintf(stderr, "%s: %d módulo(s)%s, %zu bytes de bytecode\n", saida,
+                deps.n, usa_sucrase ? " e o sucrase" : "", bytecode);
+    lista_liberar(&deps);
+    JS_FreeContext(ctx);
+    liberar_runtime(rt);
+    return ret < 0;
+}
+
+// Execução do executável compilado: o script é lido direto do mapeamento.
+// Os átomos do bytecode dele (ou os do sucrase, se embutido) são criados
+// primeiro, para que esse bytecode seja executado sem relocação.
+static int executar_embutido(void) {
+    size_t len, len_sucrase;
+    const uint8_t *principal = procurar_embutido(ENTRADA_PRINCIPAL, NULL, &len);
+    const uint8_t *sucrase = procurar_embutido(ENTRADA_SUCRASE, NULL, &len_sucrase);
+    int ret = 0;
+
+    if (!principal)
+        return 1;
+    if (sucrase) {
+        imagem_mapeada = (void *)sucrase;
+        imagem_tamanho = len_sucrase;
+        imagem_embutida = 1;
+    }
+    JSRuntime *rt = criar_runtime(sucrase != NULL);
+    if (!sucrase)
+        JS_ReserveImageAtoms(rt, principal, len);
+    JSContext *ctx = criar_contexto(rt);
+    JSValue val = JS_ReadObject(ctx, principal, len,
+                                JS_READ_OBJ_BYTECODE | JS_READ_OBJ_ROM_DATA);
+    if (!JS_IsException(val))
+        val = JS_EvalFunction(ctx, val);
+    if (JS_IsException(val)) {
+        mostrar_excecao(ctx);
+        ret = 1;
+    }
+    JS_FreeValue(ctx, val);
+    if (executar_laco(ctx) < 0)
+        ret = 1;
+    JS_FreeContext(ctx);
+    liberar_runtime(rt);
+    liberar_imagem();
+    munmap(executavel_mapeado, executavel_mapa_tamanho);
+    return ret;
+}
+
+static void uso(void) {
+    fprintf(stderr, "uso: verde [opções] [arquivo.js|.jsx|.ts|.tsx]\n"
+            "  --heap-snapshot arquivo  grava um heap snapshot no fim da execução\n"
+            "  --lazy                   compila as funções internas na primeira chamada\n"
+            "  --server socket          servidor: um fork() do runtime aquecido por job\n"
+            "  --workers N              com --server: filhos esperando jobs (padrão 2 por CPU)\n"
+            "  --client socket          executa o arquivo no servidor\n"
+            "  --bench N                com --client: envia N jobs e mede a vazão\n"
+            "  --clients K              com --bench: K clientes em paralelo (padrão 1)\n"
+            "  --batch lista|diretório  executa vários scripts, um contexto novo para cada\n"
+            "  --compare                com --batch: compara com um processo por script\n"
+            "  -j N arquivo...          executa os arquivos (ou a lista do --batch) em N threads\n"
+            "  --compile arquivo [-o executável]\n"
+            "                           gera um executável com o bytecode do arquivo e dos\n"
+            "                           módulos do verdemod (padrão: o nome sem a extensão)\n"
+            "  (kill -USR2 <pid> grava verde-<pid>-<n>.heapsnapshot a qualquer momento)\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *snapshot_final = NULL;
+    const char *socket_servidor = NULL, *socket_cliente = NULL;
+    const char *lista_batch = NULL, *saida = NULL;
+    int bench_jobs = 0, bench_clientes = 1, processos = 0, comparar = 0;
+    int n_threads = 0, compilar = 0;
+    int primeiro_arg = 1;
+
+    js_std_set_worker_new_context_func(criar_contexto_worker);
+
+    // executável gerado com --compile: as opções são do script
+    if (abrir_embutido() == 0)
+        return executar_embutido();
+
+    while (primeiro_arg < argc && argv[primeiro_arg][0] == '-' &&
+           (argv[primeiro_arg][1] == '-' || !strcmp(argv[primeiro_arg], "-j") ||
+            !strcmp(argv[primeiro_arg], "-o"))) {
+        const char *opt = argv[primeiro_arg++];
+        if (!strcmp(opt, "--compare")) {
+            comparar = 1;
+            continue;
+        }
+        if (!strcmp(opt, "--compile")) {
+            compilar = 1;
+            continue;
+        }
+        if (!strcmp(opt, "--lazy")) {
+            compilacao_preguicosa = 1;
+            continue;
+        }
+        if (primeiro_arg >= argc)
+            uso();
+        if (!strcmp(opt, "--heap-snapshot")) {
+            snapshot_final = argv[primeiro_arg++];
+        } else if (!strcmp(opt, "--server")) {
+            socket_servidor = argv[primeiro_arg++];
+        } else if (!strcmp(opt, "--batch")) {
+            lista_batch = argv[primeiro_arg++];
+        } else if (!strcmp(opt, "-j")) {
+            n_threads = atoi(argv[primeiro_arg++]);
+            if (n_threads < 1)
+                uso();
+        } else if (!strcmp(opt, "-o")) {
+            saida = argv[primeiro_arg++];
+        } else if (!strcmp(opt, "--workers")) {
+            processos = atoi(argv[primeiro_arg++]);
+        } else if (!strcmp(opt, "--client")) {
+            socket_cliente = argv[primeiro_arg++];
+        } else if (!strcmp(opt, "--bench")) {
+            bench_jobs = atoi(argv[primeiro_arg++]);
+        } else if (!strcmp(opt, "--clients")) {
+            bench_clientes = atoi(argv[primeiro_arg++]);
+        } else {
+            uso();
+        }
+    }
+
+    if (compilar) {
+        // verde --compile app.js -o app: o -o também pode vir depois
+        const char *arquivo = NULL;
+        char nome[256];
+        for (int i = primeiro_arg; i < argc; i++) {
+            if (!strcmp(argv[i], "-o") && i + 1 < argc)
+                saida = argv[++i];
+            else if (!arquivo)
+                arquivo = argv[i];
+            else
+                uso();
+        }
+        if (!arquivo)
+            uso();
+        if (!saida) {
+            snprintf(nome, sizeof(nome), "%s", arquivo);
+            char *ponto = strrchr(nome, '.');
+            if (ponto && !strchr(ponto, '/'))
+                *ponto = '\0';
+            if (!strcmp(nome, arquivo))
+                uso();
+            saida = nome;
+        }
+        return compilar_executavel(arquivo, saida);
+    }
+
+    if (socket_cliente) {
+        // o cliente não precisa de runtime
+        if (primeiro_arg >= argc)
+            uso();
+        if (bench_jobs > 0)
+            return benchmark_cliente(socket_cliente, argv[primeiro_arg],
+                                     bench_jobs, bench_clientes);
+        const int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+        int status = executar_remoto(socket_cliente, argv[primeiro_arg], fds);
+        return status < 0 ? 2 : status;
+    }
+
+    signal(SIGUSR2, pedir_snapshot);
+    js_std_set_poll_hook(atender_snapshot);
+
+    if (lista_batch || n_threads > 0) {
+        ListaArquivos l = { 0 };
+        if (lista_batch && ler_lista(lista_batch, &l) < 0)
+            return 1;
+        for (int i = primeiro_arg; !lista_batch && i < argc; i++)
+            lista_adicionar(&l, strdup(argv[i]));
+        int ret = modo_batch(&l, n_threads > 0 ? n_threads : 1, comparar, snapshot_final);
+        lista_liberar(&l);
+        liberar_modulos();
+        liberar_imagem();
+        return ret;
+    }
+
+    // no modo servidor o sucrase é carregado no aquecimento
+    JSRuntime *rt = criar_runtime(socket_servidor != NULL);
+    JSContext *ctx = criar_contexto(rt);
+    int status = 0;
+
+    if (socket_servidor) {
+        return modo_servidor(rt, ctx, socket_servidor, processos);
+    } else if (primeiro_arg < argc) {
+        status = executar_arquivo(ctx, argv[primeiro_arg]);
     } else {
         // REPL
         char buffer[1024];
         while (1) {
             printf("> ");
             if (!fgets(buffer, sizeof(buffer), stdin)) break;
+            verificar_interrupcao(rt, NULL);
             JSValue val = JS_Eval(ctx, buffer, strlen(buffer), "<stdin>", 0);
-            if (JS_IsException(val)) {
-                JSValue exc = JS_GetException(ctx);
-                const char *err = JS_ToCString(ctx, exc);
-                fprintf(stderr, "Erro: %s\n", err);
-                JS_FreeCString(ctx, err);
-                JS_FreeValue(ctx, exc);
-            }
+            if (JS_IsException(val))
+                mostrar_excecao(ctx);
             JS_FreeValue(ctx, val);
+            executar_laco(ctx);
         }
     }
 
+    if (snapshot_final)
+        gravar_snapshot(rt, snapshot_final);
+
     JS_FreeContext(ctx);
-    JS_FreeRuntime(rt);
-    return 0;
+    liberar_runtime(rt);
+    liberar_modulos();
+    liberar_imagem();
+    return status;
 }
@@ -2,21 +2,21 @@
 
 #include "quickjs-libc.h"
 
-const uint32_t qjsc_hello_size = 93;
+const uint32_t qjsc_hello_size = 95;
 
-const uint8_t qjsc_hello[93] = {
- 0x04, 0x04, 0x0e, 0x63, 0x6f, 0x6e, 0x73, 0x6f,
+const uint8_t qjsc_hello[95] = {
+ 0x06, 0x04, 0x0e, 0x63, 0x6f, 0x6e, 0x73, 0x6f,
  0x6c, 0x65, 0x06, 0x6c, 0x6f, 0x67, 0x16, 0x48,
  0x65, 0x6c, 0x6c, 0x6f, 0x20, 0x57, 0x6f, 0x72,
  0x6c, 0x64, 0x22, 0x65, 0x78, 0x61, 0x6d, 0x70,
  0x6c, 0x65, 0x73, 0x2f, 0x68, 0x65, 0x6c, 0x6c,
- 0x6f, 0x2e, 0x6a, 0x73, 0x0c, 0x00, 0x06, 0x00,
- 0xa4, 0x01, 0x00, 0x01, 0x00, 0x03, 0x00, 0x00,
- 0x14, 0x01, 0xa6, 0x01, 0x00, 0x00, 0x00, 0x39,
- 0xdb, 0x00, 0x00, 0x00, 0x43, 0xdc, 0x00, 0x00,
- 0x00, 0x04, 0xdd, 0x00, 0x00, 0x00, 0x24, 0x01,
- 0x00, 0xd0, 0x28, 0xbc, 0x03, 0x06, 0x00, 0x00,
- 0x1b, 0x0e, 0x34, 0x08, 0x00,
+ 0x6f, 0x2e, 0x6a, 0x73, 0x08, 0x06, 0x00, 0x00,
+ 0x1b, 0x0e, 0x34, 0x08, 0x00, 0x0c, 0x00, 0x06,
+ 0x00, 0xa4, 0x01, 0x00, 0x01, 0x00, 0x03, 0x00,
+ 0x00, 0x14, 0x01, 0xa6, 0x01, 0x00, 0x00, 0x00,
+ 0x39, 0xe9, 0x00, 0x00, 0x00, 0x43, 0xea, 0x00,
+ 0x00, 0x00, 0x04, 0xeb, 0x00, 0x00, 0x00, 0x24,
+ 0x01, 0x00, 0xd0, 0x28, 0xd8, 0x03, 0x00,
 };
 
 static JSContext *JS_NewCustomContext(JSRuntime *rt)
@@ -89,12 +89,18 @@ static int eval_file(JSContext *ctx, const char *filename, int module)
 
     if (module < 0) {
         module = (has_suffix(filename, ".mjs") ||
+                  has_suffix(filename, ".mts") ||
                   JS_DetectModule((const char *)buf, buf_len));
     }
     if (module)
         eval_flags = JS_EVAL_TYPE_MODULE;
     else
         eval_flags = JS_EVAL_TYPE_GLOBAL;
+    if (has_suffix(filename, ".jsx") || has_suffix(filename, ".tsx"))
+        eval_flags |= JS_EVAL_FLAG_JSX;
+    if (has_suffix(filename, ".ts") || has_suffix(filename, ".mts") ||
+        has_suffix(filename, ".tsx"))
+        eval_flags |= JS_EVAL_FLAG_TYPESCRIPT;
     ret = eval_buf(ctx, buf, buf_len, filename, eval_flags);
     js_free(ctx, buf);
     return ret;
@@ -303,6 +309,7 @@ void help(void)
            "    --no-unhandled-rejection  ignore unhandled promise rejections\n"
            "-s                    strip all the debug info\n"
            "    --strip-source    strip the source code\n"
+           "    --lazy            compile the inner functions on their first call\n"
            "-q  --quit         just instantiate the interpreter and quit\n");
     exit(1);
 }
@@ -325,6 +332,7 @@ int main(int argc, char **argv)
     char *include_list[32];
     int i, include_count = 0;
     int strip_flags = 0;
+    int lazy_compile = 0;
     size_t stack_size = 0;
 
     /* cannot use getopt because we want to pass the command line to
@@ -432,6 +440,10 @@ int main(int argc, char **argv)
                 strip_flags = JS_STRIP_SOURCE;
                 continue;
             }
+            if (!strcmp(longopt, "lazy")) {
+                lazy_compile = 1;
+                continue;
+            }
             if (opt) {
                 fprintf(stderr, "qjs: unknown option '-%c'\n", opt);
             } else {
@@ -456,6 +468,7 @@ int main(int argc, char **argv)
     if (stack_size != 0)
         JS_SetMaxStackSize(rt, stack_size);
     JS_SetStripInfo(rt, strip_flags);
+    JS_SetLazyCompile(rt, lazy_compile);
     js_std_set_worker_new_context_func(JS_NewCustomContext);
     js_std_init_handlers(rt);
     ctx = JS_NewCustomContext(rt);
@@ -511,8 +524,16 @@ int main(int argc, char **argv)
 
     if (dump_memory) {
         JSMemoryUsage stats;
+        JSJobStats job_stats;
         JS_ComputeMemoryUsage(rt, &stats);
         JS_DumpMemoryUsage(stdout, &stats, rt);
+        JS_GetJobStats(rt, &job_stats);
+        printf("\nJobs: %" PRId64 " executed in %" PRId64 " batches (%" PRId64
+               " us, max %" PRId64 " jobs / %" PRId64 " us per batch),"
+               " max pending %" PRId64 "\n",
+               job_stats.executed, job_stats.drain_count,
+               job_stats.drain_time, job_stats.max_drain_jobs,
+               job_stats.max_drain_time, job_stats.max_pending);
     }
     js_std_free_handlers(rt);
     JS_FreeContext(ctx);
@@ -156,6 +156,21 @@ DEF(hash_constructor, "#constructor")
 DEF(as, "as")
 DEF(from, "from")
 DEF(meta, "meta")
+/* TypeScript contextual keywords */
+DEF(type, "type")
+DEF(declare, "declare")
+DEF(abstract, "abstract")
+DEF(readonly, "readonly")
+DEF(override, "override")
+DEF(namespace, "namespace")
+DEF(module, "module")
+DEF(keyof, "keyof")
+DEF(unique, "unique")
+DEF(infer, "infer")
+DEF(is, "is")
+DEF(asserts, "asserts")
+DEF(satisfies, "satisfies")
+DEF(out, "out")
 DEF(_default_, "*default*")
 DEF(_star_, "*")
 DEF(Module, "Module")
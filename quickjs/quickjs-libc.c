@@ -46,6 +46,11 @@
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 
 #if defined(__FreeBSD__)
 extern char **environ;
@@ -72,6 +77,29 @@ typedef sig_t sighandler_t;
 #ifdef USE_WORKER
 #include <pthread.h>
 #include <stdatomic.h>
+#include <poll.h>
+#if defined(__linux__)
+/* the worker messages are signaled with an eventfd instead of a pipe */
+#define USE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+#endif
+
+#if defined(__GLIBC__) && !defined(CONFIG_NO_POSIX_SPAWN)
+#if __GLIBC_PREREQ(2, 34)
+/* os.exec() uses posix_spawn() when possible. It is much faster than
+   fork() with a large heap. glibc 2.34 has the closefrom and chdir
+   file actions. */
+#define USE_POSIX_SPAWN
+#include <spawn.h>
+#endif
+#endif
+
+#if defined(__linux__) && !defined(CONFIG_NO_EPOLL)
+/* use epoll() with persistent registrations instead of select() in
+   js_os_poll(). select() is still used if epoll_create1() fails. */
+#define USE_EPOLL
+#include <sys/epoll.h>
 #endif
 
 #include "cutils.h"
@@ -82,14 +110,13 @@ typedef sig_t sighandler_t;
 #define PATH_MAX 4096
 #endif
 
-/* TODO:
-   - add socket calls
-*/
-
 typedef struct {
     struct list_head link;
     int fd;
     JSValue rw_func[2];
+    /* the fd cannot be polled with epoll (e.g. regular file): it is
+       always ready, as with select() */
+    BOOL always_ready;
 } JSOSRWHandler;
 
 typedef struct {
@@ -98,30 +125,41 @@ typedef struct {
     JSValue func;
 } JSOSSignalHandler;
 
-typedef struct {
-    struct list_head link;
-    int timer_id;
+typedef struct JSOSTimer {
+    int heap_index; /* position in timer_heap */
+    int timer_id; /* -1 for os.sleepAsync() */
+    struct JSOSTimer *hash_next; /* in timer_hash if timer_id > 0 */
     int64_t timeout;
+    uint64_t seq; /* creation order, for the timers with the same timeout */
     JSValue func;
 } JSOSTimer;
 
-typedef struct {
+typedef struct JSWorkerMessage {
     struct list_head link;
+    struct JSWorkerMessage *next; /* in JSWorkerMessagePipe.msg_stack */
     uint8_t *data;
     size_t data_len;
     /* list of SharedArrayBuffers, necessary to free the message */
     uint8_t **sab_tab;
     size_t sab_tab_len;
+    /* contents of the transferred ArrayBuffers */
+    JSTransferBuffer *transfer_tab;
+    size_t transfer_len;
 } JSWorkerMessage;
 
 typedef struct {
     int ref_count;
 #ifdef USE_WORKER
-    pthread_mutex_t mutex;
+    /* messages posted by the senders, most recent first. It is pushed
+       without lock and emptied at once by the receiver. read_fd is
+       only signaled when a message is pushed to an empty stack. */
+    _Atomic(JSWorkerMessage *) msg_stack;
 #endif
-    struct list_head msg_queue; /* list of JSWorkerMessage.link */
+    /* messages taken by the receiver and not handled yet, only
+       accessed by the receiving thread (list of JSWorkerMessage.link) */
+    struct list_head msg_queue;
     int read_fd;
-    int write_fd;
+    int write_fd; /* same as read_fd with eventfd */
 } JSWorkerMessagePipe;
 
 typedef struct {
@@ -130,19 +168,78 @@ typedef struct {
     JSValue on_message_func;
 } JSWorkerMessageHandler;
 
+typedef struct JSOSIOQueue JSOSIOQueue;
+
+/* asynchronous file I/O request executed by an I/O thread */
+typedef struct JSOSIORequest {
+    struct list_head link; /* in os_io_requests */
+    struct JSOSIORequest *next; /* in JSOSIOQueue.done_stack */
+    JSOSIOQueue *queue; /* receives the request when it is done */
+    int op; /* OS_IO_x */
+    char *filename;
+    int fd;
+    int64_t pos;
+    uint8_t *buf; /* data to write or data read */
+    size_t len;
+    int64_t result; /* < 0 if error (-errno) */
+    /* only accessed by the thread which submitted the request */
+    JSContext *ctx;
+    JSValue resolving_funcs[2];
+} JSOSIORequest;
+
+struct JSOSIOQueue {
+    int ref_count; /* one for the thread state and one per request */
+#ifdef USE_WORKER
+    /* completed requests, most recent first. read_fd is only
+       signaled when a request is pushed to an empty stack. */
+    _Atomic(JSOSIORequest *) done_stack;
+#endif
+    int read_fd;
+    int write_fd; /* same as read_fd with eventfd */
+};
+
 typedef struct JSThreadState {
     struct list_head os_rw_handlers; /* list of JSOSRWHandler.link */
     struct list_head os_signal_handlers; /* list JSOSSignalHandler.link */
-    struct list_head os_timers; /* list of JSOSTimer.link */
+    /* pending timers: binary min-heap ordered by (timeout, seq) */
+    JSOSTimer **timer_heap;
+    int timer_count, timer_heap_size;
+    uint64_t next_timer_seq;
+    /* setTimeout() timers by id (chained hash table) */
+    JSOSTimer **timer_hash;
+    int timer_hash_count, timer_hash_size; /* size is a power of two */
     struct list_head port_list; /* list of JSWorkerMessageHandler.link */
     int eval_script_recurse; /* only used in the main thread */
     int next_timer_id; /* for setTimeout() */
+    /* os_rw_handlers indexed by fd */
+    JSOSRWHandler **rw_handler_tab;
+    int rw_handler_tab_size;
+#ifdef USE_EPOLL
+    /* created on first use by os_poll_get_epoll(). -1 if select() is
+       used. */
+    int epoll_fd;
+    int epoll_generation; /* os_fork_generation of epoll_fd, -1 if none */
+    int always_ready_count; /* number of JSOSRWHandler.always_ready */
+    /* events returned by the last epoll_wait(), handled one per
+       js_os_poll() call. A callback may drain or close an fd before
+       its event is handled, so the events of the fds whose handler
+       changes are dropped and the others are checked again with
+       poll(). */
+    struct epoll_event poll_events[64];
+    int poll_event_pos, poll_event_count;
+#endif
     /* not used in the main thread */
     JSWorkerMessagePipe *recv_pipe, *send_pipe;
+    /* asynchronous I/O: created with the first request */
+    JSOSIOQueue *io_queue;
+    int io_pending_count; /* number of requests not completed */
+    /* an exception was not caught by a callback or a job */
+    BOOL loop_error;
 } JSThreadState;
 
 static uint64_t os_pending_signals;
 static int (*os_poll_func)(JSContext *ctx);
+static void (*os_poll_hook)(JSRuntime *rt);
 
 static void js_std_dbuf_init(JSContext *ctx, DynBuf *s)
 {
@@ -588,6 +685,7 @@ JSModuleDef *js_module_loader(JSContext *ctx,
         size_t buf_len;
         uint8_t *buf;
         JSValue func_val;
+        int eval_flags;
 
         buf = js_load_file(ctx, &buf_len, module_name);
         if (!buf) {
@@ -597,8 +695,13 @@ JSModuleDef *js_module_loader(JSContext *ctx,
         }
 
         /* compile the module */
-        func_val = JS_Eval(ctx, (char *)buf, buf_len, module_name,
-                           JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+        eval_flags = JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY;
+        if (has_suffix(module_name, ".jsx") || has_suffix(module_name, ".tsx"))
+            eval_flags |= JS_EVAL_FLAG_JSX;
+        if (has_suffix(module_name, ".ts") || has_suffix(module_name, ".mts") ||
+            has_suffix(module_name, ".tsx"))
+            eval_flags |= JS_EVAL_FLAG_TYPESCRIPT;
+        func_val = JS_Eval(ctx, (char *)buf, buf_len, module_name, eval_flags);
         js_free(ctx, buf);
         if (JS_IsException(func_val))
             return NULL;
@@ -734,6 +837,31 @@ static JSValue js_std_gc(JSContext *ctx, JSValueConst this_val,
     return JS_UNDEFINED;
 }
 
+/* write a heap snapshot in the Chrome DevTools format. Return 0 or
+   -errno. */
+static JSValue js_std_writeHeapSnapshot(JSContext *ctx, JSValueConst this_val,
+                                        int argc, JSValueConst *argv)
+{
+    const char *filename;
+    FILE *f;
+    int err;
+
+    filename = JS_ToCString(ctx, argv[0]);
+    if (!filename)
+        return JS_EXCEPTION;
+    f = fopen(filename, "w");
+    JS_FreeCString(ctx, filename);
+    if (!f)
+        return JS_NewInt32(ctx, -errno);
+    err = 0;
+    errno = 0;
+    if (JS_WriteHeapSnapshot(JS_GetRuntime(ctx), f) < 0)
+        err = errno ? errno : ENOMEM;
+    if (fclose(f) != 0 && !err)
+        err = errno;
+    return JS_NewInt32(ctx, -err);
+}
+
 static int interrupt_handler(JSRuntime *rt, void *opaque)
 {
     return (os_pending_signals >> SIGINT) & 1;
@@ -765,6 +893,8 @@ static JSValue js_evalScript(JSContext *ctx, JSValueConst this_val,
     JSValueConst options_obj;
     BOOL backtrace_barrier = FALSE;
     BOOL is_async = FALSE;
+    BOOL is_jsx = FALSE;
+    BOOL is_ts = FALSE;
     int flags;
 
     if (argc >= 2) {
@@ -775,6 +905,10 @@ static JSValue js_evalScript(JSContext *ctx, JSValueConst this_val,
         if (get_bool_option(ctx, &is_async, options_obj,
                             "async"))
             return JS_EXCEPTION;
+        if (get_bool_option(ctx, &is_jsx, options_obj, "jsx"))
+            return JS_EXCEPTION;
+        if (get_bool_option(ctx, &is_ts, options_obj, "typescript"))
+            return JS_EXCEPTION;
     }
 
     str = JS_ToCStringLen(ctx, &len, argv[0]);
@@ -789,6 +923,10 @@ static JSValue js_evalScript(JSContext *ctx, JSValueConst this_val,
         flags |= JS_EVAL_FLAG_BACKTRACE_BARRIER;
     if (is_async)
         flags |= JS_EVAL_FLAG_ASYNC;
+    if (is_jsx)
+        flags |= JS_EVAL_FLAG_JSX;
+    if (is_ts)
+        flags |= JS_EVAL_FLAG_TYPESCRIPT;
     ret = JS_Eval(ctx, str, len, "<evalScript>", flags);
     JS_FreeCString(ctx, str);
     if (!ts->recv_pipe && --ts->eval_script_recurse == 0) {
@@ -1505,12 +1643,22 @@ static const JSCFunctionListEntry js_std_error_props[] = {
     DEF(EPERM),
     DEF(EPIPE),
     DEF(EBADF),
+    DEF(EAGAIN),
+    DEF(EINTR),
+#if !defined(_WIN32)
+    DEF(EINPROGRESS),
+    DEF(EADDRINUSE),
+    DEF(ECONNREFUSED),
+    DEF(ECONNRESET),
+    DEF(ENOTCONN),
+#endif
 #undef DEF
 };
 
 static const JSCFunctionListEntry js_std_funcs[] = {
     JS_CFUNC_DEF("exit", 1, js_std_exit ),
     JS_CFUNC_DEF("gc", 0, js_std_gc ),
+    JS_CFUNC_DEF("writeHeapSnapshot", 1, js_std_writeHeapSnapshot ),
     JS_CFUNC_DEF("evalScript", 1, js_evalScript ),
     JS_CFUNC_DEF("loadScript", 1, js_loadScript ),
     JS_CFUNC_DEF("getenv", 1, js_std_getenv ),
@@ -1853,24 +2001,148 @@ static BOOL is_main_thread(JSRuntime *rt)
 
 static JSOSRWHandler *find_rh(JSThreadState *ts, int fd)
 {
-    JSOSRWHandler *rh;
+    if (fd < 0 || fd >= ts->rw_handler_tab_size)
+        return NULL;
+    return ts->rw_handler_tab[fd];
+}
+
+#ifdef USE_EPOLL
+/* set the epoll events of 'fd' (0 to remove it). Return -1 with errno
+   set if the fd cannot be registered. */
+static int os_poll_update(JSThreadState *ts, int fd, uint32_t events)
+{
+    struct epoll_event ev;
+    int i;
+
+    /* the pending events of 'fd' were for the previous handler */
+    for(i = ts->poll_event_pos; i < ts->poll_event_count; i++) {
+        if (ts->poll_events[i].data.fd == fd)
+            ts->poll_events[i].events = 0;
+    }
+    if (events == 0) {
+        /* ignore the error if the fd was closed */
+        epoll_ctl(ts->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        return 0;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    /* a closed fd is removed from the epoll set even if its handler
+       remains, so always try both operations */
+    if (epoll_ctl(ts->epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0)
+        return 0;
+    if (errno != ENOENT)
+        return -1;
+    return epoll_ctl(ts->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void os_poll_register_all(JSThreadState *ts);
+
+/* incremented in the child by fork() */
+static int os_fork_generation;
+static pthread_once_t os_fork_once = PTHREAD_ONCE_INIT;
+
+static void os_fork_child(void)
+{
+    os_fork_generation++;
+}
+
+static void os_fork_init(void)
+{
+    pthread_atfork(NULL, NULL, os_fork_child);
+}
+
+/* return the epoll fd of the current process or -1 if select() must be
+   used. A child created by fork() shares the epoll instance of its
+   parent, so it would receive the events of the parent fds: it gets
+   its own instance instead. */
+static int os_poll_get_epoll(JSThreadState *ts)
+{
+    if (likely(ts->epoll_generation == os_fork_generation))
+        return ts->epoll_fd;
+    if (ts->epoll_fd >= 0)
+        close(ts->epoll_fd);
+    ts->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    ts->epoll_generation = os_fork_generation;
+    /* the events of the previous instance are not valid */
+    ts->poll_event_pos = 0;
+    ts->poll_event_count = 0;
+    if (ts->epoll_fd >= 0)
+        os_poll_register_all(ts);
+    return ts->epoll_fd;
+}
+
+static void os_poll_update_rh(JSThreadState *ts, JSOSRWHandler *rh)
+{
+    uint32_t events = 0;
+    BOOL always_ready;
+
+    if (os_poll_get_epoll(ts) < 0)
+        return;
+    if (!JS_IsNull(rh->rw_func[0]))
+        events |= EPOLLIN;
+    if (!JS_IsNull(rh->rw_func[1]))
+        events |= EPOLLOUT;
+    always_ready = (os_poll_update(ts, rh->fd, events) < 0 && errno == EPERM);
+    ts->always_ready_count += always_ready - rh->always_ready;
+    rh->always_ready = always_ready;
+}
+
+/* the read end of a message pipe is registered while at least one
+   port with a message handler uses it */
+static void os_poll_update_port(JSThreadState *ts, int fd)
+{
+    struct list_head *el;
+    uint32_t events = 0;
+
+    if (os_poll_get_epoll(ts) < 0)
+        return;
+    list_for_each(el, &ts->port_list) {
+        JSWorkerMessageHandler *port = list_entry(el, JSWorkerMessageHandler, link);
+        if (port->recv_pipe->read_fd == fd &&
+            !JS_IsNull(port->on_message_func)) {
+            events = EPOLLIN;
+            break;
+        }
+    }
+    os_poll_update(ts, fd, events);
+}
+
+/* register all the fds of 'ts' in a new epoll instance */
+static void os_poll_register_all(JSThreadState *ts)
+{
     struct list_head *el;
 
+    ts->always_ready_count = 0;
     list_for_each(el, &ts->os_rw_handlers) {
-        rh = list_entry(el, JSOSRWHandler, link);
-        if (rh->fd == fd)
-            return rh;
+        JSOSRWHandler *rh = list_entry(el, JSOSRWHandler, link);
+        rh->always_ready = FALSE;
+        os_poll_update_rh(ts, rh);
     }
-    return NULL;
+    list_for_each(el, &ts->port_list) {
+        JSWorkerMessageHandler *port = list_entry(el, JSWorkerMessageHandler, link);
+        os_poll_update_port(ts, port->recv_pipe->read_fd);
+    }
+    if (ts->io_queue)
+        os_poll_update(ts, ts->io_queue->read_fd, EPOLLIN);
 }
+#endif
 
 static void free_rw_handler(JSRuntime *rt, JSOSRWHandler *rh)
 {
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
     int i;
     list_del(&rh->link);
+    ts->rw_handler_tab[rh->fd] = NULL;
     for(i = 0; i < 2; i++) {
         JS_FreeValueRT(rt, rh->rw_func[i]);
     }
+#ifdef USE_EPOLL
+    rh->rw_func[0] = JS_NULL;
+    rh->rw_func[1] = JS_NULL;
+    if (ts->epoll_fd >= 0)
+        os_poll_update_rh(ts, rh);
+#endif
     js_free_rt(rt, rh);
 }
 
@@ -1895,13 +2167,29 @@ static JSValue js_os_setReadHandler(JSContext *ctx, JSValueConst this_val,
                 JS_IsNull(rh->rw_func[1])) {
                 /* remove the entry */
                 free_rw_handler(JS_GetRuntime(ctx), rh);
+                return JS_UNDEFINED;
             }
         }
     } else {
         if (!JS_IsFunction(ctx, func))
             return JS_ThrowTypeError(ctx, "not a function");
+        if (fd < 0)
+            return JS_ThrowRangeError(ctx, "invalid file descriptor");
         rh = find_rh(ts, fd);
         if (!rh) {
+            if (fd >= ts->rw_handler_tab_size) {
+                JSOSRWHandler **tab;
+                int i, new_size;
+                new_size = max_int(fd + 1, ts->rw_handler_tab_size * 3 / 2);
+                tab = js_realloc(ctx, ts->rw_handler_tab,
+                                 sizeof(tab[0]) * new_size);
+                if (!tab)
+                    return JS_EXCEPTION;
+                for(i = ts->rw_handler_tab_size; i < new_size; i++)
+                    tab[i] = NULL;
+                ts->rw_handler_tab = tab;
+                ts->rw_handler_tab_size = new_size;
+            }
             rh = js_mallocz(ctx, sizeof(*rh));
             if (!rh)
                 return JS_EXCEPTION;
@@ -1909,10 +2197,15 @@ static JSValue js_os_setReadHandler(JSContext *ctx, JSValueConst this_val,
             rh->rw_func[0] = JS_NULL;
             rh->rw_func[1] = JS_NULL;
             list_add_tail(&rh->link, &ts->os_rw_handlers);
+            ts->rw_handler_tab[fd] = rh;
         }
         JS_FreeValue(ctx, rh->rw_func[magic]);
         rh->rw_func[magic] = JS_DupValue(ctx, func);
     }
+#ifdef USE_EPOLL
+    if (rh)
+        os_poll_update_rh(ts, rh);
+#endif
     return JS_UNDEFINED;
 }
 
@@ -2028,9 +2321,123 @@ static JSValue js_os_now(JSContext *ctx, JSValue this_val,
     return JS_NewFloat64(ctx, (double)get_time_ns() / 1e6);
 }
 
+static BOOL timer_lt(const JSOSTimer *a, const JSOSTimer *b)
+{
+    return a->timeout < b->timeout ||
+        (a->timeout == b->timeout && a->seq < b->seq);
+}
+
+static void timer_heap_set(JSThreadState *ts, int i, JSOSTimer *th)
+{
+    ts->timer_heap[i] = th;
+    th->heap_index = i;
+}
+
+static void timer_heap_up(JSThreadState *ts, int i)
+{
+    JSOSTimer *th = ts->timer_heap[i];
+    int parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!timer_lt(th, ts->timer_heap[parent]))
+            break;
+        timer_heap_set(ts, i, ts->timer_heap[parent]);
+        i = parent;
+    }
+    timer_heap_set(ts, i, th);
+}
+
+static void timer_heap_down(JSThreadState *ts, int i)
+{
+    JSOSTimer *th = ts->timer_heap[i];
+    int child;
+
+    for(;;) {
+        child = 2 * i + 1;
+        if (child >= ts->timer_count)
+            break;
+        if (child + 1 < ts->timer_count &&
+            timer_lt(ts->timer_heap[child + 1], ts->timer_heap[child]))
+            child++;
+        if (!timer_lt(ts->timer_heap[child], th))
+            break;
+        timer_heap_set(ts, i, ts->timer_heap[child]);
+        i = child;
+    }
+    timer_heap_set(ts, i, th);
+}
+
+static int timer_hash_resize(JSContext *ctx, JSThreadState *ts)
+{
+    JSOSTimer **tab, *th, *th_next;
+    int i, new_size;
+
+    new_size = max_int(16, ts->timer_hash_size * 2);
+    tab = js_mallocz(ctx, sizeof(tab[0]) * new_size);
+    if (!tab)
+        return -1;
+    for(i = 0; i < ts->timer_hash_size; i++) {
+        for(th = ts->timer_hash[i]; th != NULL; th = th_next) {
+            th_next = th->hash_next;
+            th->hash_next = tab[th->timer_id & (new_size - 1)];
+            tab[th->timer_id & (new_size - 1)] = th;
+        }
+    }
+    js_free(ctx, ts->timer_hash);
+    ts->timer_hash = tab;
+    ts->timer_hash_size = new_size;
+    return 0;
+}
+
+/* 'th' must have its timer_id and timeout set */
+static int add_timer(JSContext *ctx, JSThreadState *ts, JSOSTimer *th)
+{
+    JSOSTimer **pth;
+
+    if (ts->timer_count == ts->timer_heap_size) {
+        int new_size = max_int(16, ts->timer_heap_size * 3 / 2);
+        JSOSTimer **heap = js_realloc(ctx, ts->timer_heap,
+                                      sizeof(heap[0]) * new_size);
+        if (!heap)
+            return -1;
+        ts->timer_heap = heap;
+        ts->timer_heap_size = new_size;
+    }
+    if (th->timer_id > 0) {
+        /* a failed resize only makes the chains longer */
+        if (ts->timer_hash_count >= ts->timer_hash_size &&
+            timer_hash_resize(ctx, ts) < 0 && ts->timer_hash_size == 0)
+            return -1;
+        pth = &ts->timer_hash[th->timer_id & (ts->timer_hash_size - 1)];
+        th->hash_next = *pth;
+        *pth = th;
+        ts->timer_hash_count++;
+    }
+    th->seq = ts->next_timer_seq++;
+    timer_heap_set(ts, ts->timer_count++, th);
+    timer_heap_up(ts, th->heap_index);
+    return 0;
+}
+
 static void free_timer(JSRuntime *rt, JSOSTimer *th)
 {
-    list_del(&th->link);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    JSOSTimer **pth, *last;
+
+    last = ts->timer_heap[--ts->timer_count];
+    if (last != th) {
+        timer_heap_set(ts, th->heap_index, last);
+        timer_heap_down(ts, last->heap_index);
+        timer_heap_up(ts, last->heap_index);
+    }
+    if (th->timer_id > 0) {
+        pth = &ts->timer_hash[th->timer_id & (ts->timer_hash_size - 1)];
+        while (*pth != th)
+            pth = &(*pth)->hash_next;
+        *pth = th->hash_next;
+        ts->timer_hash_count--;
+    }
     JS_FreeValueRT(rt, th->func);
     js_free_rt(rt, th);
 }
@@ -2058,18 +2465,21 @@ static JSValue js_os_setTimeout(JSContext *ctx, JSValueConst this_val,
     else
         ts->next_timer_id++;
     th->timeout = get_time_ms() + delay;
+    if (add_timer(ctx, ts, th)) {
+        js_free(ctx, th);
+        return JS_EXCEPTION;
+    }
     th->func = JS_DupValue(ctx, func);
-    list_add_tail(&th->link, &ts->os_timers);
     return JS_NewInt32(ctx, th->timer_id);
 }
 
 static JSOSTimer *find_timer_by_id(JSThreadState *ts, int timer_id)
 {
-    struct list_head *el;
-    if (timer_id <= 0)
+    JSOSTimer *th;
+    if (timer_id <= 0 || ts->timer_hash_size == 0)
         return NULL;
-    list_for_each(el, &ts->os_timers) {
-        JSOSTimer *th = list_entry(el, JSOSTimer, link);
+    for(th = ts->timer_hash[timer_id & (ts->timer_hash_size - 1)];
+        th != NULL; th = th->hash_next) {
         if (th->timer_id == timer_id)
             return th;
     }
@@ -2118,13 +2528,28 @@ static JSValue js_os_sleepAsync(JSContext *ctx, JSValueConst this_val,
     }
     th->timer_id = -1;
     th->timeout = get_time_ms() + delay;
+    if (add_timer(ctx, ts, th)) {
+        js_free(ctx, th);
+        JS_FreeValue(ctx, promise);
+        JS_FreeValue(ctx, resolving_funcs[0]);
+        JS_FreeValue(ctx, resolving_funcs[1]);
+        return JS_EXCEPTION;
+    }
     th->func = JS_DupValue(ctx, resolving_funcs[0]);
-    list_add_tail(&th->link, &ts->os_timers);
     JS_FreeValue(ctx, resolving_funcs[0]);
     JS_FreeValue(ctx, resolving_funcs[1]);
     return promise;
 }
 
+/* dump the exception of a callback or a job. It is reported by
+   js_std_loop(). */
+static void js_std_dump_loop_error(JSContext *ctx)
+{
+    JSThreadState *ts = JS_GetRuntimeOpaque(JS_GetRuntime(ctx));
+    ts->loop_error = TRUE;
+    js_std_dump_error(ctx);
+}
+
 static void call_handler(JSContext *ctx, JSValueConst func)
 {
     JSValue ret, func1;
@@ -2134,10 +2559,68 @@ static void call_handler(JSContext *ctx, JSValueConst func)
     ret = JS_Call(ctx, func1, JS_UNDEFINED, 0, NULL);
     JS_FreeValue(ctx, func1);
     if (JS_IsException(ret))
-        js_std_dump_error(ctx);
+        js_std_dump_loop_error(ctx);
     JS_FreeValue(ctx, ret);
 }
 
+/* execute all the pending jobs. Return the number of executed jobs. */
+static int js_std_run_jobs(JSRuntime *rt)
+{
+    JSContext *ctx1;
+    int n, total = 0;
+
+    for(;;) {
+        n = JS_ExecutePendingJobs(rt, 0, 0, &ctx1);
+        if (n >= 0) {
+            total += n;
+            break;
+        }
+        js_std_dump_loop_error(ctx1);
+        total++;
+    }
+    return total;
+}
+
+/* Call all the timers which are expired at the start of the tick.
+   Return TRUE if at least one was called. Otherwise '*pmin_delay' is
+   set to the delay in ms until the next timer (-1 if none). */
+static BOOL run_timers(JSContext *ctx, JSThreadState *ts, int *pmin_delay)
+{
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSOSTimer *th;
+    JSValue func;
+    int64_t cur_time, delay;
+    uint64_t seq_end;
+    BOOL called = FALSE;
+
+    if (ts->timer_count == 0) {
+        *pmin_delay = -1;
+        return FALSE;
+    }
+    cur_time = get_time_ms();
+    /* the timers created by the handlers are for the next tick */
+    seq_end = ts->next_timer_seq;
+    while (ts->timer_count != 0) {
+        th = ts->timer_heap[0];
+        if (th->timeout > cur_time || th->seq >= seq_end)
+            break;
+        func = th->func;
+        th->func = JS_UNDEFINED;
+        free_timer(rt, th);
+        call_handler(ctx, func);
+        JS_FreeValue(ctx, func);
+        called = TRUE;
+        /* execute the pending jobs before the next handler, as
+           js_std_loop() does between two ticks */
+        js_std_run_jobs(rt);
+    }
+    if (!called) {
+        delay = ts->timer_heap[0]->timeout - cur_time;
+        *pmin_delay = delay < 10000 ? delay : 10000;
+    }
+    return called;
+}
+
 #if defined(_WIN32)
 
 static int js_os_poll(JSContext *ctx)
@@ -2145,38 +2628,17 @@ static int js_os_poll(JSContext *ctx)
     JSRuntime *rt = JS_GetRuntime(ctx);
     JSThreadState *ts = JS_GetRuntimeOpaque(rt);
     int min_delay, console_fd;
-    int64_t cur_time, delay;
     JSOSRWHandler *rh;
     struct list_head *el;
 
     /* XXX: handle signals if useful */
 
-    if (list_empty(&ts->os_rw_handlers) && list_empty(&ts->os_timers))
+    if (list_empty(&ts->os_rw_handlers) && ts->timer_count == 0)
         return -1; /* no more events */
 
     /* XXX: only timers and basic console input are supported */
-    if (!list_empty(&ts->os_timers)) {
-        cur_time = get_time_ms();
-        min_delay = 10000;
-        list_for_each(el, &ts->os_timers) {
-            JSOSTimer *th = list_entry(el, JSOSTimer, link);
-            delay = th->timeout - cur_time;
-            if (delay <= 0) {
-                JSValue func;
-                /* the timer expired */
-                func = th->func;
-                th->func = JS_UNDEFINED;
-                free_timer(rt, th);
-                call_handler(ctx, func);
-                JS_FreeValue(ctx, func);
-                return 0;
-            } else if (delay < min_delay) {
-                min_delay = delay;
-            }
-        }
-    } else {
-        min_delay = -1;
-    }
+    if (run_timers(ctx, ts, &min_delay))
+        return 0;
 
     console_fd = -1;
     list_for_each(el, &ts->os_rw_handlers) {
@@ -2216,41 +2678,62 @@ static int js_os_poll(JSContext *ctx)
 #ifdef USE_WORKER
 
 static void js_free_message(JSWorkerMessage *msg);
+static JSWorkerMessagePipe *js_dup_message_pipe(JSWorkerMessagePipe *ps);
+static void js_free_message_pipe(JSWorkerMessagePipe *ps);
+static void js_pipe_signal(JSWorkerMessagePipe *ps);
+static void js_pipe_take_messages(JSWorkerMessagePipe *ps);
+static int handle_io_completions(JSRuntime *rt, JSThreadState *ts);
+
+/* the first port handling the messages of 'ps' */
+static JSWorkerMessageHandler *find_port(JSThreadState *ts,
+                                         JSWorkerMessagePipe *ps)
+{
+    struct list_head *el;
+    list_for_each(el, &ts->port_list) {
+        JSWorkerMessageHandler *port = list_entry(el, JSWorkerMessageHandler, link);
+        if (port->recv_pipe == ps && !JS_IsNull(port->on_message_func))
+            return port;
+    }
+    return NULL;
+}
 
-/* return 1 if a message was handled, 0 if no message */
+/* handle all the messages received by the pipe of 'port'. Return 1 if
+   at least one message was handled, 0 if no message */
 static int handle_posted_message(JSRuntime *rt, JSContext *ctx,
                                  JSWorkerMessageHandler *port)
 {
-    JSWorkerMessagePipe *ps = port->recv_pipe;
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    JSWorkerMessagePipe *ps;
     int ret;
     struct list_head *el;
     JSWorkerMessage *msg;
     JSValue obj, data_obj, func, retval;
 
-    pthread_mutex_lock(&ps->mutex);
-    if (!list_empty(&ps->msg_queue)) {
+    /* the handlers may free the port */
+    ps = js_dup_message_pipe(port->recv_pipe);
+    js_pipe_take_messages(ps);
+    ret = 0;
+    while (!list_empty(&ps->msg_queue)) {
+        if (ret) {
+            /* execute the pending jobs between two messages, as
+               between two calls of js_os_poll() */
+            js_std_run_jobs(rt);
+        }
+        port = find_port(ts, ps);
+        if (!port) {
+            /* keep the messages for the next handler */
+            js_pipe_signal(ps);
+            break;
+        }
         el = ps->msg_queue.next;
         msg = list_entry(el, JSWorkerMessage, link);
 
         /* remove the message from the queue */
         list_del(&msg->link);
 
-        if (list_empty(&ps->msg_queue)) {
-            uint8_t buf[16];
-            int ret;
-            for(;;) {
-                ret = read(ps->read_fd, buf, sizeof(buf));
-                if (ret >= 0)
-                    break;
-                if (errno != EAGAIN && errno != EINTR)
-                    break;
-            }
-        }
-
-        pthread_mutex_unlock(&ps->mutex);
-
-        data_obj = JS_ReadObject(ctx, msg->data, msg->data_len,
-                                 JS_READ_OBJ_SAB | JS_READ_OBJ_REFERENCE);
+        data_obj = JS_ReadObjectTransfer(ctx, msg->data, msg->data_len,
+                                         JS_READ_OBJ_SAB | JS_READ_OBJ_REFERENCE,
+                                         msg->transfer_tab, msg->transfer_len);
 
         js_free_message(msg);
 
@@ -2271,15 +2754,13 @@ static int handle_posted_message(JSRuntime *rt, JSContext *ctx,
         JS_FreeValue(ctx, func);
         if (JS_IsException(retval)) {
         fail:
-            js_std_dump_error(ctx);
+            js_std_dump_loop_error(ctx);
         } else {
             JS_FreeValue(ctx, retval);
         }
         ret = 1;
-    } else {
-        pthread_mutex_unlock(&ps->mutex);
-        ret = 0;
     }
+    js_free_message_pipe(ps);
     return ret;
 }
 #else
@@ -2288,6 +2769,121 @@ static int handle_posted_message(JSRuntime *rt, JSContext *ctx,
 {
     return 0;
 }
+
+static int handle_io_completions(JSRuntime *rt, JSThreadState *ts)
+{
+    return 0;
+}
+#endif
+
+#ifdef USE_EPOLL
+/* call the handler of an fd returned by epoll_wait(). Return 1 if a
+   handler was called. */
+static int os_poll_dispatch(JSRuntime *rt, JSContext *ctx, JSThreadState *ts,
+                            const struct epoll_event *ev)
+{
+    JSOSRWHandler *rh;
+    struct list_head *el;
+    int fd = ev->data.fd;
+
+    if (ts->io_queue && fd == ts->io_queue->read_fd)
+        return handle_io_completions(rt, ts);
+    /* the handler may have been removed or replaced since epoll_wait() */
+    rh = find_rh(ts, fd);
+    if (rh) {
+        if (!JS_IsNull(rh->rw_func[0]) &&
+            (ev->events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+            call_handler(ctx, rh->rw_func[0]);
+            return 1;
+        }
+        if (!JS_IsNull(rh->rw_func[1]) &&
+            (ev->events & (EPOLLOUT | EPOLLERR))) {
+            call_handler(ctx, rh->rw_func[1]);
+            return 1;
+        }
+        return 0;
+    }
+    list_for_each(el, &ts->port_list) {
+        JSWorkerMessageHandler *port = list_entry(el, JSWorkerMessageHandler, link);
+        if (!JS_IsNull(port->on_message_func) &&
+            port->recv_pipe->read_fd == fd) {
+            if (handle_posted_message(rt, ctx, port))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* update the events of an fd returned by a previous epoll_wait().
+   Return FALSE if it is no longer ready. */
+static BOOL os_poll_check(struct epoll_event *ev)
+{
+    struct pollfd pfd;
+
+    pfd.fd = ev->data.fd;
+    pfd.events = 0;
+    if (ev->events & EPOLLIN)
+        pfd.events |= POLLIN;
+    if (ev->events & EPOLLOUT)
+        pfd.events |= POLLOUT;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) <= 0)
+        return FALSE;
+    ev->events = 0;
+    if (pfd.revents & POLLIN)
+        ev->events |= EPOLLIN;
+    if (pfd.revents & POLLOUT)
+        ev->events |= EPOLLOUT;
+    if (pfd.revents & POLLERR)
+        ev->events |= EPOLLERR;
+    if (pfd.revents & POLLHUP)
+        ev->events |= EPOLLHUP;
+    /* POLLNVAL: the fd was closed */
+    return ev->events != 0;
+}
+
+static void os_poll_epoll(JSRuntime *rt, JSContext *ctx, JSThreadState *ts,
+                          int timeout)
+{
+    struct list_head *el;
+    struct epoll_event *ev;
+    BOOL is_new;
+    int ret;
+
+    is_new = FALSE;
+    if (ts->poll_event_pos >= ts->poll_event_count) {
+        ret = epoll_wait(ts->epoll_fd, ts->poll_events,
+                         countof(ts->poll_events),
+                         ts->always_ready_count != 0 ? 0 : timeout);
+        ts->poll_event_pos = 0;
+        ts->poll_event_count = max_int(ret, 0);
+        is_new = TRUE;
+    }
+    while (ts->poll_event_pos < ts->poll_event_count) {
+        ev = &ts->poll_events[ts->poll_event_pos++];
+        /* the events are level triggered, so the skipped ones are
+           returned again by the next epoll_wait() if still ready */
+        if (ev->events == 0 || (!is_new && !os_poll_check(ev)))
+            continue;
+        if (os_poll_dispatch(rt, ctx, ts, ev))
+            return;
+    }
+
+    if (ts->always_ready_count != 0) {
+        list_for_each(el, &ts->os_rw_handlers) {
+            JSOSRWHandler *rh = list_entry(el, JSOSRWHandler, link);
+            if (rh->always_ready) {
+                /* move it to the end so that the other always ready
+                   handlers are called next */
+                list_del(&rh->link);
+                list_add_tail(&rh->link, &ts->os_rw_handlers);
+                call_handler(ctx, JS_IsNull(rh->rw_func[0]) ?
+                             rh->rw_func[1] : rh->rw_func[0]);
+                return;
+            }
+        }
+    }
+}
 #endif
 
 static int js_os_poll(JSContext *ctx)
@@ -2295,12 +2891,14 @@ static int js_os_poll(JSContext *ctx)
     JSRuntime *rt = JS_GetRuntime(ctx);
     JSThreadState *ts = JS_GetRuntimeOpaque(rt);
     int ret, fd_max, min_delay;
-    int64_t cur_time, delay;
     fd_set rfds, wfds;
     JSOSRWHandler *rh;
     struct list_head *el;
     struct timeval tv, *tvp;
 
+    if (os_poll_hook)
+        os_poll_hook(rt);
+
     /* only check signals in the main thread */
     if (!ts->recv_pipe &&
         unlikely(os_pending_signals != 0)) {
@@ -2318,29 +2916,13 @@ static int js_os_poll(JSContext *ctx)
         }
     }
 
-    if (list_empty(&ts->os_rw_handlers) && list_empty(&ts->os_timers) &&
-        list_empty(&ts->port_list))
+    if (list_empty(&ts->os_rw_handlers) && ts->timer_count == 0 &&
+        list_empty(&ts->port_list) && ts->io_pending_count == 0)
         return -1; /* no more events */
 
-    if (!list_empty(&ts->os_timers)) {
-        cur_time = get_time_ms();
-        min_delay = 10000;
-        list_for_each(el, &ts->os_timers) {
-            JSOSTimer *th = list_entry(el, JSOSTimer, link);
-            delay = th->timeout - cur_time;
-            if (delay <= 0) {
-                JSValue func;
-                /* the timer expired */
-                func = th->func;
-                th->func = JS_UNDEFINED;
-                free_timer(rt, th);
-                call_handler(ctx, func);
-                JS_FreeValue(ctx, func);
-                return 0;
-            } else if (delay < min_delay) {
-                min_delay = delay;
-            }
-        }
+    if (run_timers(ctx, ts, &min_delay))
+        return 0;
+    if (min_delay >= 0) {
         tv.tv_sec = min_delay / 1000;
         tv.tv_usec = (min_delay % 1000) * 1000;
         tvp = &tv;
@@ -2348,6 +2930,13 @@ static int js_os_poll(JSContext *ctx)
         tvp = NULL;
     }
 
+#ifdef USE_EPOLL
+    if (os_poll_get_epoll(ts) >= 0) {
+        os_poll_epoll(rt, ctx, ts, min_delay);
+        return 0;
+    }
+#endif
+
     FD_ZERO(&rfds);
     FD_ZERO(&wfds);
     fd_max = -1;
@@ -2369,6 +2958,11 @@ static int js_os_poll(JSContext *ctx)
         }
     }
 
+    if (ts->io_pending_count != 0) {
+        fd_max = max_int(fd_max, ts->io_queue->read_fd);
+        FD_SET(ts->io_queue->read_fd, &rfds);
+    }
+
     ret = select(fd_max + 1, &rfds, &wfds, NULL, tvp);
     if (ret > 0) {
         list_for_each(el, &ts->os_rw_handlers) {
@@ -2397,6 +2991,11 @@ static int js_os_poll(JSContext *ctx)
                 }
             }
         }
+
+        if (ts->io_pending_count != 0 &&
+            FD_ISSET(ts->io_queue->read_fd, &rfds)) {
+            handle_io_completions(rt, ts);
+        }
     }
     done:
     return 0;
@@ -2894,13 +3493,50 @@ static int my_execvpe(const char *filename, char **argv, char **envp)
 }
 
 /* exec(args[, options]) -> exitcode */
-static JSValue js_os_exec(JSContext *ctx, JSValueConst this_val,
-                          int argc, JSValueConst *argv)
-{
-    JSValueConst options, args = argv[0];
-    JSValue val, ret_val;
-    const char **exec_argv, *file = NULL, *str, *cwd = NULL;
-    char **envp = environ;
+#ifdef USE_POSIX_SPAWN
+/* start the process with posix_spawn(), which does not copy the page
+   tables of the parent. Return -1 if posix_spawn() failed: fork() is
+   then used so that the errors are reported as with exec() (exit code
+   127). */
+static int js_os_spawn(const char *file, char **exec_argv, char **envp,
+                       const int *std_fds, const char *cwd, BOOL use_path)
+{
+    posix_spawn_file_actions_t fa;
+    pid_t pid;
+    int i, ret;
+
+    if (posix_spawn_file_actions_init(&fa))
+        return -1;
+    ret = 0;
+    /* same actions as in the child after fork() */
+    for(i = 0; i < 3 && ret == 0; i++) {
+        if (std_fds[i] != i)
+            ret = posix_spawn_file_actions_adddup2(&fa, std_fds[i], i);
+    }
+    if (ret == 0)
+        ret = posix_spawn_file_actions_addclosefrom_np(&fa, 3);
+    if (ret == 0 && cwd)
+        ret = posix_spawn_file_actions_addchdir_np(&fa, cwd);
+    if (ret == 0) {
+        if (use_path)
+            ret = posix_spawnp(&pid, file, &fa, NULL, exec_argv, envp);
+        else
+            ret = posix_spawn(&pid, file, &fa, NULL, exec_argv, envp);
+    }
+    posix_spawn_file_actions_destroy(&fa);
+    if (ret != 0)
+        return -1;
+    return pid;
+}
+#endif
+
+static JSValue js_os_exec(JSContext *ctx, JSValueConst this_val,
+                          int argc, JSValueConst *argv)
+{
+    JSValueConst options, args = argv[0];
+    JSValue val, ret_val;
+    const char **exec_argv, *file = NULL, *str, *cwd = NULL, *exec_file;
+    char **envp = environ;
     uint32_t exec_argc, i;
     int ret, pid, status;
     BOOL block_flag = TRUE, use_path = TRUE;
@@ -3012,7 +3648,17 @@ static JSValue js_os_exec(JSContext *ctx, JSValueConst this_val,
         }
     }
 
-    pid = fork();
+    exec_file = file ? file : exec_argv[0];
+    pid = -1;
+#ifdef USE_POSIX_SPAWN
+    /* setuid() and setgid() need fork() */
+    if (uid == -1 && gid == -1) {
+        pid = js_os_spawn(exec_file, (char **)exec_argv, envp, std_fds, cwd,
+                          use_path);
+    }
+#endif
+    if (pid < 0)
+        pid = fork();
     if (pid < 0) {
         JS_ThrowTypeError(ctx, "fork error");
         goto exception;
@@ -3062,12 +3708,10 @@ static JSValue js_os_exec(JSContext *ctx, JSValueConst this_val,
                 _exit(127);
         }
 
-        if (!file)
-            file = exec_argv[0];
         if (use_path)
-            ret = my_execvpe(file, (char **)exec_argv, envp);
+            ret = my_execvpe(exec_file, (char **)exec_argv, envp);
         else
-            ret = execve(file, (char **)exec_argv, envp);
+            ret = execve(exec_file, (char **)exec_argv, envp);
         _exit(127);
     }
     /* parent */
@@ -3204,6 +3848,364 @@ static JSValue js_os_dup2(JSContext *ctx, JSValueConst this_val,
     return JS_NewInt32(ctx, ret);
 }
 
+/* sockets */
+
+#if !defined(__linux__)
+static void js_os_set_nonblock(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#if defined(SO_NOSIGPIPE)
+    {
+        int v = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &v, sizeof(v));
+    }
+#endif
+}
+#endif
+
+/* convert {family, address, port} or {path} to a socket address. The
+   family is deduced from the other properties if absent. */
+static int js_os_get_sockaddr(JSContext *ctx, struct sockaddr_storage *ss,
+                              socklen_t *plen, JSValueConst obj)
+{
+    JSValue val;
+    const char *str;
+    int family, port, ret;
+
+    if (!JS_IsObject(obj)) {
+        JS_ThrowTypeError(ctx, "socket address must be an object");
+        return -1;
+    }
+    memset(ss, 0, sizeof(*ss));
+
+    val = JS_GetPropertyStr(ctx, obj, "path");
+    if (JS_IsException(val))
+        return -1;
+    if (!JS_IsUndefined(val)) {
+        struct sockaddr_un *sa_un = (struct sockaddr_un *)ss;
+        size_t len;
+        str = JS_ToCStringLen(ctx, &len, val);
+        JS_FreeValue(ctx, val);
+        if (!str)
+            return -1;
+        if (len >= sizeof(sa_un->sun_path)) {
+            JS_FreeCString(ctx, str);
+            JS_ThrowRangeError(ctx, "socket path is too long");
+            return -1;
+        }
+        sa_un->sun_family = AF_UNIX;
+        memcpy(sa_un->sun_path, str, len + 1);
+        JS_FreeCString(ctx, str);
+        *plen = offsetof(struct sockaddr_un, sun_path) + len + 1;
+        return 0;
+    }
+
+    val = JS_GetPropertyStr(ctx, obj, "address");
+    if (JS_IsException(val))
+        return -1;
+    if (JS_IsUndefined(val)) {
+        str = NULL;
+    } else {
+        str = JS_ToCString(ctx, val);
+        JS_FreeValue(ctx, val);
+        if (!str)
+            return -1;
+    }
+    val = JS_GetPropertyStr(ctx, obj, "family");
+    if (JS_IsException(val)) {
+        goto fail;
+    } else if (JS_IsUndefined(val)) {
+        family = (str && strchr(str, ':')) ? AF_INET6 : AF_INET;
+    } else {
+        ret = JS_ToInt32(ctx, &family, val);
+        JS_FreeValue(ctx, val);
+        if (ret)
+            goto fail;
+    }
+    val = JS_GetPropertyStr(ctx, obj, "port");
+    ret = JS_ToInt32(ctx, &port, val);
+    JS_FreeValue(ctx, val);
+    if (ret)
+        goto fail;
+    if (port < 0 || port > 65535) {
+        JS_ThrowRangeError(ctx, "invalid port");
+        goto fail;
+    }
+
+    if (family == AF_INET) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        ret = str ? inet_pton(AF_INET, str, &sin->sin_addr) : 1;
+        *plen = sizeof(*sin);
+    } else if (family == AF_INET6) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        ret = str ? inet_pton(AF_INET6, str, &sin6->sin6_addr) : 1;
+        *plen = sizeof(*sin6);
+    } else {
+        JS_ThrowRangeError(ctx, "unsupported address family");
+        goto fail;
+    }
+    if (ret != 1) {
+        JS_ThrowTypeError(ctx, "invalid address");
+        goto fail;
+    }
+    JS_FreeCString(ctx, str);
+    return 0;
+ fail:
+    JS_FreeCString(ctx, str);
+    return -1;
+}
+
+static JSValue js_os_new_sockaddr(JSContext *ctx, const struct sockaddr *sa,
+                                  socklen_t len)
+{
+    JSValue obj;
+    char buf[INET6_ADDRSTRLEN];
+    int port;
+
+    obj = JS_NewObject(ctx);
+    if (JS_IsException(obj))
+        return obj;
+    JS_DefinePropertyValueStr(ctx, obj, "family",
+                              JS_NewInt32(ctx, sa->sa_family),
+                              JS_PROP_C_W_E);
+    switch(sa->sa_family) {
+    case AF_UNIX:
+        {
+            const struct sockaddr_un *sa_un = (const struct sockaddr_un *)sa;
+            size_t path_len;
+            /* unnamed sockets have no path */
+            path_len = 0;
+            if (len > offsetof(struct sockaddr_un, sun_path))
+                path_len = strnlen(sa_un->sun_path, len - offsetof(struct sockaddr_un, sun_path));
+            JS_DefinePropertyValueStr(ctx, obj, "path",
+                                      JS_NewStringLen(ctx, sa_un->sun_path, path_len),
+                                      JS_PROP_C_W_E);
+        }
+        break;
+    case AF_INET:
+        {
+            const struct sockaddr_in *sin = (const struct sockaddr_in *)sa;
+            inet_ntop(AF_INET, &sin->sin_addr, buf, sizeof(buf));
+            port = ntohs(sin->sin_port);
+            goto set_inet;
+        }
+    case AF_INET6:
+        {
+            const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)sa;
+            inet_ntop(AF_INET6, &sin6->sin6_addr, buf, sizeof(buf));
+            port = ntohs(sin6->sin6_port);
+        }
+    set_inet:
+        JS_DefinePropertyValueStr(ctx, obj, "address",
+                                  JS_NewString(ctx, buf), JS_PROP_C_W_E);
+        JS_DefinePropertyValueStr(ctx, obj, "port", JS_NewInt32(ctx, port),
+                                  JS_PROP_C_W_E);
+        break;
+    }
+    return obj;
+}
+
+/* socket(domain, type, protocol = 0): return a nonblocking socket */
+static JSValue js_os_socket(JSContext *ctx, JSValueConst this_val,
+                            int argc, JSValueConst *argv)
+{
+    int domain, type, protocol, fd;
+
+    if (JS_ToInt32(ctx, &domain, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &type, argv[1]))
+        return JS_EXCEPTION;
+    protocol = 0;
+    if (argc >= 3 && JS_ToInt32(ctx, &protocol, argv[2]))
+        return JS_EXCEPTION;
+#if defined(__linux__)
+    fd = socket(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+#else
+    fd = socket(domain, type, protocol);
+    if (fd >= 0)
+        js_os_set_nonblock(fd);
+#endif
+    return JS_NewInt32(ctx, js_get_errno(fd));
+}
+
+/* bind(fd, addr) and connect(fd, addr) */
+static JSValue js_os_bind_connect(JSContext *ctx, JSValueConst this_val,
+                                  int argc, JSValueConst *argv, int magic)
+{
+    struct sockaddr_storage ss;
+    socklen_t len;
+    int fd, ret;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (js_os_get_sockaddr(ctx, &ss, &len, argv[1]))
+        return JS_EXCEPTION;
+    if (magic) {
+        ret = connect(fd, (struct sockaddr *)&ss, len);
+        /* connect() must not be restarted after EINTR: the connection
+           continues asynchronously as with EINPROGRESS */
+        if (ret < 0 && errno == EINTR)
+            errno = EINPROGRESS;
+    } else {
+        ret = bind(fd, (struct sockaddr *)&ss, len);
+    }
+    return JS_NewInt32(ctx, js_get_errno(ret));
+}
+
+/* listen(fd, backlog = SOMAXCONN) */
+static JSValue js_os_listen(JSContext *ctx, JSValueConst this_val,
+                            int argc, JSValueConst *argv)
+{
+    int fd, backlog;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    backlog = SOMAXCONN;
+    if (argc >= 2 && !JS_IsUndefined(argv[1]) &&
+        JS_ToInt32(ctx, &backlog, argv[1]))
+        return JS_EXCEPTION;
+    return JS_NewInt32(ctx, js_get_errno(listen(fd, backlog)));
+}
+
+/* accept(fd): return a nonblocking socket or -EAGAIN if no connection
+   is pending */
+static JSValue js_os_accept(JSContext *ctx, JSValueConst this_val,
+                            int argc, JSValueConst *argv)
+{
+    int fd, ret;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    for(;;) {
+#if defined(__linux__)
+        ret = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        ret = accept(fd, NULL, NULL);
+        if (ret >= 0)
+            js_os_set_nonblock(ret);
+#endif
+        if (ret >= 0 || errno != EINTR)
+            break;
+    }
+    return JS_NewInt32(ctx, js_get_errno(ret));
+}
+
+/* getsockname(fd) and getpeername(fd): return [addr, err] */
+static JSValue js_os_getsockname(JSContext *ctx, JSValueConst this_val,
+                                 int argc, JSValueConst *argv, int magic)
+{
+    struct sockaddr_storage ss;
+    socklen_t len;
+    int fd, ret;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    len = sizeof(ss);
+    memset(&ss, 0, sizeof(ss));
+    if (magic)
+        ret = getpeername(fd, (struct sockaddr *)&ss, &len);
+    else
+        ret = getsockname(fd, (struct sockaddr *)&ss, &len);
+    if (ret < 0)
+        return make_obj_error(ctx, JS_NULL, errno);
+    return make_obj_error(ctx, js_os_new_sockaddr(ctx, (struct sockaddr *)&ss, len), 0);
+}
+
+/* shutdown(fd, how) */
+static JSValue js_os_shutdown(JSContext *ctx, JSValueConst this_val,
+                              int argc, JSValueConst *argv)
+{
+    int fd, how;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &how, argv[1]))
+        return JS_EXCEPTION;
+    return JS_NewInt32(ctx, js_get_errno(shutdown(fd, how)));
+}
+
+/* setsockopt(fd, level, name, value) with an integer value */
+static JSValue js_os_setsockopt(JSContext *ctx, JSValueConst this_val,
+                                int argc, JSValueConst *argv)
+{
+    int fd, level, name, val;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &level, argv[1]))
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &name, argv[2]))
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &val, argv[3]))
+        return JS_EXCEPTION;
+    return JS_NewInt32(ctx, js_get_errno(setsockopt(fd, level, name,
+                                                    &val, sizeof(val))));
+}
+
+/* getsockopt(fd, level, name): return [value, err] */
+static JSValue js_os_getsockopt(JSContext *ctx, JSValueConst this_val,
+                                int argc, JSValueConst *argv)
+{
+    int fd, level, name, val;
+    socklen_t len;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &level, argv[1]))
+        return JS_EXCEPTION;
+    if (JS_ToInt32(ctx, &name, argv[2]))
+        return JS_EXCEPTION;
+    val = 0;
+    len = sizeof(val);
+    if (getsockopt(fd, level, name, &val, &len) < 0)
+        return make_obj_error(ctx, JS_NULL, errno);
+    return make_obj_error(ctx, JS_NewInt32(ctx, val), 0);
+}
+
+/* recv(fd, buffer, offset, length) and send(fd, buffer, offset,
+   length). Unlike write(), send() does not raise SIGPIPE if the
+   connection is closed. */
+static JSValue js_os_send_recv(JSContext *ctx, JSValueConst this_val,
+                               int argc, JSValueConst *argv, int magic)
+{
+    int fd, flags;
+    uint64_t pos, len;
+    size_t size;
+    ssize_t ret;
+    uint8_t *buf;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToIndex(ctx, &pos, argv[2]))
+        return JS_EXCEPTION;
+    if (JS_ToIndex(ctx, &len, argv[3]))
+        return JS_EXCEPTION;
+    buf = JS_GetArrayBuffer(ctx, &size, argv[1]);
+    if (!buf)
+        return JS_EXCEPTION;
+    if (pos + len > size)
+        return JS_ThrowRangeError(ctx, "read/write array buffer overflow");
+    flags = 0;
+#if defined(MSG_NOSIGNAL)
+    if (magic)
+        flags |= MSG_NOSIGNAL;
+#endif
+    for(;;) {
+        if (magic)
+            ret = send(fd, buf + pos, len, flags);
+        else
+            ret = recv(fd, buf + pos, len, flags);
+        if (ret >= 0 || errno != EINTR)
+            break;
+    }
+    return JS_NewInt64(ctx, js_get_errno(ret));
+}
+
 #endif /* !_WIN32 */
 
 #ifdef USE_WORKER
@@ -3266,28 +4268,125 @@ static void js_sab_dup(void *opaque, void *ptr)
     atomic_add_int(&sab->ref_count, 1);
 }
 
+/* create a signal: fds[0] becomes readable when fds[1] is signaled
+   (both are the same eventfd if available) */
+static int js_new_signal_fds(int fds[2])
+{
+#ifdef USE_EVENTFD
+    fds[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fds[0] < 0)
+        return -1;
+    fds[1] = fds[0];
+#else
+    if (pipe(fds) < 0)
+        return -1;
+    /* the receiver reads it only to reset the signal */
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+#endif
+    return 0;
+}
+
+static void js_close_signal_fds(int read_fd, int write_fd)
+{
+    close(read_fd);
+    if (write_fd != read_fd)
+        close(write_fd);
+}
+
+/* make the read end of the signal readable */
+static void js_signal_fd(int write_fd)
+{
+#ifdef USE_EVENTFD
+    uint64_t v = 1;
+#else
+    uint8_t v = 0;
+#endif
+    int ret;
+
+    for(;;) {
+        ret = write(write_fd, &v, sizeof(v));
+        if (ret >= 0 || errno != EINTR)
+            break;
+    }
+}
+
+static void js_reset_signal_fd(int read_fd)
+{
+    uint8_t buf[16];
+    int ret;
+
+    for(;;) {
+        ret = read(read_fd, buf, sizeof(buf));
+        if (ret >= 0 || errno != EINTR)
+            break;
+    }
+}
+
 static JSWorkerMessagePipe *js_new_message_pipe(void)
 {
     JSWorkerMessagePipe *ps;
     int pipe_fds[2];
 
-    if (pipe(pipe_fds) < 0)
+    if (js_new_signal_fds(pipe_fds) < 0)
         return NULL;
-
     ps = malloc(sizeof(*ps));
     if (!ps) {
-        close(pipe_fds[0]);
-        close(pipe_fds[1]);
+        js_close_signal_fds(pipe_fds[0], pipe_fds[1]);
         return NULL;
     }
     ps->ref_count = 1;
     init_list_head(&ps->msg_queue);
-    pthread_mutex_init(&ps->mutex, NULL);
+    atomic_init(&ps->msg_stack, NULL);
     ps->read_fd = pipe_fds[0];
     ps->write_fd = pipe_fds[1];
     return ps;
 }
 
+/* make read_fd readable */
+static void js_pipe_signal(JSWorkerMessagePipe *ps)
+{
+    js_signal_fd(ps->write_fd);
+}
+
+/* add a message to the pipe. Safe to call from any thread. */
+static void js_pipe_post(JSWorkerMessagePipe *ps, JSWorkerMessage *msg)
+{
+    JSWorkerMessage *head;
+
+    head = atomic_load_explicit(&ps->msg_stack, memory_order_relaxed);
+    do {
+        msg->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&ps->msg_stack, &head, msg,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+    /* only the first message wakes up the receiver: the next ones are
+       taken with it */
+    if (!head)
+        js_pipe_signal(ps);
+}
+
+/* move the posted messages to ps->msg_queue (receiving thread
+   only) */
+static void js_pipe_take_messages(JSWorkerMessagePipe *ps)
+{
+    JSWorkerMessage *msg, *next, *first;
+
+    /* reset the signal before emptying the stack: a message posted
+       after it signals again */
+    js_reset_signal_fd(ps->read_fd);
+    msg = atomic_exchange_explicit(&ps->msg_stack, NULL, memory_order_acquire);
+    /* the stack is in reverse order */
+    first = NULL;
+    while (msg) {
+        next = msg->next;
+        msg->next = first;
+        first = msg;
+        msg = next;
+    }
+    for(msg = first; msg; msg = msg->next)
+        list_add_tail(&msg->link, &ps->msg_queue);
+}
+
 static JSWorkerMessagePipe *js_dup_message_pipe(JSWorkerMessagePipe *ps)
 {
     atomic_add_int(&ps->ref_count, 1);
@@ -3302,6 +4401,11 @@ static void js_free_message(JSWorkerMessage *msg)
         js_sab_free(NULL, msg->sab_tab[i]);
     }
     free(msg->sab_tab);
+    /* the transferred buffers not owned by an ArrayBuffer */
+    for(i = 0; i < msg->transfer_len; i++) {
+        free(msg->transfer_tab[i].data);
+    }
+    free(msg->transfer_tab);
     free(msg->data);
     free(msg);
 }
@@ -3322,9 +4426,13 @@ static void js_free_message_pipe(JSWorkerMessagePipe *ps)
             msg = list_entry(el, JSWorkerMessage, link);
             js_free_message(msg);
         }
-        pthread_mutex_destroy(&ps->mutex);
-        close(ps->read_fd);
-        close(ps->write_fd);
+        msg = atomic_load(&ps->msg_stack);
+        while (msg) {
+            JSWorkerMessage *next = msg->next;
+            js_free_message(msg);
+            msg = next;
+        }
+        js_close_signal_fds(ps->read_fd, ps->write_fd);
         free(ps);
     }
 }
@@ -3332,9 +4440,17 @@ static void js_free_message_pipe(JSWorkerMessagePipe *ps)
 static void js_free_port(JSRuntime *rt, JSWorkerMessageHandler *port)
 {
     if (port) {
+#ifdef USE_EPOLL
+        /* NULL if the worker is finalized after js_std_free_handlers() */
+        JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+#endif
+        list_del(&port->link);
+#ifdef USE_EPOLL
+        if (ts)
+            os_poll_update_port(ts, port->recv_pipe->read_fd);
+#endif
         js_free_message_pipe(port->recv_pipe);
         JS_FreeValueRT(rt, port->on_message_func);
-        list_del(&port->link);
         js_free_rt(rt, port);
     }
 }
@@ -3526,17 +4642,27 @@ static JSValue js_worker_postMessage(JSContext *ctx, JSValueConst this_val,
 {
     JSWorkerData *worker = JS_GetOpaque2(ctx, this_val, js_worker_class_id);
     JSWorkerMessagePipe *ps;
-    size_t data_len, sab_tab_len, i;
+    size_t data_len, sab_tab_len, transfer_len, i;
     uint8_t *data;
     JSWorkerMessage *msg;
     uint8_t **sab_tab;
+    JSTransferBuffer *transfer_tab;
+    JSValueConst transfer;
 
     if (!worker)
         return JS_EXCEPTION;
 
-    data = JS_WriteObject2(ctx, &data_len, argv[0],
-                           JS_WRITE_OBJ_SAB | JS_WRITE_OBJ_REFERENCE,
-                           &sab_tab, &sab_tab_len);
+    /* the ArrayBuffers of the transfer list are moved without copy */
+    transfer = JS_UNDEFINED;
+    if (argc > 1 && !JS_IsUndefined(argv[1])) {
+        if (!JS_IsArray(ctx, argv[1]))
+            return JS_ThrowTypeError(ctx, "transfer list must be an array");
+        transfer = argv[1];
+    }
+    data = JS_WriteObjectTransfer(ctx, &data_len, argv[0],
+                                  JS_WRITE_OBJ_SAB | JS_WRITE_OBJ_REFERENCE,
+                                  transfer, &sab_tab, &sab_tab_len,
+                                  &transfer_tab, &transfer_len);
     if (!data)
         return JS_EXCEPTION;
 
@@ -3545,6 +4671,7 @@ static JSValue js_worker_postMessage(JSContext *ctx, JSValueConst this_val,
         goto fail;
     msg->data = NULL;
     msg->sab_tab = NULL;
+    msg->transfer_tab = NULL;
 
     /* must reallocate because the allocator may be different */
     msg->data = malloc(data_len);
@@ -3561,8 +4688,18 @@ static JSValue js_worker_postMessage(JSContext *ctx, JSValueConst this_val,
     }
     msg->sab_tab_len = sab_tab_len;
 
+    if (transfer_len > 0) {
+        msg->transfer_tab = malloc(sizeof(msg->transfer_tab[0]) * transfer_len);
+        if (!msg->transfer_tab)
+            goto fail;
+        memcpy(msg->transfer_tab, transfer_tab,
+               sizeof(msg->transfer_tab[0]) * transfer_len);
+    }
+    msg->transfer_len = transfer_len;
+
     js_free(ctx, data);
     js_free(ctx, sab_tab);
+    js_free(ctx, transfer_tab);
 
     /* increment the SAB reference counts */
     for(i = 0; i < msg->sab_tab_len; i++) {
@@ -3570,31 +4707,22 @@ static JSValue js_worker_postMessage(JSContext *ctx, JSValueConst this_val,
     }
 
     ps = worker->send_pipe;
-    pthread_mutex_lock(&ps->mutex);
-    /* indicate that data is present */
-    if (list_empty(&ps->msg_queue)) {
-        uint8_t ch = '\0';
-        int ret;
-        for(;;) {
-            ret = write(ps->write_fd, &ch, 1);
-            if (ret == 1)
-                break;
-            if (ret < 0 && (errno != EAGAIN || errno != EINTR))
-                break;
-        }
-    }
-    list_add_tail(&msg->link, &ps->msg_queue);
-    pthread_mutex_unlock(&ps->mutex);
+    js_pipe_post(ps, msg);
     return JS_UNDEFINED;
  fail:
     if (msg) {
         free(msg->data);
         free(msg->sab_tab);
+        free(msg->transfer_tab);
         free(msg);
     }
+    /* the transferred ArrayBuffers are already detached */
+    for(i = 0; i < transfer_len; i++)
+        free(transfer_tab[i].data);
     js_free(ctx, data);
     js_free(ctx, sab_tab);
-    return JS_EXCEPTION;
+    js_free(ctx, transfer_tab);
+    return JS_ThrowOutOfMemory(ctx);
 
 }
 
@@ -3629,6 +4757,9 @@ static JSValue js_worker_set_onmessage(JSContext *ctx, JSValueConst this_val,
         }
         JS_FreeValue(ctx, port->on_message_func);
         port->on_message_func = JS_DupValue(ctx, func);
+#ifdef USE_EPOLL
+        os_poll_update_port(ts, port->recv_pipe->read_fd);
+#endif
     }
     return JS_UNDEFINED;
 }
@@ -3652,8 +4783,620 @@ static const JSCFunctionListEntry js_worker_proto_funcs[] = {
     JS_CGETSET_DEF("onmessage", js_worker_get_onmessage, js_worker_set_onmessage ),
 };
 
+/* Asynchronous file I/O */
+
+/* maximum number of I/O threads, shared by all the runtimes */
+#define OS_IO_THREAD_MAX 4
+
+enum {
+    OS_IO_READ_FILE,
+    OS_IO_WRITE_FILE,
+    OS_IO_PREAD,
+    OS_IO_PWRITE,
+};
+
+static pthread_mutex_t os_io_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t os_io_cond = PTHREAD_COND_INITIALIZER;
+/* requests waiting for an I/O thread (list of JSOSIORequest.link) */
+static struct list_head os_io_requests = LIST_HEAD_INIT(os_io_requests);
+static int os_io_request_count; /* number of requests in os_io_requests */
+static int os_io_thread_count, os_io_idle_count;
+
+static JSOSIOQueue *js_new_io_queue(void)
+{
+    JSOSIOQueue *q;
+    int fds[2];
+
+    if (js_new_signal_fds(fds) < 0)
+        return NULL;
+    q = malloc(sizeof(*q));
+    if (!q) {
+        js_close_signal_fds(fds[0], fds[1]);
+        return NULL;
+    }
+    q->ref_count = 1;
+    atomic_init(&q->done_stack, NULL);
+    q->read_fd = fds[0];
+    q->write_fd = fds[1];
+    return q;
+}
+
+static void js_free_io_queue(JSOSIOQueue *q)
+{
+    int ref_count;
+
+    if (!q)
+        return;
+    ref_count = atomic_add_int(&q->ref_count, -1);
+    assert(ref_count >= 0);
+    if (ref_count == 0) {
+        /* no request can reference it */
+        js_close_signal_fds(q->read_fd, q->write_fd);
+        free(q);
+    }
+}
+
+static void os_io_free_request(JSOSIORequest *req)
+{
+    if (req->ctx) {
+        JS_FreeValue(req->ctx, req->resolving_funcs[0]);
+        JS_FreeValue(req->ctx, req->resolving_funcs[1]);
+        JS_FreeContext(req->ctx);
+    }
+    free(req->filename);
+    free(req->buf);
+    free(req);
+}
+
+/* read until 'len' bytes or the end of file */
+static ssize_t os_io_read_full(int fd, uint8_t *buf, size_t len, int64_t pos)
+{
+    size_t n;
+    ssize_t ret;
+
+    n = 0;
+    while (n < len) {
+        if (pos >= 0)
+            ret = pread(fd, buf + n, len - n, pos + n);
+        else
+            ret = read(fd, buf + n, len - n);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (ret == 0)
+            break;
+        n += ret;
+    }
+    return n;
+}
+
+static ssize_t os_io_write_full(int fd, const uint8_t *buf, size_t len,
+                                int64_t pos)
+{
+    size_t n;
+    ssize_t ret;
+
+    n = 0;
+    while (n < len) {
+        if (pos >= 0)
+            ret = pwrite(fd, buf + n, len - n, pos + n);
+        else
+            ret = write(fd, buf + n, len - n);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        n += ret;
+    }
+    return n;
+}
+
+static int64_t os_io_read_file(JSOSIORequest *req)
+{
+    struct stat st;
+    size_t size, len;
+    uint8_t *buf;
+    ssize_t ret;
+    int fd;
+
+    fd = open(req->filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    /* the size is only a hint: the file may change and some files
+       (e.g. in /proc) have no size */
+    size = 4096;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+        size = st.st_size + 1;
+    len = 0;
+    for(;;) {
+        buf = realloc(req->buf, size);
+        if (!buf) {
+            ret = -ENOMEM;
+            break;
+        }
+        req->buf = buf;
+        ret = os_io_read_full(fd, buf + len, size - len, -1);
+        if (ret < 0)
+            break;
+        len += ret;
+        if (len < size) {
+            ret = len;
+            break;
+        }
+        size = max_int64(size + size / 2, 4096);
+    }
+    close(fd);
+    req->len = len;
+    return ret;
+}
+
+static int64_t os_io_write_file(JSOSIORequest *req)
+{
+    ssize_t ret;
+    int fd;
+
+    fd = open(req->filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0)
+        return -errno;
+    ret = os_io_write_full(fd, req->buf, req->len, -1);
+    if (close(fd) < 0 && ret >= 0)
+        ret = -errno;
+    return ret;
+}
+
+static void os_io_execute(JSOSIORequest *req)
+{
+    switch(req->op) {
+    case OS_IO_READ_FILE:
+        req->result = os_io_read_file(req);
+        break;
+    case OS_IO_WRITE_FILE:
+        req->result = os_io_write_file(req);
+        break;
+    case OS_IO_PREAD:
+        req->result = os_io_read_full(req->fd, req->buf, req->len, req->pos);
+        if (req->result >= 0)
+            req->len = req->result;
+        break;
+    case OS_IO_PWRITE:
+        req->result = os_io_write_full(req->fd, req->buf, req->len, req->pos);
+        break;
+    default:
+        abort();
+    }
+}
+
+/* post a completed request to its queue. Safe to call from any
+   thread. */
+static void os_io_post(JSOSIORequest *req)
+{
+    JSOSIOQueue *q = req->queue;
+    JSOSIORequest *head;
+
+    /* 'req' may be freed by the receiver as soon as it is pushed */
+    head = atomic_load_explicit(&q->done_stack, memory_order_relaxed);
+    do {
+        req->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&q->done_stack, &head, req,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+    if (!head)
+        js_signal_fd(q->write_fd);
+    js_free_io_queue(q);
+}
+
+static void *os_io_thread(void *arg)
+{
+    JSOSIORequest *req;
+
+    pthread_mutex_lock(&os_io_mutex);
+    for(;;) {
+        while (list_empty(&os_io_requests)) {
+            os_io_idle_count++;
+            pthread_cond_wait(&os_io_cond, &os_io_mutex);
+            os_io_idle_count--;
+        }
+        req = list_entry(os_io_requests.next, JSOSIORequest, link);
+        list_del(&req->link);
+        os_io_request_count--;
+        pthread_mutex_unlock(&os_io_mutex);
+
+        os_io_execute(req);
+        os_io_post(req);
+
+        pthread_mutex_lock(&os_io_mutex);
+    }
+    return NULL;
+}
+
+static JSOSIORequest *os_io_new_request(JSContext *ctx, int op)
+{
+    JSOSIORequest *req;
+
+    req = malloc(sizeof(*req));
+    if (!req) {
+        JS_ThrowOutOfMemory(ctx);
+        return NULL;
+    }
+    memset(req, 0, sizeof(*req));
+    req->op = op;
+    req->fd = -1;
+    req->pos = -1;
+    return req;
+}
+
+/* queue 'req' for an I/O thread and return its promise. 'req' is
+   freed in case of exception. */
+static JSValue os_io_submit(JSContext *ctx, JSOSIORequest *req)
+{
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    JSValue promise;
+    pthread_t tid;
+    pthread_attr_t attr;
+    int ret;
+
+    if (!ts->io_queue) {
+        ts->io_queue = js_new_io_queue();
+        if (!ts->io_queue) {
+            os_io_free_request(req);
+            return JS_ThrowTypeError(ctx, "could not create the I/O queue");
+        }
+#ifdef USE_EPOLL
+        if (os_poll_get_epoll(ts) >= 0)
+            os_poll_update(ts, ts->io_queue->read_fd, EPOLLIN);
+#endif
+    }
+
+    promise = JS_NewPromiseCapability(ctx, req->resolving_funcs);
+    if (JS_IsException(promise)) {
+        os_io_free_request(req);
+        return JS_EXCEPTION;
+    }
+    req->ctx = JS_DupContext(ctx);
+
+    pthread_mutex_lock(&os_io_mutex);
+    /* start a new thread if all the idle ones will be busy */
+    if (os_io_request_count >= os_io_idle_count &&
+        os_io_thread_count < OS_IO_THREAD_MAX) {
+        pthread_attr_init(&attr);
+        /* no join at the end */
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        ret = pthread_create(&tid, &attr, os_io_thread, NULL);
+        pthread_attr_destroy(&attr);
+        if (ret == 0) {
+            os_io_thread_count++;
+        } else if (os_io_thread_count == 0) {
+            pthread_mutex_unlock(&os_io_mutex);
+            JS_FreeValue(ctx, promise);
+            os_io_free_request(req);
+            return JS_ThrowTypeError(ctx, "could not create I/O thread");
+        }
+    }
+    atomic_add_int(&ts->io_queue->ref_count, 1);
+    req->queue = ts->io_queue;
+    list_add_tail(&req->link, &os_io_requests);
+    os_io_request_count++;
+    if (os_io_idle_count != 0)
+        pthread_cond_signal(&os_io_cond);
+    pthread_mutex_unlock(&os_io_mutex);
+
+    ts->io_pending_count++;
+    return promise;
+}
+
+static void js_os_io_free_buffer(JSRuntime *rt, void *opaque, void *ptr)
+{
+    free(ptr);
+}
+
+static JSValue os_io_new_error(JSContext *ctx, int err)
+{
+    JSValue obj;
+
+    obj = JS_NewError(ctx);
+    if (JS_IsException(obj))
+        return obj;
+    JS_DefinePropertyValueStr(ctx, obj, "message",
+                              JS_NewString(ctx, strerror(err)),
+                              JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
+    JS_DefinePropertyValueStr(ctx, obj, "errno", JS_NewInt32(ctx, err),
+                              JS_PROP_C_W_E);
+    return obj;
+}
+
+/* resolve or reject the promise of a completed request */
+static void os_io_settle(JSOSIORequest *req)
+{
+    JSContext *ctx = req->ctx;
+    JSValue val, ret;
+    BOOL is_reject;
+
+    is_reject = (req->result < 0);
+    if (is_reject) {
+        val = os_io_new_error(ctx, -req->result);
+    } else if (req->op == OS_IO_READ_FILE || req->op == OS_IO_PREAD) {
+        /* the ArrayBuffer takes the data read without copy */
+        val = JS_NewArrayBuffer(ctx, req->buf, req->len,
+                                js_os_io_free_buffer, NULL, FALSE);
+        if (!JS_IsException(val))
+            req->buf = NULL;
+    } else {
+        val = JS_NewInt64(ctx, req->result);
+    }
+    if (JS_IsException(val)) {
+        val = JS_GetException(ctx);
+        is_reject = TRUE;
+    }
+    ret = JS_Call(ctx, req->resolving_funcs[is_reject], JS_UNDEFINED,
+                  1, (JSValueConst *)&val);
+    JS_FreeValue(ctx, val);
+    if (JS_IsException(ret))
+        js_std_dump_loop_error(ctx);
+    else
+        JS_FreeValue(ctx, ret);
+}
+
+/* take the completed requests, in completion order */
+static JSOSIORequest *os_io_take_completions(JSOSIOQueue *q)
+{
+    JSOSIORequest *req, *next, *first;
+
+    /* reset the signal before emptying the stack: a request posted
+       after it signals again */
+    js_reset_signal_fd(q->read_fd);
+    req = atomic_exchange_explicit(&q->done_stack, NULL, memory_order_acquire);
+    first = NULL;
+    while (req) {
+        next = req->next;
+        req->next = first;
+        first = req;
+        req = next;
+    }
+    return first;
+}
+
+/* settle the completed requests. Return 1 if at least one request was
+   completed. */
+static int handle_io_completions(JSRuntime *rt, JSThreadState *ts)
+{
+    JSOSIORequest *req, *next;
+    int ret;
+
+    ret = 0;
+    for(req = os_io_take_completions(ts->io_queue); req; req = next) {
+        next = req->next;
+        if (ret) {
+            /* execute the pending jobs between two completions, as
+               between two calls of js_os_poll() */
+            js_std_run_jobs(rt);
+        }
+        ts->io_pending_count--;
+        os_io_settle(req);
+        os_io_free_request(req);
+        ret = 1;
+    }
+    return ret;
+}
+
+/* cancel the requests of 'ts' which are not started and wait for the
+   others. The promises are not settled. */
+static void os_io_cancel_all(JSThreadState *ts)
+{
+    JSOSIOQueue *q = ts->io_queue;
+    JSOSIORequest *req, *next;
+    struct list_head *el, *el1;
+    struct pollfd pfd;
+
+    if (!q)
+        return;
+    pthread_mutex_lock(&os_io_mutex);
+    list_for_each_safe(el, el1, &os_io_requests) {
+        req = list_entry(el, JSOSIORequest, link);
+        if (req->queue == q) {
+            list_del(&req->link);
+            os_io_request_count--;
+            js_free_io_queue(q);
+            os_io_free_request(req);
+            ts->io_pending_count--;
+        }
+    }
+    pthread_mutex_unlock(&os_io_mutex);
+
+    while (ts->io_pending_count != 0) {
+        pfd.fd = q->read_fd;
+        pfd.events = POLLIN;
+        poll(&pfd, 1, -1);
+        for(req = os_io_take_completions(q); req; req = next) {
+            next = req->next;
+            ts->io_pending_count--;
+            os_io_free_request(req);
+        }
+    }
+    js_free_io_queue(q);
+    ts->io_queue = NULL;
+}
+
+/* get a copy of the contents of 'val' (string, ArrayBuffer or typed
+   array) in req->buf */
+static int os_io_get_data(JSContext *ctx, JSOSIORequest *req,
+                          JSValueConst val)
+{
+    const uint8_t *data;
+    const char *str;
+    size_t len, offset, size;
+    JSValue abuf;
+
+    str = NULL;
+    abuf = JS_UNDEFINED;
+    if (JS_IsString(val)) {
+        str = JS_ToCStringLen(ctx, &len, val);
+        if (!str)
+            return -1;
+        data = (const uint8_t *)str;
+    } else {
+        data = JS_GetArrayBuffer(ctx, &len, val);
+        if (!data) {
+            JS_FreeValue(ctx, JS_GetException(ctx));
+            abuf = JS_GetTypedArrayBuffer(ctx, val, &offset, &len, NULL);
+            if (JS_IsException(abuf))
+                return -1;
+            data = JS_GetArrayBuffer(ctx, &size, abuf);
+            if (!data) {
+                JS_FreeValue(ctx, abuf);
+                return -1;
+            }
+            data += offset;
+        }
+    }
+    /* the I/O thread cannot access the JS objects */
+    req->buf = malloc(max_int64(len, 1));
+    if (req->buf) {
+        memcpy(req->buf, data, len);
+        req->len = len;
+    }
+    JS_FreeCString(ctx, str);
+    JS_FreeValue(ctx, abuf);
+    if (!req->buf) {
+        JS_ThrowOutOfMemory(ctx);
+        return -1;
+    }
+    return 0;
+}
+
+static int os_io_get_filename(JSContext *ctx, JSOSIORequest *req,
+                              JSValueConst val)
+{
+    const char *filename;
+
+    filename = JS_ToCString(ctx, val);
+    if (!filename)
+        return -1;
+    req->filename = strdup(filename);
+    JS_FreeCString(ctx, filename);
+    if (!req->filename) {
+        JS_ThrowOutOfMemory(ctx);
+        return -1;
+    }
+    return 0;
+}
+
+/* readFileAsync(filename) -> Promise<ArrayBuffer> */
+static JSValue js_os_readFileAsync(JSContext *ctx, JSValueConst this_val,
+                                   int argc, JSValueConst *argv)
+{
+    JSOSIORequest *req;
+
+    req = os_io_new_request(ctx, OS_IO_READ_FILE);
+    if (!req)
+        return JS_EXCEPTION;
+    if (os_io_get_filename(ctx, req, argv[0])) {
+        os_io_free_request(req);
+        return JS_EXCEPTION;
+    }
+    return os_io_submit(ctx, req);
+}
+
+/* writeFileAsync(filename, data) -> Promise<number> */
+static JSValue js_os_writeFileAsync(JSContext *ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv)
+{
+    JSOSIORequest *req;
+
+    req = os_io_new_request(ctx, OS_IO_WRITE_FILE);
+    if (!req)
+        return JS_EXCEPTION;
+    if (os_io_get_filename(ctx, req, argv[0]) ||
+        os_io_get_data(ctx, req, argv[1])) {
+        os_io_free_request(req);
+        return JS_EXCEPTION;
+    }
+    return os_io_submit(ctx, req);
+}
+
+/* preadAsync(fd, length, position) -> Promise<ArrayBuffer> */
+static JSValue js_os_preadAsync(JSContext *ctx, JSValueConst this_val,
+                                int argc, JSValueConst *argv)
+{
+    JSOSIORequest *req;
+    int fd;
+    uint64_t len, pos;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToIndex(ctx, &len, argv[1]))
+        return JS_EXCEPTION;
+    if (JS_ToIndex(ctx, &pos, argv[2]))
+        return JS_EXCEPTION;
+    if (len > INT32_MAX)
+        return JS_ThrowRangeError(ctx, "invalid length");
+    req = os_io_new_request(ctx, OS_IO_PREAD);
+    if (!req)
+        return JS_EXCEPTION;
+    req->fd = fd;
+    req->pos = pos;
+    req->len = len;
+    req->buf = malloc(max_int64(len, 1));
+    if (!req->buf) {
+        os_io_free_request(req);
+        return JS_ThrowOutOfMemory(ctx);
+    }
+    return os_io_submit(ctx, req);
+}
+
+/* pwriteAsync(fd, buffer, offset, length, position) -> Promise<number> */
+static JSValue js_os_pwriteAsync(JSContext *ctx, JSValueConst this_val,
+                                 int argc, JSValueConst *argv)
+{
+    JSOSIORequest *req;
+    int fd;
+    uint64_t offset, len, pos;
+    size_t size;
+    uint8_t *buf;
+
+    if (JS_ToInt32(ctx, &fd, argv[0]))
+        return JS_EXCEPTION;
+    if (JS_ToIndex(ctx, &offset, argv[2]))
+        return JS_EXCEPTION;
+    if (JS_ToIndex(ctx, &len, argv[3]))
+        return JS_EXCEPTION;
+    if (JS_ToIndex(ctx, &pos, argv[4]))
+        return JS_EXCEPTION;
+    buf = JS_GetArrayBuffer(ctx, &size, argv[1]);
+    if (!buf)
+        return JS_EXCEPTION;
+    if (offset + len > size)
+        return JS_ThrowRangeError(ctx, "read/write array buffer overflow");
+    req = os_io_new_request(ctx, OS_IO_PWRITE);
+    if (!req)
+        return JS_EXCEPTION;
+    req->fd = fd;
+    req->pos = pos;
+    req->len = len;
+    /* the data is copied because the ArrayBuffer may be modified or
+       freed during the write */
+    req->buf = malloc(max_int64(len, 1));
+    if (!req->buf) {
+        os_io_free_request(req);
+        return JS_ThrowOutOfMemory(ctx);
+    }
+    memcpy(req->buf, buf + offset, len);
+    return os_io_submit(ctx, req);
+}
+
 #endif /* USE_WORKER */
 
+/* 'func' is called by the event loop before it waits for events. A
+   signal interrupts the wait, so the requests made by the signal
+   handlers of the host can be handled there while the script is idle. */
+void js_std_set_poll_hook(void (*func)(JSRuntime *rt))
+{
+    os_poll_hook = func;
+}
+
 void js_std_set_worker_new_context_func(JSContext *(*func)(JSRuntime *rt))
 {
 #ifdef USE_WORKER
@@ -3755,6 +5498,40 @@ static const JSCFunctionListEntry js_os_funcs[] = {
     JS_CFUNC_DEF("kill", 2, js_os_kill ),
     JS_CFUNC_DEF("dup", 1, js_os_dup ),
     JS_CFUNC_DEF("dup2", 2, js_os_dup2 ),
+    JS_CFUNC_DEF("socket", 3, js_os_socket ),
+    JS_CFUNC_MAGIC_DEF("bind", 2, js_os_bind_connect, 0 ),
+    JS_CFUNC_MAGIC_DEF("connect", 2, js_os_bind_connect, 1 ),
+    JS_CFUNC_DEF("listen", 2, js_os_listen ),
+    JS_CFUNC_DEF("accept", 1, js_os_accept ),
+    JS_CFUNC_MAGIC_DEF("getsockname", 1, js_os_getsockname, 0 ),
+    JS_CFUNC_MAGIC_DEF("getpeername", 1, js_os_getsockname, 1 ),
+    JS_CFUNC_DEF("shutdown", 2, js_os_shutdown ),
+    JS_CFUNC_DEF("setsockopt", 4, js_os_setsockopt ),
+    JS_CFUNC_DEF("getsockopt", 3, js_os_getsockopt ),
+    JS_CFUNC_MAGIC_DEF("recv", 4, js_os_send_recv, 0 ),
+    JS_CFUNC_MAGIC_DEF("send", 4, js_os_send_recv, 1 ),
+    OS_FLAG(AF_INET),
+    OS_FLAG(AF_INET6),
+    OS_FLAG(AF_UNIX),
+    OS_FLAG(SOCK_STREAM),
+    OS_FLAG(SOCK_DGRAM),
+    OS_FLAG(SOL_SOCKET),
+    OS_FLAG(SO_REUSEADDR),
+    OS_FLAG(SO_KEEPALIVE),
+    OS_FLAG(SO_ERROR),
+    OS_FLAG(SO_RCVBUF),
+    OS_FLAG(SO_SNDBUF),
+    OS_FLAG(IPPROTO_TCP),
+    OS_FLAG(TCP_NODELAY),
+    OS_FLAG(SHUT_RD),
+    OS_FLAG(SHUT_WR),
+    OS_FLAG(SHUT_RDWR),
+#endif
+#ifdef USE_WORKER
+    JS_CFUNC_DEF("readFileAsync", 1, js_os_readFileAsync ),
+    JS_CFUNC_DEF("writeFileAsync", 2, js_os_writeFileAsync ),
+    JS_CFUNC_DEF("preadAsync", 3, js_os_preadAsync ),
+    JS_CFUNC_DEF("pwriteAsync", 5, js_os_pwriteAsync ),
 #endif
 };
 
@@ -3885,9 +5662,13 @@ void js_std_init_handlers(JSRuntime *rt)
     memset(ts, 0, sizeof(*ts));
     init_list_head(&ts->os_rw_handlers);
     init_list_head(&ts->os_signal_handlers);
-    init_list_head(&ts->os_timers);
     init_list_head(&ts->port_list);
     ts->next_timer_id = 1;
+#ifdef USE_EPOLL
+    ts->epoll_fd = -1;
+    ts->epoll_generation = -1;
+    pthread_once(&os_fork_once, os_fork_init);
+#endif
 
     JS_SetRuntimeOpaque(rt, ts);
 
@@ -3919,16 +5700,22 @@ void js_std_free_handlers(JSRuntime *rt)
         free_sh(rt, sh);
     }
 
-    list_for_each_safe(el, el1, &ts->os_timers) {
-        JSOSTimer *th = list_entry(el, JSOSTimer, link);
-        free_timer(rt, th);
-    }
+    while (ts->timer_count != 0)
+        free_timer(rt, ts->timer_heap[ts->timer_count - 1]);
+    js_free_rt(rt, ts->timer_heap);
+    js_free_rt(rt, ts->timer_hash);
 
 #ifdef USE_WORKER
+    os_io_cancel_all(ts);
     /* XXX: free port_list ? */
     js_free_message_pipe(ts->recv_pipe);
     js_free_message_pipe(ts->send_pipe);
 #endif
+#ifdef USE_EPOLL
+    if (ts->epoll_fd >= 0)
+        close(ts->epoll_fd);
+#endif
+    js_free_rt(rt, ts->rw_handler_tab);
 
     free(ts);
     JS_SetRuntimeOpaque(rt, NULL); /* fail safe */
@@ -3983,27 +5770,24 @@ void js_std_promise_rejection_tracker(JSContext *ctx, JSValueConst promise,
     }
 }
 
-/* main loop which calls the user JS callbacks */
-void js_std_loop(JSContext *ctx)
+/* main loop which calls the user JS callbacks. Return -1 if an
+   exception was not caught by a callback or a job (it is dumped and the
+   loop goes on), 0 otherwise. */
+int js_std_loop(JSContext *ctx)
 {
-    JSContext *ctx1;
-    int err;
+    JSThreadState *ts = JS_GetRuntimeOpaque(JS_GetRuntime(ctx));
+    int ret;
 
     for(;;) {
         /* execute the pending jobs */
-        for(;;) {
-            err = JS_ExecutePendingJob(JS_GetRuntime(ctx), &ctx1);
-            if (err <= 0) {
-                if (err < 0) {
-                    js_std_dump_error(ctx1);
-                }
-                break;
-            }
-        }
+        js_std_run_jobs(JS_GetRuntime(ctx));
 
         if (!os_poll_func || os_poll_func(ctx))
             break;
     }
+    ret = ts->loop_error ? -1 : 0;
+    ts->loop_error = FALSE;
+    return ret;
 }
 
 /* Wait for a promise and execute pending jobs while waiting for
@@ -4025,13 +5809,9 @@ JSValue js_std_await(JSContext *ctx, JSValue obj)
             JS_FreeValue(ctx, obj);
             break;
         } else if (state == JS_PROMISE_PENDING) {
-            JSContext *ctx1;
-            int err;
-            err = JS_ExecutePendingJob(JS_GetRuntime(ctx), &ctx1);
-            if (err < 0) {
-                js_std_dump_error(ctx1);
-            }
-            if (os_poll_func)
+            /* wait for events only when no job can settle the
+               promise */
+            if (js_std_run_jobs(JS_GetRuntime(ctx)) == 0 && os_poll_func)
                 os_poll_func(ctx);
         } else {
             /* not a promise */
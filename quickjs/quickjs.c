@@ -110,12 +110,26 @@
 /* test the GC by forcing it before each object allocation */
 //#define FORCE_GC_AT_MALLOC
 
+/* Store the JSObject and JSShape internal references as 32 bit
+   offsets inside a reserved heap region. Only available on 64 bit
+   POSIX systems. */
+//#define CONFIG_COMPRESSED_PTRS
+#if defined(CONFIG_COMPRESSED_PTRS) && \
+    (defined(_WIN32) || defined(EMSCRIPTEN) || INTPTR_MAX == INT32_MAX)
+#undef CONFIG_COMPRESSED_PTRS
+#endif
+
 #ifdef CONFIG_ATOMICS
 #include <pthread.h>
 #include <stdatomic.h>
 #include <errno.h>
 #endif
 
+#ifdef CONFIG_COMPRESSED_PTRS
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
 enum {
     /* classid tag        */    /* union usage   | properties */
     JS_CLASS_OBJECT = 1,        /* must be first */
@@ -215,6 +229,51 @@ typedef struct JSShape JSShape;
 typedef struct JSString JSString;
 typedef struct JSString JSAtomStruct;
 typedef struct JSObject JSObject;
+typedef struct JSBacktrace JSBacktrace;
+
+#ifdef CONFIG_COMPRESSED_PTRS
+/* Compressed references: offset in units of (1 << JS_CPTR_SHIFT)
+   bytes from the start of the compressed heap region. 0 is NULL. The
+   region is shared by all the runtimes of the process so that the
+   references can be decoded without a runtime pointer. */
+typedef uint32_t JSCPtr;
+
+#define JS_CPTR_SHIFT       3
+#define JS_CPTR_REGION_BITS (32 + JS_CPTR_SHIFT) /* 32 GB */
+#define JS_CPTR_CHUNK_BITS  18 /* 256 KB */
+#define JS_CPTR_CHUNK_SIZE  (1 << JS_CPTR_CHUNK_BITS)
+#define JS_CPTR_CHUNK_COUNT (1 << (JS_CPTR_REGION_BITS - JS_CPTR_CHUNK_BITS))
+/* number of size classes of the small blocks (up to 64 KB) */
+#define JS_CPTR_CLASS_COUNT 48
+#define JS_CPTR_SMALL_MAX   65536
+
+typedef struct JSCPtrHeap {
+    void *free_list[JS_CPTR_CLASS_COUNT];
+    uint8_t *bump_ptr[JS_CPTR_CLASS_COUNT];
+    uint8_t *bump_end[JS_CPTR_CLASS_COUNT];
+    uint32_t *spans; /* first chunk of the spans owned by the runtime */
+    int span_count;
+    int span_size;
+} JSCPtrHeap;
+
+static uint8_t *js_cptr_base;
+
+static force_inline void *js_cptr_get(JSCPtr v)
+{
+    return v ? js_cptr_base + ((uintptr_t)v << JS_CPTR_SHIFT) : NULL;
+}
+
+static force_inline JSCPtr js_cptr_make(const void *ptr)
+{
+    if (!ptr)
+        return 0;
+    return ((uintptr_t)ptr - (uintptr_t)js_cptr_base) >> JS_CPTR_SHIFT;
+}
+
+#define JS_CPTR(type) JSCPtr
+#else
+#define JS_CPTR(type) type *
+#endif
 
 #define JS_VALUE_GET_OBJ(v) ((JSObject *)JS_VALUE_GET_PTR(v))
 #define JS_VALUE_GET_STRING(v) ((JSString *)JS_VALUE_GET_PTR(v))
@@ -240,6 +299,11 @@ struct JSRuntime {
     uint32_t *atom_hash;
     JSAtomStruct **atom_array;
     int atom_free_index; /* 0 = none */
+    /* atoms JS_ATOM_END to JS_ATOM_END + image_atom_count - 1 are
+       those of a bytecode image (see JS_ReserveImageAtoms()) */
+    int image_atom_count;
+    /* if not NULL, contains the predefined atoms (see JS_InitAtoms()) */
+    uint8_t *predef_atom_buf;
 
     int class_count;    /* size of class_array */
     JSClass *class_array;
@@ -251,6 +315,7 @@ struct JSRuntime {
     /* list of JSGCObjectHeader.link. Used during JS_FreeValueRT() */
     struct list_head gc_zero_ref_count_list;
     struct list_head tmp_obj_list; /* used during GC */
+    struct JSHeapSnapshotState *heap_snapshot; /* used by JS_WriteHeapSnapshot() */
     JSGCPhaseEnum gc_phase : 8;
     size_t malloc_gc_threshold;
     struct list_head weakref_list; /* list of JSWeakRefHeader.link */
@@ -274,7 +339,14 @@ struct JSRuntime {
     JSHostPromiseRejectionTracker *host_promise_rejection_tracker;
     void *host_promise_rejection_tracker_opaque;
 
-    struct list_head job_list; /* list of JSJobEntry.link */
+    /* pending jobs: ring buffer of job_queue_size entries (power of
+       two) starting at job_head. The entries are reused, so enqueuing
+       a job does not allocate memory. */
+    struct JSJobEntry *job_queue;
+    uint32_t job_queue_size;
+    uint32_t job_head;
+    uint32_t job_count;
+    JSJobStats job_stats;
 
     JSModuleNormalizeFunc *module_normalize_func;
     JSModuleLoaderFunc *module_loader_func;
@@ -287,12 +359,17 @@ struct JSRuntime {
     JSSharedArrayBufferFunctions sab_funcs;
     /* see JS_SetStripInfo() */
     uint8_t strip_flags;
+    /* see JS_SetLazyCompile() */
+    BOOL lazy_compile : 8;
     
     /* Shape hash table */
     int shape_hash_bits;
     int shape_hash_size;
     int shape_hash_count; /* number of hashed shapes */
     JSShape **shape_hash;
+#ifdef CONFIG_COMPRESSED_PTRS
+    JSCPtrHeap cptr_heap; /* JSObject, JSShape and property arrays */
+#endif
     void *user_opaque;
 };
 
@@ -309,6 +386,8 @@ struct JSClass {
 #define JS_MODE_STRICT (1 << 0)
 #define JS_MODE_ASYNC  (1 << 2) /* async function */
 #define JS_MODE_BACKTRACE_BARRIER (1 << 3) /* stop backtrace before this frame */
+#define JS_MODE_JSX    (1 << 4) /* JSX elements are accepted */
+#define JS_MODE_TS     (1 << 5) /* TypeScript types are skipped */
 
 typedef struct JSStackFrame {
     struct JSStackFrame *prev_frame; /* NULL if first stack frame */
@@ -420,8 +499,23 @@ typedef enum {
     JS_AUTOINIT_ID_PROTOTYPE,
     JS_AUTOINIT_ID_MODULE_NS,
     JS_AUTOINIT_ID_PROP,
+    JS_AUTOINIT_ID_BACKTRACE,
+    JS_AUTOINIT_ID_INTRINSIC,
 } JSAutoInitIDEnum;
 
+/* the JSContext pointers are at least 8 byte aligned */
+#define JS_AUTOINIT_ID_MASK 7
+
+/* intrinsic groups which JS_NewContext() instantiates on first use */
+typedef enum {
+    JS_INTRINSIC_DATE,
+    JS_INTRINSIC_REGEXP,
+    JS_INTRINSIC_MAP_SET,
+    JS_INTRINSIC_TYPED_ARRAYS,
+    JS_INTRINSIC_WEAK_REF,
+    JS_INTRINSIC_COUNT,
+} JSIntrinsicEnum;
+
 /* must be large enough to have a negligible runtime cost and small
    enough to call the interrupt callback often. */
 #define JS_INTERRUPT_COUNTER_INIT 10000
@@ -452,6 +546,13 @@ struct JSContext {
     JSValue global_obj; /* global object */
     JSValue global_var_obj; /* contains the global let/const definitions */
 
+    /* mask of the JSIntrinsicEnum groups not instantiated yet */
+    uint8_t lazy_intrinsics;
+    /* TRUE while a lazy group defines its global constructors */
+    BOOL in_lazy_intrinsic;
+    /* receives the global constructors of the lazy groups */
+    JSValue intrinsic_obj;
+
     uint64_t random_state;
 
     /* when the counter reaches zero, JSRutime.interrupt_handler is called */
@@ -593,6 +694,50 @@ typedef struct JSVarDef {
 #define PC2LINE_OP_FIRST 1
 #define PC2LINE_DIFF_PC_MAX ((255 - PC2LINE_OP_FIRST) / PC2LINE_RANGE)
 
+typedef struct {
+    /* last source position */
+    const uint8_t *ptr;
+    int line_num;
+    int col_num;
+    const uint8_t *buf_start;
+} GetLineColCache;
+
+/* Reference counted buffer shared by the debug info of several
+   functions. It contains either the source code of a script (the line
+   and column numbers are relative to its start) or the debug section
+   of serialized bytecode. It is always zero terminated. */
+typedef struct JSDebugBuf {
+    int ref_count;
+    BOOL is_source; /* contains the source code of a script */
+    uint32_t len;
+    const uint8_t *data; /* points to buf[] or to read-only data */
+    GetLineColCache line_col_cache; /* only used if is_source */
+    uint8_t buf[0];
+} JSDebugBuf;
+
+typedef enum {
+    JS_DEBUG_DECODED,
+    /* pc2line_buf contains the source positions of the function
+       in 'buf': the line numbers are computed on first use */
+    JS_DEBUG_SOURCE_POS,
+    /* the debug info is stored at 'source_pos' in 'buf' */
+    JS_DEBUG_SERIALIZED,
+} JSDebugStateEnum;
+
+/* Debug info of a function. It is allocated separately from the
+   bytecode and decoded only when a line number or the source code is
+   needed. */
+typedef struct JSFunctionDebug {
+    JSAtom filename;
+    uint8_t state; /* see JSDebugStateEnum */
+    int pc2line_len;
+    const uint8_t *pc2line_buf; /* points to pc2line_data[] or into 'buf' */
+    JSDebugBuf *buf; /* may be NULL */
+    uint32_t source_pos; /* position of the source code in 'buf' */
+    uint32_t source_len; /* 0 if no source code */
+    uint8_t pc2line_data[0];
+} JSFunctionDebug;
+
 typedef enum JSFunctionKindEnum {
     JS_FUNC_NORMAL = 0,
     JS_FUNC_GENERATOR = (1 << 0),
@@ -616,7 +761,12 @@ typedef struct JSFunctionBytecode {
     uint8_t has_debug : 1;
     uint8_t read_only_bytecode : 1;
     uint8_t is_direct_or_indirect_eval : 1; /* used by JS_GetScriptOrModuleName() */
-    /* XXX: 10 bits available */
+    /* lazy function stub: the bytecode is generated from the source
+       on the first call and stored in cpool[0] (see js_lazy_compile()) */
+    uint8_t is_lazy : 1;
+    uint8_t lazy_is_func_expr : 1;
+    uint8_t lazy_is_module : 1;
+    /* XXX: 7 bits available */
     uint8_t *byte_code_buf; /* (self pointer) */
     int byte_code_len;
     JSAtom func_name;
@@ -630,14 +780,7 @@ typedef struct JSFunctionBytecode {
     JSValue *cpool; /* constant pool (self pointer) */
     int cpool_count;
     int closure_var_count;
-    struct {
-        /* debug info, move to separate structure to save memory? */
-        JSAtom filename;
-        int source_len; 
-        int pc2line_len;
-        uint8_t *pc2line_buf;
-        char *source;
-    } debug;
+    JSFunctionDebug *debug; /* NULL if has_debug = 0 */
 } JSFunctionBytecode;
 
 typedef struct JSBoundFunction {
@@ -700,6 +843,9 @@ typedef struct JSAsyncFunctionState {
     BOOL is_completed; /* TRUE if the function has returned. The stack
                           frame is no longer valid */
     JSValue resolving_funcs[2]; /* only used in JS async functions */
+    /* functions resuming the async function after an 'await',
+       created at the first one and reused by the next ones */
+    JSValue await_funcs[2];
     JSStackFrame frame;
 } JSAsyncFunctionState;
 
@@ -842,12 +988,17 @@ struct JSModuleDef {
     JSValue meta_obj; /* for import.meta */
 };
 
+/* enough for all the jobs created by the engine */
+#define JS_JOB_INLINE_ARGS 5
+
 typedef struct JSJobEntry {
-    struct list_head link;
     JSContext *ctx;
     JSJobFunc *job_func;
     int argc;
-    JSValue argv[0];
+    union {
+        JSValue args[JS_JOB_INLINE_ARGS];
+        JSValue *ext_args; /* allocated if argc > JS_JOB_INLINE_ARGS */
+    } u;
 } JSJobEntry;
 
 typedef struct JSProperty {
@@ -862,7 +1013,7 @@ typedef struct JSProperty {
             /* in order to use only 2 pointers, we compress the realm
                and the init function pointer */
             uintptr_t realm_and_id; /* realm and init_id (JS_AUTOINIT_ID_x)
-                                       in the 2 low bits */
+                                       in the 3 low bits */
             void *opaque;
         } init;
     } u;
@@ -894,8 +1045,8 @@ struct JSShape {
     int prop_size; /* allocated properties */
     int prop_count; /* include deleted properties */
     int deleted_prop_count;
-    JSShape *shape_hash_next; /* in JSRuntime.shape_hash[h] list */
-    JSObject *proto;
+    JS_CPTR(JSShape) shape_hash_next; /* in JSRuntime.shape_hash[h] list */
+    JS_CPTR(JSObject) proto;
     JSShapeProperty prop[0]; /* prop_size elements */
 };
 
@@ -921,8 +1072,8 @@ struct JSObject {
        structure is freed only if header.ref_count = 0 and
        weakref_count = 0 */
     uint32_t weakref_count; 
-    JSShape *shape; /* prototype and property names + flag */
-    JSProperty *prop; /* array of properties */
+    JS_CPTR(JSShape) shape; /* prototype and property names + flag */
+    JS_CPTR(JSProperty) prop; /* array of properties */
     union {
         void *opaque;
         struct JSBoundFunction *bound_function; /* JS_CLASS_BOUND_FUNCTION */
@@ -981,6 +1132,34 @@ struct JSObject {
     } u;
 };
 
+/* accessors for the fields which may be compressed */
+#ifdef CONFIG_COMPRESSED_PTRS
+#define JS_CPTR_ACCESSORS(name, stype, field, type)                   \
+static force_inline type *get_ ## name(const stype *p)                \
+{                                                                     \
+    return js_cptr_get(p->field);                                     \
+}                                                                     \
+static force_inline void set_ ## name(stype *p, type *v)              \
+{                                                                     \
+    p->field = js_cptr_make(v);                                       \
+}
+#else
+#define JS_CPTR_ACCESSORS(name, stype, field, type)                   \
+static force_inline type *get_ ## name(const stype *p)                \
+{                                                                     \
+    return p->field;                                                  \
+}                                                                     \
+static force_inline void set_ ## name(stype *p, type *v)              \
+{                                                                     \
+    p->field = v;                                                     \
+}
+#endif
+
+JS_CPTR_ACCESSORS(obj_shape, JSObject, shape, JSShape)
+JS_CPTR_ACCESSORS(obj_prop, JSObject, prop, JSProperty)
+JS_CPTR_ACCESSORS(shape_proto, JSShape, proto, JSObject)
+JS_CPTR_ACCESSORS(shape_hash_next, JSShape, shape_hash_next, JSShape)
+
 enum {
     __JS_ATOM_NULL = JS_ATOM_NULL,
 #define DEF(name, str) JS_ATOM_ ## name,
@@ -1032,6 +1211,9 @@ static JSAtom __JS_NewAtomInit(JSRuntime *rt, const char *str, int len,
                                int atom_type);
 static void JS_FreeAtomStruct(JSRuntime *rt, JSAtomStruct *p);
 static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b);
+static int get_line_col_cached(GetLineColCache *s, int *pcol_num, const uint8_t *ptr);
+static JSFunctionBytecode *js_lazy_compile(JSFunctionBytecode *b);
+static int js_resolve_lazy_function(JSContext *ctx, JSObject *p);
 static JSValue js_call_c_function(JSContext *ctx, JSValueConst func_obj,
                                   JSValueConst this_obj,
                                   int argc, JSValueConst *argv, int flags);
@@ -1168,6 +1350,10 @@ static JSValue js_array_buffer_constructor3(JSContext *ctx,
                                             uint8_t *buf,
                                             JSFreeArrayBufferDataFunc *free_func,
                                             void *opaque, BOOL alloc_flag);
+static BOOL js_array_buffer_is_malloc(JSRuntime *rt, JSArrayBuffer *abuf);
+static uint8_t *js_array_buffer_steal(JSRuntime *rt, JSArrayBuffer *abuf);
+static JSValue js_array_buffer_adopt(JSContext *ctx, uint8_t *buf, size_t len);
+static void array_buffer_detach(JSArrayBuffer *abuf);
 static JSArrayBuffer *js_get_array_buffer(JSContext *ctx, JSValueConst obj);
 static JSValue js_typed_array_constructor(JSContext *ctx,
                                           JSValueConst this_val,
@@ -1209,6 +1395,8 @@ static __exception int perform_promise_then(JSContext *ctx,
                                             JSValueConst *cap_resolving_funcs);
 static JSValue js_promise_resolve(JSContext *ctx, JSValueConst this_val,
                                   int argc, JSValueConst *argv, int magic);
+static JSValue promise_reaction_job(JSContext *ctx, int argc,
+                                    JSValueConst *argv);
 static JSValue js_promise_then(JSContext *ctx, JSValueConst this_val,
                                int argc, JSValueConst *argv);
 static int js_string_compare(JSContext *ctx,
@@ -1254,6 +1442,21 @@ static JSValue js_module_ns_autoinit(JSContext *ctx, JSObject *p, JSAtom atom,
                                  void *opaque);
 static JSValue JS_InstantiateFunctionListItem2(JSContext *ctx, JSObject *p,
                                                JSAtom atom, void *opaque);
+static JSValue js_backtrace_autoinit(JSContext *ctx, JSObject *p, JSAtom atom,
+                                     void *opaque);
+static void js_free_backtrace(JSRuntime *rt, JSBacktrace *bt);
+static void js_mark_backtrace(JSRuntime *rt, JSBacktrace *bt,
+                              JS_MarkFunc *mark_func);
+static int JS_DefineAutoInitProperty(JSContext *ctx, JSValueConst this_obj,
+                                     JSAtom prop, JSAutoInitIDEnum id,
+                                     void *opaque, int flags);
+static JSValue js_intrinsic_autoinit(JSContext *ctx, JSObject *p, JSAtom atom,
+                                     void *opaque);
+static void js_instantiate_class_intrinsic(JSContext *ctx, JSClassID class_id);
+static void js_add_intrinsic_typed_arrays(JSContext *ctx);
+#ifdef CONFIG_ATOMICS
+void JS_AddIntrinsicAtomics(JSContext *ctx);
+#endif
 static JSValue js_object_groupBy(JSContext *ctx, JSValueConst this_val,
                                  int argc, JSValueConst *argv, int is_map);
 static void map_delete_weakrefs(JSRuntime *rt, JSWeakRefHeader *wh);
@@ -1432,6 +1635,334 @@ static inline void js_dbuf_init(JSContext *ctx, DynBuf *s)
     dbuf_init2(s, ctx->rt, (DynBufReallocFunc *)js_realloc_rt);
 }
 
+#ifdef CONFIG_COMPRESSED_PTRS
+/* Compressed heap: the JSObject structures, the shapes and the
+   property arrays are allocated in a single reserved region so that
+   they can reference each other with 32 bit offsets. The region is
+   divided in chunks which are given to the runtimes. A chunk either
+   contains blocks of a single size class or is the start of a large
+   block spanning several chunks. */
+
+#define JS_CPTR_SPAN_LARGE (1U << 31)
+
+static pthread_mutex_t js_cptr_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* 0 if free or unused, size class + 1 for small block chunks or
+   JS_CPTR_SPAN_LARGE | chunk_count for the first chunk of large
+   blocks */
+static uint32_t js_cptr_chunk_info[JS_CPTR_CHUNK_COUNT];
+static uint32_t js_cptr_chunk_top; /* first never used chunk */
+static uint32_t js_cptr_free_spans; /* list of free spans, 0 = none */
+
+/* stored at the start of the free spans */
+typedef struct JSCPtrFreeSpan {
+    uint32_t next;
+    uint32_t chunk_count;
+} JSCPtrFreeSpan;
+
+static inline uint8_t *js_cptr_chunk_ptr(uint32_t idx)
+{
+    return js_cptr_base + ((size_t)idx << JS_CPTR_CHUNK_BITS);
+}
+
+static inline uint32_t js_cptr_chunk_idx(const void *ptr)
+{
+    return ((uint8_t *)ptr - js_cptr_base) >> JS_CPTR_CHUNK_BITS;
+}
+
+/* size classes: multiples of 16 up to 256 bytes, then 4 classes per
+   power of two up to 64 KB */
+static inline int js_cptr_size_class(size_t size)
+{
+    int e;
+    if (size <= 256)
+        return (size + 15) / 16 - (size != 0);
+    e = 31 - clz32(size - 1);
+    return 16 + (e - 8) * 4 + ((size - 1 - ((size_t)1 << e)) >> (e - 2));
+}
+
+static inline size_t js_cptr_class_size(int cl)
+{
+    int e;
+    if (cl < 16)
+        return (cl + 1) * 16;
+    cl -= 16;
+    e = (cl >> 2) + 8;
+    return ((size_t)1 << e) + (((cl & 3) + 1) << (e - 2));
+}
+
+static void js_cptr_region_init(void)
+{
+    void *ptr;
+    /* the region is reserved without access rights. The chunks are
+       made accessible when they are used for the first time. */
+    ptr = mmap(NULL, (size_t)1 << JS_CPTR_REGION_BITS, PROT_NONE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED)
+        return;
+    js_cptr_base = ptr;
+    /* chunk 0 is never used so that the offset 0 is NULL */
+    js_cptr_chunk_top = 1;
+}
+
+/* return the first chunk index or 0 if no more space */
+static uint32_t js_cptr_span_alloc(uint32_t chunk_count)
+{
+    uint32_t idx, *pidx;
+    JSCPtrFreeSpan *fs;
+
+    pthread_mutex_lock(&js_cptr_mutex);
+    /* first fit in the free spans. The end of the span is used so that
+       the list does not need to be modified when it is split. */
+    pidx = &js_cptr_free_spans;
+    while (*pidx != 0) {
+        fs = (JSCPtrFreeSpan *)js_cptr_chunk_ptr(*pidx);
+        if (fs->chunk_count == chunk_count) {
+            idx = *pidx;
+            *pidx = fs->next;
+            goto done;
+        } else if (fs->chunk_count > chunk_count) {
+            fs->chunk_count -= chunk_count;
+            idx = *pidx + fs->chunk_count;
+            goto done;
+        }
+        pidx = &fs->next;
+    }
+    if (chunk_count > JS_CPTR_CHUNK_COUNT - js_cptr_chunk_top) {
+        idx = 0;
+        goto done;
+    }
+    idx = js_cptr_chunk_top;
+    if (mprotect(js_cptr_chunk_ptr(idx), (size_t)chunk_count << JS_CPTR_CHUNK_BITS,
+                 PROT_READ | PROT_WRITE) != 0) {
+        idx = 0;
+        goto done;
+    }
+    js_cptr_chunk_top += chunk_count;
+ done:
+    pthread_mutex_unlock(&js_cptr_mutex);
+    return idx;
+}
+
+static void js_cptr_span_free(uint32_t idx, uint32_t chunk_count)
+{
+    JSCPtrFreeSpan *fs;
+
+    /* give the memory back to the system */
+    madvise(js_cptr_chunk_ptr(idx), (size_t)chunk_count << JS_CPTR_CHUNK_BITS,
+            MADV_DONTNEED);
+    pthread_mutex_lock(&js_cptr_mutex);
+    js_cptr_chunk_info[idx] = 0;
+    fs = (JSCPtrFreeSpan *)js_cptr_chunk_ptr(idx);
+    fs->chunk_count = chunk_count;
+    fs->next = js_cptr_free_spans;
+    js_cptr_free_spans = idx;
+    pthread_mutex_unlock(&js_cptr_mutex);
+}
+
+static int js_cptr_heap_init(JSRuntime *rt)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, js_cptr_region_init);
+    if (!js_cptr_base)
+        return -1;
+    memset(&rt->cptr_heap, 0, sizeof(rt->cptr_heap));
+    return 0;
+}
+
+static void js_cptr_heap_free(JSRuntime *rt)
+{
+    JSCPtrHeap *h = &rt->cptr_heap;
+    uint32_t info, idx;
+    int i;
+
+    for(i = 0; i < h->span_count; i++) {
+        idx = h->spans[i];
+        info = js_cptr_chunk_info[idx];
+        js_cptr_span_free(idx, (info & JS_CPTR_SPAN_LARGE) ?
+                          (info & ~JS_CPTR_SPAN_LARGE) : 1);
+    }
+    js_free_rt(rt, h->spans);
+    h->spans = NULL;
+    h->span_count = h->span_size = 0;
+}
+
+static int js_cptr_add_span(JSRuntime *rt, uint32_t idx)
+{
+    JSCPtrHeap *h = &rt->cptr_heap;
+    if (h->span_count >= h->span_size) {
+        int new_size = max_int(16, h->span_size * 3 / 2);
+        uint32_t *new_spans;
+        new_spans = js_realloc_rt(rt, h->spans, sizeof(h->spans[0]) * new_size);
+        if (!new_spans)
+            return -1;
+        h->spans = new_spans;
+        h->span_size = new_size;
+    }
+    h->spans[h->span_count++] = idx;
+    return 0;
+}
+
+static void js_cptr_remove_span(JSRuntime *rt, uint32_t idx)
+{
+    JSCPtrHeap *h = &rt->cptr_heap;
+    int i;
+    for(i = h->span_count - 1; i >= 0; i--) {
+        if (h->spans[i] == idx) {
+            h->spans[i] = h->spans[--h->span_count];
+            return;
+        }
+    }
+    abort();
+}
+
+static size_t js_cptr_usable_size(const void *ptr)
+{
+    uint32_t info;
+    info = js_cptr_chunk_info[js_cptr_chunk_idx(ptr)];
+    if (info & JS_CPTR_SPAN_LARGE)
+        return (size_t)(info & ~JS_CPTR_SPAN_LARGE) << JS_CPTR_CHUNK_BITS;
+    else
+        return js_cptr_class_size(info - 1);
+}
+
+static void *js_cptr_malloc_rt(JSRuntime *rt, size_t size)
+{
+    JSCPtrHeap *h = &rt->cptr_heap;
+    JSMallocState *s = &rt->malloc_state;
+    uint32_t idx, chunk_count;
+    size_t alloc_size;
+    void *ptr;
+    int cl;
+
+    if (size <= JS_CPTR_SMALL_MAX) {
+        cl = js_cptr_size_class(size);
+        alloc_size = js_cptr_class_size(cl);
+    } else {
+        cl = -1;
+        alloc_size = (size + JS_CPTR_CHUNK_SIZE - 1) & ~(size_t)(JS_CPTR_CHUNK_SIZE - 1);
+    }
+    if (unlikely(s->malloc_size + alloc_size > s->malloc_limit))
+        return NULL;
+    if (cl >= 0) {
+        ptr = h->free_list[cl];
+        if (ptr) {
+            h->free_list[cl] = *(void **)ptr;
+        } else {
+            if ((h->bump_end[cl] - h->bump_ptr[cl]) < alloc_size) {
+                idx = js_cptr_span_alloc(1);
+                if (!idx)
+                    return NULL;
+                if (js_cptr_add_span(rt, idx)) {
+                    js_cptr_span_free(idx, 1);
+                    return NULL;
+                }
+                js_cptr_chunk_info[idx] = cl + 1;
+                h->bump_ptr[cl] = js_cptr_chunk_ptr(idx);
+                h->bump_end[cl] = h->bump_ptr[cl] + JS_CPTR_CHUNK_SIZE;
+            }
+            ptr = h->bump_ptr[cl];
+            h->bump_ptr[cl] += alloc_size;
+        }
+    } else {
+        chunk_count = alloc_size >> JS_CPTR_CHUNK_BITS;
+        idx = js_cptr_span_alloc(chunk_count);
+        if (!idx)
+            return NULL;
+        if (js_cptr_add_span(rt, idx)) {
+            js_cptr_span_free(idx, chunk_count);
+            return NULL;
+        }
+        js_cptr_chunk_info[idx] = JS_CPTR_SPAN_LARGE | chunk_count;
+        ptr = js_cptr_chunk_ptr(idx);
+    }
+    s->malloc_count++;
+    s->malloc_size += alloc_size;
+    return ptr;
+}
+
+static void js_cptr_free_rt(JSRuntime *rt, void *ptr)
+{
+    JSCPtrHeap *h = &rt->cptr_heap;
+    JSMallocState *s = &rt->malloc_state;
+    uint32_t idx, info;
+
+    if (!ptr)
+        return;
+    idx = js_cptr_chunk_idx(ptr);
+    info = js_cptr_chunk_info[idx];
+    s->malloc_count--;
+    if (info & JS_CPTR_SPAN_LARGE) {
+        s->malloc_size -= (size_t)(info & ~JS_CPTR_SPAN_LARGE) << JS_CPTR_CHUNK_BITS;
+        js_cptr_remove_span(rt, idx);
+        js_cptr_span_free(idx, info & ~JS_CPTR_SPAN_LARGE);
+    } else {
+        s->malloc_size -= js_cptr_class_size(info - 1);
+        *(void **)ptr = h->free_list[info - 1];
+        h->free_list[info - 1] = ptr;
+    }
+}
+
+static void *js_cptr_realloc_rt(JSRuntime *rt, void *ptr, size_t size)
+{
+    size_t old_size;
+    void *new_ptr;
+
+    if (!ptr) {
+        if (size == 0)
+            return NULL;
+        return js_cptr_malloc_rt(rt, size);
+    }
+    if (size == 0) {
+        js_cptr_free_rt(rt, ptr);
+        return NULL;
+    }
+    old_size = js_cptr_usable_size(ptr);
+    if (size <= old_size && (old_size <= JS_CPTR_SMALL_MAX ?
+                             js_cptr_size_class(size) == js_cptr_size_class(old_size) :
+                             size > JS_CPTR_SMALL_MAX))
+        return ptr;
+    new_ptr = js_cptr_malloc_rt(rt, size);
+    if (!new_ptr)
+        return NULL;
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    js_cptr_free_rt(rt, ptr);
+    return new_ptr;
+}
+#else
+#define js_cptr_malloc_rt js_malloc_rt
+#define js_cptr_free_rt js_free_rt
+#define js_cptr_realloc_rt js_realloc_rt
+#endif
+
+/* Throw out of memory in case of error */
+static void *js_cptr_malloc(JSContext *ctx, size_t size)
+{
+    void *ptr;
+    ptr = js_cptr_malloc_rt(ctx->rt, size);
+    if (unlikely(!ptr)) {
+        JS_ThrowOutOfMemory(ctx);
+        return NULL;
+    }
+    return ptr;
+}
+
+static void js_cptr_free(JSContext *ctx, void *ptr)
+{
+    js_cptr_free_rt(ctx->rt, ptr);
+}
+
+/* Throw out of memory in case of error */
+static void *js_cptr_realloc(JSContext *ctx, void *ptr, size_t size)
+{
+    void *ret;
+    ret = js_cptr_realloc_rt(ctx->rt, ptr, size);
+    if (unlikely(!ret && size != 0)) {
+        JS_ThrowOutOfMemory(ctx);
+        return NULL;
+    }
+    return ret;
+}
+
 static inline int is_digit(int c) {
     return c >= '0' && c <= '9';
 }
@@ -1565,8 +2096,11 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
 #ifdef DUMP_LEAKS
     init_list_head(&rt->string_list);
 #endif
-    init_list_head(&rt->job_list);
 
+#ifdef CONFIG_COMPRESSED_PTRS
+    if (js_cptr_heap_init(rt))
+        goto fail;
+#endif
     if (JS_InitAtoms(rt))
         goto fail;
 
@@ -1702,6 +2236,18 @@ void JS_SetGCThreshold(JSRuntime *rt, size_t gc_threshold)
     rt->malloc_gc_threshold = gc_threshold;
 }
 
+/* the contents of the transferred ArrayBuffers are allocated with
+   malloc() so that any runtime can free them */
+static void *js_transfer_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+static void js_transfer_free(JSRuntime *rt, void *opaque, void *ptr)
+{
+    free(ptr);
+}
+
 #define malloc(s) malloc_is_forbidden(s)
 #define free(p) free_is_forbidden(p)
 #define realloc(p,s) realloc_is_forbidden(p,s)
@@ -1733,63 +2279,194 @@ int JS_GetStripInfo(JSRuntime *rt)
     return rt->strip_flags;
 }
 
+void JS_SetLazyCompile(JSRuntime *rt, BOOL enable)
+{
+    rt->lazy_compile = enable;
+}
+
+BOOL JS_GetLazyCompile(JSRuntime *rt)
+{
+    return rt->lazy_compile;
+}
+
+static inline JSValue *js_job_argv(JSJobEntry *e)
+{
+    return e->argc <= JS_JOB_INLINE_ARGS ? e->u.args : e->u.ext_args;
+}
+
+/* monotonic time in microseconds */
+static int64_t js_get_time_us(void)
+{
+#if defined(__linux__) || defined(__APPLE__)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static int js_resize_job_queue(JSContext *ctx)
+{
+    JSRuntime *rt = ctx->rt;
+    JSJobEntry *tab;
+    uint32_t i, new_size;
+
+    new_size = max_int(64, rt->job_queue_size * 2);
+    tab = js_malloc(ctx, sizeof(tab[0]) * new_size);
+    if (!tab)
+        return -1;
+    for(i = 0; i < rt->job_count; i++) {
+        tab[i] = rt->job_queue[(rt->job_head + i) & (rt->job_queue_size - 1)];
+    }
+    js_free(ctx, rt->job_queue);
+    rt->job_queue = tab;
+    rt->job_queue_size = new_size;
+    rt->job_head = 0;
+    return 0;
+}
+
 /* return 0 if OK, < 0 if exception */
 int JS_EnqueueJob(JSContext *ctx, JSJobFunc *job_func,
                   int argc, JSValueConst *argv)
 {
     JSRuntime *rt = ctx->rt;
     JSJobEntry *e;
+    JSValue *ext_args = NULL, *tab;
     int i;
 
-    e = js_malloc(ctx, sizeof(*e) + argc * sizeof(JSValue));
-    if (!e)
-        return -1;
+    if (unlikely(rt->job_count == rt->job_queue_size)) {
+        if (js_resize_job_queue(ctx))
+            return -1;
+    }
+    if (unlikely(argc > JS_JOB_INLINE_ARGS)) {
+        ext_args = js_malloc(ctx, sizeof(ext_args[0]) * argc);
+        if (!ext_args)
+            return -1;
+    }
+    e = &rt->job_queue[(rt->job_head + rt->job_count) &
+                       (rt->job_queue_size - 1)];
     e->ctx = ctx;
     e->job_func = job_func;
     e->argc = argc;
+    if (ext_args)
+        e->u.ext_args = ext_args;
+    tab = js_job_argv(e);
     for(i = 0; i < argc; i++) {
-        e->argv[i] = JS_DupValue(ctx, argv[i]);
+        tab[i] = JS_DupValue(ctx, argv[i]);
     }
-    list_add_tail(&e->link, &rt->job_list);
+    rt->job_count++;
+    rt->job_stats.enqueued++;
+    if (rt->job_count > rt->job_stats.max_pending)
+        rt->job_stats.max_pending = rt->job_count;
     return 0;
 }
 
 BOOL JS_IsJobPending(JSRuntime *rt)
 {
-    return !list_empty(&rt->job_list);
+    return rt->job_count != 0;
 }
 
-/* return < 0 if exception, 0 if no job pending, 1 if a job was
-   executed successfully. the context of the job is stored in '*pctx' */
-int JS_ExecutePendingJob(JSRuntime *rt, JSContext **pctx)
+/* remove the first pending job and execute it. The entry is copied
+   first because the job may resize the queue. */
+static int js_execute_first_job(JSRuntime *rt, JSContext **pctx)
 {
+    JSJobEntry e;
     JSContext *ctx;
-    JSJobEntry *e;
-    JSValue res;
+    JSValue res, *argv;
     int i, ret;
 
-    if (list_empty(&rt->job_list)) {
-        *pctx = NULL;
-        return 0;
-    }
-
-    /* get the first pending job and execute it */
-    e = list_entry(rt->job_list.next, JSJobEntry, link);
-    list_del(&e->link);
-    ctx = e->ctx;
-    res = e->job_func(e->ctx, e->argc, (JSValueConst *)e->argv);
-    for(i = 0; i < e->argc; i++)
-        JS_FreeValue(ctx, e->argv[i]);
+    e = rt->job_queue[rt->job_head];
+    rt->job_head = (rt->job_head + 1) & (rt->job_queue_size - 1);
+    rt->job_count--;
+    rt->job_stats.executed++;
+
+    ctx = e.ctx;
+    argv = js_job_argv(&e);
+    res = e.job_func(ctx, e.argc, (JSValueConst *)argv);
+    for(i = 0; i < e.argc; i++)
+        JS_FreeValue(ctx, argv[i]);
+    if (e.argc > JS_JOB_INLINE_ARGS)
+        js_free(ctx, argv);
     if (JS_IsException(res))
         ret = -1;
     else
         ret = 1;
     JS_FreeValue(ctx, res);
-    js_free(ctx, e);
     *pctx = ctx;
     return ret;
 }
 
+/* return < 0 if exception, 0 if no job pending, 1 if a job was
+   executed successfully. the context of the job is stored in '*pctx' */
+int JS_ExecutePendingJob(JSRuntime *rt, JSContext **pctx)
+{
+    if (rt->job_count == 0) {
+        *pctx = NULL;
+        return 0;
+    }
+    return js_execute_first_job(rt, pctx);
+}
+
+/* Execute the pending jobs, including the ones they enqueue, until
+   the queue is empty, 'max_jobs' jobs were executed or 'budget_us'
+   microseconds have elapsed (no limit if <= 0). Return the number of
+   executed jobs, or < 0 if a job raised an exception: its context is
+   stored in '*pctx' and the next jobs stay in the queue. */
+int JS_ExecutePendingJobs(JSRuntime *rt, int max_jobs, int64_t budget_us,
+                          JSContext **pctx)
+{
+    JSJobStats *s = &rt->job_stats;
+    JSContext *ctx = NULL;
+    int64_t start, duration;
+    int n, ret;
+
+    if (rt->job_count == 0) {
+        *pctx = NULL;
+        return 0;
+    }
+    start = js_get_time_us();
+    n = 0;
+    ret = 0;
+    while (rt->job_count != 0) {
+        if (max_jobs > 0 && n >= max_jobs)
+            break;
+        /* the clock is only read every 32 jobs */
+        if (budget_us > 0 && n != 0 && (n & 31) == 0 &&
+            js_get_time_us() - start >= budget_us)
+            break;
+        n++;
+        if (js_execute_first_job(rt, &ctx) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    duration = js_get_time_us() - start;
+    s->drain_count++;
+    s->drain_time += duration;
+    if (n > s->max_drain_jobs)
+        s->max_drain_jobs = n;
+    if (duration > s->max_drain_time)
+        s->max_drain_time = duration;
+    /* release the memory used by a large burst of jobs */
+    if (rt->job_count == 0 && rt->job_queue_size > 4096) {
+        js_free_rt(rt, rt->job_queue);
+        rt->job_queue = NULL;
+        rt->job_queue_size = 0;
+        rt->job_head = 0;
+    }
+    *pctx = ctx;
+    return ret < 0 ? ret : n;
+}
+
+void JS_GetJobStats(JSRuntime *rt, JSJobStats *s)
+{
+    *s = rt->job_stats;
+    s->queue_size = rt->job_queue_size;
+}
+
 static inline uint32_t atom_get_free(const JSAtomStruct *p)
 {
     return (uintptr_t)p >> 1;
@@ -1858,18 +2535,26 @@ void JS_SetRuntimeInfo(JSRuntime *rt, const char *s)
 
 void JS_FreeRuntime(JSRuntime *rt)
 {
+#ifdef DUMP_LEAKS
     struct list_head *el, *el1;
+#endif
     int i;
 
     JS_FreeValueRT(rt, rt->current_exception);
 
-    list_for_each_safe(el, el1, &rt->job_list) {
-        JSJobEntry *e = list_entry(el, JSJobEntry, link);
+    while (rt->job_count != 0) {
+        JSJobEntry *e = &rt->job_queue[rt->job_head];
+        JSValue *argv = js_job_argv(e);
         for(i = 0; i < e->argc; i++)
-            JS_FreeValueRT(rt, e->argv[i]);
-        js_free_rt(rt, e);
+            JS_FreeValueRT(rt, argv[i]);
+        if (e->argc > JS_JOB_INLINE_ARGS)
+            js_free_rt(rt, argv);
+        rt->job_head = (rt->job_head + 1) & (rt->job_queue_size - 1);
+        rt->job_count--;
     }
-    init_list_head(&rt->job_list);
+    js_free_rt(rt, rt->job_queue);
+    rt->job_queue = NULL;
+    rt->job_queue_size = 0;
 
     /* don't remove the weak objects to avoid create new jobs with
        FinalizationRegistry */
@@ -1926,6 +2611,9 @@ void JS_FreeRuntime(JSRuntime *rt)
     }
     js_free_rt(rt, rt->class_array);
 
+    for(i = 0; i < rt->image_atom_count; i++)
+        JS_FreeAtomRT(rt, JS_ATOM_END + i);
+
 #ifdef DUMP_LEAKS
     /* only the atoms defined in JS_InitAtoms() should be left */
     {
@@ -1988,15 +2676,21 @@ void JS_FreeRuntime(JSRuntime *rt)
     for(i = 0; i < rt->atom_size; i++) {
         JSAtomStruct *p = rt->atom_array[i];
         if (!atom_is_free(p)) {
+            if (rt->predef_atom_buf && i < JS_ATOM_END)
+                continue;
 #ifdef DUMP_LEAKS
             list_del(&p->link);
 #endif
             js_free_rt(rt, p);
         }
     }
+    js_free_rt(rt, rt->predef_atom_buf);
     js_free_rt(rt, rt->atom_array);
     js_free_rt(rt, rt->atom_hash);
     js_free_rt(rt, rt->shape_hash);
+#ifdef CONFIG_COMPRESSED_PTRS
+    js_cptr_heap_free(rt);
+#endif
 #ifdef DUMP_LEAKS
     if (!list_empty(&rt->string_list)) {
         if (rt->rt_info) {
@@ -2067,12 +2761,147 @@ JSContext *JS_NewContextRaw(JSRuntime *rt)
     ctx->array_ctor = JS_NULL;
     ctx->regexp_ctor = JS_NULL;
     ctx->promise_ctor = JS_NULL;
+    ctx->intrinsic_obj = JS_UNDEFINED;
     init_list_head(&ctx->loaded_modules);
 
     JS_AddIntrinsicBasicObjects(ctx);
     return ctx;
 }
 
+/* Date, RegExp, Map/Set, the typed arrays and WeakRef are not
+   created by JS_NewContext(): their global constructors are
+   JS_AUTOINIT_ID_INTRINSIC properties and the whole group is
+   instantiated in the realm of the global object on the first access
+   to one of them or when the engine needs one of their prototypes. */
+static void (* const js_intrinsic_init_table[JS_INTRINSIC_COUNT])(JSContext *ctx) = {
+    JS_AddIntrinsicDate, /* JS_INTRINSIC_DATE */
+    JS_AddIntrinsicRegExp, /* JS_INTRINSIC_REGEXP */
+    JS_AddIntrinsicMapSet, /* JS_INTRINSIC_MAP_SET */
+    js_add_intrinsic_typed_arrays, /* JS_INTRINSIC_TYPED_ARRAYS */
+    JS_AddIntrinsicWeakRef, /* JS_INTRINSIC_WEAK_REF */
+};
+
+/* global constructors of each group, in definition order */
+static const struct {
+    uint8_t group;
+    uint16_t atom;
+} js_intrinsic_globals[] = {
+    { JS_INTRINSIC_DATE, JS_ATOM_Date },
+    { JS_INTRINSIC_REGEXP, JS_ATOM_RegExp },
+    { JS_INTRINSIC_MAP_SET, JS_ATOM_Map },
+    { JS_INTRINSIC_MAP_SET, JS_ATOM_Set },
+    { JS_INTRINSIC_MAP_SET, JS_ATOM_WeakMap },
+    { JS_INTRINSIC_MAP_SET, JS_ATOM_WeakSet },
+    { JS_INTRINSIC_TYPED_ARRAYS, JS_ATOM_ArrayBuffer },
+    { JS_INTRINSIC_TYPED_ARRAYS, JS_ATOM_SharedArrayBuffer },
+    { JS_INTRINSIC_TYPED_ARRAYS, JS_ATOM_Uint8ClampedArray },
+    { JS_INTRINSIC_TYPED_ARRAYS, JS_ATOM_Int8Array },
+    { JS_INTRINSIC_TYPED_ARRAYS, JS_ATOM_Uint8Array },
+    { JS_INTRINSIC_TYPED_ARRAYS, JS_ATOM_Int16Array },
+    { JS_INTRINSIC_TYPED_ARRAYS, JS_ATOM_Uint16Array },
+    { JS_INTRINSIC_TYPED_ARRAYS, JS_ATOM_Int32Array },
+    { JS_INTRINSIC_TYPED_ARRAYS, JS_ATOM_Uint32Array },
+    { JS_INTRINSIC_TYPED_ARRAYS, JS_ATOM_BigInt64Array },
+    { JS_INTRINSIC_TYPED_ARRAYS, JS_ATOM_BigUint64Array },
+    { JS_INTRINSIC_TYPED_ARRAYS, JS_ATOM_Float32Array },
+    { JS_INTRINSIC_TYPED_ARRAYS, JS_ATOM_Float64Array },
+    { JS_INTRINSIC_TYPED_ARRAYS, JS_ATOM_DataView },
+    { JS_INTRINSIC_WEAK_REF, JS_ATOM_WeakRef },
+    { JS_INTRINSIC_WEAK_REF, JS_ATOM_FinalizationRegistry },
+};
+
+static void js_add_lazy_intrinsic(JSContext *ctx, JSIntrinsicEnum group)
+{
+    int i;
+
+    for(i = 0; i < countof(js_intrinsic_globals); i++) {
+        if (js_intrinsic_globals[i].group != group)
+            continue;
+        JS_DefineAutoInitProperty(ctx, ctx->global_obj,
+                                  js_intrinsic_globals[i].atom,
+                                  JS_AUTOINIT_ID_INTRINSIC,
+                                  (void *)(uintptr_t)group,
+                                  JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
+    }
+    ctx->lazy_intrinsics |= 1 << group;
+}
+
+static void js_instantiate_intrinsic(JSContext *ctx, JSIntrinsicEnum group)
+{
+    if (!(ctx->lazy_intrinsics & (1 << group)))
+        return;
+    ctx->lazy_intrinsics &= ~(1 << group);
+    /* the global constructors go to 'intrinsic_obj' because the
+       global object may be in the middle of an autoinit */
+    ctx->in_lazy_intrinsic = TRUE;
+    js_intrinsic_init_table[group](ctx);
+    ctx->in_lazy_intrinsic = FALSE;
+}
+
+static void js_instantiate_class_intrinsic(JSContext *ctx, JSClassID class_id)
+{
+    JSIntrinsicEnum group;
+
+    switch(class_id) {
+    case JS_CLASS_DATE:
+        group = JS_INTRINSIC_DATE;
+        break;
+    case JS_CLASS_REGEXP:
+    case JS_CLASS_REGEXP_STRING_ITERATOR:
+        group = JS_INTRINSIC_REGEXP;
+        break;
+    case JS_CLASS_MAP:
+    case JS_CLASS_SET:
+    case JS_CLASS_WEAKMAP:
+    case JS_CLASS_WEAKSET:
+    case JS_CLASS_MAP_ITERATOR:
+    case JS_CLASS_SET_ITERATOR:
+        group = JS_INTRINSIC_MAP_SET;
+        break;
+    case JS_CLASS_ARRAY_BUFFER:
+    case JS_CLASS_SHARED_ARRAY_BUFFER:
+    case JS_CLASS_UINT8C_ARRAY:
+    case JS_CLASS_INT8_ARRAY:
+    case JS_CLASS_UINT8_ARRAY:
+    case JS_CLASS_INT16_ARRAY:
+    case JS_CLASS_UINT16_ARRAY:
+    case JS_CLASS_INT32_ARRAY:
+    case JS_CLASS_UINT32_ARRAY:
+    case JS_CLASS_BIG_INT64_ARRAY:
+    case JS_CLASS_BIG_UINT64_ARRAY:
+    case JS_CLASS_FLOAT32_ARRAY:
+    case JS_CLASS_FLOAT64_ARRAY:
+    case JS_CLASS_DATAVIEW:
+        group = JS_INTRINSIC_TYPED_ARRAYS;
+        break;
+    case JS_CLASS_WEAK_REF:
+    case JS_CLASS_FINALIZATION_REGISTRY:
+        group = JS_INTRINSIC_WEAK_REF;
+        break;
+    default:
+        return;
+    }
+    js_instantiate_intrinsic(ctx, group);
+}
+
+/* return the prototype of 'class_id', instantiating its intrinsic
+   group if it is still lazy */
+static inline JSValueConst js_get_class_proto(JSContext *ctx, JSClassID class_id)
+{
+    if (unlikely(ctx->lazy_intrinsics != 0) &&
+        JS_IsNull(ctx->class_proto[class_id])) {
+        js_instantiate_class_intrinsic(ctx, class_id);
+    }
+    return ctx->class_proto[class_id];
+}
+
+static JSValue js_intrinsic_autoinit(JSContext *ctx, JSObject *p, JSAtom atom,
+                                     void *opaque)
+{
+    js_instantiate_intrinsic(ctx, (uintptr_t)opaque);
+    return JS_GetProperty(ctx, ctx->intrinsic_obj, atom);
+}
+
 JSContext *JS_NewContext(JSRuntime *rt)
 {
     JSContext *ctx;
@@ -2082,16 +2911,21 @@ JSContext *JS_NewContext(JSRuntime *rt)
         return NULL;
 
     JS_AddIntrinsicBaseObjects(ctx);
-    JS_AddIntrinsicDate(ctx);
+    ctx->intrinsic_obj = JS_NewObjectProto(ctx, JS_NULL);
+    js_add_lazy_intrinsic(ctx, JS_INTRINSIC_DATE);
     JS_AddIntrinsicEval(ctx);
     JS_AddIntrinsicStringNormalize(ctx);
-    JS_AddIntrinsicRegExp(ctx);
+    JS_AddIntrinsicRegExpCompiler(ctx);
+    js_add_lazy_intrinsic(ctx, JS_INTRINSIC_REGEXP);
     JS_AddIntrinsicJSON(ctx);
     JS_AddIntrinsicProxy(ctx);
-    JS_AddIntrinsicMapSet(ctx);
-    JS_AddIntrinsicTypedArrays(ctx);
+    js_add_lazy_intrinsic(ctx, JS_INTRINSIC_MAP_SET);
+    js_add_lazy_intrinsic(ctx, JS_INTRINSIC_TYPED_ARRAYS);
+#ifdef CONFIG_ATOMICS
+    JS_AddIntrinsicAtomics(ctx);
+#endif
     JS_AddIntrinsicPromise(ctx);
-    JS_AddIntrinsicWeakRef(ctx);
+    js_add_lazy_intrinsic(ctx, JS_INTRINSIC_WEAK_REF);
     return ctx;
 }
 
@@ -2126,7 +2960,7 @@ JSValue JS_GetClassProto(JSContext *ctx, JSClassID class_id)
 {
     JSRuntime *rt = ctx->rt;
     assert(class_id < rt->class_count);
-    return JS_DupValue(ctx, ctx->class_proto[class_id]);
+    return JS_DupValue(ctx, js_get_class_proto(ctx, class_id));
 }
 
 typedef enum JSFreeModuleEnum {
@@ -2169,6 +3003,7 @@ static void JS_MarkContext(JSRuntime *rt, JSContext *ctx,
 
     JS_MarkValue(rt, ctx->global_obj, mark_func);
     JS_MarkValue(rt, ctx->global_var_obj, mark_func);
+    JS_MarkValue(rt, ctx->intrinsic_obj, mark_func);
 
     JS_MarkValue(rt, ctx->throw_type_error, mark_func);
     JS_MarkValue(rt, ctx->eval_obj, mark_func);
@@ -2232,6 +3067,7 @@ void JS_FreeContext(JSContext *ctx)
 
     JS_FreeValue(ctx, ctx->global_obj);
     JS_FreeValue(ctx, ctx->global_var_obj);
+    JS_FreeValue(ctx, ctx->intrinsic_obj);
 
     JS_FreeValue(ctx, ctx->throw_type_error);
     JS_FreeValue(ctx, ctx->eval_obj);
@@ -2501,11 +3337,116 @@ static int JS_ResizeAtomHash(JSRuntime *rt, int new_hash_size)
     return 0;
 }
 
+#ifndef DUMP_LEAKS
+/* The predefined atoms are identical in all the runtimes. The first
+   runtime creates them one by one, then they are saved in a static
+   template from which the next runtimes copy their atom table with a
+   few memcpy(): the strings of the predefined atoms are allocated in a
+   single block and the hash table is already built. */
+#define JS_ATOM_TEMPLATE_HASH_SIZE 256
+
+typedef struct JSAtomTemplate {
+    BOOL ready;
+    int atom_size;
+    size_t buf_size;
+    uint32_t offsets[JS_ATOM_END]; /* position of each atom in 'buf' */
+    uint32_t atom_hash[JS_ATOM_TEMPLATE_HASH_SIZE];
+    /* strings of the predefined atoms, 8 byte aligned */
+    uint64_t buf[(JS_ATOM_END * (sizeof(JSString) + 8) + sizeof(js_atom_init)) / 8];
+} JSAtomTemplate;
+
+static JSAtomTemplate js_atom_template;
+#ifdef CONFIG_ATOMICS
+static pthread_mutex_t js_atom_template_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static size_t js_atom_struct_size(const JSAtomStruct *p, int i)
+{
+    if (i == JS_ATOM_NULL)
+        return sizeof(JSAtomStruct);
+    return sizeof(JSString) + (p->len << p->is_wide_char) + 1 - p->is_wide_char;
+}
+
+/* save the predefined atoms of 'rt' in the template */
+static void js_atom_template_init(JSRuntime *rt)
+{
+    JSAtomTemplate *t = &js_atom_template;
+    size_t pos;
+    int i;
+
+    if (rt->atom_hash_size != JS_ATOM_TEMPLATE_HASH_SIZE)
+        return;
+#ifdef CONFIG_ATOMICS
+    pthread_mutex_lock(&js_atom_template_mutex);
+#endif
+    if (!t->ready) {
+        pos = 0;
+        for(i = 0; i < JS_ATOM_END; i++) {
+            t->offsets[i] = pos;
+            pos += (js_atom_struct_size(rt->atom_array[i], i) + 7) & ~7;
+        }
+        assert(pos <= sizeof(t->buf));
+        t->buf_size = pos;
+        for(i = 0; i < JS_ATOM_END; i++) {
+            memcpy((uint8_t *)t->buf + t->offsets[i], rt->atom_array[i],
+                   js_atom_struct_size(rt->atom_array[i], i));
+        }
+        memcpy(t->atom_hash, rt->atom_hash, sizeof(t->atom_hash));
+        t->atom_size = rt->atom_size;
+        t->ready = TRUE;
+    }
+#ifdef CONFIG_ATOMICS
+    pthread_mutex_unlock(&js_atom_template_mutex);
+#endif
+}
+
+static int JS_InitAtomsFromTemplate(JSRuntime *rt)
+{
+    const JSAtomTemplate *t = &js_atom_template;
+    int i;
+
+    rt->atom_hash = js_malloc_rt(rt, sizeof(t->atom_hash));
+    rt->atom_array = js_malloc_rt(rt, sizeof(rt->atom_array[0]) * t->atom_size);
+    rt->predef_atom_buf = js_malloc_rt(rt, t->buf_size);
+    if (!rt->atom_hash || !rt->atom_array || !rt->predef_atom_buf)
+        return -1;
+    memcpy(rt->atom_hash, t->atom_hash, sizeof(t->atom_hash));
+    rt->atom_hash_size = JS_ATOM_TEMPLATE_HASH_SIZE;
+    rt->atom_count_resize = JS_ATOM_COUNT_RESIZE(rt->atom_hash_size);
+    memcpy(rt->predef_atom_buf, t->buf, t->buf_size);
+    for(i = 0; i < JS_ATOM_END; i++)
+        rt->atom_array[i] = (JSAtomStruct *)(rt->predef_atom_buf + t->offsets[i]);
+    rt->atom_size = t->atom_size;
+    rt->atom_count = JS_ATOM_END;
+    rt->atom_free_index = 0;
+    if (JS_ATOM_END < t->atom_size) {
+        rt->atom_free_index = JS_ATOM_END;
+        for(i = JS_ATOM_END; i < t->atom_size; i++)
+            rt->atom_array[i] = atom_set_free(i == t->atom_size - 1 ? 0 : i + 1);
+    }
+    return 0;
+}
+#endif /* !DUMP_LEAKS */
+
 static int JS_InitAtoms(JSRuntime *rt)
 {
     int i, len, atom_type;
     const char *p;
 
+#ifndef DUMP_LEAKS
+    {
+        BOOL ready;
+#ifdef CONFIG_ATOMICS
+        pthread_mutex_lock(&js_atom_template_mutex);
+#endif
+        ready = js_atom_template.ready;
+#ifdef CONFIG_ATOMICS
+        pthread_mutex_unlock(&js_atom_template_mutex);
+#endif
+        if (ready)
+            return JS_InitAtomsFromTemplate(rt);
+    }
+#endif
     rt->atom_hash_size = 0;
     rt->atom_hash = NULL;
     rt->atom_count = 0;
@@ -2527,6 +3468,9 @@ static int JS_InitAtoms(JSRuntime *rt)
             return -1;
         p = p + len + 1;
     }
+#ifndef DUMP_LEAKS
+    js_atom_template_init(rt);
+#endif
     return 0;
 }
 
@@ -4649,9 +5593,9 @@ static int resize_shape_hash(JSRuntime *rt, int new_shape_hash_bits)
         return -1;
     for(i = 0; i < rt->shape_hash_size; i++) {
         for(sh = rt->shape_hash[i]; sh != NULL; sh = sh_next) {
-            sh_next = sh->shape_hash_next;
+            sh_next = get_shape_hash_next(sh);
             h = get_shape_hash(sh->hash, new_shape_hash_bits);
-            sh->shape_hash_next = new_shape_hash[h];
+            set_shape_hash_next(sh, new_shape_hash[h]);
             new_shape_hash[h] = sh;
         }
     }
@@ -4666,7 +5610,7 @@ static void js_shape_hash_link(JSRuntime *rt, JSShape *sh)
 {
     uint32_t h;
     h = get_shape_hash(sh->hash, rt->shape_hash_bits);
-    sh->shape_hash_next = rt->shape_hash[h];
+    set_shape_hash_next(sh, rt->shape_hash[h]);
     rt->shape_hash[h] = sh;
     rt->shape_hash_count++;
 }
@@ -4674,13 +5618,17 @@ static void js_shape_hash_link(JSRuntime *rt, JSShape *sh)
 static void js_shape_hash_unlink(JSRuntime *rt, JSShape *sh)
 {
     uint32_t h;
-    JSShape **psh;
+    JSShape *sh1;
 
     h = get_shape_hash(sh->hash, rt->shape_hash_bits);
-    psh = &rt->shape_hash[h];
-    while (*psh != sh)
-        psh = &(*psh)->shape_hash_next;
-    *psh = sh->shape_hash_next;
+    sh1 = rt->shape_hash[h];
+    if (sh1 == sh) {
+        rt->shape_hash[h] = get_shape_hash_next(sh);
+    } else {
+        while (get_shape_hash_next(sh1) != sh)
+            sh1 = get_shape_hash_next(sh1);
+        set_shape_hash_next(sh1, get_shape_hash_next(sh));
+    }
     rt->shape_hash_count--;
 }
 
@@ -4697,7 +5645,7 @@ static no_inline JSShape *js_new_shape2(JSContext *ctx, JSObject *proto,
         resize_shape_hash(rt, rt->shape_hash_bits + 1);
     }
 
-    sh_alloc = js_malloc(ctx, get_shape_size(hash_size, prop_size));
+    sh_alloc = js_cptr_malloc(ctx, get_shape_size(hash_size, prop_size));
     if (!sh_alloc)
         return NULL;
     sh = get_shape_from_alloc(sh_alloc, hash_size);
@@ -4705,7 +5653,7 @@ static no_inline JSShape *js_new_shape2(JSContext *ctx, JSObject *proto,
     add_gc_object(rt, &sh->header, JS_GC_OBJ_TYPE_SHAPE);
     if (proto)
         JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, proto));
-    sh->proto = proto;
+    set_shape_proto(sh, proto);
     memset(prop_hash_end(sh) - hash_size, 0, sizeof(prop_hash_end(sh)[0]) *
            hash_size);
     sh->prop_hash_mask = hash_size - 1;
@@ -4739,7 +5687,7 @@ static JSShape *js_clone_shape(JSContext *ctx, JSShape *sh1)
 
     hash_size = sh1->prop_hash_mask + 1;
     size = get_shape_size(hash_size, sh1->prop_size);
-    sh_alloc = js_malloc(ctx, size);
+    sh_alloc = js_cptr_malloc(ctx, size);
     if (!sh_alloc)
         return NULL;
     sh_alloc1 = get_alloc_from_shape(sh1);
@@ -4748,8 +5696,8 @@ static JSShape *js_clone_shape(JSContext *ctx, JSShape *sh1)
     sh->header.ref_count = 1;
     add_gc_object(ctx->rt, &sh->header, JS_GC_OBJ_TYPE_SHAPE);
     sh->is_hashed = FALSE;
-    if (sh->proto) {
-        JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, sh->proto));
+    if (get_shape_proto(sh)) {
+        JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, get_shape_proto(sh)));
     }
     for(i = 0, pr = get_shape_prop(sh); i < sh->prop_count; i++, pr++) {
         JS_DupAtom(ctx, pr->atom);
@@ -4771,8 +5719,8 @@ static void js_free_shape0(JSRuntime *rt, JSShape *sh)
     assert(sh->header.ref_count == 0);
     if (sh->is_hashed)
         js_shape_hash_unlink(rt, sh);
-    if (sh->proto != NULL) {
-        JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_OBJECT, sh->proto));
+    if (get_shape_proto(sh) != NULL) {
+        JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_OBJECT, get_shape_proto(sh)));
     }
     pr = get_shape_prop(sh);
     for(i = 0; i < sh->prop_count; i++) {
@@ -4780,7 +5728,7 @@ static void js_free_shape0(JSRuntime *rt, JSShape *sh)
         pr++;
     }
     remove_gc_object(&sh->header);
-    js_free_rt(rt, get_alloc_from_shape(sh));
+    js_cptr_free_rt(rt, get_alloc_from_shape(sh));
 }
 
 static void js_free_shape(JSRuntime *rt, JSShape *sh)
@@ -4813,10 +5761,10 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
        in case of memory allocation failure */
     if (p) {
         JSProperty *new_prop;
-        new_prop = js_realloc(ctx, p->prop, sizeof(new_prop[0]) * new_size);
+        new_prop = js_cptr_realloc(ctx, get_obj_prop(p), sizeof(new_prop[0]) * new_size);
         if (unlikely(!new_prop))
             return -1;
-        p->prop = new_prop;
+        set_obj_prop(p, new_prop);
     }
     new_hash_size = sh->prop_hash_mask + 1;
     while (new_hash_size < new_size)
@@ -4824,7 +5772,7 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
     /* resize the property shapes. Using js_realloc() is not possible in
        case the GC runs during the allocation */
     old_sh = sh;
-    sh_alloc = js_malloc(ctx, get_shape_size(new_hash_size, new_size));
+    sh_alloc = js_cptr_malloc(ctx, get_shape_size(new_hash_size, new_size));
     if (!sh_alloc)
         return -1;
     sh = get_shape_from_alloc(sh_alloc, new_hash_size);
@@ -4852,7 +5800,7 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
         memcpy(prop_hash_end(sh) - new_hash_size, prop_hash_end(old_sh) - new_hash_size,
                sizeof(prop_hash_end(sh)[0]) * new_hash_size);
     }
-    js_free(ctx, get_alloc_from_shape(old_sh));
+    js_cptr_free(ctx, get_alloc_from_shape(old_sh));
     *psh = sh;
     sh->prop_size = new_size;
     return 0;
@@ -4868,7 +5816,7 @@ static int compact_properties(JSContext *ctx, JSObject *p)
     JSShapeProperty *old_pr, *pr;
     JSProperty *prop, *new_prop;
 
-    sh = p->shape;
+    sh = get_obj_shape(p);
     assert(!sh->is_hashed);
 
     new_size = max_int(JS_PROP_INITIAL_SIZE,
@@ -4882,7 +5830,7 @@ static int compact_properties(JSContext *ctx, JSObject *p)
 
     /* resize the hash table and the properties */
     old_sh = sh;
-    sh_alloc = js_malloc(ctx, get_shape_size(new_hash_size, new_size));
+    sh_alloc = js_cptr_malloc(ctx, get_shape_size(new_hash_size, new_size));
     if (!sh_alloc)
         return -1;
     sh = get_shape_from_alloc(sh_alloc, new_hash_size);
@@ -4896,7 +5844,7 @@ static int compact_properties(JSContext *ctx, JSObject *p)
     j = 0;
     old_pr = old_sh->prop;
     pr = sh->prop;
-    prop = p->prop;
+    prop = get_obj_prop(p);
     for(i = 0; i < sh->prop_count; i++) {
         if (old_pr->atom != JS_ATOM_NULL) {
             pr->atom = old_pr->atom;
@@ -4916,13 +5864,13 @@ static int compact_properties(JSContext *ctx, JSObject *p)
     sh->deleted_prop_count = 0;
     sh->prop_count = j;
 
-    p->shape = sh;
-    js_free(ctx, get_alloc_from_shape(old_sh));
+    set_obj_shape(p, sh);
+    js_cptr_free(ctx, get_alloc_from_shape(old_sh));
 
     /* reduce the size of the object properties */
-    new_prop = js_realloc(ctx, p->prop, sizeof(new_prop[0]) * new_size);
+    new_prop = js_cptr_realloc(ctx, get_obj_prop(p), sizeof(new_prop[0]) * new_size);
     if (new_prop)
-        p->prop = new_prop;
+        set_obj_prop(p, new_prop);
     return 0;
 }
 
@@ -4979,9 +5927,9 @@ static JSShape *find_hashed_shape_proto(JSRuntime *rt, JSObject *proto)
 
     h = shape_initial_hash(proto);
     h1 = get_shape_hash(h, rt->shape_hash_bits);
-    for(sh1 = rt->shape_hash[h1]; sh1 != NULL; sh1 = sh1->shape_hash_next) {
+    for(sh1 = rt->shape_hash[h1]; sh1 != NULL; sh1 = get_shape_hash_next(sh1)) {
         if (sh1->hash == h &&
-            sh1->proto == proto &&
+            get_shape_proto(sh1) == proto &&
             sh1->prop_count == 0) {
             return sh1;
         }
@@ -5001,11 +5949,11 @@ static JSShape *find_hashed_shape_prop(JSRuntime *rt, JSShape *sh,
     h = shape_hash(h, atom);
     h = shape_hash(h, prop_flags);
     h1 = get_shape_hash(h, rt->shape_hash_bits);
-    for(sh1 = rt->shape_hash[h1]; sh1 != NULL; sh1 = sh1->shape_hash_next) {
+    for(sh1 = rt->shape_hash[h1]; sh1 != NULL; sh1 = get_shape_hash_next(sh1)) {
         /* we test the hash first so that the rest is done only if the
            shapes really match */
         if (sh1->hash == h &&
-            sh1->proto == sh->proto &&
+            get_shape_proto(sh1) == get_shape_proto(sh) &&
             sh1->prop_count == ((n = sh->prop_count) + 1)) {
             for(i = 0; i < n; i++) {
                 if (unlikely(sh1->prop[i].atom != sh->prop[i].atom) ||
@@ -5030,7 +5978,7 @@ static __maybe_unused void JS_DumpShape(JSRuntime *rt, int i, JSShape *sh)
     /* XXX: should output readable class prototype */
     printf("%5d %3d%c %14p %5d %5d", i,
            sh->header.ref_count, " *"[sh->is_hashed],
-           (void *)sh->proto, sh->prop_size, sh->prop_count);
+           (void *)get_shape_proto(sh), sh->prop_size, sh->prop_count);
     for(j = 0; j < sh->prop_count; j++) {
         printf(" %s", JS_AtomGetStrRT(rt, atom_buf, sizeof(atom_buf),
                                       sh->prop[j].atom));
@@ -5049,7 +5997,7 @@ static __maybe_unused void JS_DumpShapes(JSRuntime *rt)
     printf("JSShapes: {\n");
     printf("%5s %4s %14s %5s %5s %s\n", "SLOT", "REFS", "PROTO", "SIZE", "COUNT", "PROPS");
     for(i = 0; i < rt->shape_hash_size; i++) {
-        for(sh = rt->shape_hash[i]; sh != NULL; sh = sh->shape_hash_next) {
+        for(sh = rt->shape_hash[i]; sh != NULL; sh = get_shape_hash_next(sh)) {
             JS_DumpShape(rt, i, sh);
             assert(sh->is_hashed);
         }
@@ -5059,8 +6007,8 @@ static __maybe_unused void JS_DumpShapes(JSRuntime *rt)
         gp = list_entry(el, JSGCObjectHeader, link);
         if (gp->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT) {
             p = (JSObject *)gp;
-            if (!p->shape->is_hashed) {
-                JS_DumpShape(rt, -1, p->shape);
+            if (!get_obj_shape(p)->is_hashed) {
+                JS_DumpShape(rt, -1, get_obj_shape(p));
             }
         }
     }
@@ -5070,9 +6018,10 @@ static __maybe_unused void JS_DumpShapes(JSRuntime *rt)
 static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID class_id)
 {
     JSObject *p;
+    JSProperty *prop;
 
     js_trigger_gc(ctx->rt, sizeof(JSObject));
-    p = js_malloc(ctx, sizeof(JSObject));
+    p = js_cptr_malloc(ctx, sizeof(JSObject));
     if (unlikely(!p))
         goto fail;
     p->class_id = class_id;
@@ -5086,14 +6035,15 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
     p->is_HTMLDDA = 0;
     p->weakref_count = 0;
     p->u.opaque = NULL;
-    p->shape = sh;
-    p->prop = js_malloc(ctx, sizeof(JSProperty) * sh->prop_size);
-    if (unlikely(!p->prop)) {
-        js_free(ctx, p);
+    set_obj_shape(p, sh);
+    prop = js_cptr_malloc(ctx, sizeof(JSProperty) * sh->prop_size);
+    if (unlikely(!prop)) {
+        js_cptr_free(ctx, p);
     fail:
         js_free_shape(ctx->rt, sh);
         return JS_EXCEPTION;
     }
+    set_obj_prop(p, prop);
 
     switch(class_id) {
     case JS_CLASS_OBJECT:
@@ -5108,7 +6058,7 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
             p->u.array.u1.size = 0;
             /* the length property is always the first one */
             if (likely(sh == ctx->array_shape)) {
-                pr = &p->prop[0];
+                pr = &get_obj_prop(p)[0];
             } else {
                 /* only used for the first array */
                 /* cannot fail */
@@ -5119,7 +6069,7 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
         }
         break;
     case JS_CLASS_C_FUNCTION:
-        p->prop[0].u.value = JS_UNDEFINED;
+        get_obj_prop(p)[0].u.value = JS_UNDEFINED;
         break;
     case JS_CLASS_ARGUMENTS:
     case JS_CLASS_UINT8C_ARRAY:
@@ -5242,7 +6192,7 @@ static int JS_SetObjectData(JSContext *ctx, JSValueConst obj, JSValue val)
 
 JSValue JS_NewObjectClass(JSContext *ctx, int class_id)
 {
-    return JS_NewObjectProtoClass(ctx, ctx->class_proto[class_id], class_id);
+    return JS_NewObjectProtoClass(ctx, js_get_class_proto(ctx, class_id), class_id);
 }
 
 JSValue JS_NewObjectProto(JSContext *ctx, JSValueConst proto)
@@ -5479,22 +6429,26 @@ JSValue JS_NewCFunctionData(JSContext *ctx, JSCFunctionData *func,
 
 static JSContext *js_autoinit_get_realm(JSProperty *pr)
 {
-    return (JSContext *)(pr->u.init.realm_and_id & ~3);
+    return (JSContext *)(pr->u.init.realm_and_id & ~JS_AUTOINIT_ID_MASK);
 }
 
 static JSAutoInitIDEnum js_autoinit_get_id(JSProperty *pr)
 {
-    return pr->u.init.realm_and_id & 3;
+    return pr->u.init.realm_and_id & JS_AUTOINIT_ID_MASK;
 }
 
 static void js_autoinit_free(JSRuntime *rt, JSProperty *pr)
 {
+    if (js_autoinit_get_id(pr) == JS_AUTOINIT_ID_BACKTRACE)
+        js_free_backtrace(rt, pr->u.init.opaque);
     JS_FreeContext(js_autoinit_get_realm(pr));
 }
 
 static void js_autoinit_mark(JSRuntime *rt, JSProperty *pr,
                              JS_MarkFunc *mark_func)
 {
+    if (js_autoinit_get_id(pr) == JS_AUTOINIT_ID_BACKTRACE)
+        js_mark_backtrace(rt, pr->u.init.opaque, mark_func);
     mark_func(rt, &js_autoinit_get_realm(pr)->header);
 }
 
@@ -5522,7 +6476,7 @@ static force_inline JSShapeProperty *find_own_property1(JSObject *p,
     JSShape *sh;
     JSShapeProperty *pr, *prop;
     intptr_t h;
-    sh = p->shape;
+    sh = get_obj_shape(p);
     h = (uintptr_t)atom & sh->prop_hash_mask;
     h = prop_hash_end(sh)[-h - 1];
     prop = get_shape_prop(sh);
@@ -5543,14 +6497,14 @@ static force_inline JSShapeProperty *find_own_property(JSProperty **ppr,
     JSShape *sh;
     JSShapeProperty *pr, *prop;
     intptr_t h;
-    sh = p->shape;
+    sh = get_obj_shape(p);
     h = (uintptr_t)atom & sh->prop_hash_mask;
     h = prop_hash_end(sh)[-h - 1];
     prop = get_shape_prop(sh);
     while (h) {
         pr = &prop[h - 1];
         if (likely(pr->atom == atom)) {
-            *ppr = &p->prop[h - 1];
+            *ppr = &get_obj_prop(p)[h - 1];
             /* the compiler should be able to assume that pr != NULL here */
             return pr;
         }
@@ -5747,20 +6701,20 @@ static void free_object(JSRuntime *rt, JSObject *p)
     p->free_mark = 1; /* used to tell the object is invalid when
                          freeing cycles */
     /* free all the fields */
-    sh = p->shape;
+    sh = get_obj_shape(p);
     pr = get_shape_prop(sh);
     for(i = 0; i < sh->prop_count; i++) {
-        free_property(rt, &p->prop[i], pr->flags);
+        free_property(rt, &get_obj_prop(p)[i], pr->flags);
         pr++;
     }
-    js_free_rt(rt, p->prop);
+    js_cptr_free_rt(rt, get_obj_prop(p));
     /* as an optimization we destroy the shape immediately without
        putting it in gc_zero_ref_count_list */
     js_free_shape(rt, sh);
 
     /* fail safe */
-    p->shape = NULL;
-    p->prop = NULL;
+    set_obj_shape(p, NULL);
+    set_obj_prop(p, NULL);
 
     finalizer = rt->class_array[p->class_id].finalizer;
     if (finalizer)
@@ -5775,7 +6729,7 @@ static void free_object(JSRuntime *rt, JSObject *p)
     remove_gc_object(&p->header);
     if (rt->gc_phase == JS_GC_PHASE_REMOVE_CYCLES) {
         if (p->header.ref_count == 0 && p->weakref_count == 0) {
-            js_free_rt(rt, p);
+            js_cptr_free_rt(rt, p);
         } else {
             /* keep the object structure because there are may be
                references to it */
@@ -5784,7 +6738,7 @@ static void free_object(JSRuntime *rt, JSObject *p)
     } else {
         /* keep the object structure in case there are weak references to it */
         if (p->weakref_count == 0) {
-            js_free_rt(rt, p);
+            js_cptr_free_rt(rt, p);
         } else {
             p->header.mark = 0; /* reset the mark so that the weakref can be freed */
         }
@@ -5973,12 +6927,12 @@ static void mark_children(JSRuntime *rt, JSGCObjectHeader *gp,
             JSShapeProperty *prs;
             JSShape *sh;
             int i;
-            sh = p->shape;
+            sh = get_obj_shape(p);
             mark_func(rt, &sh->header);
             /* mark all the fields */
             prs = get_shape_prop(sh);
             for(i = 0; i < sh->prop_count; i++) {
-                JSProperty *pr = &p->prop[i];
+                JSProperty *pr = &get_obj_prop(p)[i];
                 if (prs->atom != JS_ATOM_NULL) {
                     if (prs->flags & JS_PROP_TMASK) {
                         if ((prs->flags & JS_PROP_TMASK) == JS_PROP_GETSET) {
@@ -6051,13 +7005,15 @@ static void mark_children(JSRuntime *rt, JSGCObjectHeader *gp,
             }
             JS_MarkValue(rt, s->resolving_funcs[0], mark_func);
             JS_MarkValue(rt, s->resolving_funcs[1], mark_func);
+            JS_MarkValue(rt, s->await_funcs[0], mark_func);
+            JS_MarkValue(rt, s->await_funcs[1], mark_func);
         }
         break;
     case JS_GC_OBJ_TYPE_SHAPE:
         {
             JSShape *sh = (JSShape *)gp;
-            if (sh->proto != NULL) {
-                mark_func(rt, &sh->proto->header);
+            if (get_shape_proto(sh) != NULL) {
+                mark_func(rt, &get_shape_proto(sh)->header);
             }
         }
         break;
@@ -6186,10 +7142,13 @@ static void gc_free_cycles(JSRuntime *rt)
         assert(p->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT ||
                p->gc_obj_type == JS_GC_OBJ_TYPE_FUNCTION_BYTECODE ||
                p->gc_obj_type == JS_GC_OBJ_TYPE_ASYNC_FUNCTION);
-        if (p->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT &&
-            ((JSObject *)p)->weakref_count != 0) {
-            /* keep the object because there are weak references to it */
-            p->mark = 0;
+        if (p->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT) {
+            if (((JSObject *)p)->weakref_count != 0) {
+                /* keep the object because there are weak references to it */
+                p->mark = 0;
+            } else {
+                js_cptr_free_rt(rt, p);
+            }
         } else {
             js_free_rt(rt, p);
         }
@@ -6282,16 +7241,19 @@ static void compute_bytecode_size(JSFunctionBytecode *b, JSMemoryUsage_helper *h
     if (!b->read_only_bytecode && b->byte_code_buf) {
         hp->js_func_code_size += b->byte_code_len;
     }
-    if (b->has_debug) {
-        js_func_size += sizeof(*b) - offsetof(JSFunctionBytecode, debug);
-        if (b->debug.source) {
-            memory_used_count++;
-            js_func_size += b->debug.source_len + 1;
+    if (b->debug) {
+        JSFunctionDebug *d = b->debug;
+        memory_used_count++;
+        js_func_size += sizeof(*d);
+        if (d->buf && d->buf->data == d->buf->buf) {
+            /* the shared buffers are counted in proportion of their users
+               (not counted if read-only data) */
+            js_func_size += (d->buf->len + 1) / d->buf->ref_count;
         }
-        if (b->debug.pc2line_len) {
+        if (d->pc2line_len && d->pc2line_buf == d->pc2line_data) {
             memory_used_count++;
             hp->js_func_pc2line_count += 1;
-            hp->js_func_pc2line_size += b->debug.pc2line_len;
+            hp->js_func_pc2line_size += d->pc2line_len;
         }
     }
     hp->js_func_size += js_func_size;
@@ -6387,15 +7349,15 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
             continue;
         }
         p = (JSObject *)gp;
-        sh = p->shape;
+        sh = get_obj_shape(p);
         s->obj_count++;
-        if (p->prop) {
+        if (get_obj_prop(p)) {
             s->memory_used_count++;
-            s->prop_size += sh->prop_size * sizeof(*p->prop);
+            s->prop_size += sh->prop_size * sizeof(*get_obj_prop(p));
             s->prop_count += sh->prop_count;
             prs = get_shape_prop(sh);
             for(i = 0; i < sh->prop_count; i++) {
-                JSProperty *pr = &p->prop[i];
+                JSProperty *pr = &get_obj_prop(p)[i];
                 if (prs->atom != JS_ATOM_NULL && !(prs->flags & JS_PROP_TMASK)) {
                     compute_value_size(pr->u.value, hp);
                 }
@@ -6557,7 +7519,7 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
     s->memory_used_size += sizeof(rt->shape_hash[0]) * rt->shape_hash_size;
     for(i = 0; i < rt->shape_hash_size; i++) {
         JSShape *sh;
-        for(sh = rt->shape_hash[i]; sh != NULL; sh = sh->shape_hash_next) {
+        for(sh = rt->shape_hash[i]; sh != NULL; sh = get_shape_hash_next(sh)) {
             int hash_size = sh->prop_hash_mask + 1;
             s->shape_count++;
             s->shape_size += get_shape_size(hash_size, sh->prop_size);
@@ -6717,6 +7679,693 @@ void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt)
     }
 }
 
+/* Heap snapshot in the Chrome DevTools format (.heapsnapshot). The
+   nodes are the GC objects and the reference counted values (strings,
+   bigints). The edges are enumerated as in mark_children(). The
+   objects whose reference count is larger than the number of
+   references from the other nodes are linked to the root node. */
+
+/* order of the "node_types" field */
+typedef enum {
+    JS_HS_NODE_HIDDEN,
+    JS_HS_NODE_ARRAY,
+    JS_HS_NODE_STRING,
+    JS_HS_NODE_OBJECT,
+    JS_HS_NODE_CODE,
+    JS_HS_NODE_CLOSURE,
+    JS_HS_NODE_REGEXP,
+    JS_HS_NODE_NUMBER,
+    JS_HS_NODE_NATIVE,
+    JS_HS_NODE_SYNTHETIC,
+    JS_HS_NODE_CONCATENATED_STRING,
+    JS_HS_NODE_SLICED_STRING,
+    JS_HS_NODE_SYMBOL,
+    JS_HS_NODE_BIGINT,
+    JS_HS_NODE_OBJECT_SHAPE,
+} JSHeapSnapshotNodeTypeEnum;
+
+/* order of the "edge_types" field */
+typedef enum {
+    JS_HS_EDGE_CONTEXT,
+    JS_HS_EDGE_ELEMENT,
+    JS_HS_EDGE_PROPERTY,
+    JS_HS_EDGE_INTERNAL,
+    JS_HS_EDGE_HIDDEN,
+    JS_HS_EDGE_SHORTCUT,
+    JS_HS_EDGE_WEAK,
+} JSHeapSnapshotEdgeTypeEnum;
+
+/* the fixed names are stored after the atoms in the string table */
+typedef enum {
+    JS_HS_NAME_ROOT,
+    JS_HS_NAME_SHAPE,
+    JS_HS_NAME_VAR_REF,
+    JS_HS_NAME_ASYNC_FUNCTION,
+    JS_HS_NAME_CONTEXT,
+    JS_HS_NAME_ROPE,
+    JS_HS_NAME_BIGINT,
+    JS_HS_NAME_PROTO,
+    JS_HS_NAME_MAP,
+    JS_HS_NAME_CODE,
+    JS_HS_NAME_HOME_OBJECT,
+    JS_HS_NAME_REALM,
+    JS_HS_NAME_FIRST,
+    JS_HS_NAME_SECOND,
+    JS_HS_NAME_COUNT,
+} JSHeapSnapshotNameEnum;
+
+static const char * const js_hs_names[JS_HS_NAME_COUNT] = {
+    "(GC roots)",
+    "(shape)",
+    "(var ref)",
+    "(async function)",
+    "(context)",
+    "(concatenated string)",
+    "(bigint)",
+    "__proto__",
+    "map",
+    "code",
+    "home_object",
+    "realm",
+    "first",
+    "second",
+};
+
+#define JS_HS_NODE_FIELD_COUNT 7
+#define JS_HS_MAX_STRING_LEN   1024 /* longer string names are truncated */
+
+/* the low 2 bits of the node pointers give the kind of node */
+#define JS_HS_KIND_GC     0
+#define JS_HS_KIND_STRING 1
+#define JS_HS_KIND_ROPE   2
+#define JS_HS_KIND_BIGINT 3
+#define JS_HS_KIND_MASK   3
+
+typedef struct JSHeapSnapshotNode {
+    uintptr_t ptr; /* pointer | JS_HS_KIND_x, 0 for the root */
+    uint32_t edge_count;
+    uint32_t ref_count; /* number of references from the other nodes */
+} JSHeapSnapshotNode;
+
+typedef struct JSHeapSnapshotState {
+    JSRuntime *rt;
+    FILE *f;
+    /* FALSE: the nodes are collected and their edges are counted.
+       TRUE: the edges are written. */
+    BOOL write_edges;
+    BOOL is_first_edge;
+    BOOL error;
+    JSHeapSnapshotNode *nodes;
+    uint32_t node_count;
+    uint32_t node_size;
+    uint32_t *hash_table; /* node index + 1, 0 if empty */
+    int hash_bits; /* size = 2 * node_size */
+    uint32_t cur_node; /* node whose edges are enumerated */
+    uint32_t hidden_index; /* index of the next hidden edge of cur_node */
+    uint32_t edge_count;
+} JSHeapSnapshotState;
+
+static uint32_t js_hs_hash(uintptr_t ptr, int bits)
+{
+    return ((uint64_t)(ptr >> 3) * 0x9E3779B97F4A7C15) >> (64 - bits);
+}
+
+static int js_hs_resize(JSHeapSnapshotState *s, uint32_t new_size)
+{
+    JSHeapSnapshotNode *new_nodes;
+    uint32_t *new_hash, i, h, mask;
+    int bits;
+
+    new_nodes = js_realloc_rt(s->rt, s->nodes, sizeof(s->nodes[0]) * new_size);
+    if (!new_nodes)
+        return -1;
+    s->nodes = new_nodes;
+    s->node_size = new_size;
+    bits = 32 - clz32(new_size);
+    new_hash = js_mallocz_rt(s->rt, sizeof(new_hash[0]) << bits);
+    if (!new_hash)
+        return -1;
+    js_free_rt(s->rt, s->hash_table);
+    s->hash_table = new_hash;
+    s->hash_bits = bits;
+    mask = (1 << bits) - 1;
+    /* the root is not in the hash table */
+    for(i = 1; i < s->node_count; i++) {
+        h = js_hs_hash(s->nodes[i].ptr, bits);
+        while (new_hash[h] != 0)
+            h = (h + 1) & mask;
+        new_hash[h] = i + 1;
+    }
+    return 0;
+}
+
+/* return the node index or -1 if error */
+static int js_hs_get_node(JSHeapSnapshotState *s, uintptr_t ptr)
+{
+    uint32_t h, mask, idx;
+    JSHeapSnapshotNode *n;
+
+    mask = (1 << s->hash_bits) - 1;
+    h = js_hs_hash(ptr, s->hash_bits);
+    for(;;) {
+        idx = s->hash_table[h];
+        if (idx == 0)
+            break;
+        if (s->nodes[idx - 1].ptr == ptr)
+            return idx - 1;
+        h = (h + 1) & mask;
+    }
+    if (s->write_edges)
+        abort(); /* all the nodes are found during the first pass */
+    if (s->node_count >= s->node_size) {
+        if (js_hs_resize(s, s->node_size + s->node_size / 2)) {
+            s->error = TRUE;
+            return -1;
+        }
+        return js_hs_get_node(s, ptr);
+    }
+    idx = s->node_count++;
+    n = &s->nodes[idx];
+    n->ptr = ptr;
+    n->edge_count = 0;
+    n->ref_count = 0;
+    s->hash_table[h] = idx + 1;
+    return idx;
+}
+
+/* 'counted' is FALSE if the edge does not hold a reference */
+static void js_hs_edge(JSHeapSnapshotState *s, JSHeapSnapshotEdgeTypeEnum type,
+                       uint32_t name, uintptr_t ptr, BOOL counted)
+{
+    int idx;
+
+    idx = js_hs_get_node(s, ptr);
+    if (idx < 0)
+        return;
+    if (type == JS_HS_EDGE_HIDDEN)
+        name = s->hidden_index++;
+    if (!s->write_edges) {
+        s->nodes[s->cur_node].edge_count++;
+        if (counted)
+            s->nodes[idx].ref_count++;
+        s->edge_count++;
+    } else {
+        fprintf(s->f, "%s%d,%u,%u\n", s->is_first_edge ? "" : ",",
+                type, name, idx * JS_HS_NODE_FIELD_COUNT);
+        s->is_first_edge = FALSE;
+    }
+}
+
+static void js_hs_value_edge(JSHeapSnapshotState *s,
+                             JSHeapSnapshotEdgeTypeEnum type, uint32_t name,
+                             JSValueConst val)
+{
+    uintptr_t ptr;
+
+    switch(JS_VALUE_GET_TAG(val)) {
+    case JS_TAG_OBJECT:
+    case JS_TAG_FUNCTION_BYTECODE:
+        ptr = (uintptr_t)JS_VALUE_GET_PTR(val) | JS_HS_KIND_GC;
+        break;
+    case JS_TAG_STRING:
+        ptr = (uintptr_t)JS_VALUE_GET_PTR(val) | JS_HS_KIND_STRING;
+        break;
+    case JS_TAG_STRING_ROPE:
+        ptr = (uintptr_t)JS_VALUE_GET_PTR(val) | JS_HS_KIND_ROPE;
+        break;
+    case JS_TAG_BIG_INT:
+        ptr = (uintptr_t)JS_VALUE_GET_PTR(val) | JS_HS_KIND_BIGINT;
+        break;
+    default:
+        return;
+    }
+    js_hs_edge(s, type, name, ptr, TRUE);
+}
+
+/* edge named by a property atom */
+static void js_hs_prop_edge(JSHeapSnapshotState *s, JSAtom atom,
+                            JSValueConst val)
+{
+    if (__JS_AtomIsTaggedInt(atom))
+        js_hs_value_edge(s, JS_HS_EDGE_ELEMENT, __JS_AtomToUInt32(atom), val);
+    else
+        js_hs_value_edge(s, JS_HS_EDGE_PROPERTY, atom, val);
+}
+
+static void js_hs_mark_func(JSRuntime *rt, JSGCObjectHeader *gp)
+{
+    js_hs_edge(rt->heap_snapshot, JS_HS_EDGE_HIDDEN, 0, (uintptr_t)gp, TRUE);
+}
+
+static uint32_t js_hs_name(JSHeapSnapshotState *s, JSHeapSnapshotNameEnum name)
+{
+    return s->rt->atom_size + name;
+}
+
+static void js_hs_object_edges(JSHeapSnapshotState *s, JSObject *p)
+{
+    JSRuntime *rt = s->rt;
+    JSShape *sh;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    JSObject *proto;
+    int i;
+
+    sh = get_obj_shape(p);
+    /* the prototype is referenced by the shape */
+    proto = get_shape_proto(sh);
+    if (proto) {
+        js_hs_edge(s, JS_HS_EDGE_INTERNAL, js_hs_name(s, JS_HS_NAME_PROTO),
+                   (uintptr_t)proto, FALSE);
+    }
+    js_hs_edge(s, JS_HS_EDGE_INTERNAL, js_hs_name(s, JS_HS_NAME_MAP),
+               (uintptr_t)sh, TRUE);
+    prs = get_shape_prop(sh);
+    for(i = 0; i < sh->prop_count; i++, prs++) {
+        pr = &get_obj_prop(p)[i];
+        if (prs->atom == JS_ATOM_NULL)
+            continue;
+        switch(prs->flags & JS_PROP_TMASK) {
+        case JS_PROP_NORMAL:
+            js_hs_prop_edge(s, prs->atom, pr->u.value);
+            break;
+        case JS_PROP_GETSET:
+            if (pr->u.getset.getter) {
+                js_hs_prop_edge(s, prs->atom,
+                                JS_MKPTR(JS_TAG_OBJECT, pr->u.getset.getter));
+            }
+            if (pr->u.getset.setter) {
+                js_hs_prop_edge(s, prs->atom,
+                                JS_MKPTR(JS_TAG_OBJECT, pr->u.getset.setter));
+            }
+            break;
+        case JS_PROP_VARREF:
+            js_hs_edge(s, JS_HS_EDGE_PROPERTY, prs->atom,
+                       (uintptr_t)pr->u.var_ref, TRUE);
+            break;
+        case JS_PROP_AUTOINIT:
+            js_autoinit_mark(rt, pr, js_hs_mark_func);
+            break;
+        }
+    }
+
+    switch(p->class_id) {
+    case JS_CLASS_OBJECT:
+        break;
+    case JS_CLASS_ARRAY:
+    case JS_CLASS_ARGUMENTS:
+        for(i = 0; i < p->u.array.count; i++) {
+            js_hs_value_edge(s, JS_HS_EDGE_ELEMENT, i,
+                             p->u.array.u.values[i]);
+        }
+        break;
+    case JS_CLASS_BYTECODE_FUNCTION:
+        {
+            JSFunctionBytecode *b = p->u.func.function_bytecode;
+            JSVarRef **var_refs = p->u.func.var_refs;
+
+            if (p->u.func.home_object) {
+                js_hs_edge(s, JS_HS_EDGE_INTERNAL,
+                           js_hs_name(s, JS_HS_NAME_HOME_OBJECT),
+                           (uintptr_t)p->u.func.home_object, TRUE);
+            }
+            if (!b)
+                break;
+            if (var_refs) {
+                for(i = 0; i < b->closure_var_count; i++) {
+                    if (!var_refs[i])
+                        continue;
+                    if (b->closure_var) {
+                        js_hs_edge(s, JS_HS_EDGE_CONTEXT,
+                                   b->closure_var[i].var_name,
+                                   (uintptr_t)var_refs[i], TRUE);
+                    } else {
+                        js_hs_edge(s, JS_HS_EDGE_HIDDEN, 0,
+                                   (uintptr_t)var_refs[i], TRUE);
+                    }
+                }
+            }
+            js_hs_edge(s, JS_HS_EDGE_INTERNAL, js_hs_name(s, JS_HS_NAME_CODE),
+                       (uintptr_t)b, TRUE);
+        }
+        break;
+    default:
+        {
+            JSClassGCMark *gc_mark;
+            gc_mark = rt->class_array[p->class_id].gc_mark;
+            if (gc_mark)
+                gc_mark(rt, JS_MKPTR(JS_TAG_OBJECT, p), js_hs_mark_func);
+        }
+        break;
+    }
+}
+
+static void js_hs_node_edges(JSHeapSnapshotState *s, uint32_t idx)
+{
+    uintptr_t ptr = s->nodes[idx].ptr;
+    void *p = (void *)(ptr & ~JS_HS_KIND_MASK);
+
+    s->cur_node = idx;
+    s->hidden_index = 0;
+    switch(ptr & JS_HS_KIND_MASK) {
+    case JS_HS_KIND_GC:
+        {
+            JSGCObjectHeader *gp = p;
+            switch(gp->gc_obj_type) {
+            case JS_GC_OBJ_TYPE_JS_OBJECT:
+                js_hs_object_edges(s, p);
+                break;
+            case JS_GC_OBJ_TYPE_FUNCTION_BYTECODE:
+                {
+                    JSFunctionBytecode *b = p;
+                    int i;
+                    for(i = 0; i < b->cpool_count; i++)
+                        js_hs_value_edge(s, JS_HS_EDGE_HIDDEN, 0, b->cpool[i]);
+                    if (b->realm) {
+                        js_hs_edge(s, JS_HS_EDGE_INTERNAL,
+                                   js_hs_name(s, JS_HS_NAME_REALM),
+                                   (uintptr_t)b->realm, TRUE);
+                    }
+                }
+                break;
+            case JS_GC_OBJ_TYPE_VAR_REF:
+                {
+                    JSVarRef *var_ref = p;
+                    if (var_ref->is_detached)
+                        js_hs_value_edge(s, JS_HS_EDGE_HIDDEN, 0, *var_ref->pvalue);
+                    else
+                        mark_children(s->rt, gp, js_hs_mark_func);
+                }
+                break;
+            default:
+                mark_children(s->rt, gp, js_hs_mark_func);
+                break;
+            }
+        }
+        break;
+    case JS_HS_KIND_ROPE:
+        {
+            JSStringRope *r = p;
+            js_hs_value_edge(s, JS_HS_EDGE_INTERNAL,
+                             js_hs_name(s, JS_HS_NAME_FIRST), r->left);
+            js_hs_value_edge(s, JS_HS_EDGE_INTERNAL,
+                             js_hs_name(s, JS_HS_NAME_SECOND), r->right);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* the root references the nodes which are referenced from outside
+   the heap graph (C code, stack frames, atoms...) */
+static void js_hs_root_edges(JSHeapSnapshotState *s)
+{
+    uint32_t i;
+    int ref_count;
+
+    s->cur_node = 0;
+    s->hidden_index = 0;
+    for(i = 1; i < s->node_count; i++) {
+        /* all the nodes start with a 32 bit reference count */
+        ref_count = *(int *)(s->nodes[i].ptr & ~JS_HS_KIND_MASK);
+        if (ref_count > s->nodes[i].ref_count) {
+            js_hs_edge(s, JS_HS_EDGE_ELEMENT, s->hidden_index++,
+                       s->nodes[i].ptr, FALSE);
+        }
+    }
+}
+
+/* name of the constructor for the plain objects */
+static JSAtom js_hs_object_name(JSRuntime *rt, JSObject *p)
+{
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    JSObject *proto, *p1;
+
+    if (p->class_id == JS_CLASS_BYTECODE_FUNCTION) {
+        if (p->u.func.function_bytecode->func_name != JS_ATOM_NULL)
+            return p->u.func.function_bytecode->func_name;
+    } else if (p->class_id == JS_CLASS_OBJECT) {
+        proto = get_shape_proto(get_obj_shape(p));
+        if (proto) {
+            prs = find_own_property(&pr, proto, JS_ATOM_constructor);
+            if (prs && (prs->flags & JS_PROP_TMASK) == JS_PROP_NORMAL &&
+                JS_VALUE_GET_TAG(pr->u.value) == JS_TAG_OBJECT) {
+                p1 = JS_VALUE_GET_OBJ(pr->u.value);
+                if (p1->class_id == JS_CLASS_BYTECODE_FUNCTION &&
+                    p1->u.func.function_bytecode->func_name != JS_ATOM_NULL)
+                    return p1->u.func.function_bytecode->func_name;
+            }
+        }
+    }
+    return rt->class_array[p->class_id].class_name;
+}
+
+static void js_hs_write_node(JSHeapSnapshotState *s, uint32_t idx,
+                             uint32_t *pstring_index)
+{
+    JSRuntime *rt = s->rt;
+    uintptr_t ptr = s->nodes[idx].ptr;
+    void *p = (void *)(ptr & ~JS_HS_KIND_MASK);
+    JSHeapSnapshotNodeTypeEnum type;
+    uint32_t name;
+    size_t size;
+
+    if (idx == 0) {
+        type = JS_HS_NODE_SYNTHETIC;
+        name = js_hs_name(s, JS_HS_NAME_ROOT);
+        size = 0;
+    } else switch(ptr & JS_HS_KIND_MASK) {
+    case JS_HS_KIND_STRING:
+        {
+            JSString *str = p;
+            type = JS_HS_NODE_STRING;
+            name = (*pstring_index)++;
+            size = sizeof(*str) + (str->len << str->is_wide_char) + 1 -
+                str->is_wide_char;
+        }
+        break;
+    case JS_HS_KIND_ROPE:
+        type = JS_HS_NODE_CONCATENATED_STRING;
+        name = js_hs_name(s, JS_HS_NAME_ROPE);
+        size = sizeof(JSStringRope);
+        break;
+    case JS_HS_KIND_BIGINT:
+        type = JS_HS_NODE_BIGINT;
+        name = js_hs_name(s, JS_HS_NAME_BIGINT);
+        size = sizeof(JSBigInt) + ((JSBigInt *)p)->len * sizeof(js_limb_t);
+        break;
+    default:
+        switch(((JSGCObjectHeader *)p)->gc_obj_type) {
+        case JS_GC_OBJ_TYPE_JS_OBJECT:
+            {
+                JSObject *obj = p;
+                JSShape *sh = get_obj_shape(obj);
+                name = js_hs_object_name(rt, obj);
+                size = sizeof(*obj);
+                if (get_obj_prop(obj))
+                    size += sh->prop_size * sizeof(JSProperty);
+                switch(obj->class_id) {
+                case JS_CLASS_ARRAY:
+                case JS_CLASS_ARGUMENTS:
+                    size += obj->u.array.count * sizeof(JSValue);
+                    break;
+                case JS_CLASS_ARRAY_BUFFER:
+                case JS_CLASS_SHARED_ARRAY_BUFFER:
+                    size += sizeof(JSArrayBuffer) +
+                        obj->u.array_buffer->byte_length;
+                    break;
+                default:
+                    if (js_class_has_bytecode(obj->class_id) &&
+                        obj->u.func.var_refs) {
+                        size += obj->u.func.function_bytecode->closure_var_count *
+                            sizeof(JSVarRef *);
+                    }
+                    break;
+                }
+                if (obj->class_id == JS_CLASS_REGEXP)
+                    type = JS_HS_NODE_REGEXP;
+                else if (js_class_has_bytecode(obj->class_id) ||
+                         obj->class_id == JS_CLASS_C_FUNCTION ||
+                         obj->class_id == JS_CLASS_C_FUNCTION_DATA ||
+                         obj->class_id == JS_CLASS_BOUND_FUNCTION)
+                    type = JS_HS_NODE_CLOSURE;
+                else
+                    type = JS_HS_NODE_OBJECT;
+            }
+            break;
+        case JS_GC_OBJ_TYPE_FUNCTION_BYTECODE:
+            {
+                JSFunctionBytecode *b = p;
+                JSMemoryUsage_helper mem = { 0 };
+                compute_bytecode_size(b, &mem);
+                type = JS_HS_NODE_CODE;
+                name = b->func_name;
+                size = mem.js_func_size + mem.js_func_code_size +
+                    mem.js_func_pc2line_size;
+            }
+            break;
+        case JS_GC_OBJ_TYPE_SHAPE:
+            {
+                JSShape *sh = p;
+                type = JS_HS_NODE_OBJECT_SHAPE;
+                name = js_hs_name(s, JS_HS_NAME_SHAPE);
+                size = get_shape_size(sh->prop_hash_mask + 1, sh->prop_size);
+            }
+            break;
+        case JS_GC_OBJ_TYPE_VAR_REF:
+            type = JS_HS_NODE_HIDDEN;
+            name = js_hs_name(s, JS_HS_NAME_VAR_REF);
+            size = sizeof(JSVarRef);
+            break;
+        case JS_GC_OBJ_TYPE_ASYNC_FUNCTION:
+            type = JS_HS_NODE_HIDDEN;
+            name = js_hs_name(s, JS_HS_NAME_ASYNC_FUNCTION);
+            size = sizeof(JSAsyncFunctionState);
+            break;
+        case JS_GC_OBJ_TYPE_JS_CONTEXT:
+            type = JS_HS_NODE_HIDDEN;
+            name = js_hs_name(s, JS_HS_NAME_CONTEXT);
+            size = sizeof(JSContext) + sizeof(JSValue) * rt->class_count;
+            break;
+        default:
+            abort();
+        }
+        break;
+    }
+    /* the GC objects are not moved, so their address gives an id
+       which is stable between snapshots */
+    fprintf(s->f, "%s%d,%u,%" PRIu64 ",%u,%u,0,0\n", idx == 0 ? "" : ",",
+            type, name, ((uint64_t)ptr >> 3) * 2 + 1, (unsigned)size,
+            s->nodes[idx].edge_count);
+}
+
+static void js_hs_write_string(FILE *f, const JSString *p)
+{
+    int i, c, len;
+
+    len = min_int(p->len, JS_HS_MAX_STRING_LEN);
+    putc('"', f);
+    for(i = 0; i < len; i++) {
+        c = string_get(p, i);
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20 || c >= 0x7f)
+            fprintf(f, "\\u%04x", c);
+        else
+            putc(c, f);
+    }
+    putc('"', f);
+}
+
+static void js_hs_write(JSHeapSnapshotState *s)
+{
+    JSRuntime *rt = s->rt;
+    FILE *f = s->f;
+    JSAtomStruct *p;
+    uint32_t i, string_index;
+
+    fprintf(f, "{\"snapshot\":{\"meta\":{"
+            "\"node_fields\":[\"type\",\"name\",\"id\",\"self_size\",\"edge_count\",\"trace_node_id\",\"detachedness\"],\n"
+            "\"node_types\":[[\"hidden\",\"array\",\"string\",\"object\",\"code\",\"closure\",\"regexp\",\"number\",\"native\",\"synthetic\",\"concatenated string\",\"sliced string\",\"symbol\",\"bigint\",\"object shape\"],\"string\",\"number\",\"number\",\"number\",\"number\",\"number\"],\n"
+            "\"edge_fields\":[\"type\",\"name_or_index\",\"to_node\"],\n"
+            "\"edge_types\":[[\"context\",\"element\",\"property\",\"internal\",\"hidden\",\"shortcut\",\"weak\"],\"string_or_number\",\"node\"],\n"
+            "\"trace_function_info_fields\":[\"function_id\",\"name\",\"script_name\",\"script_id\",\"line\",\"column\"],\n"
+            "\"trace_node_fields\":[\"id\",\"function_info_index\",\"count\",\"size\",\"children\"],\n"
+            "\"sample_fields\":[\"timestamp_us\",\"last_assigned_id\"],\n"
+            "\"location_fields\":[\"object_index\",\"script_id\",\"line\",\"column\"]},\n"
+            "\"node_count\":%u,\"edge_count\":%u,\"trace_function_count\":0},\n",
+            s->node_count, s->edge_count);
+
+    /* the string nodes are named by their content, stored after the
+       fixed names */
+    string_index = rt->atom_size + JS_HS_NAME_COUNT;
+    fprintf(f, "\"nodes\":[");
+    for(i = 0; i < s->node_count; i++)
+        js_hs_write_node(s, i, &string_index);
+
+    fprintf(f, "],\n\"edges\":[");
+    s->write_edges = TRUE;
+    s->is_first_edge = TRUE;
+    js_hs_root_edges(s);
+    for(i = 1; i < s->node_count; i++)
+        js_hs_node_edges(s, i);
+
+    fprintf(f, "],\n\"trace_function_infos\":[],\n\"trace_tree\":[],\n"
+            "\"samples\":[],\n\"locations\":[],\n\"strings\":[");
+    for(i = 0; i < rt->atom_size; i++) {
+        p = rt->atom_array[i];
+        if (i != 0)
+            putc(',', f);
+        if (!atom_is_free(p) && p != NULL)
+            js_hs_write_string(f, p);
+        else
+            fprintf(f, "\"\"");
+        putc('\n', f);
+    }
+    for(i = 0; i < JS_HS_NAME_COUNT; i++)
+        fprintf(f, ",\"%s\"\n", js_hs_names[i]);
+    for(i = 1; i < s->node_count; i++) {
+        if ((s->nodes[i].ptr & JS_HS_KIND_MASK) == JS_HS_KIND_STRING) {
+            putc(',', f);
+            js_hs_write_string(f, (JSString *)(s->nodes[i].ptr & ~JS_HS_KIND_MASK));
+            putc('\n', f);
+        }
+    }
+    fprintf(f, "]}\n");
+}
+
+int JS_WriteHeapSnapshot(JSRuntime *rt, FILE *f)
+{
+    JSHeapSnapshotState ss, *s = &ss;
+    struct list_head *el;
+    uint32_t i, gc_count;
+    int ret;
+
+    /* remove the unreachable cycles first */
+    JS_RunGC(rt);
+
+    memset(s, 0, sizeof(*s));
+    s->rt = rt;
+    s->f = f;
+    gc_count = 0;
+    list_for_each(el, &rt->gc_obj_list) {
+        gc_count++;
+    }
+    /* the strings are added while enumerating the edges */
+    if (js_hs_resize(s, max_int(gc_count + gc_count / 2, 16)))
+        goto fail;
+    s->nodes[0].ptr = 0;
+    s->nodes[0].edge_count = 0;
+    s->nodes[0].ref_count = 0;
+    s->node_count = 1;
+    list_for_each(el, &rt->gc_obj_list) {
+        js_hs_get_node(s, (uintptr_t)list_entry(el, JSGCObjectHeader, link));
+    }
+
+    rt->heap_snapshot = s;
+    /* first pass: find the reference counted values and count the
+       edges. 'node_count' grows during the loop. */
+    for(i = 1; i < s->node_count && !s->error; i++)
+        js_hs_node_edges(s, i);
+    if (!s->error)
+        js_hs_root_edges(s);
+    if (!s->error)
+        js_hs_write(s);
+    rt->heap_snapshot = NULL;
+    if (s->error)
+        goto fail;
+    ret = ferror(f) ? -1 : 0;
+ done:
+    js_free_rt(rt, s->nodes);
+    js_free_rt(rt, s->hash_table);
+    return ret;
+ fail:
+    ret = -1;
+    goto done;
+}
+
 JSValue JS_GetGlobalObject(JSContext *ctx)
 {
     return JS_DupValue(ctx, ctx->global_obj);
@@ -6801,20 +8450,224 @@ static int get_sleb128(int32_t *pval, const uint8_t *buf,
     return ret;
 }
 
+/* if 'rom_data' is TRUE, 'data' is referenced instead of being copied */
+static JSDebugBuf *js_new_debug_buf(JSContext *ctx, const uint8_t *data,
+                                    size_t len, BOOL is_source, BOOL rom_data)
+{
+    JSDebugBuf *buf;
+
+    buf = js_malloc(ctx, sizeof(*buf) + (rom_data ? 0 : len + 1));
+    if (!buf)
+        return NULL;
+    buf->ref_count = 1;
+    buf->is_source = is_source;
+    buf->len = len;
+    if (rom_data) {
+        buf->data = data;
+    } else {
+        memcpy(buf->buf, data, len);
+        buf->buf[len] = '\0';
+        buf->data = buf->buf;
+    }
+    buf->line_col_cache.ptr = buf->data;
+    buf->line_col_cache.buf_start = buf->data;
+    buf->line_col_cache.line_num = 0;
+    buf->line_col_cache.col_num = 0;
+    return buf;
+}
+
+static void js_free_debug_buf(JSRuntime *rt, JSDebugBuf *buf)
+{
+    if (buf && --buf->ref_count == 0)
+        js_free_rt(rt, buf);
+}
+
+/* the line number table is stored in the same allocation */
+static JSFunctionDebug *js_new_function_debug(JSContext *ctx,
+                                              const uint8_t *pc2line_buf,
+                                              int pc2line_len)
+{
+    JSFunctionDebug *d;
+
+    d = js_mallocz(ctx, sizeof(*d) + pc2line_len);
+    if (!d)
+        return NULL;
+    memcpy_no_ub(d->pc2line_data, pc2line_buf, pc2line_len);
+    d->pc2line_buf = d->pc2line_data;
+    d->pc2line_len = pc2line_len;
+    return d;
+}
+
+static void free_function_debug(JSRuntime *rt, JSFunctionDebug *d)
+{
+    JS_FreeAtomRT(rt, d->filename);
+    js_free_debug_buf(rt, d->buf);
+    js_free_rt(rt, d);
+}
+
+static void put_pc2line_entry(DynBuf *dbuf, int diff_pc, int diff_line,
+                              int diff_col)
+{
+    if (diff_line >= PC2LINE_BASE &&
+        diff_line < PC2LINE_BASE + PC2LINE_RANGE &&
+        diff_pc <= PC2LINE_DIFF_PC_MAX) {
+        dbuf_putc(dbuf, (diff_line - PC2LINE_BASE) +
+                  diff_pc * PC2LINE_RANGE + PC2LINE_OP_FIRST);
+    } else {
+        /* longer encoding */
+        dbuf_putc(dbuf, 0);
+        dbuf_put_leb128(dbuf, diff_pc);
+        dbuf_put_sleb128(dbuf, diff_line);
+    }
+    dbuf_put_sleb128(dbuf, diff_col);
+}
+
+/* replace the source positions of 'b' by the pc2line table (see
+   compute_pc2line_info()) */
+static int decode_source_pos(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    JSFunctionDebug *d = b->debug;
+    GetLineColCache *lc = &d->buf->line_col_cache;
+    const uint8_t *p, *p_end;
+    uint32_t pos, diff_pc;
+    int diff_pos, ret, line_num, col_num, last_line_num, last_col_num;
+    DynBuf dbuf;
+
+    p = d->pc2line_buf;
+    p_end = p + d->pc2line_len;
+    ret = get_leb128(&pos, p, p_end);
+    if (ret < 0)
+        return -1;
+    p += ret;
+
+    dbuf_init2(&dbuf, rt, (DynBufReallocFunc *)js_realloc_rt);
+    last_line_num = get_line_col_cached(lc, &last_col_num, d->buf->data + pos);
+    dbuf_put_leb128(&dbuf, last_line_num);
+    dbuf_put_leb128(&dbuf, last_col_num);
+    while (p < p_end) {
+        ret = get_leb128(&diff_pc, p, p_end);
+        if (ret < 0)
+            goto fail;
+        p += ret;
+        ret = get_sleb128(&diff_pos, p, p_end);
+        if (ret < 0)
+            goto fail;
+        p += ret;
+        pos += diff_pos;
+        line_num = get_line_col_cached(lc, &col_num, d->buf->data + pos);
+        put_pc2line_entry(&dbuf, diff_pc, line_num - last_line_num,
+                          col_num - last_col_num);
+        last_line_num = line_num;
+        last_col_num = col_num;
+    }
+    if (dbuf_error(&dbuf))
+        goto fail;
+    d = js_realloc_rt(rt, d, sizeof(*d) + dbuf.size);
+    if (!d)
+        goto fail;
+    memcpy(d->pc2line_data, dbuf.buf, dbuf.size);
+    d->pc2line_buf = d->pc2line_data;
+    d->pc2line_len = dbuf.size;
+    d->state = JS_DEBUG_DECODED;
+    b->debug = d;
+    dbuf_free(&dbuf);
+    return 0;
+ fail:
+    dbuf_free(&dbuf);
+    return -1;
+}
+
+/* decode the debug record of a function read by JS_ReadObject() */
+static int decode_debug_record(JSFunctionDebug *d)
+{
+    JSDebugBuf *buf = d->buf;
+    const uint8_t *p, *p_end;
+    uint32_t len, pos;
+    int ret;
+
+    p = buf->data + d->source_pos;
+    p_end = buf->data + buf->len;
+    d->source_pos = 0;
+    d->source_len = 0;
+    ret = get_leb128(&len, p, p_end);
+    if (ret < 0)
+        goto fail;
+    p += ret;
+    if (len > p_end - p)
+        goto fail;
+    d->pc2line_buf = p;
+    d->pc2line_len = len;
+    p += len;
+    ret = get_leb128(&len, p, p_end);
+    if (ret < 0)
+        goto fail;
+    p += ret;
+    if (len != 0) {
+        ret = get_leb128(&pos, p, p_end);
+        if (ret < 0 || pos > buf->len || len > buf->len - pos)
+            goto fail;
+        d->source_pos = pos;
+        d->source_len = len;
+    }
+    d->state = JS_DEBUG_DECODED;
+    return 0;
+ fail:
+    /* invalid data: ignore the debug info */
+    d->pc2line_buf = NULL;
+    d->pc2line_len = 0;
+    d->state = JS_DEBUG_DECODED;
+    return -1;
+}
+
+/* Return the debug info of 'b' or NULL if none. The line number table
+   is only computed if 'need_pc2line' is TRUE. */
+static JSFunctionDebug *js_get_function_debug(JSRuntime *rt,
+                                              JSFunctionBytecode *b,
+                                              BOOL need_pc2line)
+{
+    JSFunctionDebug *d = b->debug;
+
+    if (!d)
+        return NULL;
+    if (d->state == JS_DEBUG_SERIALIZED)
+        decode_debug_record(d);
+    if (d->state == JS_DEBUG_SOURCE_POS && need_pc2line) {
+        if (decode_source_pos(rt, b))
+            return NULL;
+    }
+    return b->debug;
+}
+
+/* return the source code of 'b' or NULL if not available. It is not
+   zero terminated. */
+static const char *js_get_function_source(JSRuntime *rt, JSFunctionBytecode *b,
+                                          int *plen)
+{
+    JSFunctionDebug *d;
+
+    d = js_get_function_debug(rt, b, FALSE);
+    if (!d || d->source_len == 0)
+        return NULL;
+    *plen = d->source_len;
+    return (const char *)d->buf->data + d->source_pos;
+}
+
 /* use pc_value = -1 to get the position of the function definition */
 static int find_line_num(JSContext *ctx, JSFunctionBytecode *b,
                          uint32_t pc_value, int *pcol_num)
 {
+    JSFunctionDebug *d;
     const uint8_t *p_end, *p;
     int new_line_num, line_num, pc, v, ret, new_col_num, col_num;
     uint32_t val;
     unsigned int op;
 
-    if (!b->has_debug || !b->debug.pc2line_buf)
+    d = js_get_function_debug(ctx->rt, b, TRUE);
+    if (!d || !d->pc2line_buf)
         goto fail; /* function was stripped */
 
-    p = b->debug.pc2line_buf;
-    p_end = p + b->debug.pc2line_len;
+    p = d->pc2line_buf;
+    p_end = p + d->pc2line_len;
 
     /* get the function line and column numbers */
     ret = get_leb128(&val, p, p_end);
@@ -6872,39 +8725,124 @@ static int find_line_num(JSContext *ctx, JSFunctionBytecode *b,
 /* in order to avoid executing arbitrary code during the stack trace
    generation, we only look at simple 'name' properties containing a
    string. */
-static const char *get_func_name(JSContext *ctx, JSValueConst func)
+static JSValue get_func_name(JSContext *ctx, JSValueConst func)
 {
     JSProperty *pr;
     JSShapeProperty *prs;
     JSValueConst val;
 
     if (JS_VALUE_GET_TAG(func) != JS_TAG_OBJECT)
-        return NULL;
+        return JS_UNDEFINED;
     prs = find_own_property(&pr, JS_VALUE_GET_OBJ(func), JS_ATOM_name);
     if (!prs)
-        return NULL;
+        return JS_UNDEFINED;
     if ((prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL)
-        return NULL;
+        return JS_UNDEFINED;
     val = pr->u.value;
     if (JS_VALUE_GET_TAG(val) != JS_TAG_STRING)
-        return NULL;
-    return JS_ToCString(ctx, val);
+        return JS_UNDEFINED;
+    return JS_DupValue(ctx, val);
 }
 
 #define JS_BACKTRACE_FLAG_SKIP_FIRST_LEVEL (1 << 0)
 
+typedef struct JSBacktraceFrame {
+    JSValue func_name; /* string or JS_UNDEFINED */
+    JSFunctionBytecode *b; /* NULL if native or no debug info */
+    uint32_t pc;
+    BOOL is_native;
+} JSBacktraceFrame;
+
+/* the stack trace is captured as (function, pc) pairs and only
+   converted to a string when the 'stack' property is read */
+struct JSBacktrace {
+    int frame_count;
+    JSBacktraceFrame frames[0];
+};
+
+static JSBacktrace *js_capture_backtrace(JSContext *ctx, int backtrace_flags)
+{
+    JSRuntime *rt = ctx->rt;
+    JSStackFrame *sf;
+    JSBacktrace *bt;
+    JSBacktraceFrame *fr;
+    JSObject *p;
+    int n, skip;
+
+    skip = (backtrace_flags & JS_BACKTRACE_FLAG_SKIP_FIRST_LEVEL) != 0;
+    n = 0;
+    for(sf = rt->current_stack_frame; sf != NULL; sf = sf->prev_frame) {
+        if (sf->js_mode & JS_MODE_BACKTRACE_BARRIER)
+            break;
+        n++;
+    }
+    n = max_int(n - skip, 0);
+    /* no exception is raised here so that the current one is kept */
+    bt = js_malloc_rt(rt, sizeof(*bt) + sizeof(bt->frames[0]) * n);
+    if (!bt)
+        return NULL;
+    bt->frame_count = n;
+    sf = rt->current_stack_frame;
+    if (skip && sf)
+        sf = sf->prev_frame;
+    for(fr = bt->frames; fr < bt->frames + n; fr++, sf = sf->prev_frame) {
+        fr->func_name = get_func_name(ctx, sf->cur_func);
+        fr->b = NULL;
+        fr->pc = 0;
+        fr->is_native = TRUE;
+        p = JS_VALUE_GET_OBJ(sf->cur_func);
+        if (js_class_has_bytecode(p->class_id)) {
+            JSFunctionBytecode *b = p->u.func.function_bytecode;
+            fr->is_native = FALSE;
+            if (b->has_debug) {
+                fr->b = b;
+                fr->pc = sf->cur_pc - b->byte_code_buf - 1;
+                b->header.ref_count++;
+            }
+        }
+    }
+    return bt;
+}
+
+static void js_free_backtrace(JSRuntime *rt, JSBacktrace *bt)
+{
+    JSBacktraceFrame *fr;
+
+    if (!bt)
+        return;
+    for(fr = bt->frames; fr < bt->frames + bt->frame_count; fr++) {
+        JS_FreeValueRT(rt, fr->func_name);
+        if (fr->b)
+            JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, fr->b));
+    }
+    js_free_rt(rt, bt);
+}
+
+static void js_mark_backtrace(JSRuntime *rt, JSBacktrace *bt,
+                              JS_MarkFunc *mark_func)
+{
+    int i;
+
+    if (!bt)
+        return;
+    for(i = 0; i < bt->frame_count; i++) {
+        if (bt->frames[i].b)
+            mark_func(rt, &bt->frames[i].b->header);
+    }
+}
+
 /* if filename != NULL, an additional level is added with the filename
    and line number information (used for parse error). */
-static void build_backtrace(JSContext *ctx, JSValueConst error_obj,
-                            const char *filename, int line_num, int col_num,
-                            int backtrace_flags)
+static JSValue js_format_backtrace(JSContext *ctx, const char *filename,
+                                   int line_num, int col_num,
+                                   const JSBacktrace *bt)
 {
-    JSStackFrame *sf;
+    const JSBacktraceFrame *fr;
     JSValue str;
     DynBuf dbuf;
     const char *func_name_str;
     const char *str1;
-    JSObject *p;
+    int i, frame_count;
 
     js_dbuf_init(ctx, &dbuf);
     if (filename) {
@@ -6912,23 +8850,13 @@ static void build_backtrace(JSContext *ctx, JSValueConst error_obj,
         if (line_num != -1)
             dbuf_printf(&dbuf, ":%d:%d", line_num, col_num);
         dbuf_putc(&dbuf, '\n');
-        str = JS_NewString(ctx, filename);
-        /* Note: SpiderMonkey does that, could update once there is a standard */
-        JS_DefinePropertyValue(ctx, error_obj, JS_ATOM_fileName, str,
-                               JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
-        JS_DefinePropertyValue(ctx, error_obj, JS_ATOM_lineNumber, JS_NewInt32(ctx, line_num),
-                               JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
-        JS_DefinePropertyValue(ctx, error_obj, JS_ATOM_columnNumber, JS_NewInt32(ctx, col_num),
-                               JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
     }
-    for(sf = ctx->rt->current_stack_frame; sf != NULL; sf = sf->prev_frame) {
-        if (sf->js_mode & JS_MODE_BACKTRACE_BARRIER)
-            break;
-        if (backtrace_flags & JS_BACKTRACE_FLAG_SKIP_FIRST_LEVEL) {
-            backtrace_flags &= ~JS_BACKTRACE_FLAG_SKIP_FIRST_LEVEL;
-            continue;
-        }
-        func_name_str = get_func_name(ctx, sf->cur_func);
+    frame_count = bt ? bt->frame_count : 0;
+    for(i = 0; i < frame_count; i++) {
+        fr = &bt->frames[i];
+        func_name_str = NULL;
+        if (!JS_IsUndefined(fr->func_name))
+            func_name_str = JS_ToCString(ctx, fr->func_name);
         if (!func_name_str || func_name_str[0] == '\0')
             str1 = "<anonymous>";
         else
@@ -6936,26 +8864,21 @@ static void build_backtrace(JSContext *ctx, JSValueConst error_obj,
         dbuf_printf(&dbuf, "    at %s", str1);
         JS_FreeCString(ctx, func_name_str);
 
-        p = JS_VALUE_GET_OBJ(sf->cur_func);
-        if (js_class_has_bytecode(p->class_id)) {
-            JSFunctionBytecode *b;
+        if (fr->is_native) {
+            dbuf_printf(&dbuf, " (native)");
+        } else if (fr->b) {
+            JSFunctionBytecode *b = fr->b;
             const char *atom_str;
             int line_num1, col_num1;
 
-            b = p->u.func.function_bytecode;
-            if (b->has_debug) {
-                line_num1 = find_line_num(ctx, b,
-                                          sf->cur_pc - b->byte_code_buf - 1, &col_num1);
-                atom_str = JS_AtomToCString(ctx, b->debug.filename);
-                dbuf_printf(&dbuf, " (%s",
-                            atom_str ? atom_str : "<null>");
-                JS_FreeCString(ctx, atom_str);
-                if (line_num1 != 0)
-                    dbuf_printf(&dbuf, ":%d:%d", line_num1, col_num1);
-                dbuf_putc(&dbuf, ')');
-            }
-        } else {
-            dbuf_printf(&dbuf, " (native)");
+            line_num1 = find_line_num(ctx, b, fr->pc, &col_num1);
+            atom_str = JS_AtomToCString(ctx, b->debug->filename);
+            dbuf_printf(&dbuf, " (%s",
+                        atom_str ? atom_str : "<null>");
+            JS_FreeCString(ctx, atom_str);
+            if (line_num1 != 0)
+                dbuf_printf(&dbuf, ":%d:%d", line_num1, col_num1);
+            dbuf_putc(&dbuf, ')');
         }
         dbuf_putc(&dbuf, '\n');
     }
@@ -6965,6 +8888,46 @@ static void build_backtrace(JSContext *ctx, JSValueConst error_obj,
     else
         str = JS_NewString(ctx, (char *)dbuf.buf);
     dbuf_free(&dbuf);
+    return str;
+}
+
+static JSValue js_backtrace_autoinit(JSContext *ctx, JSObject *p, JSAtom atom,
+                                     void *opaque)
+{
+    return js_format_backtrace(ctx, NULL, 0, 0, opaque);
+}
+
+/* if filename != NULL, an additional level is added with the filename
+   and line number information (used for parse error). */
+static void build_backtrace(JSContext *ctx, JSValueConst error_obj,
+                            const char *filename, int line_num, int col_num,
+                            int backtrace_flags)
+{
+    JSBacktrace *bt;
+    JSValue str;
+
+    bt = js_capture_backtrace(ctx, backtrace_flags);
+    if (filename) {
+        str = JS_NewString(ctx, filename);
+        /* Note: SpiderMonkey does that, could update once there is a standard */
+        JS_DefinePropertyValue(ctx, error_obj, JS_ATOM_fileName, str,
+                               JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
+        JS_DefinePropertyValue(ctx, error_obj, JS_ATOM_lineNumber, JS_NewInt32(ctx, line_num),
+                               JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
+        JS_DefinePropertyValue(ctx, error_obj, JS_ATOM_columnNumber, JS_NewInt32(ctx, col_num),
+                               JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
+    } else if (bt && JS_VALUE_GET_TAG(error_obj) == JS_TAG_OBJECT &&
+               JS_VALUE_GET_OBJ(error_obj)->extensible &&
+               !find_own_property1(JS_VALUE_GET_OBJ(error_obj), JS_ATOM_stack)) {
+        /* the string is built on the first access to 'stack' */
+        if (JS_DefineAutoInitProperty(ctx, error_obj, JS_ATOM_stack,
+                                      JS_AUTOINIT_ID_BACKTRACE, bt,
+                                      JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE) >= 0)
+            return;
+    }
+    /* parse errors are not performance critical: format immediately */
+    str = js_format_backtrace(ctx, filename, line_num, col_num, bt);
+    js_free_backtrace(ctx->rt, bt);
     JS_DefinePropertyValue(ctx, error_obj, JS_ATOM_stack, str,
                            JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
 }
@@ -7253,8 +9216,8 @@ static int JS_SetPrototypeInternal(JSContext *ctx, JSValueConst obj,
 
     if (unlikely(p->class_id == JS_CLASS_PROXY))
         return js_proxy_setPrototypeOf(ctx, obj, proto_val, throw_flag);
-    sh = p->shape;
-    if (sh->proto == proto)
+    sh = get_obj_shape(p);
+    if (get_shape_proto(sh) == proto)
         return TRUE;
     if (!p->extensible) {
         if (throw_flag) {
@@ -7277,17 +9240,17 @@ static int JS_SetPrototypeInternal(JSContext *ctx, JSValueConst obj,
                 }
             }
             /* Note: for Proxy objects, proto is NULL */
-            p1 = p1->shape->proto;
+            p1 = get_shape_proto(get_obj_shape(p1));
         } while (p1 != NULL);
         JS_DupValue(ctx, proto_val);
     }
 
     if (js_shape_prepare_update(ctx, p, NULL))
         return -1;
-    sh = p->shape;
-    if (sh->proto)
-        JS_FreeValue(ctx, JS_MKPTR(JS_TAG_OBJECT, sh->proto));
-    sh->proto = proto;
+    sh = get_obj_shape(p);
+    if (get_shape_proto(sh))
+        JS_FreeValue(ctx, JS_MKPTR(JS_TAG_OBJECT, get_shape_proto(sh)));
+    set_shape_proto(sh, proto);
     return TRUE;
 }
 
@@ -7339,7 +9302,7 @@ JSValue JS_GetPrototype(JSContext *ctx, JSValueConst obj)
         if (unlikely(p->class_id == JS_CLASS_PROXY)) {
             val = js_proxy_getPrototypeOf(ctx, obj);
         } else {
-            p = p->shape->proto;
+            p = get_shape_proto(get_obj_shape(p));
             if (!p)
                 val = JS_NULL;
             else
@@ -7389,7 +9352,7 @@ static int JS_OrdinaryIsInstanceOf(JSContext *ctx, JSValueConst val,
     proto = JS_VALUE_GET_OBJ(obj_proto);
     p = JS_VALUE_GET_OBJ(val);
     for(;;) {
-        proto1 = p->shape->proto;
+        proto1 = get_shape_proto(get_obj_shape(p));
         if (!proto1) {
             /* slow case if proxy in the prototype chain */
             if (unlikely(p->class_id == JS_CLASS_PROXY)) {
@@ -7465,6 +9428,8 @@ static JSAutoInitFunc *js_autoinit_func_table[] = {
     js_instantiate_prototype, /* JS_AUTOINIT_ID_PROTOTYPE */
     js_module_ns_autoinit, /* JS_AUTOINIT_ID_MODULE_NS */
     JS_InstantiateFunctionListItem2, /* JS_AUTOINIT_ID_PROP */
+    js_backtrace_autoinit, /* JS_AUTOINIT_ID_BACKTRACE */
+    js_intrinsic_autoinit, /* JS_AUTOINIT_ID_INTRINSIC */
 };
 
 /* warning: 'prs' is reallocated after it */
@@ -7646,7 +9611,7 @@ JSValue JS_GetPropertyInternal(JSContext *ctx, JSValueConst obj,
                 }
             }
         }
-        p = p->shape->proto;
+        p = get_shape_proto(get_obj_shape(p));
         if (!p)
             break;
     }
@@ -7916,7 +9881,7 @@ static int __exception JS_GetOwnPropertyNamesInternal(JSContext *ctx,
     exotic_keys_count = 0;
     exotic_count = 0;
     tab_exotic = NULL;
-    sh = p->shape;
+    sh = get_obj_shape(p);
     for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
         atom = prs->atom;
         if (atom != JS_ATOM_NULL) {
@@ -7928,7 +9893,7 @@ static int __exception JS_GetOwnPropertyNamesInternal(JSContext *ctx,
                    name space (implicit GetOwnProperty) */
                 if (unlikely((prs->flags & JS_PROP_TMASK) == JS_PROP_VARREF) &&
                     (flags & (JS_GPN_SET_ENUM | JS_GPN_ENUM_ONLY))) {
-                    JSVarRef *var_ref = p->prop[i].u.var_ref;
+                    JSVarRef *var_ref = get_obj_prop(p)[i].u.var_ref;
                     if (unlikely(JS_IsUninitialized(*var_ref->pvalue))) {
                         JS_ThrowReferenceErrorUninitialized(ctx, prs->atom);
                         return -1;
@@ -8019,7 +9984,7 @@ static int __exception JS_GetOwnPropertyNamesInternal(JSContext *ctx,
     sym_index = str_index + str_keys_count;
 
     num_sorted = TRUE;
-    sh = p->shape;
+    sh = get_obj_shape(p);
     for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
         atom = prs->atom;
         if (atom != JS_ATOM_NULL) {
@@ -8260,7 +10225,7 @@ int JS_HasProperty(JSContext *ctx, JSValueConst obj, JSAtom prop)
                 return FALSE;
             }
         }
-        p = p->shape->proto;
+        p = get_shape_proto(get_obj_shape(p));
         if (!p)
             break;
     }
@@ -8443,7 +10408,7 @@ static JSProperty *add_property(JSContext *ctx,
 {
     JSShape *sh, *new_sh;
 
-    sh = p->shape;
+    sh = get_obj_shape(p);
     if (sh->is_hashed) {
         /* try to find an existing shape */
         new_sh = find_hashed_shape_prop(ctx->rt, sh, prop, prop_flags);
@@ -8452,15 +10417,15 @@ static JSProperty *add_property(JSContext *ctx,
             /*  the property array may need to be resized */
             if (new_sh->prop_size != sh->prop_size) {
                 JSProperty *new_prop;
-                new_prop = js_realloc(ctx, p->prop, sizeof(p->prop[0]) *
+                new_prop = js_cptr_realloc(ctx, get_obj_prop(p), sizeof(new_prop[0]) *
                                       new_sh->prop_size);
                 if (!new_prop)
                     return NULL;
-                p->prop = new_prop;
+                set_obj_prop(p, new_prop);
             }
-            p->shape = js_dup_shape(new_sh);
+            set_obj_shape(p, js_dup_shape(new_sh));
             js_free_shape(ctx->rt, sh);
-            return &p->prop[new_sh->prop_count - 1];
+            return &get_obj_prop(p)[new_sh->prop_count - 1];
         } else if (sh->header.ref_count != 1) {
             /* if the shape is shared, clone it */
             new_sh = js_clone_shape(ctx, sh);
@@ -8469,14 +10434,16 @@ static JSProperty *add_property(JSContext *ctx,
             /* hash the cloned shape */
             new_sh->is_hashed = TRUE;
             js_shape_hash_link(ctx->rt, new_sh);
-            js_free_shape(ctx->rt, p->shape);
-            p->shape = new_sh;
+            js_free_shape(ctx->rt, get_obj_shape(p));
+            set_obj_shape(p, new_sh);
         }
     }
-    assert(p->shape->header.ref_count == 1);
-    if (add_shape_property(ctx, &p->shape, p, prop, prop_flags))
+    sh = get_obj_shape(p);
+    assert(sh->header.ref_count == 1);
+    if (add_shape_property(ctx, &sh, p, prop, prop_flags))
         return NULL;
-    return &p->prop[p->shape->prop_count - 1];
+    set_obj_shape(p, sh);
+    return &get_obj_prop(p)[sh->prop_count - 1];
 }
 
 /* can be called on Array or Arguments objects. return < 0 if
@@ -8493,11 +10460,12 @@ static no_inline __exception int convert_fast_array_to_array(JSContext *ctx,
         return -1;
     len = p->u.array.count;
     /* resize the properties once to simplify the error handling */
-    sh = p->shape;
+    sh = get_obj_shape(p);
     new_count = sh->prop_count + len;
     if (new_count > sh->prop_size) {
-        if (resize_properties(ctx, &p->shape, p, new_count))
+        if (resize_properties(ctx, &sh, p, new_count))
             return -1;
+        set_obj_shape(p, sh);
     }
 
     tab = p->u.array.u.values;
@@ -8524,7 +10492,7 @@ static int delete_property(JSContext *ctx, JSObject *p, JSAtom atom)
     intptr_t h, h1;
 
  redo:
-    sh = p->shape;
+    sh = get_obj_shape(p);
     h1 = atom & sh->prop_hash_mask;
     h = prop_hash_end(sh)[-h1 - 1];
     prop = get_shape_prop(sh);
@@ -8541,7 +10509,7 @@ static int delete_property(JSContext *ctx, JSObject *p, JSAtom atom)
                 lpr_idx = lpr - get_shape_prop(sh);
             if (js_shape_prepare_update(ctx, p, &pr))
                 return -1;
-            sh = p->shape;
+            sh = get_obj_shape(p);
             /* remove property */
             if (lpr) {
                 lpr = get_shape_prop(sh) + lpr_idx;
@@ -8551,7 +10519,7 @@ static int delete_property(JSContext *ctx, JSObject *p, JSAtom atom)
             }
             sh->deleted_prop_count++;
             /* free the entry */
-            pr1 = &p->prop[h - 1];
+            pr1 = &get_obj_prop(p)[h - 1];
             free_property(ctx->rt, pr1, pr->flags);
             JS_FreeAtom(ctx, pr->atom);
             /* put default values */
@@ -8638,7 +10606,7 @@ static int set_array_length(JSContext *ctx, JSObject *p, JSValue val,
     if (ret)
         return -1;
     /* JS_ToArrayLengthFree() must be done before the read-only test */
-    if (unlikely(!(p->shape->prop[0].flags & JS_PROP_WRITABLE)))
+    if (unlikely(!(get_obj_shape(p)->prop[0].flags & JS_PROP_WRITABLE)))
         return JS_ThrowTypeErrorReadOnly(ctx, flags, JS_ATOM_length);
 
     if (likely(p->fast_array)) {
@@ -8649,18 +10617,18 @@ static int set_array_length(JSContext *ctx, JSObject *p, JSValue val,
             }
             p->u.array.count = len;
         }
-        p->prop[0].u.value = JS_NewUint32(ctx, len);
+        get_obj_prop(p)[0].u.value = JS_NewUint32(ctx, len);
     } else {
         /* Note: length is always a uint32 because the object is an
            array */
-        JS_ToUint32(ctx, &cur_len, p->prop[0].u.value);
+        JS_ToUint32(ctx, &cur_len, get_obj_prop(p)[0].u.value);
         if (len < cur_len) {
             uint32_t d;
             JSShape *sh;
             JSShapeProperty *pr;
 
             d = cur_len - len;
-            sh = p->shape;
+            sh = get_obj_shape(p);
             if (d <= sh->prop_count) {
                 JSAtom atom;
 
@@ -8700,7 +10668,7 @@ static int set_array_length(JSContext *ctx, JSObject *p, JSValue val,
                             /* remove the property */
                             delete_property(ctx, p, pr->atom);
                             /* WARNING: the shape may have been modified */
-                            sh = p->shape;
+                            sh = get_obj_shape(p);
                             pr = get_shape_prop(sh) + i;
                         }
                     }
@@ -8709,7 +10677,7 @@ static int set_array_length(JSContext *ctx, JSObject *p, JSValue val,
         } else {
             cur_len = len;
         }
-        set_value(ctx, &p->prop[0].u.value, JS_NewUint32(ctx, cur_len));
+        set_value(ctx, &get_obj_prop(p)[0].u.value, JS_NewUint32(ctx, cur_len));
         if (unlikely(cur_len > len)) {
             return JS_ThrowTypeErrorOrFalse(ctx, flags, "not configurable");
         }
@@ -8745,14 +10713,14 @@ static int add_fast_array_element(JSContext *ctx, JSObject *p,
     new_len = p->u.array.count + 1;
     /* update the length if necessary. We assume that if the length is
        not an integer, then if it >= 2^31.  */
-    if (likely(JS_VALUE_GET_TAG(p->prop[0].u.value) == JS_TAG_INT)) {
-        array_len = JS_VALUE_GET_INT(p->prop[0].u.value);
+    if (likely(JS_VALUE_GET_TAG(get_obj_prop(p)[0].u.value) == JS_TAG_INT)) {
+        array_len = JS_VALUE_GET_INT(get_obj_prop(p)[0].u.value);
         if (new_len > array_len) {
-            if (unlikely(!(get_shape_prop(p->shape)->flags & JS_PROP_WRITABLE))) {
+            if (unlikely(!(get_shape_prop(get_obj_shape(p))->flags & JS_PROP_WRITABLE))) {
                 JS_FreeValue(ctx, val);
                 return JS_ThrowTypeErrorReadOnly(ctx, flags, JS_ATOM_length);
             }
-            p->prop[0].u.value = JS_NewInt32(ctx, new_len);
+            get_obj_prop(p)[0].u.value = JS_NewInt32(ctx, new_len);
         }
     }
     if (unlikely(new_len > p->u.array.u1.size)) {
@@ -8975,7 +10943,7 @@ int JS_SetPropertyInternal(JSContext *ctx, JSValueConst obj,
                 }
             }
         }
-        p1 = p1->shape->proto;
+        p1 = get_shape_proto(get_obj_shape(p1));
     prototype_lookup:
         if (!p1)
             break;
@@ -9104,9 +11072,9 @@ static int JS_SetPropertyValue(JSContext *ctx, JSValueConst this_obj,
                     !p->fast_array || !p->extensible)
                     goto slow_path;
                 /* check if prototype chain has a numeric property */
-                p1 = p->shape->proto;
+                p1 = get_shape_proto(get_obj_shape(p));
                 while (p1 != NULL) {
-                    sh1 = p1->shape;
+                    sh1 = get_obj_shape(p1);
                     if (p1->class_id == JS_CLASS_ARRAY) {
                         if (unlikely(!p1->fast_array))
                             goto slow_path;
@@ -9116,7 +11084,7 @@ static int JS_SetPropertyValue(JSContext *ctx, JSValueConst this_obj,
                     } else {
                         goto slow_path;
                     }
-                    p1 = sh1->proto;
+                    p1 = get_shape_proto(sh1);
                 }
                 /* add element */
                 return add_fast_array_element(ctx, p, val, flags);
@@ -9300,10 +11268,10 @@ static int JS_CreateProperty(JSContext *ctx, JSObject *p,
                 JSShapeProperty *pslen;
             generic_array:
                 /* update the length field */
-                plen = &p->prop[0];
+                plen = &get_obj_prop(p)[0];
                 JS_ToUint32(ctx, &len, plen->u.value);
                 if ((idx + 1) > len) {
-                    pslen = get_shape_prop(p->shape);
+                    pslen = get_shape_prop(get_obj_shape(p));
                     if (unlikely(!(pslen->flags & JS_PROP_WRITABLE)))
                         return JS_ThrowTypeErrorReadOnly(ctx, flags, JS_ATOM_length);
                     /* XXX: should update the length after defining
@@ -9410,7 +11378,7 @@ static int js_shape_prepare_update(JSContext *ctx, JSObject *p,
     JSShape *sh;
     uint32_t idx = 0;    /* prevent warning */
 
-    sh = p->shape;
+    sh = get_obj_shape(p);
     if (sh->is_hashed) {
         if (sh->header.ref_count != 1) {
             if (pprs)
@@ -9419,8 +11387,8 @@ static int js_shape_prepare_update(JSContext *ctx, JSObject *p,
             sh = js_clone_shape(ctx, sh);
             if (!sh)
                 return -1;
-            js_free_shape(ctx->rt, p->shape);
-            p->shape = sh;
+            js_free_shape(ctx->rt, get_obj_shape(p));
+            set_obj_shape(p, sh);
             if (pprs)
                 *pprs = get_shape_prop(sh) + idx;
         } else {
@@ -9618,7 +11586,7 @@ int JS_DefineProperty(JSContext *ctx, JSValueConst this_obj,
                        property is read-only. */
                     if ((flags & (JS_PROP_HAS_WRITABLE | JS_PROP_WRITABLE)) ==
                         JS_PROP_HAS_WRITABLE) {
-                        prs = get_shape_prop(p->shape);
+                        prs = get_shape_prop(get_obj_shape(p));
                         if (js_update_property_flags(ctx, p, &prs,
                                                      prs->flags & ~JS_PROP_WRITABLE))
                             return -1;
@@ -9747,8 +11715,8 @@ static int JS_DefineAutoInitProperty(JSContext *ctx, JSValueConst this_obj,
     if (unlikely(!pr))
         return -1;
     pr->u.init.realm_and_id = (uintptr_t)JS_DupContext(ctx);
-    assert((pr->u.init.realm_and_id & 3) == 0);
-    assert(id <= 3);
+    assert((pr->u.init.realm_and_id & JS_AUTOINIT_ID_MASK) == 0);
+    assert(id <= JS_AUTOINIT_ID_MASK);
     pr->u.init.realm_and_id |= id;
     pr->u.init.opaque = opaque;
     return TRUE;
@@ -12958,7 +14926,7 @@ static __maybe_unused void JS_DumpObject(JSRuntime *rt, JSObject *p)
     BOOL is_first = TRUE;
 
     /* XXX: should encode atoms with special characters */
-    sh = p->shape; /* the shape can be NULL while freeing an object */
+    sh = get_obj_shape(p); /* the shape can be NULL while freeing an object */
     printf("%14p %4d ",
            (void *)p,
            p->header.ref_count);
@@ -12966,7 +14934,7 @@ static __maybe_unused void JS_DumpObject(JSRuntime *rt, JSObject *p)
         printf("%3d%c %14p ",
                sh->header.ref_count,
                " *"[sh->is_hashed],
-               (void *)sh->proto);
+               (void *)get_shape_proto(sh));
     } else {
         printf("%3s  %14s ", "-", "-");
     }
@@ -13009,7 +14977,7 @@ static __maybe_unused void JS_DumpObject(JSRuntime *rt, JSObject *p)
         printf("{ ");
         for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
             if (prs->atom != JS_ATOM_NULL) {
-                pr = &p->prop[i];
+                pr = &get_obj_prop(p)[i];
                 if (!is_first)
                     printf(", ");
                 printf("%s: ",
@@ -14775,7 +16743,7 @@ static JSValue js_function_proto_fileName(JSContext *ctx,
 {
     JSFunctionBytecode *b = JS_GetFunctionBytecode(this_val);
     if (b && b->has_debug) {
-        return JS_AtomToString(ctx, b->debug.filename);
+        return JS_AtomToString(ctx, b->debug->filename);
     }
     return JS_UNDEFINED;
 }
@@ -14987,7 +16955,7 @@ static JSValue build_for_in_iterator(JSContext *ctx, JSValue obj)
         JSShape *sh;
         JSShapeProperty *prs;
         /* check that there are no enumerable normal fields */
-        sh = p->shape;
+        sh = get_obj_shape(p);
         for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
             if (prs->flags & JS_PROP_ENUMERABLE)
                 goto normal_case;
@@ -15786,6 +17754,14 @@ static JSValue js_closure(JSContext *ctx, JSValue bfunc,
     JSAtom name_atom;
 
     b = JS_VALUE_GET_PTR(bfunc);
+    if (b->is_lazy &&
+        JS_VALUE_GET_TAG(b->cpool[0]) == JS_TAG_FUNCTION_BYTECODE) {
+        /* the stub is already compiled */
+        JSValue bfunc1 = JS_DupValue(ctx, b->cpool[0]);
+        JS_FreeValue(ctx, bfunc);
+        bfunc = bfunc1;
+        b = JS_VALUE_GET_PTR(bfunc);
+    }
     func_obj = JS_NewObjectClass(ctx, func_kind_to_class_id[b->func_kind]);
     if (JS_IsException(func_obj)) {
         JS_FreeValue(ctx, bfunc);
@@ -16226,6 +18202,11 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                          (JSValueConst *)argv, flags);
     }
     b = p->u.func.function_bytecode;
+    if (unlikely(b->is_lazy)) {
+        if (js_resolve_lazy_function(caller_ctx, p))
+            return JS_EXCEPTION;
+        b = p->u.func.function_bytecode;
+    }
 
     if (unlikely(argc < b->arg_count || (flags & JS_CALL_FLAG_COPY_ARGV))) {
         arg_allocated_size = b->arg_count;
@@ -18745,7 +20726,7 @@ static JSValue js_create_from_ctor(JSContext *ctx, JSValueConst ctor,
     JSContext *realm;
 
     if (JS_IsUndefined(ctor)) {
-        proto = JS_DupValue(ctx, ctx->class_proto[class_id]);
+        proto = JS_DupValue(ctx, js_get_class_proto(ctx, class_id));
     } else {
         proto = JS_GetProperty(ctx, ctor, JS_ATOM_prototype);
         if (JS_IsException(proto))
@@ -18755,7 +20736,7 @@ static JSValue js_create_from_ctor(JSContext *ctx, JSValueConst ctor,
             realm = JS_GetFunctionRealm(ctx, ctor);
             if (!realm)
                 return JS_EXCEPTION;
-            proto = JS_DupValue(ctx, realm->class_proto[class_id]);
+            proto = JS_DupValue(ctx, js_get_class_proto(realm, class_id));
         }
     }
     obj = JS_NewObjectProtoClass(ctx, proto, class_id);
@@ -18858,6 +20839,11 @@ static JSAsyncFunctionState *async_func_init(JSContext *ctx,
     JSStackFrame *sf;
     int local_count, i, arg_buf_len, n;
 
+    p = JS_VALUE_GET_OBJ(func_obj);
+    if (p->u.func.function_bytecode->is_lazy) {
+        if (js_resolve_lazy_function(ctx, p))
+            return NULL;
+    }
     s = js_mallocz(ctx, sizeof(*s));
     if (!s)
         return NULL;
@@ -18890,6 +20876,8 @@ static JSAsyncFunctionState *async_func_init(JSContext *ctx,
         sf->arg_buf[i] = JS_UNDEFINED;
     s->resolving_funcs[0] = JS_UNDEFINED;
     s->resolving_funcs[1] = JS_UNDEFINED;
+    s->await_funcs[0] = JS_UNDEFINED;
+    s->await_funcs[1] = JS_UNDEFINED;
     s->is_completed = FALSE;
     return s;
 }
@@ -18953,6 +20941,8 @@ static void __async_func_free(JSRuntime *rt, JSAsyncFunctionState *s)
 
     JS_FreeValueRT(rt, s->resolving_funcs[0]);
     JS_FreeValueRT(rt, s->resolving_funcs[1]);
+    JS_FreeValueRT(rt, s->await_funcs[0]);
+    JS_FreeValueRT(rt, s->await_funcs[1]);
 
     remove_gc_object(&s->header);
     if (rt->gc_phase == JS_GC_PHASE_REMOVE_CYCLES && s->header.ref_count != 0) {
@@ -19170,35 +21160,57 @@ static void js_async_function_resolve_mark(JSRuntime *rt, JSValueConst val,
     }
 }
 
+/* create the functions resuming 's' after an 'await'. They are only
+   referenced by the promise reactions, so the same ones can be used
+   for all the 'await' of the function. */
 static int js_async_function_resolve_create(JSContext *ctx,
-                                            JSAsyncFunctionState *s,
-                                            JSValue *resolving_funcs)
+                                            JSAsyncFunctionState *s)
 {
+    JSValue func;
     int i;
     JSObject *p;
 
+    if (!JS_IsUndefined(s->await_funcs[0]))
+        return 0;
     for(i = 0; i < 2; i++) {
-        resolving_funcs[i] =
-            JS_NewObjectProtoClass(ctx, ctx->function_proto,
-                                   JS_CLASS_ASYNC_FUNCTION_RESOLVE + i);
-        if (JS_IsException(resolving_funcs[i])) {
-            if (i == 1)
-                JS_FreeValue(ctx, resolving_funcs[0]);
+        func = JS_NewObjectProtoClass(ctx, ctx->function_proto,
+                                      JS_CLASS_ASYNC_FUNCTION_RESOLVE + i);
+        if (JS_IsException(func)) {
+            if (i == 1) {
+                JS_FreeValue(ctx, s->await_funcs[0]);
+                s->await_funcs[0] = JS_UNDEFINED;
+            }
             return -1;
         }
-        p = JS_VALUE_GET_OBJ(resolving_funcs[i]);
+        p = JS_VALUE_GET_OBJ(func);
         s->header.ref_count++;
         p->u.async_function_data = s;
+        s->await_funcs[i] = func;
     }
     return 0;
 }
 
+/* the await functions reference 's': free them to break the cycle */
+static void js_async_function_free_await_funcs(JSRuntime *rt,
+                                               JSAsyncFunctionState *s)
+{
+    int i;
+    JSValue func;
+
+    for(i = 0; i < 2; i++) {
+        func = s->await_funcs[i];
+        s->await_funcs[i] = JS_UNDEFINED;
+        JS_FreeValueRT(rt, func);
+    }
+}
+
 static void js_async_function_resume(JSContext *ctx, JSAsyncFunctionState *s)
 {
     JSValue func_ret, ret2;
 
     func_ret = async_func_resume(ctx, s);
     if (s->is_completed) {
+        js_async_function_free_await_funcs(ctx->rt, s);
         if (JS_IsException(func_ret)) {
             JSValue error;
         fail:
@@ -19215,7 +21227,8 @@ static void js_async_function_resume(JSContext *ctx, JSAsyncFunctionState *s)
             JS_FreeValue(ctx, ret2); /* XXX: what to do if exception ? */
         }
     } else {
-        JSValue value, promise, resolving_funcs[2], resolving_funcs1[2];
+        JSValue value, promise, resolving_funcs1[2];
+        JSValueConst args[5];
         int i, res;
 
         value = s->frame.cur_sp[-1];
@@ -19223,26 +21236,37 @@ static void js_async_function_resume(JSContext *ctx, JSAsyncFunctionState *s)
 
         /* await */
         JS_FreeValue(ctx, func_ret); /* not used */
-        promise = js_promise_resolve(ctx, ctx->promise_ctor,
-                                     1, (JSValueConst *)&value, 0);
-        JS_FreeValue(ctx, value);
-        if (JS_IsException(promise))
+        if (js_async_function_resolve_create(ctx, s)) {
+            JS_FreeValue(ctx, value);
             goto fail;
-        if (js_async_function_resolve_create(ctx, s, resolving_funcs)) {
+        }
+        if (!JS_IsObject(value)) {
+            /* fast path: PromiseResolve() would return a new promise
+               already fulfilled with 'value', so its reaction job can
+               be queued directly */
+            args[0] = JS_UNDEFINED;
+            args[1] = JS_UNDEFINED;
+            args[2] = s->await_funcs[0];
+            args[3] = JS_FALSE;
+            args[4] = value;
+            res = JS_EnqueueJob(ctx, promise_reaction_job, 5, args);
+            JS_FreeValue(ctx, value);
+        } else {
+            /* a native promise is returned as is */
+            promise = js_promise_resolve(ctx, ctx->promise_ctor,
+                                         1, (JSValueConst *)&value, 0);
+            JS_FreeValue(ctx, value);
+            if (JS_IsException(promise))
+                goto fail;
+            /* Note: no need to create 'thrownawayCapability' as in
+               the spec */
+            for(i = 0; i < 2; i++)
+                resolving_funcs1[i] = JS_UNDEFINED;
+            res = perform_promise_then(ctx, promise,
+                                       (JSValueConst *)s->await_funcs,
+                                       (JSValueConst *)resolving_funcs1);
             JS_FreeValue(ctx, promise);
-            goto fail;
         }
-
-        /* Note: no need to create 'thrownawayCapability' as in
-           the spec */
-        for(i = 0; i < 2; i++)
-            resolving_funcs1[i] = JS_UNDEFINED;
-        res = perform_promise_then(ctx, promise,
-                                   (JSValueConst *)resolving_funcs,
-                                   (JSValueConst *)resolving_funcs1);
-        JS_FreeValue(ctx, promise);
-        for(i = 0; i < 2; i++)
-            JS_FreeValue(ctx, resolving_funcs[i]);
         if (res)
             goto fail;
     }
@@ -19896,14 +21920,6 @@ typedef struct LineNumberSlot {
     uint32_t source_pos;
 } LineNumberSlot;
 
-typedef struct {
-    /* last source position */
-    const uint8_t *ptr;
-    int line_num;
-    int col_num;
-    const uint8_t *buf_start;
-} GetLineColCache;
-
 typedef enum JSParseFunctionEnum {
     JS_PARSE_FUNC_STATEMENT,
     JS_PARSE_FUNC_VAR,
@@ -20025,12 +22041,16 @@ typedef struct JSFunctionDef {
     /* pc2line table */
     BOOL strip_debug : 1; /* strip all debug info (implies strip_source = TRUE) */
     BOOL strip_source : 1; /* strip only source code */
+    BOOL lazy_compile : 1; /* inner functions may be compiled on first call */
     JSAtom filename;
     uint32_t source_pos; /* pointer in the eval() source */
     GetLineColCache *get_line_col_cache; /* XXX: could remove to save memory */
     DynBuf pc2line;
+    /* copy of the parsed source shared with the function bytecodes
+       (NULL if strip_source) */
+    JSDebugBuf *source_buf;
 
-    char *source;  /* raw source, utf-8 encoded */
+    const uint8_t *source;  /* raw source in source_buf, utf-8 encoded */
     int source_len;
 
     JSModuleDef *module; /* != NULL when parsing a module */
@@ -20076,6 +22096,16 @@ typedef struct JSParseState {
     BOOL allow_html_comments;
     BOOL ext_json; /* true if accepting JSON superset */
     GetLineColCache get_line_col_cache;
+    /* JSX factory and fragment names (NULL until the first JSX element) */
+    const uint8_t *jsx_factory;
+    int jsx_factory_len;
+    const uint8_t *jsx_fragment;
+    int jsx_fragment_len;
+    /* TypeScript: > 0 while tokens are tentatively parsed as a type,
+       type errors then fail without raising an exception */
+    int ts_speculative;
+    /* TypeScript: start of the true branch of the current '?:' */
+    const uint8_t *ts_cond_ptr;
 } JSParseState;
 
 typedef struct JSOpCode {
@@ -22211,6 +24241,8 @@ static __exception int js_parse_function_decl2(JSParseState *s,
 static __exception int js_parse_assign_expr2(JSParseState *s, int parse_flags);
 static __exception int js_parse_assign_expr(JSParseState *s);
 static __exception int js_parse_unary(JSParseState *s, int parse_flags);
+static __exception int js_parse_ts_type(JSParseState *s, BOOL allow_cond);
+static BOOL js_parse_ts_is_cond_arrow(JSParseState *s);
 static void push_break_entry(JSFunctionDef *fd, BlockEnv *be,
                              JSAtom label_name,
                              int label_break, int label_cont,
@@ -22366,6 +24398,21 @@ static BOOL token_is_ident(int tok)
              tok <= TOK_LAST_KEYWORD));
 }
 
+/* in TypeScript, '<' may start the type parameters of a method */
+static BOOL js_parse_is_method_start(JSParseState *s)
+{
+    return s->token.val == '(' ||
+        (s->token.val == '<' && (s->cur_func->js_mode & JS_MODE_TS));
+}
+
+/* in TypeScript, 'get', 'set' or 'async' followed by these tokens is a
+   property name: get<T>(), get?: T, get!: T */
+static BOOL js_parse_ts_is_name_end(JSParseState *s)
+{
+    return (s->cur_func->js_mode & JS_MODE_TS) &&
+        (s->token.val == '<' || s->token.val == '?' || s->token.val == '!');
+}
+
 /* if the property is an expression, name = JS_ATOM_NULL */
 static int __exception js_parse_property_name(JSParseState *s,
                                               JSAtom *pname,
@@ -22392,7 +24439,8 @@ static int __exception js_parse_property_name(JSParseState *s,
             if (s->token.val == ':' || s->token.val == ',' ||
                 s->token.val == '}' || s->token.val == '(' ||
                 s->token.val == '=' ||
-                (s->token.val == ';' && allow_private)) {
+                (s->token.val == ';' && allow_private) ||
+                js_parse_ts_is_name_end(s)) {
                 is_non_reserved_ident = TRUE;
                 goto ident_found;
             }
@@ -22409,7 +24457,7 @@ static int __exception js_parse_property_name(JSParseState *s,
                 goto fail1;
             if (s->token.val == ':' || s->token.val == ',' ||
                 s->token.val == '}' || s->token.val == '(' ||
-                s->token.val == '=') {
+                s->token.val == '=' || js_parse_ts_is_name_end(s)) {
                 is_non_reserved_ident = TRUE;
                 goto ident_found;
             }
@@ -22436,7 +24484,7 @@ static int __exception js_parse_property_name(JSParseState *s,
         if (is_non_reserved_ident &&
             prop_type == PROP_TYPE_IDENT && allow_var) {
             if (!(s->token.val == ':' ||
-                  (s->token.val == '(' && allow_method))) {
+                  (js_parse_is_method_start(s) && allow_method))) {
                 prop_type = PROP_TYPE_VAR;
             }
         }
@@ -22471,7 +24519,7 @@ static int __exception js_parse_property_name(JSParseState *s,
         goto invalid_prop;
     }
     if (prop_type != PROP_TYPE_IDENT && prop_type != PROP_TYPE_VAR &&
-        s->token.val != '(') {
+        !js_parse_is_method_start(s)) {
         JS_FreeAtom(s->ctx, name);
     invalid_prop:
         js_parse_error(s, "invalid property name");
@@ -22505,6 +24553,14 @@ static __exception int js_parse_seek_token(JSParseState *s, const JSParsePos *sp
     return next_token(s);
 }
 
+/* TypeScript: undo a failed speculative parsing */
+static int js_parse_ts_restore(JSParseState *s, const JSParsePos *pos)
+{
+    /* the tokenizer may have raised an exception */
+    JS_FreeValue(s->ctx, JS_GetException(s->ctx));
+    return js_parse_seek_token(s, pos);
+}
+
 /* return TRUE if a regexp literal is allowed after this token */
 static BOOL is_regexp_allowed(int tok)
 {
@@ -22550,7 +24606,7 @@ static int js_parse_skip_parens_token(JSParseState *s, int *pbits, BOOL no_line_
 {
     char state[256];
     size_t level = 0;
-    JSParsePos pos;
+    JSParsePos pos, pos1;
     int last_tok, tok = TOK_EOF;
     int c, tok_len, bits = 0;
     const uint8_t *last_token_ptr;
@@ -22617,7 +24673,33 @@ static int js_parse_skip_parens_token(JSParseState *s, int *pbits, BOOL no_line_
         case '=':
             bits |= SKIP_HAS_ASSIGNMENT;
             break;
+        case ':':
+            /* TypeScript: skip the type annotations, which may
+               contain '<' or '=>' */
+            if ((s->cur_func->js_mode & JS_MODE_TS) && level >= 2) {
+                js_parse_get_pos(s, &pos1);
+                s->ts_speculative++;
+                c = (next_token(s) || js_parse_ts_type(s, TRUE));
+                s->ts_speculative--;
+                if (!c) {
+                    last_tok = TOK_IDENT;
+                    continue;
+                }
+                if (js_parse_ts_restore(s, &pos1))
+                    goto done;
+            }
+            break;
 
+        case '<':
+            /* JSX elements cannot be skipped token by token: the
+               expression is assumed not to be a destructuring pattern
+               or arrow function parameters */
+            if ((s->cur_func->js_mode & JS_MODE_JSX) &&
+                is_regexp_allowed(last_tok)) {
+                tok = TOK_EOF;
+                goto done;
+            }
+            break;
         case TOK_DIV_ASSIGN:
             tok_len = 2;
             goto parse_regexp;
@@ -22652,6 +24734,25 @@ static int js_parse_skip_parens_token(JSParseState *s, int *pbits, BOOL no_line_
                 tok = TOK_OF;
             if (no_line_terminator && has_lf_in_range(last_token_ptr, s->token.ptr))
                 tok = '\n';
+            if (tok == ':' && no_line_terminator &&
+                (s->cur_func->js_mode & JS_MODE_TS) && *pos.ptr == '(') {
+                /* TypeScript: return type of an arrow function. In
+                   'a ? (b) : c => d', the ':' belongs to the
+                   conditional. */
+                s->ts_speculative++;
+                c = (next_token(s) || js_parse_ts_type(s, TRUE));
+                s->ts_speculative--;
+                if (!c) {
+                    tok = s->token.val;
+                    if (s->got_lf)
+                        tok = '\n';
+                    else if (tok == TOK_ARROW && pos.ptr == s->ts_cond_ptr &&
+                             !js_parse_ts_is_cond_arrow(s))
+                        tok = ':';
+                } else {
+                    JS_FreeValue(s->ctx, JS_GetException(s->ctx));
+                }
+            }
             break;
         }
     }
@@ -22664,6 +24765,881 @@ static int js_parse_skip_parens_token(JSParseState *s, int *pbits, BOOL no_line_
     return tok;
 }
 
+/* TypeScript (JS_MODE_TS): the type annotations and the declarations
+   which only define types are parsed and skipped without emitting
+   code. The types are not checked. Enums, namespaces and parameter
+   properties, which would generate code, are not supported. */
+
+/* return TRUE if the current token is the word 'atom' (identifier or
+   keyword) */
+static BOOL token_is_ts_word(JSParseState *s, JSAtom atom)
+{
+    return token_is_ident(s->token.val) &&
+        s->token.u.ident.atom == atom && !s->token.u.ident.has_escape;
+}
+
+/* no exception is raised while the tokens are speculatively parsed as
+   a type */
+static int js_parse_ts_error(JSParseState *s, const char *msg)
+{
+    if (s->ts_speculative)
+        return -1;
+    return js_parse_error(s, "%s", msg);
+}
+
+static int js_parse_ts_expect(JSParseState *s, int tok)
+{
+    if (s->token.val != tok && s->ts_speculative)
+        return -1;
+    return js_parse_expect(s, tok);
+}
+
+/* skip a balanced (), [] or {} group */
+static int js_parse_ts_skip_group(JSParseState *s)
+{
+    char state[256];
+    size_t level = 0;
+    int c;
+
+    for(;;) {
+        switch(s->token.val) {
+        case '(':
+        case '[':
+        case '{':
+            if (level >= sizeof(state))
+                return js_parse_ts_error(s, "too many nested brackets");
+            state[level++] = s->token.val;
+            break;
+        case ')':
+            c = '(';
+            goto close_group;
+        case ']':
+            c = '[';
+            goto close_group;
+        case '}':
+            if (level > 0 && state[level - 1] == '`') {
+                /* continue the parsing of the template */
+                level--;
+                free_token(s, &s->token);
+                s->got_lf = FALSE;
+                if (js_parse_template_part(s, s->buf_ptr))
+                    return -1;
+                goto handle_template;
+            }
+            c = '{';
+        close_group:
+            if (level == 0 || state[--level] != c)
+                return js_parse_ts_error(s, "unbalanced brackets");
+            break;
+        case TOK_TEMPLATE:
+        handle_template:
+            if (s->token.u.str.sep != '`') {
+                if (level >= sizeof(state))
+                    return js_parse_ts_error(s, "too many nested brackets");
+                state[level++] = '`';
+            }
+            break;
+        case TOK_EOF:
+            return js_parse_ts_error(s, "unexpected end of input");
+        }
+        if (next_token(s))
+            return -1;
+        if (level == 0)
+            return 0;
+    }
+}
+
+/* TypeScript: the current token is the '=>' of '(b): c => d' which
+   starts the consequent of a conditional. It is an arrow function only
+   if its body is followed by the ':' of the conditional, otherwise
+   'c => d' is the alternate. */
+static BOOL js_parse_ts_is_cond_arrow(JSParseState *s)
+{
+    int cond_level = 0;
+    BOOL ret = FALSE;
+
+    s->ts_speculative++;
+    if (next_token(s))
+        goto done;
+    for(;;) {
+        switch(s->token.val) {
+        case '?':
+            cond_level++;
+            break;
+        case ':':
+            if (cond_level == 0) {
+                ret = TRUE;
+                goto done;
+            }
+            cond_level--;
+            break;
+        case ')':
+        case ']':
+        case '}':
+        case ',':
+        case ';':
+        case TOK_EOF:
+            goto done;
+        }
+        if (js_parse_ts_skip_group(s))
+            goto done;
+    }
+ done:
+    s->ts_speculative--;
+    JS_FreeValue(s->ctx, JS_GetException(s->ctx));
+    return ret;
+}
+
+/* consume the '>' closing a type parameter or argument list. '>>',
+   '>=', ... are split. */
+static int js_parse_ts_close_angle(JSParseState *s)
+{
+    switch(s->token.val) {
+    case '>':
+        return next_token(s);
+    case TOK_SAR:
+    case TOK_SHR:
+    case TOK_GTE:
+    case TOK_SAR_ASSIGN:
+    case TOK_SHR_ASSIGN:
+        s->buf_ptr = s->token.ptr + 1;
+        return next_token(s);
+    default:
+        return js_parse_ts_expect(s, '>');
+    }
+}
+
+static int js_parse_ts_type_args(JSParseState *s)
+{
+    if (js_parse_ts_expect(s, '<'))
+        return -1;
+    for(;;) {
+        if (js_parse_ts_type(s, TRUE))
+            return -1;
+        if (s->token.val != ',')
+            break;
+        if (next_token(s))
+            return -1;
+    }
+    return js_parse_ts_close_angle(s);
+}
+
+static int js_parse_ts_type_params(JSParseState *s)
+{
+    if (js_parse_ts_expect(s, '<'))
+        return -1;
+    for(;;) {
+        /* const and variance modifiers */
+        while ((s->token.val == TOK_CONST || s->token.val == TOK_IN ||
+                token_is_ts_word(s, JS_ATOM_out)) &&
+               peek_token(s, FALSE) == TOK_IDENT) {
+            if (next_token(s))
+                return -1;
+        }
+        if (s->token.val != TOK_IDENT)
+            return js_parse_ts_error(s, "type parameter name expected");
+        if (next_token(s))
+            return -1;
+        if (s->token.val == TOK_EXTENDS) {
+            if (next_token(s) || js_parse_ts_type(s, TRUE))
+                return -1;
+        }
+        if (s->token.val == '=') {
+            if (next_token(s) || js_parse_ts_type(s, TRUE))
+                return -1;
+        }
+        if (s->token.val != ',')
+            break;
+        if (next_token(s))
+            return -1;
+        /* accept a trailing comma, e.g. <T,>() => {} in TSX */
+        if (s->token.val == '>')
+            break;
+    }
+    return js_parse_ts_close_angle(s);
+}
+
+/* return TRUE if a type may start after the current token on the same
+   line */
+static BOOL js_parse_ts_peek_type_start(JSParseState *s)
+{
+    int c = peek_token(s, TRUE);
+    return (c == TOK_IDENT || c == TOK_IMPORT || c == '(' || c == '[' ||
+            c == '{' || c == '<' || c == '\'' || c == '"' || c == '`' ||
+            c == '-' || (c >= '0' && c <= '9'));
+}
+
+static int js_parse_ts_primary_type(JSParseState *s)
+{
+    JSParsePos pos;
+
+    switch(s->token.val) {
+    case '(':
+        /* function type or parenthesized type */
+        js_parse_get_pos(s, &pos);
+        if (js_parse_ts_skip_group(s))
+            return -1;
+        if (s->token.val == TOK_ARROW)
+            goto function_type;
+        if (js_parse_seek_token(s, &pos) || next_token(s) ||
+            js_parse_ts_type(s, TRUE))
+            return -1;
+        return js_parse_ts_expect(s, ')');
+    case '<':
+        /* generic function type */
+        if (js_parse_ts_type_params(s))
+            return -1;
+    function_params:
+        if (s->token.val != '(')
+            return js_parse_ts_expect(s, '(');
+        if (js_parse_ts_skip_group(s))
+            return -1;
+    function_type:
+        if (js_parse_ts_expect(s, TOK_ARROW))
+            return -1;
+        return js_parse_ts_type(s, TRUE);
+    case TOK_NEW:
+    constructor_type:
+        if (next_token(s))
+            return -1;
+        if (s->token.val == '<' && js_parse_ts_type_params(s))
+            return -1;
+        goto function_params;
+    case '{':
+    case '[':
+        /* object, mapped and tuple types */
+        return js_parse_ts_skip_group(s);
+    case '-':
+        if (next_token(s))
+            return -1;
+        if (s->token.val != TOK_NUMBER)
+            return js_parse_ts_error(s, "number expected");
+        /* fall thru */
+    case TOK_NUMBER:
+    case TOK_STRING:
+    case TOK_NULL:
+    case TOK_TRUE:
+    case TOK_FALSE:
+    case TOK_VOID:
+        return next_token(s);
+    case TOK_THIS:
+        if (next_token(s))
+            return -1;
+        goto type_predicate;
+    case TOK_TEMPLATE:
+        /* template literal type */
+        while (s->token.u.str.sep != '`') {
+            if (next_token(s) || js_parse_ts_type(s, TRUE))
+                return -1;
+            if (s->token.val != '}')
+                return js_parse_ts_expect(s, '}');
+            free_token(s, &s->token);
+            s->got_lf = FALSE;
+            if (js_parse_template_part(s, s->buf_ptr))
+                return -1;
+        }
+        return next_token(s);
+    case TOK_TYPEOF:
+        /* type query */
+        if (next_token(s))
+            return -1;
+        if (s->token.val == TOK_IMPORT)
+            goto import_type;
+        if (!token_is_ident(s->token.val))
+            return js_parse_ts_error(s, "identifier expected");
+        goto type_name;
+    case TOK_IMPORT:
+    import_type:
+        if (next_token(s))
+            return -1;
+        if (s->token.val != '(')
+            return js_parse_ts_expect(s, '(');
+        if (js_parse_ts_skip_group(s))
+            return -1;
+        goto qualified_name;
+    case TOK_IDENT:
+        if (token_is_ts_word(s, JS_ATOM_asserts) &&
+            peek_token(s, TRUE) == TOK_IDENT) {
+            /* 'asserts x' or 'asserts x is T' */
+            if (next_token(s))
+                return -1;
+            if (!token_is_ident(s->token.val))
+                return js_parse_ts_error(s, "identifier expected");
+            goto type_name;
+        }
+        if (token_is_ts_word(s, JS_ATOM_abstract) &&
+            peek_token(s, TRUE) == TOK_IDENT) {
+            if (next_token(s))
+                return -1;
+            if (s->token.val != TOK_NEW)
+                return js_parse_ts_error(s, "'new' expected");
+            goto constructor_type;
+        }
+    type_name:
+        if (next_token(s))
+            return -1;
+    qualified_name:
+        while (s->token.val == '.') {
+            if (next_token(s))
+                return -1;
+            if (!token_is_ident(s->token.val))
+                return js_parse_ts_error(s, "identifier expected");
+            if (next_token(s))
+                return -1;
+        }
+        if (s->token.val == '<' && !s->got_lf) {
+            if (js_parse_ts_type_args(s))
+                return -1;
+        }
+    type_predicate:
+        if (token_is_ts_word(s, JS_ATOM_is) && !s->got_lf) {
+            if (next_token(s))
+                return -1;
+            return js_parse_ts_type(s, TRUE);
+        }
+        return 0;
+    default:
+        return js_parse_ts_error(s, "type expected");
+    }
+}
+
+static int js_parse_ts_type_operand(JSParseState *s)
+{
+    JSParsePos pos;
+    int ret;
+
+    if ((token_is_ts_word(s, JS_ATOM_keyof) ||
+         token_is_ts_word(s, JS_ATOM_unique) ||
+         token_is_ts_word(s, JS_ATOM_readonly)) &&
+        js_parse_ts_peek_type_start(s)) {
+        /* type operator */
+        if (next_token(s))
+            return -1;
+        return js_parse_ts_type_operand(s);
+    }
+    if (token_is_ts_word(s, JS_ATOM_infer) &&
+        peek_token(s, TRUE) == TOK_IDENT) {
+        if (next_token(s) || next_token(s))
+            return -1;
+        if (s->token.val == TOK_EXTENDS) {
+            /* constraint of the inferred type, unless the 'extends'
+               starts a conditional type */
+            js_parse_get_pos(s, &pos);
+            s->ts_speculative++;
+            ret = (next_token(s) || js_parse_ts_type(s, FALSE) ||
+                   s->token.val == '?');
+            s->ts_speculative--;
+            if (ret && js_parse_ts_restore(s, &pos))
+                return -1;
+        }
+        return 0;
+    }
+    if (js_parse_ts_primary_type(s))
+        return -1;
+    /* array and indexed access types */
+    while (s->token.val == '[' && !s->got_lf) {
+        if (next_token(s))
+            return -1;
+        if (s->token.val != ']' && js_parse_ts_type(s, TRUE))
+            return -1;
+        if (js_parse_ts_expect(s, ']'))
+            return -1;
+    }
+    return 0;
+}
+
+/* skip a type. Conditional types are accepted if 'allow_cond' is TRUE. */
+static __exception int js_parse_ts_type(JSParseState *s, BOOL allow_cond)
+{
+    /* union and intersection types, with an optional leading operator */
+    if (s->token.val == '|' || s->token.val == '&') {
+        if (next_token(s))
+            return -1;
+    }
+    for(;;) {
+        if (js_parse_ts_type_operand(s))
+            return -1;
+        if (s->token.val != '|' && s->token.val != '&')
+            break;
+        if (next_token(s))
+            return -1;
+    }
+    if (allow_cond && s->token.val == TOK_EXTENDS && !s->got_lf) {
+        if (next_token(s) ||
+            js_parse_ts_type(s, FALSE) ||
+            js_parse_ts_expect(s, '?') ||
+            js_parse_ts_type(s, TRUE) ||
+            js_parse_ts_expect(s, ':') ||
+            js_parse_ts_type(s, TRUE))
+            return -1;
+    }
+    return 0;
+}
+
+/* skip the optional ': type' annotation. Nothing is done outside of
+   TypeScript. */
+static int js_parse_ts_type_annotation(JSParseState *s)
+{
+    if (s->token.val != ':' || !(s->cur_func->js_mode & JS_MODE_TS))
+        return 0;
+    if (next_token(s))
+        return -1;
+    return js_parse_ts_type(s, TRUE);
+}
+
+/* return TRUE if 'f<T>' is followed by a token which makes it a call
+   or an instantiation expression instead of a comparison */
+static BOOL js_parse_ts_can_follow_type_args(JSParseState *s)
+{
+    switch(s->token.val) {
+    case '(':
+    case TOK_TEMPLATE:
+        return TRUE;
+    case '<':
+    case '>':
+    case '+':
+    case '-':
+    case '=':
+        return FALSE;
+    }
+    if (s->got_lf)
+        return TRUE;
+    /* tokens which cannot start an expression and binary operators */
+    switch(s->token.val) {
+    case ')':
+    case ']':
+    case '}':
+    case ',':
+    case ';':
+    case ':':
+    case '?':
+    case '.':
+    case TOK_QUESTION_MARK_DOT:
+    case TOK_EOF:
+    case '*':
+    case '/':
+    case '%':
+    case '&':
+    case '|':
+    case '^':
+    case TOK_POW:
+    case TOK_SHL:
+    case TOK_SAR:
+    case TOK_SHR:
+    case TOK_LTE:
+    case TOK_GTE:
+    case TOK_EQ:
+    case TOK_NEQ:
+    case TOK_STRICT_EQ:
+    case TOK_STRICT_NEQ:
+    case TOK_LAND:
+    case TOK_LOR:
+    case TOK_DOUBLE_QUESTION_MARK:
+    case TOK_IN:
+    case TOK_INSTANCEOF:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/* at a '<' following an expression: skip the type arguments of
+   'f<T>(x)' or 'f<T>' and return 1. Return 0 and keep the position if
+   the '<' is a comparison. */
+static int js_parse_ts_skip_call_type_args(JSParseState *s)
+{
+    JSParsePos pos;
+    int ret;
+
+    js_parse_get_pos(s, &pos);
+    s->ts_speculative++;
+    ret = js_parse_ts_type_args(s);
+    s->ts_speculative--;
+    if (ret == 0 && js_parse_ts_can_follow_type_args(s))
+        return 1;
+    if (js_parse_ts_restore(s, &pos))
+        return -1;
+    return 0;
+}
+
+/* return TRUE if the current '<' starts a generic arrow function */
+static BOOL js_parse_ts_is_generic_arrow(JSParseState *s)
+{
+    JSParsePos pos;
+    BOOL ret;
+
+    js_parse_get_pos(s, &pos);
+    s->ts_speculative++;
+    ret = (js_parse_ts_type_params(s) == 0 && s->token.val == '(' &&
+           js_parse_skip_parens_token(s, NULL, TRUE) == TOK_ARROW);
+    s->ts_speculative--;
+    /* the position was valid before */
+    js_parse_ts_restore(s, &pos);
+    return ret;
+}
+
+/* at the '<' or '(' starting the signature of a function or a method:
+   if it has no body (overload or abstract declaration), skip it and
+   return 1. Otherwise return 0 and keep the position. */
+static int js_parse_ts_bodyless_signature(JSParseState *s)
+{
+    JSParsePos pos;
+    int ret;
+
+    js_parse_get_pos(s, &pos);
+    s->ts_speculative++;
+    ret = ((s->token.val == '<' && js_parse_ts_type_params(s)) ||
+           s->token.val != '(' ||
+           js_parse_ts_skip_group(s) ||
+           js_parse_ts_type_annotation(s));
+    s->ts_speculative--;
+    if (ret == 0 && s->token.val != '{') {
+        if (js_parse_expect_semi(s))
+            return -1;
+        return 1;
+    }
+    if (js_parse_ts_restore(s, &pos))
+        return -1;
+    return 0;
+}
+
+/* skip the modifiers of a class member. '*pskip' is set to TRUE if
+   the member generates no code ('declare' or 'abstract'). */
+static int js_parse_ts_class_modifiers(JSParseState *s, BOOL *pskip)
+{
+    BOOL is_skip;
+    int c;
+
+    for(;;) {
+        is_skip = (token_is_ts_word(s, JS_ATOM_abstract) ||
+                   token_is_ts_word(s, JS_ATOM_declare));
+        if (!is_skip &&
+            !token_is_ts_word(s, JS_ATOM_public) &&
+            !token_is_ts_word(s, JS_ATOM_private) &&
+            !token_is_ts_word(s, JS_ATOM_protected) &&
+            !token_is_ts_word(s, JS_ATOM_readonly) &&
+            !token_is_ts_word(s, JS_ATOM_override))
+            break;
+        /* otherwise the word is the member name */
+        c = peek_token(s, TRUE);
+        if (c == '\n' || c == '(' || c == '=' || c == ';' || c == '}' ||
+            c == ':' || c == '?' || c == '!' || c == '<' || c == ',')
+            break;
+        if (is_skip)
+            *pskip = TRUE;
+        if (next_token(s))
+            return -1;
+    }
+    return 0;
+}
+
+/* return TRUE if the current token is the modifier of a constructor
+   parameter property */
+static BOOL js_parse_ts_is_param_property(JSParseState *s)
+{
+    int c;
+
+    if (!token_is_ts_word(s, JS_ATOM_public) &&
+        !token_is_ts_word(s, JS_ATOM_private) &&
+        !token_is_ts_word(s, JS_ATOM_protected) &&
+        !token_is_ts_word(s, JS_ATOM_readonly) &&
+        !token_is_ts_word(s, JS_ATOM_override))
+        return FALSE;
+    c = peek_token(s, FALSE);
+    return c == TOK_IDENT || c == '{' || c == '[';
+}
+
+/* return TRUE if the current '[' starts an index signature */
+static BOOL js_parse_ts_is_index_signature(JSParseState *s)
+{
+    JSParsePos pos;
+    BOOL ret;
+
+    js_parse_get_pos(s, &pos);
+    ret = (next_token(s) == 0 && token_is_ident(s->token.val) &&
+           peek_token(s, FALSE) == ':');
+    js_parse_ts_restore(s, &pos);
+    return ret;
+}
+
+/* skip a class member which generates no code: 'declare' or
+   'abstract' member, index signature */
+static int js_parse_ts_skip_class_member(JSParseState *s)
+{
+    int c;
+
+    if (token_is_ts_word(s, JS_ATOM_get) || token_is_ts_word(s, JS_ATOM_set) ||
+        token_is_ts_word(s, JS_ATOM_async)) {
+        c = peek_token(s, TRUE);
+        if (c != '\n' && c != '(' && c != '=' && c != ';' && c != '}' &&
+            c != ':' && c != '?' && c != '!' && c != '<') {
+            if (next_token(s))
+                return -1;
+        }
+    }
+    if (s->token.val == '*' && next_token(s))
+        return -1;
+    /* member name */
+    if (s->token.val == '[') {
+        if (js_parse_ts_skip_group(s))
+            return -1;
+    } else {
+        if (next_token(s))
+            return -1;
+    }
+    if ((s->token.val == '?' || s->token.val == '!') && next_token(s))
+        return -1;
+    if (js_parse_is_method_start(s)) {
+        if (s->token.val == '<' && js_parse_ts_type_params(s))
+            return -1;
+        if (s->token.val != '(')
+            return js_parse_expect(s, '(');
+        if (js_parse_ts_skip_group(s))
+            return -1;
+    }
+    if (js_parse_ts_type_annotation(s))
+        return -1;
+    return js_parse_expect_semi(s);
+}
+
+/* skip the header and the {} body of a declaration */
+static int js_parse_ts_skip_declaration_body(JSParseState *s)
+{
+    int depth = 0;
+
+    for(;;) {
+        switch(s->token.val) {
+        case '{':
+            if (depth <= 0)
+                return js_parse_ts_skip_group(s);
+            /* fall thru */
+        case '(':
+        case '[':
+            if (js_parse_ts_skip_group(s))
+                return -1;
+            continue;
+        case '<':
+            depth++;
+            break;
+        case '>':
+            depth--;
+            break;
+        case TOK_SAR:
+            depth -= 2;
+            break;
+        case TOK_SHR:
+            depth -= 3;
+            break;
+        case TOK_EOF:
+            return js_parse_expect(s, '{');
+        }
+        if (next_token(s))
+            return -1;
+    }
+}
+
+/* skip a type only import or export clause and its from clause */
+static int js_parse_ts_skip_module_clause(JSParseState *s)
+{
+    for(;;) {
+        if (s->token.val == '{') {
+            if (js_parse_ts_skip_group(s))
+                return -1;
+        } else if (token_is_ts_word(s, JS_ATOM_from)) {
+            if (next_token(s))
+                return -1;
+            if (s->token.val != TOK_STRING)
+                return js_parse_error(s, "string expected");
+            if (next_token(s))
+                return -1;
+            break;
+        } else {
+            if (next_token(s))
+                return -1;
+        }
+        if (s->token.val == ';' || s->token.val == '}' ||
+            s->token.val == TOK_EOF || s->got_lf)
+            break;
+    }
+    return js_parse_expect_semi(s);
+}
+
+/* skip a 'type A' or 'type A as B' import or export specifier and
+   return 1. Return 0 if it is not a type specifier. */
+static int js_parse_ts_type_specifier(JSParseState *s)
+{
+    JSParsePos pos;
+
+    if (!token_is_ts_word(s, JS_ATOM_type))
+        return 0;
+    js_parse_get_pos(s, &pos);
+    if (next_token(s))
+        return -1;
+    /* '{ type }' and '{ type as x }' refer to the binding 'type' */
+    if (!token_is_ident(s->token.val) ||
+        (token_is_ts_word(s, JS_ATOM_as) && peek_token(s, FALSE) == TOK_IDENT)) {
+        if (js_parse_seek_token(s, &pos))
+            return -1;
+        return 0;
+    }
+    if (next_token(s))
+        return -1;
+    if (token_is_ts_word(s, JS_ATOM_as)) {
+        if (next_token(s) || next_token(s))
+            return -1;
+    }
+    return 1;
+}
+
+/* skip 'Name<T> = type;' following 'type' */
+static int js_parse_ts_type_alias(JSParseState *s)
+{
+    if (s->token.val != TOK_IDENT)
+        return js_parse_error(s, "type name expected");
+    if (next_token(s))
+        return -1;
+    if (s->token.val == '<' && js_parse_ts_type_params(s))
+        return -1;
+    if (js_parse_expect(s, '=') || js_parse_ts_type(s, TRUE))
+        return -1;
+    return js_parse_expect_semi(s);
+}
+
+/* at 'type' following 'import': return 1 if it starts a type only
+   import */
+static int js_parse_ts_is_type_import(JSParseState *s)
+{
+    JSParsePos pos;
+    int c, ret;
+
+    c = peek_token(s, TRUE);
+    if (c == '{' || c == '*')
+        return 1;
+    if (c != TOK_IDENT)
+        return 0;
+    /* 'import type from "x"' imports the default export as 'type' */
+    js_parse_get_pos(s, &pos);
+    if (next_token(s))
+        return -1;
+    c = peek_token(s, TRUE);
+    ret = !(token_is_ts_word(s, JS_ATOM_from) && (c == '\'' || c == '"'));
+    if (js_parse_seek_token(s, &pos))
+        return -1;
+    return ret;
+}
+
+/* skip the declarations following 'declare' */
+static int js_parse_ts_ambient_declaration(JSParseState *s)
+{
+    int ret;
+
+    if (s->token.val == TOK_VAR || s->token.val == TOK_CONST ||
+        token_is_ts_word(s, JS_ATOM_let)) {
+        if (next_token(s))
+            return -1;
+        if (s->token.val == TOK_ENUM)
+            return js_parse_ts_skip_declaration_body(s);
+        for(;;) {
+            if (s->token.val == '{' || s->token.val == '[') {
+                if (js_parse_ts_skip_group(s))
+                    return -1;
+            } else {
+                if (s->token.val != TOK_IDENT)
+                    return js_parse_error(s, "variable name expected");
+                if (next_token(s))
+                    return -1;
+            }
+            if (js_parse_ts_type_annotation(s))
+                return -1;
+            if (s->token.val != ',')
+                break;
+            if (next_token(s))
+                return -1;
+        }
+        return js_parse_expect_semi(s);
+    } else if (s->token.val == TOK_FUNCTION) {
+        if (next_token(s))
+            return -1;
+        if (s->token.val != TOK_IDENT)
+            return js_parse_error(s, "function name expected");
+        if (next_token(s))
+            return -1;
+        ret = js_parse_ts_bodyless_signature(s);
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
+            return js_parse_error(s, "function body not allowed in declaration");
+        return 0;
+    } else if (token_is_ts_word(s, JS_ATOM_module) ||
+               token_is_ts_word(s, JS_ATOM_namespace) ||
+               token_is_ts_word(s, JS_ATOM_global)) {
+        /* ambient module or namespace, possibly without body */
+        do {
+            if (next_token(s))
+                return -1;
+        } while (s->token.val != '{' && s->token.val != ';' &&
+                 s->token.val != TOK_EOF && !s->got_lf);
+        if (s->token.val == '{')
+            return js_parse_ts_skip_group(s);
+        return js_parse_expect_semi(s);
+    } else if (token_is_ts_word(s, JS_ATOM_type)) {
+        if (next_token(s))
+            return -1;
+        return js_parse_ts_type_alias(s);
+    } else {
+        /* class, enum, interface */
+        return js_parse_ts_skip_declaration_body(s);
+    }
+}
+
+/* skip the TypeScript declarations which generate no code and return
+   1. 'abstract' before 'class' is skipped and 0 is returned. */
+static int js_parse_ts_declaration(JSParseState *s)
+{
+    JSParsePos pos;
+    JSAtom atom;
+    int c;
+
+    if (s->token.val == TOK_ENUM)
+        return js_parse_error(s, "TypeScript enums are not supported");
+    if (!token_is_ident(s->token.val) || s->token.u.ident.has_escape)
+        return 0;
+    atom = s->token.u.ident.atom;
+    if (atom != JS_ATOM_type && atom != JS_ATOM_interface &&
+        atom != JS_ATOM_declare && atom != JS_ATOM_abstract &&
+        atom != JS_ATOM_namespace && atom != JS_ATOM_module)
+        return 0;
+    /* these words start a declaration only when followed by an
+       identifier on the same line */
+    c = peek_token(s, TRUE);
+    if (c != TOK_IDENT && !(c == TOK_FUNCTION && atom == JS_ATOM_declare))
+        return 0;
+    switch(atom) {
+    case JS_ATOM_type:
+        if (next_token(s) || js_parse_ts_type_alias(s))
+            return -1;
+        break;
+    case JS_ATOM_interface:
+        if (js_parse_ts_skip_declaration_body(s))
+            return -1;
+        break;
+    case JS_ATOM_declare:
+        if (next_token(s) || js_parse_ts_ambient_declaration(s))
+            return -1;
+        break;
+    case JS_ATOM_abstract:
+        js_parse_get_pos(s, &pos);
+        if (next_token(s))
+            return -1;
+        if (s->token.val != TOK_CLASS && js_parse_seek_token(s, &pos))
+            return -1;
+        return 0;
+    default:
+        return js_parse_error(s, "TypeScript namespaces are not supported");
+    }
+    return 1;
+}
+
 static void set_object_name(JSParseState *s, JSAtom name)
 {
     JSFunctionDef *fd = s->cur_func;
@@ -22753,7 +25729,7 @@ static __exception int js_parse_object_literal(JSParseState *s)
             emit_u16(s, s->cur_func->scope_level);
             emit_op(s, OP_define_field);
             emit_atom(s, name);
-        } else if (s->token.val == '(') {
+        } else if (js_parse_is_method_start(s)) {
             BOOL is_getset = (prop_type == PROP_TYPE_GET ||
                               prop_type == PROP_TYPE_SET);
             JSParseFunctionEnum func_type;
@@ -23026,7 +26002,7 @@ static __exception int js_parse_class(JSParseState *s, BOOL is_class_expr,
     JSFunctionDef *method_fd, *ctor_fd;
     int saved_js_mode, class_name_var_idx, prop_type, ctor_cpool_offset;
     int class_flags = 0, i, define_class_offset;
-    BOOL is_static, is_private;
+    BOOL is_static, is_private, ts_skip;
     const uint8_t *class_start_ptr = s->token.ptr;
     const uint8_t *start_ptr;
     ClassFieldsDef class_fields[2];
@@ -23048,6 +26024,10 @@ static __exception int js_parse_class(JSParseState *s, BOOL is_class_expr,
         js_parse_error(s, "class statement requires a name");
         goto fail;
     }
+    if ((fd->js_mode & JS_MODE_TS) && s->token.val == '<') {
+        if (js_parse_ts_type_params(s))
+            goto fail;
+    }
     if (!is_class_expr) {
         if (class_name == JS_ATOM_NULL)
             class_var_name = JS_ATOM__default_; /* export default */
@@ -23064,9 +26044,22 @@ static __exception int js_parse_class(JSParseState *s, BOOL is_class_expr,
             goto fail;
         if (js_parse_left_hand_side_expr(s))
             goto fail;
+        if ((fd->js_mode & JS_MODE_TS) && s->token.val == '<') {
+            if (js_parse_ts_type_args(s))
+                goto fail;
+        }
     } else {
         emit_op(s, OP_undefined);
     }
+    if ((fd->js_mode & JS_MODE_TS) &&
+        token_is_ts_word(s, JS_ATOM_implements)) {
+        do {
+            if (next_token(s))
+                goto fail;
+            if (js_parse_ts_type(s, FALSE))
+                goto fail;
+        } while (s->token.val == ',');
+    }
 
     /* add a 'const' definition for the class name */
     if (class_name != JS_ATOM_NULL) {
@@ -23115,9 +26108,15 @@ static __exception int js_parse_class(JSParseState *s, BOOL is_class_expr,
             continue;
         }
         is_static = FALSE;
+        ts_skip = FALSE;
+        if ((fd->js_mode & JS_MODE_TS) &&
+            js_parse_ts_class_modifiers(s, &ts_skip))
+            goto fail;
         if (s->token.val == TOK_STATIC) {
             int next = peek_token(s, TRUE);
-            if (!(next == ';' || next == '}' || next == '(' || next == '='))
+            if (!(next == ';' || next == '}' || next == '(' || next == '=' ||
+                  ((fd->js_mode & JS_MODE_TS) &&
+                   (next == ':' || next == '?' || next == '!' || next == '<'))))
                 is_static = TRUE;
         }
         prop_type = -1;
@@ -23164,8 +26163,19 @@ static __exception int js_parse_class(JSParseState *s, BOOL is_class_expr,
                 is_static = FALSE;
                 name = JS_DupAtom(ctx, JS_ATOM_static);
                 prop_type = PROP_TYPE_IDENT;
+            } else if ((fd->js_mode & JS_MODE_TS) &&
+                       js_parse_ts_class_modifiers(s, &ts_skip)) {
+                goto fail;
             }
         }
+        if (prop_type < 0 && (fd->js_mode & JS_MODE_TS) &&
+            (ts_skip || (s->token.val == '[' &&
+                         js_parse_ts_is_index_signature(s)))) {
+            /* declare and abstract members, index signatures */
+            if (js_parse_ts_skip_class_member(s))
+                goto fail;
+            continue;
+        }
         if (is_static)
             emit_op(s, OP_swap);
         start_ptr = s->token.ptr;
@@ -23174,6 +26184,12 @@ static __exception int js_parse_class(JSParseState *s, BOOL is_class_expr,
             if (prop_type < 0)
                 goto fail;
         }
+        if ((fd->js_mode & JS_MODE_TS) &&
+            (s->token.val == '?' || s->token.val == '!')) {
+            /* optional or definitely assigned member */
+            if (next_token(s))
+                goto fail;
+        }
         is_private = prop_type & PROP_TYPE_PRIVATE;
         prop_type &= ~PROP_TYPE_PRIVATE;
 
@@ -23247,11 +26263,13 @@ static __exception int js_parse_class(JSParseState *s, BOOL is_class_expr,
                 }
                 emit_u8(s, OP_DEFINE_METHOD_GETTER + is_set);
             }
-        } else if (prop_type == PROP_TYPE_IDENT && s->token.val != '(') {
+        } else if (prop_type == PROP_TYPE_IDENT && !js_parse_is_method_start(s)) {
             ClassFieldsDef *cf = &class_fields[is_static];
             JSAtom field_var_name = JS_ATOM_NULL;
 
             /* class field */
+            if (js_parse_ts_type_annotation(s))
+                goto fail;
 
             /* XXX: spec: not consistent with method name checks */
             if (name == JS_ATOM_constructor || name == JS_ATOM_prototype) {
@@ -23354,6 +26372,17 @@ static __exception int js_parse_class(JSParseState *s, BOOL is_class_expr,
                 else
                     func_type = JS_PARSE_FUNC_CLASS_CONSTRUCTOR;
             }
+            if (fd->js_mode & JS_MODE_TS) {
+                int ret = js_parse_ts_bodyless_signature(s);
+                if (ret < 0)
+                    goto fail;
+                if (ret) {
+                    /* overload signature: drop the computed name */
+                    if (name == JS_ATOM_NULL)
+                        emit_op(s, OP_drop);
+                    goto next_member;
+                }
+            }
             if (is_private) {
                 class_fields[is_static].need_brand = TRUE;
             }
@@ -23389,6 +26418,7 @@ static __exception int js_parse_class(JSParseState *s, BOOL is_class_expr,
                 emit_u8(s, OP_DEFINE_METHOD_METHOD);
             }
         }
+    next_member:
         if (is_static)
             emit_op(s, OP_swap);
         JS_FreeAtom(ctx, name);
@@ -23409,12 +26439,8 @@ static __exception int js_parse_class(JSParseState *s, BOOL is_class_expr,
 
     /* store the class source code in the constructor. */
     if (!fd->strip_source) {
-        js_free(ctx, ctor_fd->source);
         ctor_fd->source_len = s->buf_ptr - class_start_ptr;
-        ctor_fd->source = js_strndup(ctx, (const char *)class_start_ptr,
-                                     ctor_fd->source_len);
-        if (!ctor_fd->source)
-            goto fail;
+        ctor_fd->source = class_start_ptr;
     }
 
     /* consume the '}' */
@@ -24427,6 +27453,8 @@ static int js_parse_destructuring_element(JSParseState *s, int tok, int is_arg,
     } else {
         return js_parse_error(s, "invalid assignment syntax");
     }
+    if (tok != 0 && js_parse_ts_type_annotation(s))
+        return -1;
     if (s->token.val == '=' && allow_initializer) {
         label_done = emit_goto(s, OP_goto, -1);
         if (next_token(s))
@@ -24486,6 +27514,573 @@ static void optional_chain_test(JSParseState *s, int *poptional_chaining_label,
     emit_label(s, label_next);
 }
 
+/* JSX (JS_MODE_JSX): the elements are compiled to calls of the
+   factory function, e.g. <a x="1">b</a> is compiled as
+   React.createElement("a", { x: "1" }, "b") */
+
+static const char js_jsx_default_factory[] = "React.createElement";
+static const char js_jsx_default_fragment[] = "React.Fragment";
+
+static BOOL js_jsx_is_space(int c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* return the end of the dotted name starting at 'p' */
+static const uint8_t *js_jsx_pragma_end(const uint8_t *p, const uint8_t *end)
+{
+    while (p < end && (*p == '.' || *p >= 0x80 || lre_js_is_ident_next(*p)))
+        p++;
+    return p;
+}
+
+/* read the '@jsx' and '@jsxFrag' pragmas in the comments at the start
+   of the source */
+static void js_parse_jsx_pragma(JSParseState *s)
+{
+    const uint8_t *p, *end, *q, *name;
+    const uint8_t *buf_end = s->buf_end;
+    BOOL is_frag;
+
+    s->jsx_factory = (const uint8_t *)js_jsx_default_factory;
+    s->jsx_factory_len = sizeof(js_jsx_default_factory) - 1;
+    s->jsx_fragment = (const uint8_t *)js_jsx_default_fragment;
+    s->jsx_fragment_len = sizeof(js_jsx_default_fragment) - 1;
+
+    p = s->buf_start;
+    skip_shebang(&p, buf_end);
+    for(;;) {
+        while (p < buf_end && js_jsx_is_space(*p))
+            p++;
+        if (buf_end - p < 2 || p[0] != '/')
+            break;
+        if (p[1] == '*') {
+            for (end = p + 2; end < buf_end - 1; end++) {
+                if (end[0] == '*' && end[1] == '/')
+                    break;
+            }
+        } else if (p[1] == '/') {
+            for (end = p + 2; end < buf_end && *end != '\n'; end++)
+                continue;
+        } else {
+            break;
+        }
+        for (q = p + 2; q < end; q++) {
+            if (*q != '@' || end - q < 5 || memcmp(q + 1, "jsx", 3))
+                continue;
+            q += 4;
+            is_frag = (end - q >= 4 && !memcmp(q, "Frag", 4));
+            if (is_frag)
+                q += 4;
+            if (q >= end || (*q != ' ' && *q != '\t'))
+                continue;
+            while (q < end && (*q == ' ' || *q == '\t'))
+                q++;
+            name = q;
+            q = js_jsx_pragma_end(q, end);
+            if (q == name)
+                continue;
+            if (is_frag) {
+                s->jsx_fragment = name;
+                s->jsx_fragment_len = q - name;
+            } else {
+                s->jsx_factory = name;
+                s->jsx_factory_len = q - name;
+            }
+        }
+        p = end + 2;
+    }
+}
+
+/* skip the spaces and comments inside a JSX tag */
+static const uint8_t *js_jsx_skip_spaces(JSParseState *s, const uint8_t *p)
+{
+    for(;;) {
+        if (js_jsx_is_space(*p)) {
+            p++;
+        } else if (p[0] == '/' && p[1] == '*') {
+            for (p += 2; p < s->buf_end; p++) {
+                if (p[0] == '*' && p[1] == '/') {
+                    p += 2;
+                    break;
+                }
+            }
+        } else if (p[0] == '/' && p[1] == '/') {
+            while (p < s->buf_end && *p != '\n')
+                p++;
+        } else {
+            return p;
+        }
+    }
+}
+
+/* return the end of the JSX tag or attribute name starting at 'p'.
+   '-' is accepted in identifiers and ':' or '.' separate the
+   namespace or the members. */
+static const uint8_t *js_jsx_name_end(const uint8_t *p)
+{
+    const uint8_t *p_start = p;
+
+    while (*p >= 0x80 || lre_js_is_ident_next(*p) ||
+           (p != p_start && (*p == '-' || *p == ':' || *p == '.')))
+        p++;
+    return p;
+}
+
+/* emit the value of the dotted name 'name'. If 'is_method' and the
+   name has several parts, the object is left below the value for
+   OP_call_method and TRUE is returned. */
+static int emit_jsx_member(JSParseState *s, const uint8_t *name, int len,
+                           BOOL is_method)
+{
+    const uint8_t *p, *q, *end;
+    JSAtom atom;
+    BOOL ret = FALSE;
+
+    end = name + len;
+    for (p = name; p <= end; p = q + 1) {
+        q = memchr(p, '.', end - p);
+        if (!q)
+            q = end;
+        if (q == p)
+            return js_parse_error_pos(s, p, "invalid JSX name");
+        atom = JS_NewAtomLen(s->ctx, (const char *)p, q - p);
+        if (atom == JS_ATOM_NULL)
+            return -1;
+        if (p == name) {
+            emit_op(s, OP_scope_get_var);
+            emit_atom(s, atom);
+            emit_u16(s, atom == JS_ATOM_this ? 0 : s->cur_func->scope_level);
+        } else if (q == end && is_method) {
+            emit_op(s, OP_get_field2);
+            emit_atom(s, atom);
+            ret = TRUE;
+        } else {
+            emit_op(s, OP_get_field);
+            emit_atom(s, atom);
+        }
+        JS_FreeAtom(s->ctx, atom);
+    }
+    return ret;
+}
+
+static const struct {
+    char name[7];
+    uint16_t c;
+} js_jsx_entities[] = {
+    { "amp", '&' },
+    { "lt", '<' },
+    { "gt", '>' },
+    { "quot", '"' },
+    { "apos", '\'' },
+    { "nbsp", 0xa0 },
+    { "copy", 0xa9 },
+    { "reg", 0xae },
+    { "deg", 0xb0 },
+    { "middot", 0xb7 },
+    { "laquo", 0xab },
+    { "raquo", 0xbb },
+    { "times", 0xd7 },
+    { "divide", 0xf7 },
+    { "ndash", 0x2013 },
+    { "mdash", 0x2014 },
+    { "lsquo", 0x2018 },
+    { "rsquo", 0x2019 },
+    { "ldquo", 0x201c },
+    { "rdquo", 0x201d },
+    { "bull", 0x2022 },
+    { "hellip", 0x2026 },
+    { "euro", 0x20ac },
+    { "trade", 0x2122 },
+};
+
+/* append the JSX text 'p'..'end' to 'b', replacing the HTML character
+   references. The tabs are replaced by spaces if 'tab_to_space'. */
+static int js_jsx_decode(JSParseState *s, StringBuffer *b, const uint8_t *p,
+                         const uint8_t *end, BOOL tab_to_space)
+{
+    const uint8_t *q, *p_next;
+    uint32_t c;
+    int i, len;
+
+    while (p < end) {
+        c = *p++;
+        if (c == '&') {
+            q = memchr(p, ';', min_int(end - p, 10));
+            if (q) {
+                len = q - p;
+                if (len >= 2 && p[0] == '#') {
+                    char buf[10], *buf_end;
+                    BOOL is_hex = (p[1] == 'x');
+                    memcpy(buf, p + 1 + is_hex, len - 1 - is_hex);
+                    buf[len - 1 - is_hex] = '\0';
+                    c = strtoul(buf, &buf_end, is_hex ? 16 : 10);
+                    if (buf[0] != '\0' && *buf_end == '\0' && c <= 0x10FFFF) {
+                        p = q + 1;
+                        goto put_char;
+                    }
+                } else {
+                    for (i = 0; i < countof(js_jsx_entities); i++) {
+                        if (strlen(js_jsx_entities[i].name) == len &&
+                            !memcmp(js_jsx_entities[i].name, p, len)) {
+                            c = js_jsx_entities[i].c;
+                            p = q + 1;
+                            goto put_char;
+                        }
+                    }
+                }
+            }
+            c = '&';
+        } else if (c == '\t' && tab_to_space) {
+            c = ' ';
+        } else if (c >= 0x80) {
+            c = unicode_from_utf8(p - 1, UTF8_CHAR_LEN_MAX, &p_next);
+            if (c > 0x10FFFF)
+                return js_parse_error_pos(s, p - 1, "invalid UTF-8 sequence");
+            p = p_next;
+        }
+    put_char:
+        if (string_buffer_putc(b, c))
+            return -1;
+    }
+    return 0;
+}
+
+/* push the JSX attribute string 'p'..'end' */
+static int emit_jsx_string(JSParseState *s, const uint8_t *p,
+                           const uint8_t *end)
+{
+    StringBuffer b_s, *b = &b_s;
+    JSValue str;
+    int ret;
+
+    if (string_buffer_init(s->ctx, b, end - p))
+        return -1;
+    if (js_jsx_decode(s, b, p, end, FALSE)) {
+        string_buffer_free(b);
+        return -1;
+    }
+    str = string_buffer_end(b);
+    if (JS_IsException(str))
+        return -1;
+    ret = emit_push_const(s, str, 1);
+    JS_FreeValue(s->ctx, str);
+    return ret;
+}
+
+/* push the JSX text child 'p'..'end' with the JSX whitespace rules:
+   the lines are trimmed and the non empty ones are joined with a
+   space. Return 1 if a string was pushed, 0 if the text is empty. */
+static int emit_jsx_text(JSParseState *s, const uint8_t *p,
+                         const uint8_t *end)
+{
+    StringBuffer b_s, *b = &b_s;
+    const uint8_t *line, *line_end, *next, *last_line, *start, *stop, *q;
+    JSValue str;
+    int ret;
+
+    /* find the last line with a non blank character */
+    last_line = p;
+    for (line = p; line < end; line = next) {
+        for (line_end = line; line_end < end && *line_end != '\n' &&
+                 *line_end != '\r'; line_end++)
+            continue;
+        next = line_end + 1 + (line_end + 1 < end &&
+                               line_end[0] == '\r' && line_end[1] == '\n');
+        for (q = line; q < line_end; q++) {
+            if (*q != ' ' && *q != '\t') {
+                last_line = line;
+                break;
+            }
+        }
+    }
+
+    if (string_buffer_init(s->ctx, b, end - p))
+        return -1;
+    for (line = p; line < end; line = next) {
+        for (line_end = line; line_end < end && *line_end != '\n' &&
+                 *line_end != '\r'; line_end++)
+            continue;
+        next = line_end + 1 + (line_end + 1 < end &&
+                               line_end[0] == '\r' && line_end[1] == '\n');
+        start = line;
+        stop = line_end;
+        if (line != p) {
+            while (start < stop && (*start == ' ' || *start == '\t'))
+                start++;
+        }
+        if (line_end != end) {
+            while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t'))
+                stop--;
+        }
+        if (start < stop) {
+            if (js_jsx_decode(s, b, start, stop, TRUE))
+                goto fail;
+            if (line != last_line && string_buffer_putc8(b, ' '))
+                goto fail;
+        }
+    }
+    if (b->len == 0) {
+        string_buffer_free(b);
+        return 0;
+    }
+    str = string_buffer_end(b);
+    if (JS_IsException(str))
+        return -1;
+    ret = emit_push_const(s, str, 1);
+    JS_FreeValue(s->ctx, str);
+    return ret ? -1 : 1;
+ fail:
+    string_buffer_free(b);
+    return -1;
+}
+
+/* parse the JSX expression container whose '{' is at 'p' */
+static int js_parse_jsx_expr(JSParseState *s, const uint8_t *p)
+{
+    s->buf_ptr = p + 1;
+    if (next_token(s))
+        return -1;
+    if (js_parse_assign_expr(s))
+        return -1;
+    if (s->token.val != '}')
+        return js_parse_error(s, "expecting '}'");
+    return 0;
+}
+
+/* parse the JSX element or fragment whose '<' was just read and emit
+   the factory call. s->buf_ptr is left after the element. */
+static __exception int js_parse_jsx_element(JSParseState *s)
+{
+    JSContext *ctx = s->ctx;
+    const uint8_t *p, *q, *start_ptr, *name, *name_end;
+    int argc, ret;
+    BOOL is_method, has_props, has_spread;
+    JSAtom atom;
+
+    start_ptr = s->buf_ptr - 1;
+    if (!s->jsx_factory)
+        js_parse_jsx_pragma(s);
+    ret = emit_jsx_member(s, s->jsx_factory, s->jsx_factory_len, TRUE);
+    if (ret < 0)
+        return -1;
+    is_method = ret;
+    argc = 2;
+    has_spread = FALSE;
+
+    p = js_jsx_skip_spaces(s, s->buf_ptr);
+    if (*p == '>') {
+        /* fragment */
+        if (emit_jsx_member(s, s->jsx_fragment, s->jsx_fragment_len,
+                            FALSE) < 0)
+            return -1;
+        emit_op(s, OP_null);
+        name = name_end = ++p;
+        goto children;
+    }
+
+    name = p;
+    name_end = js_jsx_name_end(p);
+    if (name_end == name)
+        return js_parse_error_pos(s, p, "invalid JSX tag name");
+    if (memchr(name, '.', name_end - name) ||
+        (name_end - name == 4 && !memcmp(name, "this", 4))) {
+        if (emit_jsx_member(s, name, name_end - name, FALSE) < 0)
+            return -1;
+    } else if ((*name >= 'a' && *name <= 'z') ||
+               memchr(name, '-', name_end - name) ||
+               memchr(name, ':', name_end - name)) {
+        /* intrinsic element */
+        if (emit_jsx_string(s, name, name_end))
+            return -1;
+    } else {
+        atom = JS_NewAtomLen(ctx, (const char *)name, name_end - name);
+        if (atom == JS_ATOM_NULL)
+            return -1;
+        emit_op(s, OP_scope_get_var);
+        emit_atom(s, atom);
+        emit_u16(s, s->cur_func->scope_level);
+        JS_FreeAtom(ctx, atom);
+    }
+
+    /* attributes */
+    has_props = FALSE;
+    p = name_end;
+    for(;;) {
+        p = js_jsx_skip_spaces(s, p);
+        if (*p == '>' || *p == '/')
+            break;
+        if (!has_props) {
+            emit_op(s, OP_object);
+            has_props = TRUE;
+        }
+        if (*p == '{') {
+            /* spread attribute */
+            s->buf_ptr = p + 1;
+            if (next_token(s))
+                return -1;
+            if (s->token.val != TOK_ELLIPSIS)
+                return js_parse_error(s, "expecting '...'");
+            if (next_token(s) || js_parse_assign_expr(s))
+                return -1;
+            if (s->token.val != '}')
+                return js_parse_error(s, "expecting '}'");
+            emit_op(s, OP_null);  /* dummy excludeList */
+            emit_op(s, OP_copy_data_properties);
+            emit_u8(s, 2 | (1 << 2) | (0 << 5));
+            emit_op(s, OP_drop); /* pop excludeList */
+            emit_op(s, OP_drop); /* pop src object */
+            p = s->buf_ptr;
+            continue;
+        }
+        q = js_jsx_name_end(p);
+        if (q == p)
+            return js_parse_error_pos(s, p, "invalid JSX attribute");
+        atom = JS_NewAtomLen(ctx, (const char *)p, q - p);
+        if (atom == JS_ATOM_NULL)
+            return -1;
+        p = js_jsx_skip_spaces(s, q);
+        if (*p != '=') {
+            emit_op(s, OP_push_true);
+            ret = 0;
+        } else {
+            p = js_jsx_skip_spaces(s, p + 1);
+            if (*p == '"' || *p == '\'') {
+                q = memchr(p + 1, *p, s->buf_end - p - 1);
+                if (!q) {
+                    ret = js_parse_error_pos(s, p, "unexpected end of string");
+                } else {
+                    ret = emit_jsx_string(s, p + 1, q);
+                    p = q + 1;
+                }
+            } else if (*p == '{') {
+                ret = js_parse_jsx_expr(s, p);
+                p = s->buf_ptr;
+            } else if (*p == '<') {
+                s->buf_ptr = p + 1;
+                ret = js_parse_jsx_element(s);
+                p = s->buf_ptr;
+            } else {
+                ret = js_parse_error_pos(s, p, "invalid JSX attribute value");
+            }
+        }
+        if (ret) {
+            JS_FreeAtom(ctx, atom);
+            return -1;
+        }
+        emit_op(s, OP_define_field);
+        emit_atom(s, atom);
+        JS_FreeAtom(ctx, atom);
+    }
+    if (!has_props)
+        emit_op(s, OP_null);
+    if (*p == '/') {
+        p = js_jsx_skip_spaces(s, p + 1);
+        if (*p != '>')
+            return js_parse_error_pos(s, p, "expecting '>'");
+        p++;
+        goto done;
+    }
+    p++;
+
+ children:
+    for(;;) {
+        if (p >= s->buf_end)
+            return js_parse_error_pos(s, start_ptr, "unterminated JSX element");
+        if (*p == '<') {
+            q = js_jsx_skip_spaces(s, p + 1);
+            if (*q == '/') {
+                /* closing tag */
+                q = js_jsx_skip_spaces(s, q + 1);
+                p = js_jsx_name_end(q);
+                if (p - q != name_end - name || memcmp(q, name, p - q)) {
+                    return js_parse_error_pos(s, q, "expecting '</%.*s>'",
+                                              (int)(name_end - name), name);
+                }
+                p = js_jsx_skip_spaces(s, p);
+                if (*p != '>')
+                    return js_parse_error_pos(s, p, "expecting '>'");
+                p++;
+                break;
+            }
+            s->buf_ptr = p + 1;
+            if (js_parse_jsx_element(s))
+                return -1;
+            p = s->buf_ptr;
+            ret = 1;
+        } else if (*p == '{') {
+            s->buf_ptr = p + 1;
+            if (next_token(s))
+                return -1;
+            ret = 0;
+            if (s->token.val == TOK_ELLIPSIS) {
+                /* {...children}: the arguments are collected in an
+                   array as for a spread call */
+                if (!has_spread) {
+                    if (argc > 65535)
+                        return js_parse_error_pos(s, start_ptr, "too many JSX children");
+                    emit_op(s, OP_array_from);
+                    emit_u16(s, argc);
+                    emit_op(s, OP_push_i32);
+                    emit_u32(s, argc);
+                    has_spread = TRUE;
+                }
+                if (next_token(s) || js_parse_assign_expr(s))
+                    return -1;
+                if (s->token.val != '}')
+                    return js_parse_error(s, "expecting '}'");
+                emit_op(s, OP_append);
+            } else if (s->token.val != '}') {
+                /* not an empty expression or a comment */
+                if (js_parse_assign_expr(s))
+                    return -1;
+                if (s->token.val != '}')
+                    return js_parse_error(s, "expecting '}'");
+                ret = 1;
+            }
+            p = s->buf_ptr;
+        } else {
+            for (q = p; q < s->buf_end && *q != '<' && *q != '{'; q++)
+                continue;
+            ret = emit_jsx_text(s, p, q);
+            if (ret < 0)
+                return -1;
+            p = q;
+        }
+        if (ret) {
+            if (has_spread) {
+                /* array idx val -> array idx */
+                emit_op(s, OP_define_array_el);
+                emit_op(s, OP_inc);
+            } else {
+                argc++;
+            }
+        }
+    }
+ done:
+    if (argc > 65535)
+        return js_parse_error_pos(s, start_ptr, "too many JSX children");
+    s->buf_ptr = p;
+    emit_source_pos(s, start_ptr);
+    if (has_spread) {
+        emit_op(s, OP_drop); /* drop the index */
+        if (is_method) {
+            /* obj func array -> func obj array */
+            emit_op(s, OP_perm3);
+        } else {
+            /* func array -> func undef array */
+            emit_op(s, OP_undefined);
+            emit_op(s, OP_swap);
+        }
+        emit_op(s, OP_apply);
+        emit_u16(s, 0);
+    } else {
+        emit_op(s, is_method ? OP_call_method : OP_call);
+        emit_u16(s, argc);
+    }
+    return 0;
+}
+
 /* allowed parse_flags: PF_POSTFIX_CALL */
 static __exception int js_parse_postfix_expr(JSParseState *s, int parse_flags)
 {
@@ -24575,10 +28170,22 @@ static __exception int js_parse_postfix_expr(JSParseState *s, int parse_flags)
             return -1;
         break;
     case TOK_FUNCTION:
-        if (js_parse_function_decl(s, JS_PARSE_FUNC_EXPR,
-                                   JS_FUNC_NORMAL, JS_ATOM_NULL,
-                                   s->token.ptr))
-            return -1;
+        {
+            JSFunctionDef *fd;
+            /* a parenthesized function expression or a function
+               argument is likely to be called immediately, so it is
+               not worth compiling it lazily */
+            BOOL is_eager = (s->last_ptr > s->buf_start &&
+                             (s->last_ptr[-1] == '(' ||
+                              s->last_ptr[-1] == ','));
+            if (js_parse_function_decl2(s, JS_PARSE_FUNC_EXPR,
+                                        JS_FUNC_NORMAL, JS_ATOM_NULL,
+                                        s->token.ptr, JS_PARSE_EXPORT_NONE,
+                                        &fd))
+                return -1;
+            if (is_eager)
+                fd->lazy_compile = FALSE;
+        }
         break;
     case TOK_CLASS:
         if (js_parse_class(s, TRUE, JS_PARSE_EXPORT_NONE))
@@ -24741,7 +28348,23 @@ static __exception int js_parse_postfix_expr(JSParseState *s, int parse_flags)
             emit_op(s, OP_import);
         }
         break;
+    case '<':
+        if (s->cur_func->js_mode & JS_MODE_JSX) {
+            if (js_parse_jsx_element(s))
+                return -1;
+            if (next_token(s))
+                return -1;
+            break;
+        }
+        if (s->cur_func->js_mode & JS_MODE_TS) {
+            /* TypeScript type assertion: <T>expr */
+            if (js_parse_ts_type_args(s))
+                return -1;
+            return js_parse_unary(s, PF_POW_FORBIDDEN);
+        }
+        goto invalid_token;
     default:
+    invalid_token:
         return js_parse_error(s, "unexpected token in expression: '%.*s'",
                               (int)(s->buf_ptr - s->token.ptr), s->token.ptr);
     }
@@ -25120,6 +28743,18 @@ static __exception int js_parse_postfix_expr(JSParseState *s, int parse_flags)
             } else {
                 emit_op(s, OP_get_array_el);
             }
+        } else if ((fd->js_mode & JS_MODE_TS) && s->token.val == '!' &&
+                   !s->got_lf) {
+            /* TypeScript non-null assertion */
+            if (next_token(s))
+                return -1;
+        } else if ((fd->js_mode & JS_MODE_TS) && s->token.val == '<') {
+            /* TypeScript type arguments of a call, otherwise a comparison */
+            int ret = js_parse_ts_skip_call_type_args(s);
+            if (ret < 0)
+                return -1;
+            if (!ret)
+                break;
         } else {
             break;
         }
@@ -25416,6 +29051,24 @@ static __exception int js_parse_expr_binary(JSParseState *s, int level,
                 opcode = OP_mod;
                 break;
             default:
+                if ((s->cur_func->js_mode & JS_MODE_TS) && !s->got_lf &&
+                    (token_is_pseudo_keyword(s, JS_ATOM_as) ||
+                     token_is_pseudo_keyword(s, JS_ATOM_satisfies))) {
+                    /* TypeScript 'x as T', 'x as const' and 'x
+                       satisfies T' generate no code. They are parsed
+                       here so that the types end before any binary
+                       operator. */
+                    if (next_token(s))
+                        return -1;
+                    if (s->token.val == TOK_CONST) {
+                        if (next_token(s))
+                            return -1;
+                    } else {
+                        if (js_parse_ts_type(s, TRUE))
+                            return -1;
+                    }
+                    continue;
+                }
                 return 0;
             }
             break;
@@ -25610,11 +29263,20 @@ static __exception int js_parse_cond_expr(JSParseState *s, int parse_flags)
     if (js_parse_coalesce_expr(s, parse_flags))
         return -1;
     if (s->token.val == '?') {
+        const uint8_t *saved_cond_ptr;
+        int ret;
+
         if (next_token(s))
             return -1;
         label1 = emit_goto(s, OP_if_false, -1);
 
-        if (js_parse_assign_expr(s))
+        /* TypeScript: an arrow function return type at this position
+           must be followed by ':' */
+        saved_cond_ptr = s->ts_cond_ptr;
+        s->ts_cond_ptr = s->token.ptr;
+        ret = js_parse_assign_expr(s);
+        s->ts_cond_ptr = saved_cond_ptr;
+        if (ret)
             return -1;
         if (js_parse_expect(s, ':'))
             return -1;
@@ -25775,8 +29437,10 @@ static __exception int js_parse_assign_expr2(JSParseState *s, int parse_flags)
             emit_label(s, label_next);
         }
         return 0;
-    } else if (s->token.val == '(' &&
-               js_parse_skip_parens_token(s, NULL, TRUE) == TOK_ARROW) {
+    } else if ((s->token.val == '(' &&
+                js_parse_skip_parens_token(s, NULL, TRUE) == TOK_ARROW) ||
+               (s->token.val == '<' && (s->cur_func->js_mode & JS_MODE_TS) &&
+                js_parse_ts_is_generic_arrow(s))) {
         return js_parse_function_decl(s, JS_PARSE_FUNC_ARROW,
                                       JS_FUNC_NORMAL, JS_ATOM_NULL,
                                       s->token.ptr);
@@ -25797,7 +29461,9 @@ static __exception int js_parse_assign_expr2(JSParseState *s, int parse_flags)
         if ((s->token.val == '(' &&
              js_parse_skip_parens_token(s, NULL, TRUE) == TOK_ARROW) ||
             (s->token.val == TOK_IDENT && !s->token.u.ident.is_reserved &&
-             peek_token(s, TRUE) == TOK_ARROW)) {
+             peek_token(s, TRUE) == TOK_ARROW) ||
+            (s->token.val == '<' && (s->cur_func->js_mode & JS_MODE_TS) &&
+             js_parse_ts_is_generic_arrow(s))) {
             return js_parse_function_decl(s, JS_PARSE_FUNC_ARROW,
                                           JS_FUNC_ASYNC, JS_ATOM_NULL,
                                           source_ptr);
@@ -26156,6 +29822,13 @@ static __exception int js_parse_var(JSParseState *s, int parse_flags, int tok,
             }
             if (next_token(s))
                 goto var_error;
+            if (s->cur_func->js_mode & JS_MODE_TS) {
+                /* definite assignment assertion and type annotation */
+                if (s->token.val == '!' && next_token(s))
+                    goto var_error;
+                if (js_parse_ts_type_annotation(s))
+                    goto var_error;
+            }
             if (js_define_var(s, name, tok))
                 goto var_error;
             if (export_flag) {
@@ -26208,12 +29881,16 @@ static __exception int js_parse_var(JSParseState *s, int parse_flags, int tok,
             }
             JS_FreeAtom(ctx, name);
         } else {
-            int skip_bits;
+            int skip_bits, tok1;
             if ((s->token.val == '[' || s->token.val == '{')
-            &&  js_parse_skip_parens_token(s, &skip_bits, FALSE) == '=') {
+            &&  ((tok1 = js_parse_skip_parens_token(s, &skip_bits, FALSE)) == '=' ||
+                 (tok1 == ':' && (s->cur_func->js_mode & JS_MODE_TS)))) {
                 emit_op(s, OP_undefined);
                 if (js_parse_destructuring_element(s, tok, 0, TRUE, skip_bits & SKIP_HAS_ELLIPSIS, TRUE, export_flag) < 0)
                     return -1;
+            } else if (s->token.val == TOK_ENUM &&
+                       (s->cur_func->js_mode & JS_MODE_TS)) {
+                return js_parse_error(s, "TypeScript enums are not supported");
             } else {
                 return js_parse_error(s, "variable name expected");
             }
@@ -26566,6 +30243,14 @@ static __exception int js_parse_statement_or_decl(JSParseState *s,
         }
     }
 
+    if (s->cur_func->js_mode & JS_MODE_TS) {
+        int ret = js_parse_ts_declaration(s);
+        if (ret < 0)
+            goto fail;
+        if (ret)
+            goto done;
+    }
+
     switch(tok = s->token.val) {
     case '{':
         if (js_parse_block(s))
@@ -27069,6 +30754,8 @@ static __exception int js_parse_statement_or_decl(JSParseState *s,
                         emit_op(s, OP_scope_put_var);
                         emit_u32(s, name);
                         emit_u16(s, s->cur_func->scope_level);
+                        if (js_parse_ts_type_annotation(s))
+                            goto fail;
                     }
                     if (js_parse_expect(s, ')'))
                         goto fail;
@@ -28492,7 +32179,7 @@ JSAtom JS_GetScriptOrModuleName(JSContext *ctx, int n_stack_levels)
         if (!b->is_direct_or_indirect_eval) {
             if (!b->has_debug)
                 return JS_ATOM_NULL;
-            return JS_DupAtom(ctx, b->debug.filename);
+            return JS_DupAtom(ctx, b->debug->filename);
         } else {
             sf = sf->prev_frame;
             if (!sf)
@@ -29147,6 +32834,20 @@ static __exception int js_parse_export(JSParseState *s)
     if (next_token(s))
         return -1;
 
+    if (s->cur_func->js_mode & JS_MODE_TS) {
+        int ret;
+        if (token_is_ts_word(s, JS_ATOM_type) &&
+            ((tok = peek_token(s, TRUE)) == '{' || tok == '*')) {
+            /* export type { A }, export type * from 'x' */
+            if (next_token(s))
+                return -1;
+            return js_parse_ts_skip_module_clause(s);
+        }
+        ret = js_parse_ts_declaration(s);
+        if (ret)
+            return ret < 0 ? -1 : 0;
+    }
+
     tok = s->token.val;
     if (tok == TOK_CLASS) {
         return js_parse_class(s, FALSE, JS_PARSE_EXPORT_NAMED);
@@ -29166,6 +32867,13 @@ static __exception int js_parse_export(JSParseState *s)
     case '{':
         first_export = m->export_entries_count;
         while (s->token.val != '}') {
+            if (s->cur_func->js_mode & JS_MODE_TS) {
+                int ret = js_parse_ts_type_specifier(s);
+                if (ret < 0)
+                    return -1;
+                if (ret)
+                    goto next_export;
+            }
             if (!token_is_ident(s->token.val)) {
                 js_parse_error(s, "identifier expected");
                 return -1;
@@ -29198,6 +32906,7 @@ static __exception int js_parse_export(JSParseState *s)
             JS_FreeAtom(ctx, export_name);
             if (!me)
                 return -1;
+        next_export:
             if (s->token.val != ',')
                 break;
             if (next_token(s))
@@ -29258,6 +32967,12 @@ static __exception int js_parse_export(JSParseState *s)
         }
         break;
     case TOK_DEFAULT:
+        if (s->cur_func->js_mode & JS_MODE_TS) {
+            /* export default interface, export default abstract class */
+            int ret = js_parse_ts_declaration(s);
+            if (ret)
+                return ret < 0 ? -1 : 0;
+        }
         if (s->token.val == TOK_CLASS) {
             return js_parse_class(s, FALSE, JS_PARSE_EXPORT_DEFAULT);
         } else if (s->token.val == TOK_FUNCTION ||
@@ -29348,6 +33063,15 @@ static __exception int js_parse_import(JSParseState *s)
     if (next_token(s))
         return -1;
 
+    if ((s->cur_func->js_mode & JS_MODE_TS) &&
+        token_is_ts_word(s, JS_ATOM_type)) {
+        int ret = js_parse_ts_is_type_import(s);
+        if (ret < 0)
+            return -1;
+        if (ret)
+            return js_parse_ts_skip_module_clause(s);
+    }
+
     first_import = m->import_entries_count;
     if (s->token.val == TOK_STRING) {
         module_name = JS_ValueToAtom(ctx, s->token.u.str.str);
@@ -29401,6 +33125,13 @@ static __exception int js_parse_import(JSParseState *s)
                 return -1;
 
             while (s->token.val != '}') {
+                if (s->cur_func->js_mode & JS_MODE_TS) {
+                    int ret = js_parse_ts_type_specifier(s);
+                    if (ret < 0)
+                        return -1;
+                    if (ret)
+                        goto next_import;
+                }
                 if (!token_is_ident(s->token.val)) {
                     js_parse_error(s, "identifier expected");
                     return -1;
@@ -29430,6 +33161,7 @@ static __exception int js_parse_import(JSParseState *s)
                     goto fail;
                 JS_FreeAtom(ctx, local_name);
                 JS_FreeAtom(ctx, import_name);
+            next_import:
                 if (s->token.val != ',')
                     break;
                 if (next_token(s))
@@ -29505,9 +33237,11 @@ static JSFunctionDef *js_new_function_def(JSContext *ctx,
         list_add_tail(&fd->link, &parent->child_list);
         fd->js_mode = parent->js_mode;
         fd->parent_scope_level = parent->scope_level;
+        fd->source_buf = parent->source_buf;
     }
     fd->strip_debug = ((ctx->rt->strip_flags & JS_STRIP_DEBUG) != 0);
     fd->strip_source = ((ctx->rt->strip_flags & (JS_STRIP_DEBUG | JS_STRIP_SOURCE)) != 0);
+    fd->lazy_compile = ctx->rt->lazy_compile;
 
     fd->is_eval = is_eval;
     fd->is_func_expr = is_func_expr;
@@ -29631,8 +33365,6 @@ static void js_free_function_def(JSContext *ctx, JSFunctionDef *fd)
     JS_FreeAtom(ctx, fd->filename);
     dbuf_free(&fd->pc2line);
 
-    js_free(ctx, fd->source);
-
     if (fd->parent) {
         /* remove in parent list */
         list_del(&fd->link);
@@ -30008,9 +33740,9 @@ static __maybe_unused void js_dump_function_bytecode(JSContext *ctx, JSFunctionB
     char atom_buf[ATOM_GET_STR_BUF_SIZE];
     const char *str;
 
-    if (b->has_debug && b->debug.filename != JS_ATOM_NULL) {
+    if (b->has_debug && b->debug->filename != JS_ATOM_NULL) {
         int line_num, col_num;
-        str = JS_AtomGetStr(ctx, atom_buf, sizeof(atom_buf), b->debug.filename);
+        str = JS_AtomGetStr(ctx, atom_buf, sizeof(atom_buf), b->debug->filename);
         line_num = find_line_num(ctx, b, -1, &col_num);
         printf("%s:%d:%d: ", str, line_num, col_num);
     }
@@ -30066,11 +33798,11 @@ static __maybe_unused void js_dump_function_bytecode(JSContext *ctx, JSFunctionB
                    b->vardefs ? b->vardefs + b->arg_count : NULL, b->var_count,
                    b->closure_var, b->closure_var_count,
                    b->cpool, b->cpool_count,
-                   b->has_debug ? b->debug.source : NULL,
+                   js_get_function_source(ctx->rt, b, &i),
                    NULL, b);
 #if defined(DUMP_BYTECODE) && (DUMP_BYTECODE & 32)
-    if (b->has_debug)
-        dump_pc2line(ctx, b->debug.pc2line_buf, b->debug.pc2line_len);
+    if (js_get_function_debug(ctx->rt, b, TRUE))
+        dump_pc2line(ctx, b->debug->pc2line_buf, b->debug->pc2line_len);
 #endif
     printf("\n");
 }
@@ -31961,7 +35693,6 @@ static void add_pc2line_info(JSFunctionDef *s, uint32_t pc, uint32_t source_pos)
     }
 }
 
-/* XXX: could use a more compact storage */
 /* XXX: get_line_col_cached() is slow. For more predictable
    performance, line/cols could be stored every N source
    bytes. Alternatively, get_line_col_cached() could be issued in
@@ -31969,7 +35700,29 @@ static void add_pc2line_info(JSFunctionDef *s, uint32_t pc, uint32_t source_pos)
    small. */
 static void compute_pc2line_info(JSFunctionDef *s)
 {
-    if (!s->strip_debug) {
+    if (s->strip_debug)
+        return;
+    if (s->source_buf) {
+        /* the source is kept: only store the source positions. The
+           line and column numbers are computed when needed by
+           decode_source_pos(). */
+        uint32_t last_pc = 0, last_pos = s->source_pos;
+        int i;
+
+        js_dbuf_init(s->ctx, &s->pc2line);
+        dbuf_put_leb128(&s->pc2line, last_pos);
+        for (i = 0; i < s->line_number_count; i++) {
+            uint32_t pc = s->line_number_slots[i].pc;
+            uint32_t source_pos = s->line_number_slots[i].source_pos;
+
+            if (source_pos == -1 || pc < last_pc || source_pos == last_pos)
+                continue;
+            dbuf_put_leb128(&s->pc2line, pc - last_pc);
+            dbuf_put_sleb128(&s->pc2line, source_pos - last_pos);
+            last_pc = pc;
+            last_pos = source_pos;
+        }
+    } else {
         int last_line_num, last_col_num;
         uint32_t last_pc = 0;
         int i, line_num, col_num;
@@ -32000,19 +35753,7 @@ static void compute_pc2line_info(JSFunctionDef *s)
             if (diff_line == 0 && diff_col == 0)
                 continue;
 
-            if (diff_line >= PC2LINE_BASE &&
-                diff_line < PC2LINE_BASE + PC2LINE_RANGE &&
-                diff_pc <= PC2LINE_DIFF_PC_MAX) {
-                dbuf_putc(&s->pc2line, (diff_line - PC2LINE_BASE) +
-                          diff_pc * PC2LINE_RANGE + PC2LINE_OP_FIRST);
-            } else {
-                /* longer encoding */
-                dbuf_putc(&s->pc2line, 0);
-                dbuf_put_leb128(&s->pc2line, diff_pc);
-                dbuf_put_sleb128(&s->pc2line, diff_line);
-            }
-            dbuf_put_sleb128(&s->pc2line, diff_col);
-                
+            put_pc2line_entry(&s->pc2line, diff_pc, diff_line, diff_col);
             last_pc = pc;
             last_line_num = line_num;
             last_col_num = col_num;
@@ -33390,16 +37131,11 @@ static int add_module_variables(JSContext *ctx, JSFunctionDef *fd)
 /* create a function object from a function definition. The function
    definition is freed. All the child functions are also created. It
    must be done this way to resolve all the variables. */
-static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
+/* recompute scope linkage */
+static void compute_scope_links(JSFunctionDef *fd)
 {
-    JSValue func_obj;
-    JSFunctionBytecode *b;
-    struct list_head *el, *el1;
-    int stack_size, scope, idx;
-    int function_size, byte_code_offset, cpool_offset;
-    int closure_var_offset, vardefs_offset;
+    int scope, idx;
 
-    /* recompute scope linkage */
     for (scope = 0; scope < fd->scope_count; scope++) {
         fd->scopes[scope].first = -1;
     }
@@ -33424,6 +37160,317 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
             vd->scope_next = fd->scopes[scope].first;
         }
     }
+}
+
+/* Lazy compilation: the bytecode of an inner function is not
+   generated when the enclosing function is compiled. Instead, a stub
+   is created which holds the function source code and the closure
+   variables it may reference. The source is parsed again and compiled
+   on the first call (see js_lazy_compile()). */
+
+static BOOL is_lazy_implicit_var(JSAtom var_name)
+{
+    /* the stub is a normal function which defines its own pseudo
+       variables and 'arguments' */
+    return (var_name == JS_ATOM_home_object ||
+            var_name == JS_ATOM_this_active_func ||
+            var_name == JS_ATOM_new_target ||
+            var_name == JS_ATOM_this ||
+            var_name == JS_ATOM_arguments);
+}
+
+/* return TRUE if 'var_name' referenced in 'fd' at 'scope_level' is
+   defined in 'fd' or in one of its parents up to 's' included */
+static BOOL lazy_is_local_var(JSContext *ctx, JSFunctionDef *s,
+                              JSFunctionDef *fd, JSAtom var_name,
+                              int scope_level)
+{
+    int idx;
+
+    for(;;) {
+        for (idx = fd->scopes[scope_level].first; idx >= 0;
+             idx = fd->vars[idx].scope_next) {
+            if (fd->vars[idx].var_name == var_name)
+                return TRUE;
+        }
+        if (idx != ARG_SCOPE_END && find_var(ctx, fd, var_name) >= 0)
+            return TRUE;
+        if (fd->is_func_expr && fd->func_name == var_name)
+            return TRUE;
+        if (fd == s)
+            return FALSE;
+        scope_level = fd->parent_scope_level;
+        fd = fd->parent;
+    }
+}
+
+/* Resolve 'var_name' in the parents of 's' as resolve_scope_var()
+   does. If 'capture' is FALSE, nothing is modified and -1 is returned
+   if the variable may be resolved dynamically (with statement or
+   eval var object). If 'capture' is TRUE, the corresponding closure
+   variable is added to 's' and -1 is returned in case of
+   exception. Global variables need no closure variable. */
+static int lazy_resolve_parent_var(JSContext *ctx, JSFunctionDef *s,
+                                   JSAtom var_name, BOOL capture)
+{
+    JSFunctionDef *fd;
+    JSVarDef *vd;
+    int idx, var_idx, scope_level;
+
+    var_idx = -1;
+    for (fd = s; fd->parent;) {
+        scope_level = fd->parent_scope_level;
+        fd = fd->parent;
+        for (idx = fd->scopes[scope_level].first; idx >= 0;) {
+            vd = &fd->vars[idx];
+            if (vd->var_name == var_name) {
+                var_idx = idx;
+                break;
+            } else if (vd->var_name == JS_ATOM__with_) {
+                return -1;
+            }
+            idx = vd->scope_next;
+        }
+        if (var_idx >= 0)
+            break;
+        if (idx != ARG_SCOPE_END) {
+            var_idx = find_var(ctx, fd, var_name);
+            if (var_idx >= 0)
+                break;
+        }
+        if (fd->is_func_expr && fd->func_name == var_name) {
+            if (!capture)
+                return 0;
+            var_idx = add_func_var(ctx, fd, var_name);
+            if (var_idx < 0)
+                return -1;
+            break;
+        }
+        if (fd->var_object_idx >= 0 || fd->arg_var_object_idx >= 0)
+            return -1;
+        if (fd->is_eval)
+            break;
+    }
+
+    if (var_idx < 0) {
+        if (fd->is_eval) {
+            for (idx = 0; idx < fd->closure_var_count; idx++) {
+                JSClosureVar *cv = &fd->closure_var[idx];
+                if (cv->var_name == var_name) {
+                    if (!capture)
+                        return 0;
+                    if (get_closure_var2(ctx, s, fd, FALSE, cv->is_arg, idx,
+                                         cv->var_name, cv->is_const,
+                                         cv->is_lexical, cv->var_kind) < 0)
+                        return -1;
+                    return 0;
+                } else if (cv->var_name == JS_ATOM__var_ ||
+                           cv->var_name == JS_ATOM__arg_var_ ||
+                           cv->var_name == JS_ATOM__with_) {
+                    return -1;
+                }
+            }
+        }
+        return 0;
+    }
+    if (!capture)
+        return 0;
+    if (var_idx & ARGUMENT_VAR_OFFSET) {
+        var_idx -= ARGUMENT_VAR_OFFSET;
+        fd->args[var_idx].is_captured = 1;
+        idx = get_closure_var(ctx, s, fd, TRUE, var_idx, var_name,
+                              FALSE, FALSE, JS_VAR_NORMAL);
+    } else {
+        vd = &fd->vars[var_idx];
+        vd->is_captured = 1;
+        idx = get_closure_var(ctx, s, fd, FALSE, var_idx, var_name,
+                              vd->is_const, vd->is_lexical, vd->var_kind);
+    }
+    return idx < 0 ? -1 : 0;
+}
+
+/* collect in 'names' the variables referenced in 'fd' and its
+   children which are not defined in 's'. Return -1 if 's' cannot be
+   compiled lazily. */
+static int lazy_collect_names(JSContext *ctx, JSFunctionDef *s,
+                              JSFunctionDef *fd, JSAtom **pnames,
+                              int *pcount, int *psize)
+{
+    struct list_head *el;
+    const uint8_t *bc_buf;
+    int pos, pos_next, op, scope_level, i;
+    JSAtom var_name;
+
+    if (fd->has_eval_call)
+        return -1;
+    compute_scope_links(fd);
+    bc_buf = fd->byte_code.buf;
+    for (pos = 0; pos < fd->byte_code.size; pos = pos_next) {
+        op = bc_buf[pos];
+        pos_next = pos + opcode_info[op].size;
+        switch(op) {
+        case OP_scope_make_ref:
+            var_name = get_u32(bc_buf + pos + 1);
+            scope_level = get_u16(bc_buf + pos + 9);
+            break;
+        case OP_scope_get_var_undef:
+        case OP_scope_get_var:
+        case OP_scope_put_var:
+        case OP_scope_delete_var:
+        case OP_scope_get_ref:
+        case OP_scope_put_var_init:
+        case OP_scope_get_var_checkthis:
+        case OP_scope_get_private_field:
+        case OP_scope_get_private_field2:
+        case OP_scope_put_private_field:
+        case OP_scope_in_private_field:
+            var_name = get_u32(bc_buf + pos + 1);
+            scope_level = get_u16(bc_buf + pos + 5);
+            break;
+        default:
+            continue;
+        }
+        if (is_lazy_implicit_var(var_name) ||
+            lazy_is_local_var(ctx, s, fd, var_name, scope_level))
+            continue;
+        /* private names are resolved in pass 2 with specific errors */
+        if (op >= OP_scope_get_private_field &&
+            op <= OP_scope_in_private_field)
+            return -1;
+        for (i = 0; i < *pcount; i++) {
+            if ((*pnames)[i] == var_name)
+                break;
+        }
+        if (i == *pcount) {
+            if (js_resize_array(ctx, (void **)pnames, sizeof(**pnames),
+                                psize, *pcount + 1))
+                return -1;
+            (*pnames)[(*pcount)++] = var_name;
+        }
+    }
+    list_for_each(el, &fd->child_list) {
+        JSFunctionDef *fd1 = list_entry(el, JSFunctionDef, link);
+        if (lazy_collect_names(ctx, s, fd1, pnames, pcount, psize))
+            return -1;
+    }
+    return 0;
+}
+
+/* return JS_UNDEFINED if 'fd' cannot be compiled lazily */
+static JSValue js_create_lazy_function(JSContext *ctx, JSFunctionDef *fd)
+{
+    JSFunctionBytecode *b;
+    JSFunctionDef *fd1;
+    JSAtom *names;
+    int names_count, names_size, i;
+    int function_size, closure_var_offset;
+    JSFunctionDebug *d;
+
+    if ((fd->func_type != JS_PARSE_FUNC_STATEMENT &&
+         fd->func_type != JS_PARSE_FUNC_VAR &&
+         fd->func_type != JS_PARSE_FUNC_EXPR) ||
+        !fd->source || fd->strip_debug ||
+        fd->func_name == JS_ATOM_yield || fd->func_name == JS_ATOM_await)
+        return JS_UNDEFINED;
+
+    names = NULL;
+    names_count = 0;
+    names_size = 0;
+    if (lazy_collect_names(ctx, fd, fd, &names, &names_count, &names_size))
+        goto not_lazy;
+    for (i = 0; i < names_count; i++) {
+        if (lazy_resolve_parent_var(ctx, fd, names[i], FALSE))
+            goto not_lazy;
+    }
+    for (i = 0; i < names_count; i++) {
+        if (lazy_resolve_parent_var(ctx, fd, names[i], TRUE))
+            goto fail;
+    }
+    js_free(ctx, names);
+
+    /* the source position table only contains the function position */
+    dbuf_free(&fd->pc2line);
+    js_dbuf_init(ctx, &fd->pc2line);
+    dbuf_put_leb128(&fd->pc2line, fd->source_pos);
+    if (dbuf_error(&fd->pc2line))
+        goto fail1;
+    d = js_new_function_debug(ctx, fd->pc2line.buf, fd->pc2line.size);
+    if (!d)
+        goto fail1;
+
+    closure_var_offset = sizeof(*b) + sizeof(*b->cpool);
+    function_size = closure_var_offset +
+        fd->closure_var_count * sizeof(*fd->closure_var);
+    b = js_mallocz(ctx, function_size);
+    if (!b) {
+        js_free(ctx, d);
+        goto fail1;
+    }
+    b->header.ref_count = 1;
+    b->is_lazy = 1;
+    b->lazy_is_func_expr = fd->is_func_expr;
+    for (fd1 = fd; fd1->parent; fd1 = fd1->parent)
+        continue;
+    b->lazy_is_module = (fd1->module != NULL);
+
+    b->func_name = fd->func_name;
+    fd->func_name = JS_ATOM_NULL;
+    b->defined_arg_count = fd->defined_arg_count;
+    /* the compiled function is stored in cpool[0] */
+    b->cpool_count = 1;
+    b->cpool = (void *)((uint8_t*)b + sizeof(*b));
+    b->cpool[0] = JS_NULL;
+    b->closure_var_count = fd->closure_var_count;
+    if (b->closure_var_count) {
+        b->closure_var = (void *)((uint8_t*)b + closure_var_offset);
+        memcpy(b->closure_var, fd->closure_var,
+               b->closure_var_count * sizeof(*b->closure_var));
+        fd->closure_var_count = 0;
+    }
+
+    d->filename = JS_DupAtom(ctx, fd->filename);
+    d->state = JS_DEBUG_SOURCE_POS;
+    d->buf = fd->source_buf;
+    d->buf->ref_count++;
+    d->source_pos = fd->source - d->buf->data;
+    d->source_len = fd->source_len;
+    b->has_debug = 1;
+    b->debug = d;
+
+    b->has_prototype = fd->has_prototype;
+    b->has_simple_parameter_list = fd->has_simple_parameter_list;
+    b->js_mode = fd->js_mode;
+    b->func_kind = fd->func_kind;
+    b->new_target_allowed = fd->new_target_allowed;
+    b->super_call_allowed = fd->super_call_allowed;
+    b->super_allowed = fd->super_allowed;
+    b->arguments_allowed = fd->arguments_allowed;
+    b->realm = JS_DupContext(ctx);
+
+    add_gc_object(ctx->rt, &b->header, JS_GC_OBJ_TYPE_FUNCTION_BYTECODE);
+    js_free_function_def(ctx, fd);
+    return JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, b);
+ not_lazy:
+    js_free(ctx, names);
+    return JS_UNDEFINED;
+ fail:
+    js_free(ctx, names);
+ fail1:
+    js_free_function_def(ctx, fd);
+    return JS_EXCEPTION;
+}
+
+static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
+{
+    JSValue func_obj;
+    JSFunctionBytecode *b;
+    JSFunctionDebug *debug;
+    struct list_head *el, *el1;
+    int stack_size;
+    int function_size, byte_code_offset, cpool_offset;
+    int closure_var_offset, vardefs_offset;
+
+    compute_scope_links(fd);
 
     /* if the function contains an eval call, the closure variables
        are used to compile the eval and they must be ordered by scope,
@@ -33445,7 +37492,11 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
 
         fd1 = list_entry(el, JSFunctionDef, link);
         cpool_idx = fd1->parent_cpool_idx;
-        func_obj = js_create_function(ctx, fd1);
+        func_obj = JS_UNDEFINED;
+        if (fd1->lazy_compile)
+            func_obj = js_create_lazy_function(ctx, fd1);
+        if (JS_IsUndefined(func_obj))
+            func_obj = js_create_function(ctx, fd1);
         if (JS_IsException(func_obj))
             goto fail;
         /* save it in the constant pool */
@@ -33459,7 +37510,7 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
         dump_byte_code(ctx, 1, fd->byte_code.buf, fd->byte_code.size,
                        fd->args, fd->arg_count, fd->vars, fd->var_count,
                        fd->closure_var, fd->closure_var_count,
-                       fd->cpool, fd->cpool_count, fd->source,
+                       fd->cpool, fd->cpool_count, (const char *)fd->source,
                        fd->label_slots, NULL);
         printf("\n");
     }
@@ -33474,7 +37525,7 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
         dump_byte_code(ctx, 2, fd->byte_code.buf, fd->byte_code.size,
                        fd->args, fd->arg_count, fd->vars, fd->var_count,
                        fd->closure_var, fd->closure_var_count,
-                       fd->cpool, fd->cpool_count, fd->source,
+                       fd->cpool, fd->cpool_count, (const char *)fd->source,
                        fd->label_slots, NULL);
         printf("\n");
     }
@@ -33486,11 +37537,15 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
     if (compute_stack_size(ctx, fd, &stack_size) < 0)
         goto fail;
 
-    if (fd->strip_debug) {
-        function_size = offsetof(JSFunctionBytecode, debug);
-    } else {
-        function_size = sizeof(*b);
+    debug = NULL;
+    if (!fd->strip_debug) {
+        debug = js_new_function_debug(ctx, fd->pc2line.buf, fd->pc2line.size);
+        if (!debug)
+            goto fail;
+        dbuf_free(&fd->pc2line);
     }
+
+    function_size = sizeof(*b);
     cpool_offset = function_size;
     function_size += fd->cpool_count * sizeof(*fd->cpool);
     vardefs_offset = function_size;
@@ -33503,8 +37558,10 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
     function_size += fd->byte_code.size;
 
     b = js_mallocz(ctx, function_size);
-    if (!b)
+    if (!b) {
+        js_free(ctx, debug);
         goto fail;
+    }
     b->header.ref_count = 1;
 
     b->byte_code_buf = (void *)((uint8_t*)b + byte_code_offset);
@@ -33553,21 +37610,19 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
         JS_FreeAtom(ctx, fd->filename);
         dbuf_free(&fd->pc2line);    // probably useless
     } else {
-        /* XXX: source and pc2line info should be packed at the end of the
-           JSFunctionBytecode structure, avoiding allocation overhead
-         */
         b->has_debug = 1;
-        b->debug.filename = fd->filename;
-
-        //DynBuf pc2line;
-        //compute_pc2line_info(fd, &pc2line);
-        //js_free(ctx, fd->line_number_slots)
-        b->debug.pc2line_buf = js_realloc(ctx, fd->pc2line.buf, fd->pc2line.size);
-        if (!b->debug.pc2line_buf)
-            b->debug.pc2line_buf = fd->pc2line.buf;
-        b->debug.pc2line_len = fd->pc2line.size;
-        b->debug.source = fd->source;
-        b->debug.source_len = fd->source_len;
+        b->debug = debug;
+        debug->filename = fd->filename;
+        if (fd->source_buf) {
+            /* the line numbers are computed from the source positions */
+            debug->state = JS_DEBUG_SOURCE_POS;
+            debug->buf = fd->source_buf;
+            debug->buf->ref_count++;
+            if (fd->source) {
+                debug->source_pos = fd->source - debug->buf->data;
+                debug->source_len = fd->source_len;
+            }
+        }
     }
     if (fd->scopes != fd->def_scope_array)
         js_free(ctx, fd->scopes);
@@ -33644,11 +37699,8 @@ static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b)
         JS_FreeContext(b->realm);
 
     JS_FreeAtomRT(rt, b->func_name);
-    if (b->has_debug) {
-        JS_FreeAtomRT(rt, b->debug.filename);
-        js_free_rt(rt, b->debug.pc2line_buf);
-        js_free_rt(rt, b->debug.source);
-    }
+    if (b->debug)
+        free_function_debug(rt, b->debug);
 
     remove_gc_object(&b->header);
     if (rt->gc_phase == JS_GC_PHASE_REMOVE_CYCLES && b->header.ref_count != 0) {
@@ -33886,6 +37938,14 @@ static __exception int js_parse_function_decl2(JSParseState *s,
                 return js_parse_error(s, "function name expected");
             }
         }
+        if ((fd->js_mode & JS_MODE_TS) && !is_expr) {
+            /* TypeScript overload signature */
+            int ret = js_parse_ts_bodyless_signature(s);
+            if (ret) {
+                JS_FreeAtom(ctx, func_name);
+                return ret < 0 ? -1 : 0;
+            }
+        }
     } else if (func_type != JS_PARSE_FUNC_ARROW) {
         func_name = JS_DupAtom(ctx, func_name);
     }
@@ -33999,6 +38059,11 @@ static __exception int js_parse_function_decl2(JSParseState *s,
         emit_class_field_init(s);
     }
 
+    if ((fd->js_mode & JS_MODE_TS) && s->token.val == '<') {
+        if (js_parse_ts_type_params(s))
+            goto fail;
+    }
+
     /* parse arguments */
     fd->has_simple_parameter_list = TRUE;
     fd->has_parameter_expressions = FALSE;
@@ -34039,6 +38104,22 @@ static __exception int js_parse_function_decl2(JSParseState *s,
             BOOL rest = FALSE;
             int idx, has_initializer;
 
+            if (fd->js_mode & JS_MODE_TS) {
+                if (s->token.val == TOK_THIS && peek_token(s, FALSE) == ':') {
+                    /* 'this' parameter */
+                    if (next_token(s) || js_parse_ts_type_annotation(s))
+                        goto fail;
+                    if (s->token.val == ')')
+                        break;
+                    if (js_parse_expect(s, ','))
+                        goto fail;
+                    continue;
+                }
+                if (js_parse_ts_is_param_property(s)) {
+                    js_parse_error(s, "TypeScript parameter properties are not supported");
+                    goto fail;
+                }
+            }
             if (s->token.val == TOK_ELLIPSIS) {
                 fd->has_simple_parameter_list = FALSE;
                 rest = TRUE;
@@ -34085,6 +38166,13 @@ static __exception int js_parse_function_decl2(JSParseState *s,
                     goto fail;
                 if (next_token(s))
                     goto fail;
+                if (fd->js_mode & JS_MODE_TS) {
+                    /* optional parameter and type annotation */
+                    if (s->token.val == '?' && next_token(s))
+                        goto fail;
+                    if (js_parse_ts_type_annotation(s))
+                        goto fail;
+                }
                 if (rest) {
                     emit_op(s, OP_rest);
                     emit_u16(s, idx);
@@ -34195,6 +38283,9 @@ static __exception int js_parse_function_decl2(JSParseState *s,
 
     if (next_token(s))
         goto fail;
+    /* TypeScript return type */
+    if (js_parse_ts_type_annotation(s))
+        goto fail;
 
     /* generator function: yield after the parameters are evaluated */
     if (func_kind == JS_FUNC_GENERATOR ||
@@ -34228,9 +38319,7 @@ static __exception int js_parse_function_decl2(JSParseState *s,
                 /* the end of the function source code is after the last
                    token of the function source stored into s->last_ptr */
                 fd->source_len = s->last_ptr - ptr;
-                fd->source = js_strndup(ctx, (const char *)ptr, fd->source_len);
-                if (!fd->source)
-                    goto fail;
+                fd->source = ptr;
             }
             goto done;
         }
@@ -34255,9 +38344,7 @@ static __exception int js_parse_function_decl2(JSParseState *s,
     if (!fd->strip_source) {
         /* save the function source code */
         fd->source_len = s->buf_ptr - ptr;
-        fd->source = js_strndup(ctx, (const char *)ptr, fd->source_len);
-        if (!fd->source)
-            goto fail;
+        fd->source = ptr;
     }
 
     if (next_token(s)) {
@@ -34518,7 +38605,18 @@ static JSValue __JS_EvalInternal(JSContext *ctx, JSValueConst this_obj,
     JSFunctionBytecode *b;
     JSFunctionDef *fd;
     JSModuleDef *m;
-
+    JSDebugBuf *source_buf;
+
+    source_buf = NULL;
+    if (!(ctx->rt->strip_flags & (JS_STRIP_DEBUG | JS_STRIP_SOURCE))) {
+        /* the functions reference their source code and source
+           positions in a shared copy of the input */
+        source_buf = js_new_debug_buf(ctx, (const uint8_t *)input, input_len,
+                                      TRUE, FALSE);
+        if (!source_buf)
+            return JS_EXCEPTION;
+        input = (const char *)source_buf->data;
+    }
     js_parse_init(ctx, s, input, input_len, filename);
     skip_shebang(&s->buf_ptr, s->buf_end);
 
@@ -34533,7 +38631,9 @@ static JSValue __JS_EvalInternal(JSContext *ctx, JSValueConst this_obj,
         assert(js_class_has_bytecode(p->class_id));
         b = p->u.func.function_bytecode;
         var_refs = p->u.func.var_refs;
-        js_mode = b->js_mode;
+        /* the JSX and TypeScript syntaxes are only enabled by the
+           file type */
+        js_mode = b->js_mode & JS_MODE_STRICT;
     } else {
         sf = NULL;
         b = NULL;
@@ -34541,13 +38641,17 @@ static JSValue __JS_EvalInternal(JSContext *ctx, JSValueConst this_obj,
         js_mode = 0;
         if (flags & JS_EVAL_FLAG_STRICT)
             js_mode |= JS_MODE_STRICT;
+        if (flags & JS_EVAL_FLAG_JSX)
+            js_mode |= JS_MODE_JSX;
+        if (flags & JS_EVAL_FLAG_TYPESCRIPT)
+            js_mode |= JS_MODE_TS;
         if (eval_type == JS_EVAL_TYPE_MODULE) {
             JSAtom module_name = JS_NewAtom(ctx, filename);
             if (module_name == JS_ATOM_NULL)
-                return JS_EXCEPTION;
+                goto fail1;
             m = js_new_module_def(ctx, module_name);
             if (!m)
-                return JS_EXCEPTION;
+                goto fail1;
             js_mode |= JS_MODE_STRICT;
         }
     }
@@ -34556,6 +38660,7 @@ static JSValue __JS_EvalInternal(JSContext *ctx, JSValueConst this_obj,
     if (!fd)
         goto fail1;
     s->cur_func = fd;
+    fd->source_buf = source_buf;
     fd->eval_type = eval_type;
     fd->has_this_binding = (eval_type != JS_EVAL_TYPE_DIRECT);
     if (eval_type == JS_EVAL_TYPE_DIRECT) {
@@ -34599,6 +38704,8 @@ static JSValue __JS_EvalInternal(JSContext *ctx, JSValueConst this_obj,
 
     /* create the function object and all the enclosed functions */
     fun_obj = js_create_function(ctx, fd);
+    js_free_debug_buf(ctx->rt, source_buf);
+    source_buf = NULL;
     if (JS_IsException(fun_obj))
         goto fail1;
     /* Could add a flag to avoid resolution if necessary */
@@ -34615,12 +38722,140 @@ static JSValue __JS_EvalInternal(JSContext *ctx, JSValueConst this_obj,
     }
     return ret_val;
  fail1:
+    js_free_debug_buf(ctx->rt, source_buf);
     /* XXX: should free all the unresolved dependencies */
     if (m)
         js_free_module_def(ctx, m);
     return JS_EXCEPTION;
 }
 
+/* compile the lazy function stub 'b'. Return NULL in case of exception. */
+static JSFunctionBytecode *js_lazy_compile(JSFunctionBytecode *b)
+{
+    JSContext *ctx = b->realm;
+    JSParseState s1, *s = &s1;
+    JSFunctionDef *fd, *fd1;
+    JSFunctionBytecode *b0, *b1;
+    JSValue func_obj;
+    JSDebugBuf *source_buf;
+    char filename[ATOM_GET_STR_BUF_SIZE];
+    int i, cpool_idx;
+
+    if (JS_VALUE_GET_TAG(b->cpool[0]) == JS_TAG_FUNCTION_BYTECODE)
+        return JS_VALUE_GET_PTR(b->cpool[0]);
+
+    /* the function is parsed in the source of the whole script so that
+       the source positions of the new functions are unchanged */
+    source_buf = b->debug->buf;
+    js_parse_init(ctx, s, (const char *)source_buf->data, source_buf->len,
+                  JS_AtomGetStr(ctx, filename, sizeof(filename),
+                                b->debug->filename));
+    s->buf_ptr = source_buf->data + b->debug->source_pos;
+    s->token.ptr = s->buf_ptr;
+    s->is_module = b->lazy_is_module;
+    s->allow_html_comments = !s->is_module;
+
+    /* the function is parsed in a wrapper function whose closure
+       variables are those of the stub */
+    fd = js_new_function_def(ctx, NULL, TRUE, FALSE, s->filename,
+                             s->buf_ptr, &s->get_line_col_cache);
+    if (!fd)
+        return NULL;
+    s->cur_func = fd;
+    fd->source_buf = source_buf;
+    fd->eval_type = JS_EVAL_TYPE_DIRECT;
+    fd->js_mode = b->js_mode;
+    fd->func_name = JS_DupAtom(ctx, JS_ATOM__eval_);
+    for (i = 0; i < b->closure_var_count; i++) {
+        JSClosureVar *cv = &b->closure_var[i];
+        if (add_closure_var(ctx, fd, cv->is_local, cv->is_arg, cv->var_idx,
+                            cv->var_name, cv->is_const, cv->is_lexical,
+                            cv->var_kind) < 0)
+            goto fail;
+    }
+    push_scope(s);
+    fd->body_scope = fd->scope_level;
+
+    if (next_token(s))
+        goto fail;
+    if (js_parse_function_decl2(s, JS_PARSE_FUNC_EXPR, JS_FUNC_NORMAL,
+                                JS_ATOM_NULL, s->token.ptr,
+                                JS_PARSE_EXPORT_NONE, &fd1))
+        goto fail;
+    fd1->is_func_expr = b->lazy_is_func_expr;
+    fd1->lazy_compile = FALSE; /* its inner functions may still be lazy */
+    cpool_idx = fd1->parent_cpool_idx;
+    emit_op(s, OP_drop);
+    emit_op(s, OP_return_undef);
+
+    func_obj = js_create_function(ctx, fd);
+    if (JS_IsException(func_obj))
+        return NULL;
+    b0 = JS_VALUE_GET_PTR(func_obj);
+    b->cpool[0] = JS_DupValue(ctx, b0->cpool[cpool_idx]);
+    JS_FreeValue(ctx, func_obj);
+
+    /* make the closure variables relative to the enclosing function of
+       the stub so that the compiled function can be used by js_closure() */
+    b1 = JS_VALUE_GET_PTR(b->cpool[0]);
+    for (i = 0; i < b1->closure_var_count; i++) {
+        JSClosureVar *cv = &b1->closure_var[i];
+        JSClosureVar *cv0 = &b->closure_var[cv->var_idx];
+        cv->is_local = cv0->is_local;
+        cv->is_arg = cv0->is_arg;
+        cv->var_idx = cv0->var_idx;
+    }
+    return b1;
+ fail:
+    free_token(s, &s->token);
+    js_free_function_def(ctx, fd);
+    return NULL;
+}
+
+/* replace the lazy function stub of the function object 'p' by its
+   compiled version */
+static int js_resolve_lazy_function(JSContext *ctx, JSObject *p)
+{
+    JSFunctionBytecode *b, *b1;
+    JSVarRef **var_refs, **var_refs1;
+    int i, j;
+
+    b = p->u.func.function_bytecode;
+    b1 = js_lazy_compile(b);
+    if (!b1)
+        return -1;
+    var_refs = p->u.func.var_refs;
+    var_refs1 = NULL;
+    if (b1->closure_var_count) {
+        var_refs1 = js_malloc(ctx, sizeof(var_refs1[0]) * b1->closure_var_count);
+        if (!var_refs1)
+            return -1;
+        for (i = 0; i < b1->closure_var_count; i++) {
+            JSClosureVar *cv = &b1->closure_var[i];
+            for (j = 0; j < b->closure_var_count; j++) {
+                JSClosureVar *cv0 = &b->closure_var[j];
+                if (cv0->var_idx == cv->var_idx &&
+                    cv0->is_arg == cv->is_arg &&
+                    cv0->is_local == cv->is_local)
+                    break;
+            }
+            assert(j < b->closure_var_count);
+            var_refs1[i] = var_refs[j];
+            var_refs1[i]->header.ref_count++;
+        }
+    }
+    p->u.func.function_bytecode = b1;
+    p->u.func.var_refs = var_refs1;
+    JS_DupValue(ctx, JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, b1));
+    if (var_refs) {
+        for (i = 0; i < b->closure_var_count; i++)
+            free_var_ref(ctx->rt, var_refs[i]);
+        js_free(ctx, var_refs);
+    }
+    JS_FreeValue(ctx, JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, b));
+    return 0;
+}
+
 /* the indirection is needed to make 'eval' optional */
 static JSValue JS_EvalInternal(JSContext *ctx, JSValueConst this_obj,
                                const char *input, size_t input_len,
@@ -34822,9 +39057,15 @@ typedef enum BCTagEnum {
     BC_TAG_DATE,
     BC_TAG_OBJECT_VALUE,
     BC_TAG_OBJECT_REFERENCE,
+    BC_TAG_ARRAY_BUFFER_TRANSFER,
 } BCTagEnum;
 
-#define BC_VERSION 4
+#define BC_VERSION 6
+
+typedef struct {
+    JSDebugBuf *buf;
+    uint32_t pos; /* position in the debug section */
+} BCDebugBufEntry;
 
 typedef struct BCWriterState {
     JSContext *ctx;
@@ -34841,8 +39082,17 @@ typedef struct BCWriterState {
     uint8_t **sab_tab;
     int sab_tab_len;
     int sab_tab_size;
+    /* ArrayBuffers of the transfer list */
+    JSValue *transfer_tab;
+    int transfer_count;
     /* list of referenced objects (used if allow_reference = TRUE) */
     JSObjectList object_list;
+    /* debug info of the functions, written after the atoms */
+    DynBuf debug_dbuf;
+    /* source buffers already written in debug_dbuf */
+    BCDebugBufEntry *debug_buf_tab;
+    int debug_buf_count;
+    int debug_buf_size;
 } BCWriterState;
 
 #ifdef DUMP_READ_OBJECT
@@ -35145,12 +39395,66 @@ static int JS_WriteBigInt(BCWriterState *s, JSValueConst obj)
 
 static int JS_WriteObjectRec(BCWriterState *s, JSValueConst obj);
 
+/* The line number table and the source code are stored in the debug
+   section so that the reader can decode them only when needed. The
+   source code of a script is written once for all its functions. */
+static int JS_WriteFunctionDebug(BCWriterState *s, JSFunctionBytecode *b)
+{
+    JSFunctionDebug *d;
+    uint32_t source_pos;
+    int i;
+
+    d = js_get_function_debug(s->ctx->rt, b, TRUE);
+    if (!d) {
+        JS_ThrowOutOfMemory(s->ctx);
+        return -1;
+    }
+    source_pos = 0;
+    if (d->source_len != 0) {
+        if (d->buf->is_source) {
+            for(i = 0; i < s->debug_buf_count; i++) {
+                if (s->debug_buf_tab[i].buf == d->buf)
+                    break;
+            }
+            if (i == s->debug_buf_count) {
+                if (js_resize_array(s->ctx, (void **)&s->debug_buf_tab,
+                                    sizeof(s->debug_buf_tab[0]),
+                                    &s->debug_buf_size, i + 1))
+                    return -1;
+                s->debug_buf_tab[i].buf = d->buf;
+                s->debug_buf_tab[i].pos = s->debug_dbuf.size;
+                s->debug_buf_count++;
+                dbuf_put(&s->debug_dbuf, d->buf->data, d->buf->len);
+            }
+            source_pos = s->debug_buf_tab[i].pos + d->source_pos;
+        } else {
+            source_pos = s->debug_dbuf.size;
+            dbuf_put(&s->debug_dbuf, d->buf->data + d->source_pos,
+                     d->source_len);
+        }
+    }
+    /* position of the record in the debug section */
+    bc_put_leb128(s, s->debug_dbuf.size);
+    dbuf_put_leb128(&s->debug_dbuf, d->pc2line_len);
+    if (d->pc2line_len != 0)
+        dbuf_put(&s->debug_dbuf, d->pc2line_buf, d->pc2line_len);
+    dbuf_put_leb128(&s->debug_dbuf, d->source_len);
+    if (d->source_len != 0)
+        dbuf_put_leb128(&s->debug_dbuf, source_pos);
+    return 0;
+}
+
 static int JS_WriteFunctionTag(BCWriterState *s, JSValueConst obj)
 {
     JSFunctionBytecode *b = JS_VALUE_GET_PTR(obj);
     uint32_t flags;
     int idx, i;
 
+    if (b->is_lazy) {
+        b = js_lazy_compile(b);
+        if (!b)
+            goto fail;
+    }
     bc_put_u8(s, BC_TAG_FUNCTION_BYTECODE);
     flags = idx = 0;
     bc_set_flags(&flags, &idx, b->has_prototype, 1);
@@ -35214,15 +39518,9 @@ static int JS_WriteFunctionTag(BCWriterState *s, JSValueConst obj)
         goto fail;
 
     if (b->has_debug) {
-        bc_put_atom(s, b->debug.filename);
-        bc_put_leb128(s, b->debug.pc2line_len);
-        dbuf_put(&s->dbuf, b->debug.pc2line_buf, b->debug.pc2line_len);
-        if (b->debug.source) {
-            bc_put_leb128(s, b->debug.source_len);
-            dbuf_put(&s->dbuf, (uint8_t *)b->debug.source, b->debug.source_len);
-        } else {
-            bc_put_leb128(s, 0);
-        }
+        bc_put_atom(s, b->debug->filename);
+        if (JS_WriteFunctionDebug(s, b))
+            goto fail;
     }
 
     for(i = 0; i < b->cpool_count; i++) {
@@ -35338,7 +39636,7 @@ static int JS_WriteObjectTag(BCWriterState *s, JSValueConst obj)
 
     bc_put_u8(s, BC_TAG_OBJECT);
     prop_count = 0;
-    sh = p->shape;
+    sh = get_obj_shape(p);
     for(pass = 0; pass < 2; pass++) {
         if (pass == 1)
             bc_put_leb128(s, prop_count);
@@ -35355,7 +39653,7 @@ static int JS_WriteObjectTag(BCWriterState *s, JSValueConst obj)
                     prop_count++;
                 } else {
                     bc_put_atom(s, atom);
-                    if (JS_WriteObjectRec(s, p->prop[i].u.value))
+                    if (JS_WriteObjectRec(s, get_obj_prop(p)[i].u.value))
                         goto fail;
                 }
             }
@@ -35384,10 +39682,20 @@ static int JS_WriteArrayBuffer(BCWriterState *s, JSValueConst obj)
 {
     JSObject *p = JS_VALUE_GET_OBJ(obj);
     JSArrayBuffer *abuf = p->u.array_buffer;
+    int i;
+
     if (abuf->detached) {
         JS_ThrowTypeErrorDetachedArrayBuffer(s->ctx);
         return -1;
     }
+    for(i = 0; i < s->transfer_count; i++) {
+        if (JS_VALUE_GET_OBJ(s->transfer_tab[i]) == p) {
+            /* the contents are moved by js_transfer_array_buffers() */
+            bc_put_u8(s, BC_TAG_ARRAY_BUFFER_TRANSFER);
+            bc_put_leb128(s, i);
+            return 0;
+        }
+    }
     bc_put_u8(s, BC_TAG_ARRAY_BUFFER);
     bc_put_leb128(s, abuf->byte_length);
     dbuf_put(&s->dbuf, abuf->data, abuf->byte_length);
@@ -35566,6 +39874,11 @@ static int JS_WriteObjectAtoms(BCWriterState *s)
         JSAtomStruct *p = rt->atom_array[s->idx_to_atom[i]];
         JS_WriteString(s, p);
     }
+    /* the debug section is stored before the objects */
+    bc_put_leb128(s, s->debug_dbuf.size);
+    dbuf_put(&s->dbuf, s->debug_dbuf.buf, s->debug_dbuf.size);
+    if (dbuf_error(&s->debug_dbuf))
+        goto fail;
     /* XXX: should check for OOM in above phase */
 
     /* move the atoms at the start */
@@ -35585,10 +39898,106 @@ static int JS_WriteObjectAtoms(BCWriterState *s)
     return -1;
 }
 
-uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
-                         int flags, uint8_t ***psab_tab, size_t *psab_tab_len)
+/* check the transfer list and store its ArrayBuffers in 's' */
+static int js_get_transfer_list(BCWriterState *s, JSValueConst transfer)
+{
+    JSContext *ctx = s->ctx;
+    JSArrayBuffer *abuf;
+    JSValue val;
+    uint32_t len, i;
+    int j;
+
+    if (JS_IsUndefined(transfer))
+        return 0;
+    if (js_get_length32(ctx, &len, transfer))
+        return -1;
+    if (len == 0)
+        return 0;
+    s->transfer_tab = js_malloc(ctx, sizeof(s->transfer_tab[0]) * len);
+    if (!s->transfer_tab)
+        return -1;
+    for(i = 0; i < len; i++) {
+        val = JS_GetPropertyUint32(ctx, transfer, i);
+        if (JS_IsException(val))
+            return -1;
+        abuf = JS_GetOpaque(val, JS_CLASS_ARRAY_BUFFER);
+        if (!abuf) {
+            JS_FreeValue(ctx, val);
+            JS_ThrowTypeError(ctx, "only ArrayBuffers can be transferred");
+            return -1;
+        }
+        if (abuf->detached) {
+            JS_FreeValue(ctx, val);
+            JS_ThrowTypeErrorDetachedArrayBuffer(ctx);
+            return -1;
+        }
+        for(j = 0; j < s->transfer_count; j++) {
+            if (JS_VALUE_GET_OBJ(s->transfer_tab[j]) == JS_VALUE_GET_OBJ(val)) {
+                JS_FreeValue(ctx, val);
+                JS_ThrowTypeError(ctx, "duplicate ArrayBuffer in the transfer list");
+                return -1;
+            }
+        }
+        s->transfer_tab[s->transfer_count++] = val;
+    }
+    return 0;
+}
+
+/* detach the ArrayBuffers of the transfer list and move their
+   contents to a table allocated with js_malloc(). Nothing is detached
+   in case of exception. */
+static JSTransferBuffer *js_transfer_array_buffers(BCWriterState *s)
+{
+    JSContext *ctx = s->ctx;
+    JSTransferBuffer *tab;
+    JSArrayBuffer *abuf;
+    int i;
+
+    tab = js_mallocz(ctx, sizeof(tab[0]) * s->transfer_count);
+    if (!tab)
+        return NULL;
+    for(i = 0; i < s->transfer_count; i++) {
+        abuf = JS_GetOpaque(s->transfer_tab[i], JS_CLASS_ARRAY_BUFFER);
+        tab[i].len = abuf->byte_length;
+        /* the contents are moved only if they come from malloc() */
+        if (!js_array_buffer_is_malloc(ctx->rt, abuf)) {
+            tab[i].data = js_transfer_malloc(max_int(abuf->byte_length, 1));
+            if (!tab[i].data)
+                goto fail;
+            memcpy(tab[i].data, abuf->data, abuf->byte_length);
+        }
+    }
+    for(i = 0; i < s->transfer_count; i++) {
+        abuf = JS_GetOpaque(s->transfer_tab[i], JS_CLASS_ARRAY_BUFFER);
+        if (!tab[i].data)
+            tab[i].data = js_array_buffer_steal(ctx->rt, abuf);
+        else if (abuf->free_func)
+            abuf->free_func(ctx->rt, abuf->opaque, abuf->data);
+        array_buffer_detach(abuf);
+    }
+    return tab;
+ fail:
+    for(i = 0; i < s->transfer_count; i++)
+        js_transfer_free(ctx->rt, NULL, tab[i].data);
+    js_free(ctx, tab);
+    JS_ThrowOutOfMemory(ctx);
+    return NULL;
+}
+
+/* same as JS_WriteObject2(). The ArrayBuffers of the array 'transfer'
+   are not copied: they are detached and their contents (allocated
+   with malloc()) are returned in '*ptransfer_tab', one entry per
+   element of 'transfer'. The object must be read with
+   JS_ReadObjectTransfer(). */
+uint8_t *JS_WriteObjectTransfer(JSContext *ctx, size_t *psize, JSValueConst obj,
+                                int flags, JSValueConst transfer,
+                                uint8_t ***psab_tab, size_t *psab_tab_len,
+                                JSTransferBuffer **ptransfer_tab,
+                                size_t *ptransfer_len)
 {
     BCWriterState ss, *s = &ss;
+    JSTransferBuffer *transfer_tab = NULL;
+    int i;
 
     memset(s, 0, sizeof(*s));
     s->ctx = ctx;
@@ -35601,34 +40010,68 @@ uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
     else
         s->first_atom = 1;
     js_dbuf_init(ctx, &s->dbuf);
+    js_dbuf_init(ctx, &s->debug_dbuf);
     js_object_list_init(&s->object_list);
 
+    if (js_get_transfer_list(s, transfer))
+        goto fail;
     if (JS_WriteObjectRec(s, obj))
         goto fail;
     if (JS_WriteObjectAtoms(s))
         goto fail;
+    if (s->transfer_count > 0) {
+        transfer_tab = js_transfer_array_buffers(s);
+        if (!transfer_tab)
+            goto fail;
+    }
     js_object_list_end(ctx, &s->object_list);
     js_free(ctx, s->atom_to_idx);
     js_free(ctx, s->idx_to_atom);
+    dbuf_free(&s->debug_dbuf);
+    js_free(ctx, s->debug_buf_tab);
+    for(i = 0; i < s->transfer_count; i++)
+        JS_FreeValue(ctx, s->transfer_tab[i]);
+    js_free(ctx, s->transfer_tab);
     *psize = s->dbuf.size;
     if (psab_tab)
         *psab_tab = s->sab_tab;
     if (psab_tab_len)
         *psab_tab_len = s->sab_tab_len;
+    if (ptransfer_tab)
+        *ptransfer_tab = transfer_tab;
+    if (ptransfer_len)
+        *ptransfer_len = s->transfer_count;
     return s->dbuf.buf;
  fail:
     js_object_list_end(ctx, &s->object_list);
     js_free(ctx, s->atom_to_idx);
     js_free(ctx, s->idx_to_atom);
+    dbuf_free(&s->debug_dbuf);
+    js_free(ctx, s->debug_buf_tab);
+    for(i = 0; i < s->transfer_count; i++)
+        JS_FreeValue(ctx, s->transfer_tab[i]);
+    js_free(ctx, s->transfer_tab);
+    js_free(ctx, s->sab_tab);
     dbuf_free(&s->dbuf);
     *psize = 0;
     if (psab_tab)
         *psab_tab = NULL;
     if (psab_tab_len)
         *psab_tab_len = 0;
+    if (ptransfer_tab)
+        *ptransfer_tab = NULL;
+    if (ptransfer_len)
+        *ptransfer_len = 0;
     return NULL;
 }
 
+uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
+                         int flags, uint8_t ***psab_tab, size_t *psab_tab_len)
+{
+    return JS_WriteObjectTransfer(ctx, psize, obj, flags, JS_UNDEFINED,
+                                  psab_tab, psab_tab_len, NULL, NULL);
+}
+
 uint8_t *JS_WriteObject(JSContext *ctx, size_t *psize, JSValueConst obj,
                         int flags)
 {
@@ -35646,10 +40089,18 @@ typedef struct BCReaderState {
     BOOL allow_bytecode : 8;
     BOOL is_rom_data : 8;
     BOOL allow_reference : 8;
+    /* ArrayBuffers created from the transferred contents */
+    JSValue *transfer_tab;
+    int transfer_count;
     /* object references */
     JSObject **objects;
     int objects_count;
     int objects_size;
+    /* debug section */
+    const uint8_t *debug_section;
+    uint32_t debug_section_len;
+    BOOL debug_in_rom; /* the debug section is not copied */
+    JSDebugBuf *debug_buf; /* allocated on first use */
 
 #ifdef DUMP_READ_OBJECT
     const uint8_t *ptr_last;
@@ -36071,11 +40522,7 @@ static JSValue JS_ReadFunctionTag(BCReaderState *s)
     if (bc_get_leb128_int(s, &local_count))
         goto fail;
 
-    if (bc.has_debug) {
-        function_size = sizeof(*b);
-    } else {
-        function_size = offsetof(JSFunctionBytecode, debug);
-    }
+    function_size = sizeof(*b);
     cpool_offset = function_size;
     function_size += bc.cpool_count * sizeof(*bc.cpool);
     vardefs_offset = function_size;
@@ -36171,32 +40618,36 @@ static JSValue JS_ReadFunctionTag(BCReaderState *s)
         bc_read_trace(s, "}\n");
     }
     if (b->has_debug) {
-        /* read optional debug information */
+        /* read optional debug information. The record in the debug
+           section is decoded when needed. */
+        JSFunctionDebug *d;
         bc_read_trace(s, "debug {\n");
-        if (bc_get_atom(s, &b->debug.filename))
+        d = js_mallocz(ctx, sizeof(*d));
+        if (!d)
+            goto fail;
+        b->debug = d;
+        d->state = JS_DEBUG_SERIALIZED;
+        if (bc_get_atom(s, &d->filename))
             goto fail;
 #ifdef DUMP_READ_OBJECT
-        bc_read_trace(s, "filename: "); print_atom(s->ctx, b->debug.filename); printf("\n");
+        bc_read_trace(s, "filename: "); print_atom(s->ctx, d->filename); printf("\n");
 #endif
-        if (bc_get_leb128_int(s, &b->debug.pc2line_len))
+        if (bc_get_leb128(s, &d->source_pos))
             goto fail;
-        if (b->debug.pc2line_len) {
-            b->debug.pc2line_buf = js_mallocz(ctx, b->debug.pc2line_len);
-            if (!b->debug.pc2line_buf)
-                goto fail;
-            if (bc_get_buf(s, b->debug.pc2line_buf, b->debug.pc2line_len))
-                goto fail;
-        }
-        if (bc_get_leb128_int(s, &b->debug.source_len))
+        if (d->source_pos >= s->debug_section_len) {
+            JS_ThrowSyntaxError(ctx, "invalid debug info (pos=%u)",
+                                (unsigned int)(s->ptr - s->buf_start));
             goto fail;
-        if (b->debug.source_len) {
-            bc_read_trace(s, "source: %d bytes\n", b->source_len);
-            b->debug.source = js_mallocz(ctx, b->debug.source_len);
-            if (!b->debug.source)
-                goto fail;
-            if (bc_get_buf(s, (uint8_t *)b->debug.source, b->debug.source_len))
+        }
+        if (!s->debug_buf) {
+            s->debug_buf = js_new_debug_buf(ctx, s->debug_section,
+                                            s->debug_section_len, FALSE,
+                                            s->debug_in_rom);
+            if (!s->debug_buf)
                 goto fail;
         }
+        d->buf = s->debug_buf;
+        d->buf->ref_count++;
         bc_read_trace(s, "}\n");
     }
     if (b->cpool_count != 0) {
@@ -36502,6 +40953,26 @@ static JSValue JS_ReadSharedArrayBuffer(BCReaderState *s)
     return JS_EXCEPTION;
 }
 
+static JSValue JS_ReadArrayBufferTransfer(BCReaderState *s)
+{
+    JSContext *ctx = s->ctx;
+    uint32_t idx;
+    JSValue obj;
+
+    if (bc_get_leb128(s, &idx))
+        return JS_EXCEPTION;
+    if (idx >= s->transfer_count) {
+        JS_ThrowSyntaxError(ctx, "invalid transferred ArrayBuffer index");
+        return JS_EXCEPTION;
+    }
+    obj = JS_DupValue(ctx, s->transfer_tab[idx]);
+    if (BC_add_object_ref(s, obj)) {
+        JS_FreeValue(ctx, obj);
+        return JS_EXCEPTION;
+    }
+    return obj;
+}
+
 static JSValue JS_ReadDate(BCReaderState *s)
 {
     JSContext *ctx = s->ctx;
@@ -36514,7 +40985,7 @@ static JSValue JS_ReadDate(BCReaderState *s)
         JS_ThrowTypeError(ctx, "Number tag expected for date");
         goto fail;
     }
-    obj = JS_NewObjectProtoClass(ctx, ctx->class_proto[JS_CLASS_DATE],
+    obj = JS_NewObjectProtoClass(ctx, js_get_class_proto(ctx, JS_CLASS_DATE),
                                  JS_CLASS_DATE);
     if (JS_IsException(obj))
         goto fail;
@@ -36629,6 +41100,9 @@ static JSValue JS_ReadObjectRec(BCReaderState *s)
             goto invalid_tag;
         obj = JS_ReadSharedArrayBuffer(s);
         break;
+    case BC_TAG_ARRAY_BUFFER_TRANSFER:
+        obj = JS_ReadArrayBufferTransfer(s);
+        break;
     case BC_TAG_DATE:
         obj = JS_ReadDate(s);
         break;
@@ -36699,6 +41173,13 @@ static int JS_ReadObjectAtoms(BCReaderState *s)
             s->is_rom_data = FALSE; /* atoms must be relocated */
     }
     bc_read_trace(s, "}\n");
+    if (bc_get_leb128(s, &s->debug_section_len))
+        return -1;
+    if (s->debug_section_len > s->buf_end - s->ptr)
+        return bc_read_error_end(s);
+    bc_read_trace(s, "debug section: %u bytes\n", s->debug_section_len);
+    s->debug_section = s->ptr;
+    s->ptr += s->debug_section_len;
     return 0;
 }
 
@@ -36712,13 +41193,24 @@ static void bc_reader_free(BCReaderState *s)
         js_free(s->ctx, s->idx_to_atom);
     }
     js_free(s->ctx, s->objects);
+    js_free_debug_buf(s->ctx->rt, s->debug_buf);
+    for(i = 0; i < s->transfer_count; i++)
+        JS_FreeValue(s->ctx, s->transfer_tab[i]);
+    js_free(s->ctx, s->transfer_tab);
 }
 
-JSValue JS_ReadObject(JSContext *ctx, const uint8_t *buf, size_t buf_len,
-                       int flags)
+/* same as JS_ReadObject() for an object written by
+   JS_WriteObjectTransfer(). The ArrayBuffers are created first and
+   take the ownership of the 'transfer_tab' entries: their 'data' field
+   is set to NULL. The entries which could not be used because of an
+   exception are left unchanged. */
+JSValue JS_ReadObjectTransfer(JSContext *ctx, const uint8_t *buf, size_t buf_len,
+                              int flags, JSTransferBuffer *transfer_tab,
+                              size_t transfer_len)
 {
     BCReaderState ss, *s = &ss;
     JSValue obj;
+    size_t i;
 
     ctx->binary_object_count += 1;
     ctx->binary_object_size += buf_len;
@@ -36730,21 +41222,109 @@ JSValue JS_ReadObject(JSContext *ctx, const uint8_t *buf, size_t buf_len,
     s->ptr = buf;
     s->allow_bytecode = ((flags & JS_READ_OBJ_BYTECODE) != 0);
     s->is_rom_data = ((flags & JS_READ_OBJ_ROM_DATA) != 0);
+    s->debug_in_rom = s->is_rom_data;
     s->allow_sab = ((flags & JS_READ_OBJ_SAB) != 0);
     s->allow_reference = ((flags & JS_READ_OBJ_REFERENCE) != 0);
     if (s->allow_bytecode)
         s->first_atom = JS_ATOM_END;
     else
         s->first_atom = 1;
+    if (transfer_len > 0) {
+        s->transfer_tab = js_malloc(ctx, sizeof(s->transfer_tab[0]) *
+                                    transfer_len);
+        if (!s->transfer_tab) {
+            obj = JS_EXCEPTION;
+            goto done;
+        }
+        for(i = 0; i < transfer_len; i++) {
+            obj = js_array_buffer_adopt(ctx, transfer_tab[i].data,
+                                        transfer_tab[i].len);
+            if (JS_IsException(obj))
+                goto done;
+            transfer_tab[i].data = NULL;
+            s->transfer_tab[s->transfer_count++] = obj;
+        }
+    }
     if (JS_ReadObjectAtoms(s)) {
         obj = JS_EXCEPTION;
     } else {
         obj = JS_ReadObjectRec(s);
     }
+ done:
     bc_reader_free(s);
     return obj;
 }
 
+JSValue JS_ReadObject(JSContext *ctx, const uint8_t *buf, size_t buf_len,
+                       int flags)
+{
+    return JS_ReadObjectTransfer(ctx, buf, buf_len, flags, NULL, 0);
+}
+
+/* Create the atoms of a bytecode image with the indexes they have in
+   the image. Done before any context exists, this makes the atom
+   table of every runtime loading the image identical to the image one,
+   so that JS_ReadObject() with JS_READ_OBJ_ROM_DATA can execute the
+   bytecode in place instead of relocating a copy of it. */
+int JS_ReserveImageAtoms(JSRuntime *rt, const uint8_t *buf, size_t buf_len)
+{
+    const uint8_t *ptr = buf, *buf_end = buf + buf_len;
+    uint32_t count, len, n, i;
+    BOOL is_wide_char;
+    size_t size;
+    JSString *p;
+    JSAtom atom;
+    int ret;
+
+    if (rt->image_atom_count != 0 || rt->atom_count != JS_ATOM_END)
+        return -1; /* atoms were already allocated */
+    if (buf_len < 1 || *ptr++ != BC_VERSION)
+        return -1;
+    ret = get_leb128(&count, ptr, buf_end);
+    if (ret < 0)
+        return -1;
+    ptr += ret;
+    for(i = 0; i < count; i++) {
+        ret = get_leb128(&len, ptr, buf_end);
+        if (ret < 0)
+            return -1;
+        ptr += ret;
+        is_wide_char = len & 1;
+        len >>= 1;
+        size = (size_t)len << is_wide_char;
+        if (len > JS_STRING_LEN_MAX || buf_end - ptr < size)
+            return -1;
+        p = js_alloc_string_rt(rt, len, is_wide_char);
+        if (!p)
+            return -1;
+        memcpy(p->u.str8, ptr, size);
+        ptr += size;
+        if (is_wide_char) {
+            if (is_be()) {
+                uint32_t j;
+                for (j = 0; j < len; j++)
+                    p->u.str16[j] = bswap16(p->u.str16[j]);
+            }
+        } else {
+            p->u.str8[size] = '\0';
+        }
+        if (is_num_string(&n, p) && n <= JS_ATOM_MAX_INT) {
+            js_free_string(rt, p);
+            return -1;
+        }
+        /* the reference is kept until JS_FreeRuntime() */
+        atom = __JS_NewAtom(rt, p, JS_ATOM_TYPE_STRING);
+        if (atom == JS_ATOM_NULL)
+            return -1;
+        if (atom != JS_ATOM_END + i) {
+            JS_FreeAtomRT(rt, atom);
+            return -1;
+        }
+        rt->image_atom_count++;
+    }
+    return 0;
+}
+
 /*******************************************************************/
 /* runtime functions & objects */
 
@@ -36998,7 +41578,8 @@ static void JS_NewGlobalCConstructor2(JSContext *ctx,
                                       const char *name,
                                       JSValueConst proto)
 {
-    JS_DefinePropertyValueStr(ctx, ctx->global_obj, name,
+    JS_DefinePropertyValueStr(ctx, ctx->in_lazy_intrinsic ?
+                              ctx->intrinsic_obj : ctx->global_obj, name,
                            JS_DupValue(ctx, func_obj),
                            JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
     JS_SetConstructor(ctx, func_obj, proto);
@@ -38596,9 +43177,11 @@ static JSValue js_function_toString(JSContext *ctx, JSValueConst this_val,
     p = JS_VALUE_GET_OBJ(this_val);
     if (js_class_has_bytecode(p->class_id)) {
         JSFunctionBytecode *b = p->u.func.function_bytecode;
-        if (b->has_debug && b->debug.source) {
-            return JS_NewStringLen(ctx, b->debug.source, b->debug.source_len);
-        }
+        const char *source;
+        int source_len;
+        source = js_get_function_source(ctx->rt, b, &source_len);
+        if (source)
+            return JS_NewStringLen(ctx, source, source_len);
         func_kind = b->func_kind;
     }
     {
@@ -41929,6 +46512,7 @@ static JSValue js_string_match(JSContext *ctx, JSValueConst this_val,
             goto fail;
         args[args_len++] = (JSValueConst)str;
     }
+    js_instantiate_intrinsic(ctx, JS_INTRINSIC_REGEXP);
     rx = JS_CallConstructor(ctx, ctx->regexp_ctor, args_len, args);
     JS_FreeValue(ctx, str);
     if (JS_IsException(rx)) {
@@ -46959,7 +51543,7 @@ static void js_weakref_free(JSRuntime *rt, JSValue val)
            free_zero_refcount() */
         if (p->weakref_count == 0 && p->header.ref_count == 0 &&
             p->header.mark == 0) {
-            js_free_rt(rt, p);
+            js_cptr_free_rt(rt, p);
         }
     } else if (JS_VALUE_GET_TAG(val) == JS_TAG_SYMBOL) {
         JSString *p = JS_VALUE_GET_STRING(val);
@@ -48756,6 +53340,29 @@ static __exception int perform_promise_then(JSContext *ctx,
     JSPromiseReactionData *rd_array[2], *rd;
     int i, j;
 
+    if (s->promise_state != JS_PROMISE_PENDING) {
+        /* settled promise: no need to store the reactions */
+        JSValueConst args[5], handler;
+        if (s->promise_state == JS_PROMISE_REJECTED && !s->is_handled) {
+            JSRuntime *rt = ctx->rt;
+            if (rt->host_promise_rejection_tracker) {
+                rt->host_promise_rejection_tracker(ctx, promise, s->promise_result,
+                                                   TRUE, rt->host_promise_rejection_tracker_opaque);
+            }
+        }
+        s->is_handled = TRUE;
+        i = s->promise_state - JS_PROMISE_FULFILLED;
+        handler = resolve_reject[i];
+        if (!JS_IsFunction(ctx, handler))
+            handler = JS_UNDEFINED;
+        args[0] = cap_resolving_funcs[0];
+        args[1] = cap_resolving_funcs[1];
+        args[2] = handler;
+        args[3] = JS_NewBool(ctx, i);
+        args[4] = s->promise_result;
+        return JS_EnqueueJob(ctx, promise_reaction_job, 5, args);
+    }
+
     rd_array[0] = NULL;
     rd_array[1] = NULL;
     for(i = 0; i < 2; i++) {
@@ -48775,29 +53382,8 @@ static __exception int perform_promise_then(JSContext *ctx,
         rd_array[i] = rd;
     }
 
-    if (s->promise_state == JS_PROMISE_PENDING) {
-        for(i = 0; i < 2; i++)
-            list_add_tail(&rd_array[i]->link, &s->promise_reactions[i]);
-    } else {
-        JSValueConst args[5];
-        if (s->promise_state == JS_PROMISE_REJECTED && !s->is_handled) {
-            JSRuntime *rt = ctx->rt;
-            if (rt->host_promise_rejection_tracker) {
-                rt->host_promise_rejection_tracker(ctx, promise, s->promise_result,
-                                                   TRUE, rt->host_promise_rejection_tracker_opaque);
-            }
-        }
-        i = s->promise_state - JS_PROMISE_FULFILLED;
-        rd = rd_array[i];
-        args[0] = rd->resolving_funcs[0];
-        args[1] = rd->resolving_funcs[1];
-        args[2] = rd->handler;
-        args[3] = JS_NewBool(ctx, i);
-        args[4] = s->promise_result;
-        JS_EnqueueJob(ctx, promise_reaction_job, 5, args);
-        for(i = 0; i < 2; i++)
-            promise_reaction_data_free(ctx->rt, rd_array[i]);
-    }
+    for(i = 0; i < 2; i++)
+        list_add_tail(&rd_array[i]->link, &s->promise_reactions[i]);
     s->is_handled = TRUE;
     return 0;
 }
@@ -51392,15 +55978,57 @@ static JSValue js_array_buffer_get_byteLength(JSContext *ctx,
     return JS_NewUint32(ctx, abuf->byte_length);
 }
 
-void JS_DetachArrayBuffer(JSContext *ctx, JSValueConst obj)
+/* TRUE if the contents of 'abuf' were allocated with malloc() by the
+   default allocator. They can then be moved to another runtime. */
+static BOOL js_array_buffer_is_malloc(JSRuntime *rt, JSArrayBuffer *abuf)
+{
+    return abuf->free_func == js_array_buffer_free &&
+        rt->mf.js_malloc == js_def_malloc;
+}
+
+/* remove the contents of 'abuf' from the memory accounting of 'rt' and
+   return them. The buffer must then be detached. */
+static uint8_t *js_array_buffer_steal(JSRuntime *rt, JSArrayBuffer *abuf)
+{
+    uint8_t *data = abuf->data;
+
+    assert(js_array_buffer_is_malloc(rt, abuf));
+    rt->malloc_state.malloc_count--;
+    rt->malloc_state.malloc_size -= js_def_malloc_usable_size(data) + MALLOC_OVERHEAD;
+    abuf->data = NULL;
+    return data;
+}
+
+/* create an ArrayBuffer owning 'buf', allocated with malloc() */
+static JSValue js_array_buffer_adopt(JSContext *ctx, uint8_t *buf, size_t len)
+{
+    JSRuntime *rt = ctx->rt;
+    JSValue obj;
+
+    if (rt->mf.js_malloc == js_def_malloc) {
+        obj = js_array_buffer_constructor3(ctx, JS_UNDEFINED, len,
+                                           JS_CLASS_ARRAY_BUFFER, buf,
+                                           js_array_buffer_free, NULL,
+                                           FALSE);
+        if (!JS_IsException(obj)) {
+            rt->malloc_state.malloc_count++;
+            rt->malloc_state.malloc_size += js_def_malloc_usable_size(buf) +
+                MALLOC_OVERHEAD;
+        }
+    } else {
+        obj = js_array_buffer_constructor3(ctx, JS_UNDEFINED, len,
+                                           JS_CLASS_ARRAY_BUFFER, buf,
+                                           js_transfer_free, NULL,
+                                           FALSE);
+    }
+    return obj;
+}
+
+/* the contents must have been freed */
+static void array_buffer_detach(JSArrayBuffer *abuf)
 {
-    JSArrayBuffer *abuf = JS_GetOpaque(obj, JS_CLASS_ARRAY_BUFFER);
     struct list_head *el;
 
-    if (!abuf || abuf->detached)
-        return;
-    if (abuf->free_func)
-        abuf->free_func(ctx->rt, abuf->opaque, abuf->data);
     abuf->data = NULL;
     abuf->byte_length = 0;
     abuf->detached = TRUE;
@@ -51419,6 +56047,17 @@ void JS_DetachArrayBuffer(JSContext *ctx, JSValueConst obj)
     }
 }
 
+void JS_DetachArrayBuffer(JSContext *ctx, JSValueConst obj)
+{
+    JSArrayBuffer *abuf = JS_GetOpaque(obj, JS_CLASS_ARRAY_BUFFER);
+
+    if (!abuf || abuf->detached)
+        return;
+    if (abuf->free_func)
+        abuf->free_func(ctx->rt, abuf->opaque, abuf->data);
+    array_buffer_detach(abuf);
+}
+
 /* get an ArrayBuffer or SharedArrayBuffer */
 static JSArrayBuffer *js_get_array_buffer(JSContext *ctx, JSValueConst obj)
 {
@@ -54123,7 +58762,7 @@ void JS_AddIntrinsicAtomics(JSContext *ctx)
 
 #endif /* CONFIG_ATOMICS */
 
-void JS_AddIntrinsicTypedArrays(JSContext *ctx)
+static void js_add_intrinsic_typed_arrays(JSContext *ctx)
 {
     JSValue typed_array_base_proto, typed_array_base_func;
     JSValueConst array_buffer_func, shared_array_buffer_func;
@@ -54205,6 +58844,11 @@ void JS_AddIntrinsicTypedArrays(JSContext *ctx)
     JS_NewGlobalCConstructorOnly(ctx, "DataView",
                                  js_dataview_constructor, 1,
                                  ctx->class_proto[JS_CLASS_DATAVIEW]);
+}
+
+void JS_AddIntrinsicTypedArrays(JSContext *ctx)
+{
+    js_add_intrinsic_typed_arrays(ctx);
     /* Atomics */
 #ifdef CONFIG_ATOMICS
     JS_AddIntrinsicAtomics(ctx);
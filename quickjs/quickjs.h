@@ -343,6 +343,12 @@ static inline JSValue __JS_NewShortBigInt(JSContext *ctx, int64_t d)
 /* allow top-level await in normal script. JS_Eval() returns a
    promise. Only allowed with JS_EVAL_TYPE_GLOBAL */
 #define JS_EVAL_FLAG_ASYNC (1 << 7)
+/* accept JSX elements, compiled to calls of the factory function
+   (React.createElement by default, see the '@jsx' pragma) */
+#define JS_EVAL_FLAG_JSX (1 << 8)
+/* accept TypeScript: type annotations, interfaces, type aliases,
+   generics, 'as'/'satisfies' and 'declare' forms are skipped */
+#define JS_EVAL_FLAG_TYPESCRIPT (1 << 9)
 
 typedef JSValue JSCFunction(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv);
 typedef JSValue JSCFunctionMagic(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic);
@@ -444,6 +450,8 @@ typedef struct JSMemoryUsage {
 
 void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s);
 void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt);
+/* write the heap graph in the Chrome DevTools format (.heapsnapshot) */
+int JS_WriteHeapSnapshot(JSRuntime *rt, FILE *f);
 
 /* atom support */
 #define JS_ATOM_NULL 0
@@ -906,6 +914,10 @@ void JS_SetCanBlock(JSRuntime *rt, JS_BOOL can_block);
 #define JS_STRIP_DEBUG  (1 << 1) /* strip all debug info including source code */
 void JS_SetStripInfo(JSRuntime *rt, int flags);
 int JS_GetStripInfo(JSRuntime *rt);
+/* if enabled, the bytecode of the inner functions is only generated
+   when they are first called (the source code must not be stripped) */
+void JS_SetLazyCompile(JSRuntime *rt, JS_BOOL enable);
+JS_BOOL JS_GetLazyCompile(JSRuntime *rt);
 
 /* set the [IsHTMLDDA] internal slot */
 void JS_SetIsHTMLDDA(JSContext *ctx, JSValueConst obj);
@@ -937,6 +949,24 @@ int JS_EnqueueJob(JSContext *ctx, JSJobFunc *job_func, int argc, JSValueConst *a
 
 JS_BOOL JS_IsJobPending(JSRuntime *rt);
 int JS_ExecutePendingJob(JSRuntime *rt, JSContext **pctx);
+/* execute up to 'max_jobs' jobs for at most 'budget_us' microseconds
+   (no limit if <= 0). Return the number of executed jobs or < 0 if
+   a job raised an exception in '*pctx'. */
+int JS_ExecutePendingJobs(JSRuntime *rt, int max_jobs, int64_t budget_us,
+                          JSContext **pctx);
+
+typedef struct JSJobStats {
+    int64_t enqueued; /* jobs enqueued */
+    int64_t executed; /* jobs executed */
+    int64_t max_pending; /* most jobs pending at the same time */
+    int64_t drain_count; /* calls of JS_ExecutePendingJobs() with pending jobs */
+    int64_t drain_time; /* time spent in these calls (microseconds) */
+    int64_t max_drain_jobs; /* most jobs executed by one call */
+    int64_t max_drain_time; /* longest call (microseconds) */
+    int64_t queue_size; /* entries currently allocated in the queue */
+} JSJobStats;
+
+void JS_GetJobStats(JSRuntime *rt, JSJobStats *s);
 
 /* Object Writer/Reader (currently only used to handle precompiled code) */
 #define JS_WRITE_OBJ_BYTECODE  (1 << 0) /* allow function/module */
@@ -949,6 +979,20 @@ uint8_t *JS_WriteObject(JSContext *ctx, size_t *psize, JSValueConst obj,
                         int flags);
 uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
                          int flags, uint8_t ***psab_tab, size_t *psab_tab_len);
+/* contents of a transferred ArrayBuffer, allocated with malloc() */
+typedef struct JSTransferBuffer {
+    uint8_t *data;
+    size_t len;
+} JSTransferBuffer;
+/* same as JS_WriteObject2() but the ArrayBuffers of the array
+   'transfer' are detached and their contents returned in
+   '*ptransfer_tab' (allocated with js_malloc()) instead of being
+   copied */
+uint8_t *JS_WriteObjectTransfer(JSContext *ctx, size_t *psize, JSValueConst obj,
+                                int flags, JSValueConst transfer,
+                                uint8_t ***psab_tab, size_t *psab_tab_len,
+                                JSTransferBuffer **ptransfer_tab,
+                                size_t *ptransfer_len);
 
 #define JS_READ_OBJ_BYTECODE  (1 << 0) /* allow function/module */
 #define JS_READ_OBJ_ROM_DATA  (1 << 1) /* avoid duplicating 'buf' data */
@@ -956,6 +1000,18 @@ uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
 #define JS_READ_OBJ_REFERENCE (1 << 3) /* allow object references */
 JSValue JS_ReadObject(JSContext *ctx, const uint8_t *buf, size_t buf_len,
                       int flags);
+/* the transferred contents are owned by the new ArrayBuffers: the
+   'data' field of the used entries is set to NULL */
+JSValue JS_ReadObjectTransfer(JSContext *ctx, const uint8_t *buf, size_t buf_len,
+                              int flags, JSTransferBuffer *transfer_tab,
+                              size_t transfer_len);
+/* Create the atoms of the bytecode image 'buf' with the same indexes
+   as in the image. Must be called just after JS_NewRuntime(). The
+   bytecode read from the image with JS_READ_OBJ_ROM_DATA is then
+   used in place, so several runtimes can share one copy of it.
+   Return -1 if the image is invalid or if its atom indexes could not
+   be reserved. */
+int JS_ReserveImageAtoms(JSRuntime *rt, const uint8_t *buf, size_t buf_len);
 /* instantiate and evaluate a bytecode function. Only used when
    reading a script or module with JS_ReadObject() */
 JSValue JS_EvalFunction(JSContext *ctx, JSValue fun_obj);
@@ -65,6 +65,7 @@ enum test_mode_t {
 } test_mode = TEST_DEFAULT_NOSTRICT;
 int compact;
 int show_timings;
+int lazy_compile;
 int skip_async;
 int skip_module;
 int new_style;
@@ -464,6 +465,7 @@ static void *agent_start(void *arg)
     if (rt == NULL) {
         fatal(1, "JS_NewRuntime failure");
     }
+    JS_SetLazyCompile(rt, lazy_compile);
     ctx = JS_NewContext(rt);
     if (ctx == NULL) {
         JS_FreeRuntime(rt);
@@ -1555,6 +1557,7 @@ int run_test_buf(const char *filename, const char *harness, namelist_t *ip,
     if (rt == NULL) {
         fatal(1, "JS_NewRuntime failure");
     }
+    JS_SetLazyCompile(rt, lazy_compile);
     ctx = JS_NewContext(rt);
     if (ctx == NULL) {
         JS_FreeRuntime(rt);
@@ -1855,6 +1858,7 @@ int run_test262_harness_test(const char *filename, BOOL is_module)
     if (rt == NULL) {
         fatal(1, "JS_NewRuntime failure");
     }
+    JS_SetLazyCompile(rt, lazy_compile);
     ctx = JS_NewContext(rt);
     if (ctx == NULL) {
         JS_FreeRuntime(rt);
@@ -1994,6 +1998,7 @@ void help(void)
            "-m             print memory usage summary\n"
            "-n             use new style harness\n"
            "-N             run test prepared by test262-harness+eshost\n"
+           "-L             compile the inner functions on their first call\n"
            "-s             run tests in strict mode, skip @nostrict tests\n"
            "-E             only run tests from the error file\n"
            "-C             use compact progress indicator\n"
@@ -2092,6 +2097,8 @@ int main(int argc, char **argv)
             slow_test_threshold = atoi(get_opt_arg(arg, argv[optind++]));
         } else if (str_equal(arg, "-N")) {
             is_test262_harness = TRUE;
+        } else if (str_equal(arg, "-L")) {
+            lazy_compile = TRUE;
         } else if (str_equal(arg, "--module")) {
             is_module = TRUE;
         } else {
@@ -2,10 +2,10 @@
 
 #include "quickjs-libc.h"
 
-const uint32_t qjsc_test_fib_size = 173;
+const uint32_t qjsc_test_fib_size = 175;
 
-const uint8_t qjsc_test_fib[173] = {
- 0x04, 0x07, 0x28, 0x65, 0x78, 0x61, 0x6d, 0x70,
+const uint8_t qjsc_test_fib[175] = {
+ 0x06, 0x07, 0x28, 0x65, 0x78, 0x61, 0x6d, 0x70,
  0x6c, 0x65, 0x73, 0x2f, 0x74, 0x65, 0x73, 0x74,
  0x5f, 0x66, 0x69, 0x62, 0x2e, 0x6a, 0x73, 0x10,
  0x2e, 0x2f, 0x66, 0x69, 0x62, 0x2e, 0x73, 0x6f,
@@ -13,20 +13,20 @@ const uint8_t qjsc_test_fib[173] = {
  0x73, 0x6f, 0x6c, 0x65, 0x06, 0x6c, 0x6f, 0x67,
  0x16, 0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x20, 0x57,
  0x6f, 0x72, 0x6c, 0x64, 0x10, 0x66, 0x69, 0x62,
- 0x28, 0x31, 0x30, 0x29, 0x3d, 0x0d, 0xb6, 0x03,
- 0x01, 0xb8, 0x03, 0x00, 0x00, 0x01, 0x00, 0xba,
- 0x03, 0x00, 0x00, 0x0c, 0x20, 0x06, 0x01, 0xa4,
- 0x01, 0x00, 0x00, 0x00, 0x05, 0x01, 0x00, 0x32,
- 0x00, 0xba, 0x03, 0x00, 0x0c, 0x08, 0xed, 0x02,
- 0x29, 0x39, 0xde, 0x00, 0x00, 0x00, 0x43, 0xdf,
- 0x00, 0x00, 0x00, 0x04, 0xe0, 0x00, 0x00, 0x00,
- 0x24, 0x01, 0x00, 0x0e, 0x39, 0xde, 0x00, 0x00,
- 0x00, 0x43, 0xdf, 0x00, 0x00, 0x00, 0x04, 0xe1,
- 0x00, 0x00, 0x00, 0x67, 0x00, 0x00, 0xc0, 0x0a,
- 0xf2, 0x24, 0x02, 0x00, 0x0e, 0x06, 0x2f, 0xb6,
- 0x03, 0x12, 0x00, 0x00, 0x00, 0x04, 0x08, 0x00,
- 0x1b, 0x0e, 0x34, 0x08, 0x17, 0x15, 0x1b, 0x0e,
- 0x4d, 0x28, 0x07, 0x1f, 0x00,
+ 0x28, 0x31, 0x30, 0x29, 0x3d, 0x14, 0x12, 0x00,
+ 0x00, 0x00, 0x04, 0x08, 0x00, 0x1b, 0x0e, 0x34,
+ 0x08, 0x17, 0x15, 0x1b, 0x0e, 0x4d, 0x28, 0x07,
+ 0x1f, 0x00, 0x0d, 0xd2, 0x03, 0x01, 0xd4, 0x03,
+ 0x00, 0x00, 0x01, 0x00, 0xd6, 0x03, 0x00, 0x00,
+ 0x0c, 0x20, 0x06, 0x01, 0xa4, 0x01, 0x00, 0x00,
+ 0x00, 0x05, 0x01, 0x00, 0x32, 0x00, 0xd6, 0x03,
+ 0x00, 0x0c, 0x08, 0xed, 0x02, 0x29, 0x39, 0xec,
+ 0x00, 0x00, 0x00, 0x43, 0xed, 0x00, 0x00, 0x00,
+ 0x04, 0xee, 0x00, 0x00, 0x00, 0x24, 0x01, 0x00,
+ 0x0e, 0x39, 0xec, 0x00, 0x00, 0x00, 0x43, 0xed,
+ 0x00, 0x00, 0x00, 0x04, 0xef, 0x00, 0x00, 0x00,
+ 0x67, 0x00, 0x00, 0xc0, 0x0a, 0xf2, 0x24, 0x02,
+ 0x00, 0x0e, 0x06, 0x2f, 0xd2, 0x03, 0x00,
 };
 
 static JSContext *JS_NewCustomContext(JSRuntime *rt)
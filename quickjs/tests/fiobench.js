@@ -0,0 +1,126 @@
+/*
+ * File read benchmark: sequential blocking reads (os.read) against
+ * concurrent asynchronous reads (os.readFileAsync)
+ *
+ * usage: qjs tests/fiobench.js [-c] [file_count [file_size]]
+ *
+ * -c: drop the page cache before each run so that the data is read
+ *     from the disk (Linux, must be root)
+ */
+import * as std from "std";
+import * as os from "os";
+
+var args = scriptArgs.slice(1);
+var cold = (args[0] === "-c");
+if (cold)
+    args.shift();
+var N = args.length > 0 ? args[0] | 0 : 64;
+var SIZE = args.length > 1 ? args[1] | 0 : 1 << 20;
+var dir = "/tmp/fiobench." + os.getpid();
+var files = [];
+
+function setup()
+{
+    var buf, i, fd;
+
+    os.mkdir(dir, 0o755);
+    buf = new Uint8Array(SIZE);
+    for(i = 0; i < SIZE; i++)
+        buf[i] = i;
+    for(i = 0; i < N; i++) {
+        files[i] = dir + "/f" + i;
+        fd = os.open(files[i], os.O_WRONLY | os.O_CREAT | os.O_TRUNC);
+        os.write(fd, buf.buffer, 0, SIZE);
+        os.close(fd);
+    }
+}
+
+function cleanup()
+{
+    var i;
+    for(i = 0; i < N; i++)
+        os.remove(files[i]);
+    os.remove(dir);
+}
+
+function drop_caches()
+{
+    var f;
+    os.exec(["sync"]);
+    f = std.open("/proc/sys/vm/drop_caches", "w");
+    if (!f)
+        throw new Error("cannot drop the page cache");
+    f.puts("3\n");
+    f.close();
+}
+
+/* measure the longest delay of a 1 ms periodic timer while 'func'
+   runs: it is the longest time the event loop is blocked */
+async function measure(name, func)
+{
+    var ti, t, max_lag = 0, last, running = true, total;
+
+    if (cold)
+        drop_caches();
+    function tick()
+    {
+        var now = os.now();
+        max_lag = Math.max(max_lag, now - last);
+        last = now;
+        if (running)
+            os.setTimeout(tick, 1);
+    }
+    last = os.now();
+    os.setTimeout(tick, 1);
+    ti = os.now();
+    total = await func();
+    t = os.now() - ti;
+    running = false;
+    max_lag = Math.max(max_lag, os.now() - last);
+    console.log(name + ": " + N + " files, " + t.toFixed(1) + " ms, " +
+                (total / 1048576 * 1000 / t).toFixed(0) + " MB/s, " +
+                "max loop stall " + max_lag.toFixed(1) + " ms");
+}
+
+async function read_sequential()
+{
+    var i, fd, ab, st, err, total = 0;
+    for(i = 0; i < N; i++) {
+        [st, err] = os.stat(files[i]);
+        fd = os.open(files[i], os.O_RDONLY);
+        ab = new ArrayBuffer(st.size);
+        total += os.read(fd, ab, 0, st.size);
+        os.close(fd);
+    }
+    return total;
+}
+
+async function read_concurrent()
+{
+    var i, tab = [], total = 0;
+    for(i = 0; i < N; i++)
+        tab.push(os.readFileAsync(files[i]));
+    tab = await Promise.all(tab);
+    for(i = 0; i < N; i++)
+        total += tab[i].byteLength;
+    return total;
+}
+
+async function main()
+{
+    var i;
+    setup();
+    /* warm up the page cache and the I/O threads */
+    await read_concurrent();
+    for(i = 0; i < 3; i++) {
+        await measure("sequential os.read", read_sequential);
+        await measure("concurrent os.readFileAsync", read_concurrent);
+    }
+    cleanup();
+}
+
+main().catch(function (e) {
+    print(e);
+    cleanup();
+    std.exit(1);
+});
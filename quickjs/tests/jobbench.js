@@ -0,0 +1,67 @@
+/*
+ * Job queue benchmark: promise reactions and await chains
+ *
+ * usage: qjs -d tests/jobbench.js [count]
+ */
+import * as os from "os";
+
+var N = scriptArgs.length > 1 ? scriptArgs[1] | 0 : 1000000;
+
+function report(name, n, t)
+{
+    console.log(name + ": " + n + " jobs, " + t.toFixed(1) + " ms, " +
+                (t * 1e6 / n).toFixed(1) + " ns/job");
+}
+
+/* one long await chain: one job pending at a time */
+async function bench_await()
+{
+    var i, ti = os.now();
+    for(i = 0; i < N; i++)
+        await i;
+    report("await chain", N, os.now() - ti);
+}
+
+/* many concurrent then() chains: a large queue */
+function bench_then()
+{
+    var chains = 10000, depth = N / chains, i, j, p, ti = os.now();
+    var all = [];
+    for(i = 0; i < chains; i++) {
+        p = Promise.resolve(i);
+        for(j = 0; j < depth; j++)
+            p = p.then(function(v) { return v + 1; });
+        all.push(p);
+    }
+    return Promise.all(all).then(function() {
+        report("then chains (x" + chains + ")", N, os.now() - ti);
+    });
+}
+
+/* async functions awaiting each other */
+async function leaf(v)
+{
+    return v;
+}
+
+async function node(v)
+{
+    return await leaf(v) + await leaf(v);
+}
+
+async function bench_nested()
+{
+    var i, n = N / 10, ti = os.now();
+    for(i = 0; i < n; i++)
+        await node(i);
+    report("nested async calls", n, os.now() - ti);
+}
+
+async function main()
+{
+    await bench_await();
+    await bench_then();
+    await bench_nested();
+}
+
+main();
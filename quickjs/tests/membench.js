@@ -0,0 +1,62 @@
+/*
+ * Memory benchmark: many small objects
+ *
+ * Run with "qjs -d" to get the memory usage of the live heap. Compare
+ * a default build with a CONFIG_COMPRESSED_PTRS=y build.
+ */
+
+var N = 1000000;
+
+function Point(x, y)
+{
+    this.x = x;
+    this.y = y;
+}
+
+function make_objects(n)
+{
+    var tab = [], i;
+    for(i = 0; i < n; i++)
+        tab.push({ a: i, b: i + 1 });
+    return tab;
+}
+
+function make_instances(n)
+{
+    var tab = [], i;
+    for(i = 0; i < n; i++)
+        tab.push(new Point(i, -i));
+    return tab;
+}
+
+function make_closures(n)
+{
+    var tab = [], i;
+    for(i = 0; i < n; i++)
+        tab.push((function(v) { return function() { return v; }; })(i));
+    return tab;
+}
+
+function make_lists(n)
+{
+    var head = null, i;
+    for(i = 0; i < n; i++)
+        head = { val: i, next: head };
+    return head;
+}
+
+function bench(name, f, n)
+{
+    var ti = Date.now();
+    var res = f(n);
+    console.log(name + ": " + n + " objects, " + (Date.now() - ti) + " ms");
+    return res;
+}
+
+/* keep everything alive so that "qjs -d" reports the whole heap */
+var live = [
+    bench("object literals", make_objects, N),
+    bench("instances", make_instances, N),
+    bench("closures", make_closures, N / 4),
+    bench("linked list", make_lists, N),
+];
@@ -125,7 +125,7 @@ function log_one(text, n, ti) {
     }
 }
 
-function bench(f, text)
+async function bench(f, text)
 {
     var i, j, n, t, ti, nb_its, ref, ti_n, ti_n1;
 
@@ -141,6 +141,8 @@ function bench(f, text)
             for (j = 0; j < max_iterations; j++) {
                 t = get_clock();
                 nb_its = f(n);
+                if (nb_its instanceof Promise)
+                    nb_its = await nb_its;
                 t = get_clock() - t;
                 if (nb_its < 0)
                     return; // test failure
@@ -655,6 +657,64 @@ function func_closure_call(n)
     return n * 4;
 }
 
+function throw_catch(n)
+{
+    function f(a)
+    {
+        throw new Error("error");
+    }
+
+    var j, sum;
+    sum = 0;
+    for(j = 0; j < n; j++) {
+        try {
+            f(j);
+        } catch(e) {
+            sum++;
+        }
+    }
+    global_res = sum;
+    return n;
+}
+
+function throw_catch_stack(n)
+{
+    function f(a)
+    {
+        throw new Error("error");
+    }
+
+    var j, sum;
+    sum = 0;
+    for(j = 0; j < n; j++) {
+        try {
+            f(j);
+        } catch(e) {
+            sum += e.stack.length;
+        }
+    }
+    global_res = sum;
+    return n;
+}
+
+async function await_value(n)
+{
+    var j;
+    for(j = 0; j < n; j++) {
+        await j;
+    }
+    return n;
+}
+
+async function await_promise(n)
+{
+    var j, p = Promise.resolve(1);
+    for(j = 0; j < n; j++) {
+        await p;
+    }
+    return n;
+}
+
 function int_arith(n)
 {
     var i, j, sum;
@@ -1342,7 +1402,7 @@ function save_result(filename, obj)
         console.log("cannot save " + filename);
 }
 
-function main(argc, argv, g)
+async function main(argc, argv, g)
 {
     var test_list = [
         empty_loop,
@@ -1376,6 +1436,10 @@ function main(argc, argv, g)
         global_func_call,
         func_call,
         func_closure_call,
+        throw_catch,
+        throw_catch_stack,
+        await_value,
+        await_promise,
         int_arith,
         float_arith,
         map_set_string,
@@ -1469,7 +1533,7 @@ function main(argc, argv, g)
 
     for(i = 0; i < tests.length; i++) {
         f = tests[i];
-        bench(f, f.name, ref_data, log_data);
+        await bench(f, f.name, ref_data, log_data);
         if (ref_data && ref_data[f.name])
             n++;
     }
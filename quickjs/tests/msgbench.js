@@ -0,0 +1,89 @@
+/*
+ * Worker message benchmark: small messages between two threads
+ *
+ * usage: qjs tests/msgbench.js [message_count]
+ */
+import * as os from "os";
+
+var parent = os.Worker.parent;
+
+if (parent) {
+    parent.onmessage = function(e) {
+        var ev = e.data, i;
+        switch(ev.type) {
+        case "ping":
+            parent.postMessage(ev);
+            break;
+        case "flood":
+            /* send a burst of small messages */
+            for(i = 0; i < ev.count; i++)
+                parent.postMessage(i);
+            break;
+        case "end":
+            parent.onmessage = null;
+            break;
+        }
+    };
+} else {
+    var N = scriptArgs.length > 1 ? scriptArgs[1] | 0 : 100000;
+    var worker = new os.Worker("./msgbench.js");
+
+    function report(name, n, t)
+    {
+        console.log(name + ": " + n + " messages, " + t.toFixed(1) + " ms, " +
+                    (n * 1000 / t).toFixed(0) + " msg/s");
+    }
+
+    /* the worker posts N messages in a row */
+    function bench_flood(next)
+    {
+        var n = 0, ti = os.now();
+        worker.onmessage = function(e) {
+            if (++n == N) {
+                report("flood", N, os.now() - ti);
+                next();
+            }
+        };
+        worker.postMessage({ type: "flood", count: N });
+    }
+
+    /* one message in flight: round trip latency */
+    function bench_ping(next)
+    {
+        var n = 0, count = N / 10, ti = os.now();
+        worker.onmessage = function(e) {
+            if (++n == count) {
+                report("ping-pong", count * 2, os.now() - ti);
+                next();
+            } else {
+                worker.postMessage(e.data);
+            }
+        };
+        worker.postMessage({ type: "ping", n: 0 });
+    }
+
+    /* 100 messages in flight */
+    function bench_window(next)
+    {
+        var n = 0, window = 100, i, ti = os.now();
+        worker.onmessage = function(e) {
+            if (++n == N) {
+                report("ping-pong (x" + window + ")", N * 2, os.now() - ti);
+                next();
+            } else if (n <= N - window) {
+                worker.postMessage(e.data);
+            }
+        };
+        for(i = 0; i < window; i++)
+            worker.postMessage({ type: "ping", n: i });
+    }
+
+    bench_flood(function() {
+        bench_ping(function() {
+            bench_window(function() {
+                worker.onmessage = null;
+                worker.postMessage({ type: "end" });
+            });
+        });
+    });
+}
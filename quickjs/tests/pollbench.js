@@ -0,0 +1,48 @@
+/*
+ * Event loop benchmark: one read handler per pipe, a single byte
+ * passed from pipe to pipe so that each wakeup has one ready fd.
+ *
+ * usage: qjs tests/pollbench.js [fd_count [wakeups]]
+ *
+ * Compare a default build (epoll on Linux) with a CONFIG_NO_EPOLL
+ * build. select() cannot watch fds above FD_SETSIZE (1024).
+ */
+import * as os from "os";
+
+var fd_count = scriptArgs.length > 1 ? scriptArgs[1] | 0 : 10000;
+var wakeups = scriptArgs.length > 2 ? scriptArgs[2] | 0 : 100000;
+var pipes = [], buf = new Uint8Array(1), ti, count = 0;
+
+function next(i)
+{
+    return function() {
+        os.read(pipes[i][0], buf.buffer, 0, 1);
+        if (++count == wakeups) {
+            var t = os.now() - ti;
+            console.log(fd_count + " fds: " + wakeups + " wakeups in " +
+                        t.toFixed(1) + " ms, " +
+                        (t * 1000 / wakeups).toFixed(2) + " us/wakeup");
+            for(var p of pipes) {
+                os.setReadHandler(p[0], null);
+                os.close(p[0]);
+                os.close(p[1]);
+            }
+            return;
+        }
+        os.write(pipes[(i + 1) % pipes.length][1], buf.buffer, 0, 1);
+    };
+}
+
+ti = os.now();
+for(var i = 0; i < fd_count / 2; i++) {
+    var p = os.pipe();
+    if (!p)
+        throw Error("os.pipe() failed after " + (2 * i) + " fds (ulimit -n?)");
+    pipes.push(p);
+}
+for(var i = 0; i < pipes.length; i++)
+    os.setReadHandler(pipes[i][0], next(i));
+console.log(fd_count + " fds: registration " + (os.now() - ti).toFixed(1) + " ms");
+
+ti = os.now();
+os.write(pipes[0][1], buf.buffer, 0, 1);
@@ -0,0 +1,143 @@
+/*
+ * Socket benchmark: request/response round trips with an in-process
+ * echo server, compared with one process per request (as with
+ * std.urlGet())
+ *
+ * usage: qjs tests/sockbench.js [request_count]
+ */
+import * as std from "std";
+import * as os from "os";
+
+var N = scriptArgs.length > 1 ? scriptArgs[1] | 0 : 20000;
+var MSG_LEN = 64;
+
+function report(name, n, t)
+{
+    console.log(name + ": " + n + " requests, " + t.toFixed(1) + " ms, " +
+                (n * 1000 / t).toFixed(0) + " req/s");
+}
+
+/* accept the connections on 'lfd' and echo their data */
+function start_server(lfd)
+{
+    var buf = new ArrayBuffer(4096);
+
+    os.setReadHandler(lfd, function () {
+        var fd = os.accept(lfd);
+        if (fd < 0)
+            return;
+        os.setReadHandler(fd, function () {
+            var ret = os.recv(fd, buf, 0, buf.byteLength);
+            if (ret > 0) {
+                /* small messages: the send buffer is never full */
+                os.send(fd, buf, 0, ret);
+            } else if (ret != -std.Error.EAGAIN) {
+                os.setReadHandler(fd, null);
+                os.close(fd);
+            }
+        });
+    });
+}
+
+/* 'conc' connections, each with one request in flight */
+function run_clients(family, addr, conc, count, next)
+{
+    var ti, done = 0, sent = 0, i;
+
+    function start_client()
+    {
+        var fd, buf, received;
+        fd = os.socket(family, os.SOCK_STREAM);
+        if (family == os.AF_INET)
+            os.setsockopt(fd, os.IPPROTO_TCP, os.TCP_NODELAY, 1);
+        buf = new ArrayBuffer(MSG_LEN);
+        os.connect(fd, addr);
+        function send_request()
+        {
+            sent++;
+            received = 0;
+            os.send(fd, buf, 0, MSG_LEN);
+        }
+        os.setWriteHandler(fd, function () {
+            /* connected */
+            os.setWriteHandler(fd, null);
+            send_request();
+        });
+        os.setReadHandler(fd, function () {
+            var ret = os.recv(fd, buf, received, MSG_LEN - received);
+            if (ret <= 0)
+                return;
+            received += ret;
+            if (received < MSG_LEN)
+                return;
+            done++;
+            if (sent < count) {
+                send_request();
+            } else {
+                os.setReadHandler(fd, null);
+                os.close(fd);
+                if (done == count)
+                    next(os.now() - ti);
+            }
+        });
+    }
+    ti = os.now();
+    for(i = 0; i < conc; i++)
+        start_client();
+}
+
+function bench_popen(count)
+{
+    var i, f, ti = os.now();
+    for(i = 0; i < count; i++) {
+        f = std.popen("echo ping", "r");
+        f.getline();
+        f.close();
+    }
+    report("one process per request", count, os.now() - ti);
+}
+
+function main()
+{
+    var tcp_fd, unix_fd, tcp_addr, path, unix_addr, tests;
+
+    tcp_fd = os.socket(os.AF_INET, os.SOCK_STREAM);
+    os.bind(tcp_fd, { address: "127.0.0.1", port: 0 });
+    os.listen(tcp_fd);
+    tcp_addr = os.getsockname(tcp_fd)[0];
+    start_server(tcp_fd);
+
+    path = "/tmp/sockbench." + os.getpid();
+    unix_addr = { path: path };
+    unix_fd = os.socket(os.AF_UNIX, os.SOCK_STREAM);
+    os.bind(unix_fd, unix_addr);
+    os.listen(unix_fd);
+    start_server(unix_fd);
+
+    tests = [
+        [ "tcp, 1 connection", os.AF_INET, tcp_addr, 1 ],
+        [ "tcp, 16 connections", os.AF_INET, tcp_addr, 16 ],
+        [ "unix, 1 connection", os.AF_UNIX, unix_addr, 1 ],
+        [ "unix, 16 connections", os.AF_UNIX, unix_addr, 16 ],
+    ];
+    function next_test()
+    {
+        var t = tests.shift();
+        if (!t) {
+            os.setReadHandler(tcp_fd, null);
+            os.setReadHandler(unix_fd, null);
+            os.close(tcp_fd);
+            os.close(unix_fd);
+            os.remove(path);
+            bench_popen(Math.min(N, 500));
+            return;
+        }
+        run_clients(t[1], t[2], t[3], N, function (dt) {
+            report(t[0], N, dt);
+            next_test();
+        });
+    }
+    next_test();
+}
+
+main();
@@ -0,0 +1,37 @@
+/*
+ * os.exec() latency as the heap grows
+ *
+ * usage: qjs tests/spawnbench.js [max_heap_mb [exec_count]]
+ */
+import * as os from "os";
+
+var MAX_MB = scriptArgs.length > 1 ? scriptArgs[1] | 0 : 2048;
+var N = scriptArgs.length > 2 ? scriptArgs[2] | 0 : 100;
+var CHUNK_MB = 64;
+
+function bench(heap_mb)
+{
+    var i, ti, t;
+    ti = os.now();
+    for(i = 0; i < N; i++)
+        os.exec(["true"]);
+    t = (os.now() - ti) / N;
+    console.log("heap " + heap_mb + " MB: " + t.toFixed(3) + " ms per exec");
+}
+
+function main()
+{
+    var heap = [], heap_mb = 0, mb;
+
+    bench(0);
+    for(mb = 256; mb <= MAX_MB; mb *= 2) {
+        while (heap_mb < mb) {
+            /* the pages are touched so that they are mapped */
+            heap.push(new Uint8Array(CHUNK_MB << 20).fill(1));
+            heap_mb += CHUNK_MB;
+        }
+        bench(heap_mb);
+    }
+}
+
+main();
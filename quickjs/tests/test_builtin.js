@@ -1025,6 +1025,26 @@ function eval_error(eval_str, expected_error, line_num, col_num)
     }
 }
 
+function test_lazy_intrinsics()
+{
+    var d, names, r;
+
+    /* the constructors created on first use look like the eager ones */
+    d = Object.getOwnPropertyDescriptor(globalThis, "WeakSet");
+    assert(typeof d.value, "function");
+    assert(d.writable && d.configurable && !d.enumerable, true);
+    names = Object.getOwnPropertyNames(globalThis);
+    assert(names.indexOf("Map") < names.indexOf("Set") &&
+           names.indexOf("Set") < names.indexOf("WeakSet"), true);
+
+    /* objects created internally get the prototypes of their realm */
+    r = /a/;
+    assert(Object.getPrototypeOf(r) === RegExp.prototype, true);
+    assert("bab".match("a").index, 1);
+    assert(Object.getPrototypeOf(new Uint8Array(1).buffer) === ArrayBuffer.prototype, true);
+    assert(Object.getPrototypeOf(Map.groupBy([1], x => x)) === Map.prototype, true);
+}
+
 function test_line_column_numbers()
 {
     var f, e;
@@ -1051,8 +1071,19 @@ function test_line_column_numbers()
     eval_error('\n null[0];', TypeError, 2, 6); 
     eval_error('\n null . abcd;', TypeError, 2, 7); 
     eval_error('\n null ( 1234 );', TypeError, 2, 7); 
+
+    /* nested functions, the later one being used first */
+    f = eval("(function() {\n  function g() {\n    return Error('a');\n  }\n" +
+             "  function h() { return g(); }\n  return [g, h];\n})()");
+    e = f[1]();
+    check_error_pos(e, Error, 3, 5);
+    check_error_pos(e, Error, 5, 18);
+    assert(f[1].lineNumber, 5);
+    assert(f[0].lineNumber, 2);
+    assert(f[1].toString(), "function h() { return g(); }");
 }
 
+test_lazy_intrinsics();
 test();
 test_function();
 test_enum();
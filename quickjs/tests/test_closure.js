@@ -212,6 +212,54 @@ function test_eval_const()
     assert(success);
 }
 
+/* inner functions may be compiled on their first call */
+function test_lazy_function()
+{
+    var a = 1, tab = [], i, f;
+    const c = 2;
+
+    function f1(x) {
+        function f2(y) {
+            return function f3() { return a + c + x + y; };
+        }
+        return f2(10);
+    }
+    assert(f1(100)() === 113);
+    a = 2;
+    assert(f1(100)() === 114);
+
+    for(let j = 0; j < 3; j++) {
+        tab.push(function g() { return j; });
+    }
+    assert(tab[1]() === 1);
+    /* closures created after the first call */
+    for(let j = 3; j < 6; j++) {
+        tab.push(function g() { return j; });
+    }
+    for(i = 0; i < tab.length; i++)
+        assert(tab[i]() === i);
+
+    f = function fact(n) { return n <= 1 ? 1 : n * fact(n - 1); };
+    assert(f(5) === 120);
+
+    function set_c() { c = 3; }
+    try {
+        set_c();
+        assert(false);
+    } catch(e) {
+        assert(e instanceof TypeError);
+    }
+
+    function f4(x = a, ...rest) { return x + arguments.length + rest.length; }
+    assert(f4.length === 0);
+    assert(f4() === 2);
+    assert(f4(1, 2, 3) === 6);
+    assert(f4.toString() === "function f4(x = a, ...rest) { return x + arguments.length + rest.length; }");
+
+    function *g1() { yield a; yield c; }
+    assert([...g1()].join() === "2,2");
+}
+
 test_closure1();
 test_closure2();
 test_closure3();
@@ -219,3 +267,4 @@ test_arrow_function();
 test_with();
 test_eval_closure();
 test_eval_const();
+test_lazy_function();
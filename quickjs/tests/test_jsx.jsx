@@ -0,0 +1,88 @@
+import * as std from "std";
+import { assert, assertThrows } from "./assert.js";
+
+var React = {
+    createElement(type, props, ...children) {
+        return { type, props, children };
+    },
+    Fragment: "fragment",
+};
+
+function str(e)
+{
+    return JSON.stringify(e);
+}
+
+function test_elements()
+{
+    var Comp = "comp", ns = { Comp: "ns.comp" };
+
+    assert(str(<div/>), str({ type: "div", props: null, children: [] }));
+    assert(str(<div a="1" b={2} c>x</div>),
+           str({ type: "div", props: { a: "1", b: 2, c: true }, children: ["x"] }));
+    assert(<Comp/>.type, "comp");
+    assert(<ns.Comp/>.type, "ns.comp");
+    assert(<custom-element/>.type, "custom-element");
+    assert(str(<>a<b/></>),
+           str({ type: "fragment", props: null,
+                 children: ["a", { type: "b", props: null, children: [] }] }));
+    assert(str(<a x="1" {...{ y: 2 }} z={3}/>.props), str({ x: "1", y: 2, z: 3 }));
+    assert(str(<ul>{[1, 2].map(i => <li key={i}/>)}</ul>.children[0].map(e => e.props.key)),
+           "[1,2]");
+    assert(<a attr=<b/>/>.props.attr.type, "b");
+}
+
+function test_spread_children()
+{
+    var arr = ["x", <b/>];
+    assert(str(<a>{...arr}</a>), str(<a>{arr[0]}{arr[1]}</a>));
+    assert(str(<a>1{...arr}<c/>{..."yz"}</a>.children),
+           str(["1", "x", { type: "b", props: null, children: [] },
+                { type: "c", props: null, children: [] }, "y", "z"]));
+    assert(str(<>{...[]}</>), str({ type: "fragment", props: null, children: [] }));
+    /* factory which is not a method */
+    globalThis.h = (type, props, ...children) => children.length;
+    assert(std.evalScript("/* @jsx h */ <a>{...[1, 2]}{3}</a>", { jsx: true }), 3);
+    delete globalThis.h;
+}
+
+function test_text()
+{
+    assert(str(<a>  one
+                  two  {"x"}
+                  &lt;&amp;&#65;&#x42;&nbsp;</a>.children),
+           str(["  one two  ", "x", "<&AB\u00a0"]));
+    assert(str(<a> </a>.children), str([" "]));
+    assert(str(<a>
+               </a>.children), "[]");
+    assert(str(<a>{/* comment */}{}</a>.children), "[]");
+    assert(<a b="&quot;it's&quot;"/>.props.b, "\"it's\"");
+}
+
+function test_syntax()
+{
+    /* global code: the factory must be a global */
+    var jsx = (s) => std.evalScript(s, { jsx: true });
+    globalThis.React = React;
+    assert(jsx("<x/>").type, "x");
+    assertThrows(SyntaxError, () => jsx("<a></b>"));
+    assertThrows(SyntaxError, () => jsx("<a>{...}</a>"));
+    assertThrows(SyntaxError, () => jsx("<a b=1/>"));
+    assertThrows(SyntaxError, () => jsx("<a>"));
+    /* direct eval does not inherit the JSX mode */
+    var x = 1, y = 2;
+    assertThrows(SyntaxError, () => eval("<x/>"));
+    assert(eval("x <y> (2)"), false);
+    /* '<' is still a comparison operator */
+    var a = 1, b = 2;
+    assert(a < b, true);
+    assert((a) < (b), true);
+    /* JSX inside parentheses before an arrow function */
+    var f = () => (<p>it's</p>);
+    assert(f().children[0], "it's");
+}
+
+test_elements();
+test_spread_children();
+test_text();
+test_syntax();
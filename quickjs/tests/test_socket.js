@@ -0,0 +1,269 @@
+import * as std from "std";
+import * as os from "os";
+
+function assert(actual, expected, message) {
+    if (arguments.length == 1)
+        expected = true;
+
+    if (actual === expected)
+        return;
+
+    if (actual !== null && expected !== null
+    &&  typeof actual == 'object' && typeof expected == 'object'
+    &&  actual.toString() === expected.toString())
+        return;
+
+    throw Error("assertion failed: got |" + actual + "|" +
+                ", expected |" + expected + "|" +
+                (message ? " (" + message + ")" : ""));
+}
+
+function wait_readable(fd)
+{
+    return new Promise(function (resolve) {
+        os.setReadHandler(fd, function () {
+            os.setReadHandler(fd, null);
+            resolve();
+        });
+    });
+}
+
+function wait_writable(fd)
+{
+    return new Promise(function (resolve) {
+        os.setWriteHandler(fd, function () {
+            os.setWriteHandler(fd, null);
+            resolve();
+        });
+    });
+}
+
+async function accept(fd)
+{
+    var ret;
+    for(;;) {
+        ret = os.accept(fd);
+        if (ret != -std.Error.EAGAIN)
+            return ret;
+        await wait_readable(fd);
+    }
+}
+
+async function connect(fd, addr)
+{
+    var ret, val, err;
+    ret = os.connect(fd, addr);
+    if (ret == -std.Error.EINPROGRESS) {
+        /* the result is known when the socket becomes writable */
+        await wait_writable(fd);
+        [val, err] = os.getsockopt(fd, os.SOL_SOCKET, os.SO_ERROR);
+        assert(err, 0);
+        ret = -val;
+    }
+    return ret;
+}
+
+async function recv(fd, buf, pos, len)
+{
+    var ret;
+    for(;;) {
+        ret = os.recv(fd, buf, pos, len);
+        if (ret != -std.Error.EAGAIN)
+            return ret;
+        await wait_readable(fd);
+    }
+}
+
+async function send_all(fd, buf, pos, len)
+{
+    var ret;
+    while (len > 0) {
+        ret = os.send(fd, buf, pos, len);
+        if (ret == -std.Error.EAGAIN) {
+            await wait_writable(fd);
+        } else {
+            assert(ret > 0);
+            pos += ret;
+            len -= ret;
+        }
+    }
+}
+
+/* read until the end of stream */
+async function recv_all(fd)
+{
+    var buf = new ArrayBuffer(65536), res = new Uint8Array(0), tmp, ret;
+    for(;;) {
+        ret = await recv(fd, buf, 0, buf.byteLength);
+        assert(ret >= 0);
+        if (ret == 0)
+            return res;
+        tmp = new Uint8Array(res.length + ret);
+        tmp.set(res);
+        tmp.set(new Uint8Array(buf, 0, ret), res.length);
+        res = tmp;
+    }
+}
+
+/* echo the data of one connection and close it */
+async function echo_server(lfd)
+{
+    var fd, buf, ret;
+    fd = await accept(lfd);
+    assert(fd >= 0);
+    buf = new ArrayBuffer(4096);
+    for(;;) {
+        ret = await recv(fd, buf, 0, buf.byteLength);
+        assert(ret >= 0);
+        if (ret == 0)
+            break;
+        await send_all(fd, buf, 0, ret);
+    }
+    os.close(fd);
+}
+
+async function echo_client(fd, data)
+{
+    var res, i, recv_promise;
+    /* receive while sending to avoid filling both socket buffers */
+    recv_promise = recv_all(fd);
+    await send_all(fd, data.buffer, 0, data.length);
+    assert(os.shutdown(fd, os.SHUT_WR), 0);
+    res = await recv_promise;
+    assert(res.length, data.length);
+    for(i = 0; i < data.length; i++) {
+        if (res[i] != data[i])
+            assert(res[i], data[i], "byte " + i);
+    }
+    os.close(fd);
+}
+
+function make_data(len)
+{
+    var data = new Uint8Array(len), i;
+    for(i = 0; i < len; i++)
+        data[i] = (i * 7) & 0xff;
+    return data;
+}
+
+async function test_tcp()
+{
+    var lfd, fd, addr, err, server;
+
+    lfd = os.socket(os.AF_INET, os.SOCK_STREAM);
+    assert(lfd >= 0);
+    assert(os.setsockopt(lfd, os.SOL_SOCKET, os.SO_REUSEADDR, 1), 0);
+    assert(os.bind(lfd, { address: "127.0.0.1", port: 0 }), 0);
+    assert(os.listen(lfd), 0);
+    [addr, err] = os.getsockname(lfd);
+    assert(err, 0);
+    assert(addr.family, os.AF_INET);
+    assert(addr.address, "127.0.0.1");
+    assert(addr.port > 0);
+
+    server = echo_server(lfd);
+    fd = os.socket(os.AF_INET, os.SOCK_STREAM);
+    assert(fd >= 0);
+    assert(os.setsockopt(fd, os.IPPROTO_TCP, os.TCP_NODELAY, 1), 0);
+    assert(os.getsockopt(fd, os.IPPROTO_TCP, os.TCP_NODELAY)[0] != 0);
+    assert(await connect(fd, addr), 0);
+    assert(os.getpeername(fd)[0].port, addr.port);
+    /* large enough to need several writes */
+    await echo_client(fd, make_data(1 << 20));
+    await server;
+    os.close(lfd);
+
+    /* nobody listens on the port anymore */
+    fd = os.socket(os.AF_INET, os.SOCK_STREAM);
+    assert(await connect(fd, addr), -std.Error.ECONNREFUSED);
+    os.close(fd);
+}
+
+async function test_unix()
+{
+    var path, lfd, fd, server, addr, err;
+
+    path = "/tmp/qjs_test_socket." + os.getpid();
+    os.remove(path);
+    lfd = os.socket(os.AF_UNIX, os.SOCK_STREAM);
+    assert(lfd >= 0);
+    assert(os.bind(lfd, { path: path }), 0);
+    assert(os.listen(lfd, 4), 0);
+    [addr, err] = os.getsockname(lfd);
+    assert(err, 0);
+    assert(addr.family, os.AF_UNIX);
+    assert(addr.path, path);
+
+    server = echo_server(lfd);
+    fd = os.socket(os.AF_UNIX, os.SOCK_STREAM);
+    assert(await connect(fd, { path: path }), 0);
+    await echo_client(fd, make_data(100000));
+    await server;
+    os.close(lfd);
+    assert(os.remove(path), 0);
+}
+
+async function test_errors()
+{
+    var lfd, fd, cfd, addr, ret, err;
+
+    /* no SIGPIPE when the peer is closed */
+    lfd = os.socket(os.AF_INET, os.SOCK_STREAM);
+    assert(os.bind(lfd, { address: "127.0.0.1", port: 0 }), 0);
+    assert(os.listen(lfd), 0);
+    fd = os.socket(os.AF_INET, os.SOCK_STREAM);
+    assert(await connect(fd, os.getsockname(lfd)[0]), 0);
+    cfd = await accept(lfd);
+    assert(cfd >= 0);
+    os.close(cfd);
+    os.close(lfd);
+    for(;;) {
+        ret = os.send(fd, new ArrayBuffer(1024), 0, 1024);
+        if (ret < 0)
+            break;
+        /* wait for the reset of the connection */
+        os.sleep(1);
+    }
+    assert(ret == -std.Error.EPIPE || ret == -std.Error.ECONNRESET);
+    os.close(fd);
+
+    [addr, err] = os.getpeername(-1);
+    assert(addr, null);
+    assert(err, std.Error.EBADF);
+    assert(os.accept(-1), -std.Error.EBADF);
+
+    fd = os.socket(os.AF_INET6, os.SOCK_STREAM);
+    if (fd >= 0) {
+        ret = os.bind(fd, { address: "::1", port: 0 });
+        /* IPv6 may be disabled */
+        if (ret == 0)
+            assert(os.getsockname(fd)[0].family, os.AF_INET6);
+        os.close(fd);
+    }
+
+    try {
+        os.connect(0, { address: "not an address", port: 1 });
+        assert(false);
+    } catch(e) {
+        assert(e instanceof TypeError);
+    }
+    try {
+        os.connect(0, { address: "127.0.0.1", port: 65536 });
+        assert(false);
+    } catch(e) {
+        assert(e instanceof RangeError);
+    }
+}
+
+async function main()
+{
+    await test_tcp();
+    await test_unix();
+    await test_errors();
+}
+
+main().catch(function (e) {
+    print(e);
+    print(e.stack);
+    std.exit(1);
+});
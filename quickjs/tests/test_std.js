@@ -236,6 +236,21 @@ function test_os_exec()
     ret = os.exec(["/bin/sh", "-c", "exit 1"], { usePath: false });
     assert(ret, 1);
 
+    ret = os.exec(["qjs_nonexistent_command"]);
+    assert(ret, 127);
+    ret = os.exec(["/nonexistent/sh"], { usePath: false });
+    assert(ret, 127);
+
+    fds = os.pipe();
+    pid = os.exec(["pwd"], { stdout: fds[1], block: false, cwd: "/" });
+    assert(pid >= 0);
+    os.close(fds[1]);
+    f = std.fdopen(fds[0], "r");
+    assert(f.getline(), "/");
+    f.close();
+    [ret, status] = os.waitpid(pid, 0);
+    assert(ret, pid);
+
     fds = os.pipe();
     pid = os.exec(["sh", "-c", "echo $FOO"], {
         stdout: fds[1],
@@ -262,6 +277,58 @@ function test_os_exec()
     assert(status & 0x7f, os.SIGTERM);
 }
 
+async function test_async_io()
+{
+    var fname, buf, ab, fd, ret, i, tab, err;
+
+    fname = "tmp_async_file.bin";
+    buf = new Uint8Array(100000);
+    for(i = 0; i < buf.length; i++)
+        buf[i] = i & 0xff;
+    ret = await os.writeFileAsync(fname, buf);
+    assert(ret, buf.length);
+
+    ab = await os.readFileAsync(fname);
+    assert(ab instanceof ArrayBuffer, true);
+    assert(ab.byteLength, buf.length);
+    tab = new Uint8Array(ab);
+    for(i = 0; i < buf.length; i++)
+        assert(tab[i] == buf[i]);
+
+    fd = os.open(fname, os.O_RDWR);
+    assert(fd >= 0);
+    assert(await os.pwriteAsync(fd, buf.buffer, 10, 5, 1000), 5);
+    tab = new Uint8Array(await os.preadAsync(fd, 5, 1000));
+    assert(tab.join(), "10,11,12,13,14");
+    /* short read at the end of the file */
+    ab = await os.preadAsync(fd, 10, buf.length - 4);
+    assert(ab.byteLength, 4);
+    /* the file position is not used */
+    assert(os.seek(fd, 0, std.SEEK_CUR), 0);
+    assert(os.close(fd), 0);
+
+    /* concurrent requests */
+    tab = [];
+    for(i = 0; i < 16; i++)
+        tab.push(os.readFileAsync(fname));
+    tab = await Promise.all(tab);
+    for(i = 0; i < tab.length; i++)
+        assert(tab[i].byteLength, buf.length);
+
+    assert(await os.writeFileAsync(fname, "h\u00e9llo"), 6);
+    assert(std.loadFile(fname), "h\u00e9llo");
+
+    assert(os.remove(fname), 0);
+    err = null;
+    try {
+        await os.readFileAsync(fname);
+    } catch(e) {
+        err = e;
+    }
+    assert(err instanceof Error, true);
+    assert(err.errno, std.Error.ENOENT);
+}
+
 function test_timer()
 {
     var th, i;
@@ -274,6 +341,34 @@ function test_timer()
         os.clearTimeout(th[i]);
 }
 
+/* the first handler drains both pipes: the event of the second one,
+   returned by the same poll, must not call its handler */
+function test_rw_handler_drain()
+{
+    var p = [os.pipe(), os.pipe()], buf = new Uint8Array(1);
+    var calls = 0, i;
+
+    function handler() {
+        calls++;
+        if (calls == 1) {
+            for(i = 0; i < 2; i++)
+                assert(os.read(p[i][0], buf.buffer, 0, 1), 1);
+        }
+    }
+    for(i = 0; i < 2; i++) {
+        os.write(p[i][1], buf.buffer, 0, 1);
+        os.setReadHandler(p[i][0], handler);
+    }
+    os.setTimeout(function () {
+        for(i = 0; i < 2; i++) {
+            os.setReadHandler(p[i][0], null);
+            os.close(p[i][0]);
+            os.close(p[i][1]);
+        }
+        assert(calls, 1);
+    }, 50);
+}
+
 /* test closure variable handling when freeing asynchronous
    function */
 function test_async_gc()
@@ -294,6 +389,51 @@ function test_async_gc()
     })();
 }
 
+function test_heap_snapshot()
+{
+    var fname = "tmp_file.heapsnapshot";
+    var s, meta, nf, ef, i, j, n, edge_count, to, name, found;
+    function HeapTest() {
+        this.heap_test_prop = "heap_test_value";
+    }
+    var obj = new HeapTest();
+
+    assert(std.writeHeapSnapshot(fname), 0);
+    s = JSON.parse(std.loadFile(fname));
+    os.remove(fname);
+
+    meta = s.snapshot.meta;
+    nf = meta.node_fields.length;
+    ef = meta.edge_fields.length;
+    assert(s.nodes.length, s.snapshot.node_count * nf);
+    assert(s.edges.length, s.snapshot.edge_count * ef);
+    edge_count = 0;
+    for(i = 0; i < s.nodes.length; i += nf)
+        edge_count += s.nodes[i + 4];
+    assert(edge_count, s.snapshot.edge_count);
+
+    /* find the object and its property */
+    found = false;
+    j = 0;
+    for(i = 0; i < s.nodes.length; i += nf) {
+        n = s.nodes[i + 4];
+        if (s.strings[s.nodes[i + 1]] === "HeapTest" &&
+            meta.node_types[0][s.nodes[i]] === "object") {
+            for(; n > 0; n--, j += ef) {
+                name = s.strings[s.edges[j + 1]];
+                to = s.edges[j + 2];
+                if (meta.edge_types[0][s.edges[j]] === "property" &&
+                    name === "heap_test_prop" &&
+                    s.strings[s.nodes[to + 1]] === "heap_test_value") {
+                    found = true;
+                }
+            }
+        }
+        j += n * ef;
+    }
+    assert(found, true);
+}
+
 test_printf();
 test_file1();
 test_file2();
@@ -302,6 +442,13 @@ test_popen();
 test_os();
 test_os_exec();
 test_timer();
+test_rw_handler_drain();
 test_ext_json();
 test_async_gc();
+test_heap_snapshot();
 
+test_async_io().catch(function (e) {
+    print(e);
+    print(e.stack);
+    std.exit(1);
+});
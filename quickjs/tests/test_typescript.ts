@@ -0,0 +1,206 @@
+import * as std from "std";
+import { assert, assertThrows } from "./assert.js";
+import type { Foo } from "./does_not_exist.js";
+import { type Bar, assert as assert2 } from "./assert.js";
+export type { Foo };
+export type Pair<T> = [T, T];
+export interface Shape { area(): number; }
+export declare const version: string;
+
+type Num = number;
+type Fn<T extends object = {}> = (x: T, ...rest: unknown[]) => T extends Array<infer U> ? U : never;
+type Tpl = `a${string}b`;
+type Keys = keyof typeof globalThis;
+type Cond<T> = T extends string ? "s" : T extends (infer U extends number)[] ? U : never;
+interface Point<T = number> extends Shape {
+    x: T;
+    y?: T;
+    readonly [key: string]: any;
+    method<U>(a: U): Map<string, Array<U>>;
+}
+declare function ext(x: number): void;
+declare let g1: number, g2: { a: string };
+declare class Ext<T> { m(): T; }
+declare module "mod" { export const x: number; }
+declare global { interface Window { foo: string } }
+
+function test_annotations()
+{
+    var a: number = 1;
+    let b: Array<Array<number>> = [[a]];
+    const c: { x: number; y: string } = { x: 1, y: "a" };
+    let d!: string;
+    let e: Num | string | undefined, f: (x: number) => number = x => x + 1;
+    let u: | "a" | "b" = "a";
+    const { x, y }: { x: number; y: string } = c;
+    const [p, q]: [number, string] = [1, "b"];
+
+    assert(b[0][0], 1);
+    assert(x + y, "1a");
+    assert(p + q, "1b");
+    assert(f(1), 2);
+    assert(d, undefined);
+    assert(e, undefined);
+    assert(u, "a");
+}
+
+function add(a: number, b?: number, ...rest: number[]): number
+{
+    return a + (b ?? 0) + rest.length;
+}
+
+function over(x: string): string;
+function over(x: number): number;
+function over(x: any): any
+{
+    return x;
+}
+
+function isStr(x: unknown): x is string
+{
+    return typeof x === "string";
+}
+
+function withThis(this: { v: number }, k: number): number
+{
+    return this.v * k;
+}
+
+function test_functions()
+{
+    assert(add(1), 1);
+    assert(add(1, 2, 3, 4), 5);
+    assert(over(3), 3);
+    assert(isStr("a"), true);
+    assert(withThis.call({ v: 2 }, 3), 6);
+    assert(withThis.length, 1);
+
+    const id = <T,>(v: T): T => v;
+    const pair = <A, B extends A = A>(a: A, b: B): [A, B] => [a, b];
+    const obj = ({ a }: { a: number }): number => a * 2;
+    const typed = async (v: number): Promise<number> => v;
+    const gen = function <T>(v: T): T { return v; };
+    assert(id(5), 5);
+    assert(pair(1, 2)[1], 2);
+    assert(obj({ a: 2 }), 4);
+    assert(typed instanceof Function, true);
+    assert(gen<string>("g"), "g");
+
+    var o = {
+        m<T>(v: T): T { return v; },
+        get v(): number { return 1; },
+    };
+    assert(o.m(7), 7);
+    assert(o.v, 1);
+
+    try {
+        throw 1;
+    } catch (err: unknown) {
+        assert(err, 1);
+    }
+}
+
+abstract class Base<T> implements Shape {
+    abstract name: string;
+    protected abstract kind(): string;
+    area(): number { return 0; }
+}
+
+class Circle extends Base<number> implements Shape, Point {
+    static readonly PI: number = 3;
+    declare extra: string;
+    private r: number;
+    public name = "circle";
+    x!: number;
+    y?: number;
+    #secret?: string = "s";
+    [key: string]: any;
+
+    constructor(r: number);
+    constructor(r: any) {
+        super();
+        this.r = r;
+    }
+    protected kind(): string { return "round"; }
+    public override area(): number { return Circle.PI * this.r * this.r; }
+    get radius(): number { return this.r; }
+    set radius(v: number) { this.r = v; }
+    method<U>(a: U): Map<string, Array<U>> { return new Map<string, Array<U>>(); }
+    static create(r: number): Circle { return new Circle(r); }
+    get secret(): string | undefined { return this.#secret; }
+}
+
+function test_classes()
+{
+    const c = Circle.create(2);
+    assert(c.area(), 12);
+    assert(c.radius, 2);
+    c.radius = 1;
+    assert(c.area(), 3);
+    assert(c.name, "circle");
+    assert(c.kind(), "round");
+    assert(c.secret, "s");
+    assert("extra" in c, false);
+    assert(c.method<number>(1).size, 0);
+    assert(Object.getOwnPropertyNames(Circle.prototype).includes("constructor"), true);
+}
+
+function test_expressions()
+{
+    var v: unknown = "str";
+    var n: any = null;
+    const arr = [1, 2, 3] as const;
+    const cfg = { a: 1 } satisfies { a: number };
+    assert((v as string).length, 3);
+    assert((<string>v).length, 3);
+    assert(v as unknown as string, "str");
+    assert(arr.length, 3);
+    assert(cfg.a, 1);
+    assert(n!?.x, undefined);
+    assert([1, 2]!.length, 2);
+    /* comparisons are not type arguments */
+    var a = 1, b = 2, d = 3;
+    assert(a < b, true);
+    assert((a < b) === (b > a), true);
+    assert(a < b && d > b, true);
+    assert(1 as number + 1, 2);
+    /* conditional with parenthesized true branch */
+    var f = a ? (b) : d;
+    assert(f, 2);
+    var g = a ? (b) : (c) => c;
+    assert(g, 2);
+    var h = !a ? null : (c): number => c;
+    assert(h(4), 4);
+    /* arrow function with a return type as true branch */
+    var k = a ? (c: number): number => c + 1 : null;
+    assert(k(1), 2);
+    var m = a ? (c: number): number => c ? 1 : 2 : null;
+    assert(m(0), 2);
+    var set = new Set<number>([1]);
+    assert(set.has(1), true);
+    assert(new Array<number>(2).length, 2);
+}
+
+function test_syntax()
+{
+    var ts = (s: string): any => std.evalScript(s, { typescript: true });
+    assert(ts("let t: number = 3; t as number"), 3);
+    assertThrows(SyntaxError, () => ts("enum E { A }"));
+    assertThrows(SyntaxError, () => ts("namespace N { }"));
+    assertThrows(SyntaxError, () => ts("class A { constructor(private x: number) {} }"));
+    assertThrows(SyntaxError, () => ts("let x: = 1"));
+    /* direct eval does not inherit the TypeScript mode */
+    var x1 = 1, y1 = 2, z1 = 3;
+    assertThrows(SyntaxError, () => eval("let t: number = 3"));
+    assert(eval("x1 < y1 > (z1)"), false);
+    /* contextual words are still identifiers */
+    var type = 1, declare = 2, namespace = 3, abstract = 4;
+    assert(type + declare + namespace + abstract, 10);
+    assert(assert2 === assert, true);
+}
+
+test_annotations();
+test_functions();
+test_classes();
+test_expressions();
+test_syntax();
@@ -47,6 +47,16 @@ function test_worker()
                 let buf = ev.buf;
                 /* check that the SharedArrayBuffer was modified */
                 assert(buf[2], 10);
+                test_transfer();
+            }
+            break;
+        case "transfer_done":
+            {
+                let buf = ev.buf;
+                /* the worker modified and transferred back the buffer */
+                assert(buf.length, 16);
+                assert(buf[0], 1);
+                assert(buf[15], 20);
                 worker.postMessage({ type: "abort" });
             }
             break;
@@ -59,4 +69,32 @@ function test_worker()
 }
 
 
+function assert_throws(expected_error, func)
+{
+    var err = false;
+    try {
+        func();
+    } catch(e) {
+        err = true;
+        if (!(e instanceof expected_error))
+            throw Error("unexpected exception type: " + e);
+    }
+    if (!err)
+        throw Error("expected exception");
+}
+
+function test_transfer()
+{
+    var ab = new ArrayBuffer(16);
+    var buf = new Uint8Array(ab);
+    buf[0] = 1;
+    assert_throws(TypeError, () => worker.postMessage(buf, [buf]));
+    assert_throws(TypeError, () => worker.postMessage(buf, [ab, ab]));
+    worker.postMessage({ type: "transfer", buf: buf }, [ab]);
+    /* the sender buffer is detached */
+    assert(ab.byteLength, 0);
+    assert(buf.length, 0);
+    assert_throws(TypeError, () => worker.postMessage(null, [ab]));
+}
+
 test_worker();
@@ -17,6 +17,11 @@ function handle_msg(e) {
         ev.buf[2] = 10;
         parent.postMessage({ type: "sab_done", buf: ev.buf });
         break;
+    case "transfer":
+        ev.buf[15] = 20;
+        parent.postMessage({ type: "transfer_done", buf: ev.buf },
+                           [ev.buf.buffer]);
+        break;
     }
 }
 
@@ -0,0 +1,62 @@
+/*
+ * Timer benchmark: many pending os.setTimeout() timers
+ *
+ * usage: qjs tests/timerbench.js [timer_count]
+ */
+import * as os from "os";
+
+var N = scriptArgs.length > 1 ? scriptArgs[1] | 0 : 100000;
+
+function report(name, t)
+{
+    console.log(name + ": " + N + " timers, " + t.toFixed(1) + " ms");
+}
+
+/* set then clear every timer, newest first (debounce) */
+function bench_clear()
+{
+    var ids = [], i, ti = os.now();
+    for(i = 0; i < N; i++)
+        ids.push(os.setTimeout(function() { throw Error("cleared"); }, 1000 + i % 100));
+    for(i = N - 1; i >= 0; i--)
+        os.clearTimeout(ids[i]);
+    report("set+clear", os.now() - ti);
+}
+
+/* timers with spread delays, all expiring (retry/backoff) */
+function bench_expire(next)
+{
+    var i, count = 0, ti = os.now();
+    function fire() {
+        if (++count == N) {
+            report("set+expire (0-50 ms)", os.now() - ti);
+            next();
+        }
+    }
+    for(i = 0; i < N; i++)
+        os.setTimeout(fire, (i * 7919) % 51);
+}
+
+/* short rescheduling chains while N long timers are pending */
+function bench_chain()
+{
+    var chains = 100, left = 10000, ids = [], i, ti;
+    for(i = 0; i < N; i++)
+        ids.push(os.setTimeout(function() { throw Error("cleared"); }, 60000));
+    ti = os.now();
+    function fire() {
+        if (--left == 0) {
+            console.log("10000 chained timers with " + N + " pending: " +
+                        (os.now() - ti).toFixed(1) + " ms");
+            for(i = 0; i < N; i++)
+                os.clearTimeout(ids[i]);
+        } else if (left >= chains) {
+            os.setTimeout(fire, 0);
+        }
+    }
+    for(i = 0; i < chains; i++)
+        os.setTimeout(fire, 0);
+}
+
+bench_clear();
+bench_expire(bench_chain);
@@ -0,0 +1,63 @@
+/*
+ * Worker message benchmark: large ArrayBuffers copied or transferred
+ *
+ * usage: qjs tests/transferbench.js [size_in_MB] [message_count]
+ */
+import * as os from "os";
+
+var parent = os.Worker.parent;
+
+if (parent) {
+    /* worker: send each buffer back the way it was received */
+    parent.onmessage = function(e) {
+        var ev = e.data;
+        if (ev.type == "end") {
+            parent.onmessage = null;
+        } else if (ev.transfer) {
+            parent.postMessage(ev, [ev.buf]);
+        } else {
+            parent.postMessage(ev);
+        }
+    };
+} else {
+    var size = (scriptArgs.length > 1 ? +scriptArgs[1] : 64) * 1024 * 1024;
+    var count = scriptArgs.length > 2 ? scriptArgs[2] | 0 : 20;
+    var worker = new os.Worker("./transferbench.js");
+
+    /* 'count' round trips of a 'size' bytes buffer */
+    function bench(transfer, next)
+    {
+        var buf = new ArrayBuffer(size), n = 0, ti = os.now();
+        function send() {
+            var msg = { type: "buf", transfer: transfer, buf: buf };
+            if (transfer)
+                worker.postMessage(msg, [buf]);
+            else
+                worker.postMessage(msg);
+        }
+        worker.onmessage = function(e) {
+            buf = e.data.buf;
+            if (buf.byteLength != size)
+                throw Error("invalid size");
+            if (++n < count) {
+                send();
+            } else {
+                var t = os.now() - ti;
+                console.log((transfer ? "transfer" : "copy") + ": " +
+                            count * 2 + " messages of " + (size >> 20) +
+                            " MB, " + t.toFixed(1) + " ms, " +
+                            (count * 2 * (size >> 20) * 1000 / t).toFixed(0) +
+                            " MB/s");
+                next();
+            }
+        };
+        send();
+    }
+
+    bench(false, function() {
+        bench(true, function() {
+            worker.onmessage = null;
+            worker.postMessage({ type: "end" });
+        });
+    });
+}
@@ -0,0 +1,92 @@
+/*
+ * TypeScript benchmark: native type stripping in the parser against
+ * the sucrase transpiler followed by the compilation of its output
+ *
+ * usage: qjs tests/tsbench.ts [sucrase_bundle [iterations]]
+ */
+import * as std from "std";
+import * as os from "os";
+
+var BUNDLE: string = scriptArgs.length > 1 ? scriptArgs[1] : "../sucrase.bundle.js";
+var N: number = scriptArgs.length > 2 ? scriptArgs[2] | 0 : 20;
+
+/* 'n' blocks of typical typed code in a function expression, so that
+   the evaluation only compiles it */
+function make_source(n: number): string
+{
+    var tab: string[] = [], i: number;
+    tab.push("(function () {\n");
+    for(i = 0; i < n; i++) {
+        tab.push(`
+interface Item${i}<T> { id: number; value: T; tags?: string[]; }
+type Pair${i}<A, B = A> = [A, B];
+class Store${i}<T extends object> {
+    private items: Map<number, Item${i}<T>> = new Map();
+    add(id: number, value: T): Item${i}<T> {
+        const it: Item${i}<T> = { id, value };
+        this.items.set(id, it);
+        return it;
+    }
+    get(id: number): T | undefined { return this.items.get(id)?.value; }
+}
+function sum${i}(a: number[], f: (x: number) => number = (x: number): number => x): number {
+    let s: number = 0;
+    for (const x of a as readonly number[])
+        s += f(x!);
+    return s;
+}
+const pair${i}: Pair${i}<number> = [sum${i}([1, 2]), <number>${i}];
+const store${i} = new Store${i}<{ n: number }>();
+`);
+    }
+    tab.push("})\n");
+    return tab.join("");
+}
+
+function load_sucrase(): (src: string) => string
+{
+    var src: string | null, ti: number;
+    src = std.loadFile(BUNDLE);
+    if (src === null)
+        throw new Error(BUNDLE + ": cannot read the sucrase bundle");
+    /* the bundled wrapper only enables the JSX transform */
+    if (src.indexOf('transforms: ["jsx"]') < 0)
+        throw new Error(BUNDLE + ": unexpected wrapper");
+    src = src.replace('transforms: ["jsx"]', 'transforms: ["typescript"]');
+    ti = os.now();
+    std.evalScript(src);
+    console.log("sucrase bundle load: " + (os.now() - ti).toFixed(1) + " ms");
+    return (globalThis as any).sucraseTransform;
+}
+
+function bench(name: string, src: string, count: number,
+               func: (src: string) => Function)
+{
+    var i: number, ti: number, t: number;
+    /* warm up and check that the result runs */
+    func(src)();
+    ti = os.now();
+    for(i = 0; i < count; i++)
+        func(src);
+    t = (os.now() - ti) / count;
+    console.log(name + ": " + (src.length / 1024).toFixed(0) + " KB, " +
+                t.toFixed(3) + " ms per source, " +
+                (src.length / 1048576 * 1000 / t).toFixed(1) + " MB/s");
+}
+
+function main()
+{
+    var transform = load_sucrase(), n: number, src: string, count: number;
+
+    for(n of [10, 100, 500]) {
+        src = make_source(n);
+        /* fewer iterations for the large sources */
+        count = Math.max(2, Math.round(N * 10 / n));
+        bench("native", src, count,
+              (s: string): Function => std.evalScript(s, { typescript: true }));
+        bench("sucrase", src, count,
+              (s: string): Function => std.evalScript(transform(s)));
+    }
+}
+
+main();